@@ -49,3 +49,14 @@ Bitboard Bitboard::mirror_files() const
 
 	return mirrored;
 }
+
+Bitboard Bitboard::mirror_ranks() const
+{
+	Bitboard mirrored = Bitboard::make_empty();
+
+	Bitboard cpy = *this;
+	while (cpy)
+		mirrored |= sq_rank_mirror(cpy.pop_first_square());
+
+	return mirrored;
+}
@@ -212,6 +212,9 @@ struct Bitboard
 		return mirr ? mirror_files() : *this;
 	}
 
+	// Returns a copy of this bitboard with the ranks mirrored, which swaps the sides of the board.
+	NODISCARD Bitboard mirror_ranks() const;
+
 	// Returns and pops the first lowest set bit. Used for attack generation.
 	INLINE size_t pop_1st_bit()
 	{
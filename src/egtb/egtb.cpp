@@ -1,6 +1,50 @@
 #include "egtb.h"
+#include "egtb_metadata.h"
+
+#include "chess/attack.h"
 
 #include "util/algo.h"
+#include "util/memory.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <set>
+#include <thread>
+#include <tuple>
+
+// Cache files of piece groups:
+//   uint32 magic, uint32 build key, uint32 size of Placement_Index, uint32 number of pieces
+//   Piece[MAX_PIECE_GROUP_SIZE] and a padding byte
+//   uint64 table size, uint64 compress size, uint64 number of raw placements
+//   uint64 weights[MAX_PIECE_GROUP_SIZE]
+//   the placements, then the mirrored placement indices, padded to 8 bytes
+//   the unique placement index of each raw placement, then the raw index of each unique placement
+//   the raw index contributions by piece and square
+//   uint64 checksum of everything above
+// Files written by another build are ignored, see piece_group_cache_build_key.
+static constexpr uint32_t PIECE_GROUP_CACHE_MAGIC = 0x70726770;
+static constexpr uint64_t PIECE_GROUP_CACHE_CHECKSUM_INIT_VALUE = 0x7067726f7570;
+static constexpr size_t PIECE_GROUP_CACHE_HEADER_SIZE =
+	  sizeof(uint32_t) * 4
+	+ Piece_Group::MAX_PIECE_GROUP_SIZE + 1
+	+ sizeof(uint64_t) * 3
+	+ sizeof(uint64_t) * Piece_Group::MAX_PIECE_GROUP_SIZE;
+
+static std::filesystem::path s_piece_group_cache_dir;
+
+// A hash of the build id and of when this file was compiled. The tables and how they
+// are made can only change with this file or the headers it includes, so a stale
+// cache is never loaded, even from a build of uncommitted changes with the same id.
+NODISCARD static uint32_t piece_group_cache_build_key()
+{
+	static const uint32_t key = []() {
+		const std::string build = std::string(egtb_generator_build_id()) + " " __DATE__ " " __TIME__;
+		return static_cast<uint32_t>(XXH64(build.data(), build.size(), PIECE_GROUP_CACHE_CHECKSUM_INIT_VALUE));
+	}();
+	return key;
+}
 
 Piece_Group::Piece_Group(const std::vector<Piece>& pcs) :
 	m_num_pieces(pcs.size()),
@@ -10,6 +54,7 @@ Piece_Group::Piece_Group(const std::vector<Piece>& pcs) :
 	m_placements{},
 	m_weights{},
 	m_unique_placement_indices{},
+	m_raw_index_by_square{},
 	m_opp_piece_group(nullptr)
 {
 	if (m_num_pieces >= MAX_PIECE_GROUP_SIZE)
@@ -163,26 +208,288 @@ Piece_Group::Piece_Group(const std::vector<Piece>& pcs) :
 		m_mirr_placement_index[i] = mir_idx;
 	}
 
-	// Fill the lookup table for raw index differences on quiet move.
-	for (Placement_Index i = ZERO_INDEX; i < m_table_size; ++i)
+	// Fill the raw index contributions of the pieces, used for the index differences on quiet moves.
+	for (size_t i = 0; i < m_num_pieces; ++i)
+	{
+		const Piece p = m_pieces[i];
+		const size_t num_squares = static_cast<size_t>(possible_sq_nb(p));
+		for (size_t j = 0; j < num_squares; ++j)
+			m_raw_index_by_square[i][possible_sq(p, j)] = static_cast<int32_t>(m_weights[i] * j);
+	}
+}
+
+double Piece_Group::estimated_mobility() const
+{
+	const Bitboard empty = Bitboard::make_empty();
+
+	double mobility = 0.0;
+	for (size_t i = 0; i < m_num_pieces; ++i)
 	{
-		const Placement& base_list = m_placements[i];
+		const Piece pc = m_pieces[i];
+		const size_t num_squares = static_cast<size_t>(possible_sq_nb(pc));
 
-		for (size_t j = 0; j < m_num_pieces; ++j)
+		size_t num_moves = 0;
+		for (size_t j = 0; j < num_squares; ++j)
 		{
-			const Piece p = m_pieces[j];
-			const Square from = base_list[j];
-			for (Square to = SQ_START; to < SQ_END; ++to)
+			const Square sq = possible_sq(pc, j);
+			switch (piece_type(pc))
 			{
-				// We only care about squares that the piece can be on.
-				if (possible_sq_index(p, to) == -1)
-					continue;
-
-				Placement moved_list = base_list;
-				moved_list[j] = to;
-				m_diff_on_move[j][from][to] = static_cast<int32_t>(non_unique_placement_index(moved_list))
-										    - static_cast<int32_t>(non_unique_placement_index(base_list));
+			case KING:
+				num_moves += king_attack_bb(sq).num_set_bits();
+				break;
+			case ADVISOR:
+				num_moves += advisor_attack_bb(sq).num_set_bits();
+				break;
+			case BISHOP:
+				num_moves += bishop_att_no_mask(sq).num_set_bits();
+				break;
+			case KNIGHT:
+				num_moves += knight_att_no_mask(sq).num_set_bits();
+				break;
+			case ROOK:
+			case CANNON:
+				num_moves += rook_attack_bb(sq, empty).num_set_bits();
+				break;
+			case PAWN:
+				num_moves += pawn_attack_bb(sq, piece_color(pc)).num_set_bits();
+				break;
+			default:
+				ASSUME(false);
 			}
 		}
+
+		mobility += static_cast<double>(num_moves) / num_squares;
+	}
+
+	return mobility;
+}
+
+NODISCARD static size_t piece_group_cache_file_size(size_t table_size, size_t num_raw_placements)
+{
+	return
+		  PIECE_GROUP_CACHE_HEADER_SIZE
+		+ ceil_to_multiple(table_size * (sizeof(Piece_Group::Placement) + sizeof(Piece_Group::Placement_Index)), sizeof(uint64_t))
+		+ num_raw_placements * (sizeof(Piece_Group::Full_Placement_Index) + sizeof(uint32_t))
+		+ sizeof(int32_t) * Piece_Group::MAX_PIECE_GROUP_SIZE * SQUARE_NB
+		+ sizeof(uint64_t);
+}
+
+template <typename T>
+NODISCARD static Const_Span<uint8_t> as_bytes(const std::vector<T>& v)
+{
+	return Const_Span(reinterpret_cast<const uint8_t*>(v.data()), v.size() * sizeof(T));
+}
+
+template <typename T>
+NODISCARD static Span<uint8_t> as_writable_bytes(std::vector<T>& v)
+{
+	return Span(reinterpret_cast<uint8_t*>(v.data()), v.size() * sizeof(T));
+}
+
+void Piece_Group::save_to_cache(const std::filesystem::path& path) const
+{
+	// Other threads and processes may write the same file at the same time,
+	// each writes its own partial file and the last rename wins.
+	const std::filesystem::path partial_path = std::filesystem::path(path).concat(
+		"." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()))
+		+ "." + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())
+		+ ".part"
+	);
+
+	try
+	{
+		{
+			Memory_Mapped_File file;
+			if (!file.create(partial_path, piece_group_cache_file_size(m_table_size, m_unique_placement_indices.size())))
+				throw std::runtime_error("Cannot create file.");
+
+			Serial_Memory_Writer writer(file.data_span());
+
+			writer.write<uint32_t>(PIECE_GROUP_CACHE_MAGIC);
+			writer.write<uint32_t>(piece_group_cache_build_key());
+			writer.write<uint32_t>(sizeof(Placement_Index));
+			writer.write<uint32_t>(static_cast<uint32_t>(m_num_pieces));
+			for (size_t i = 0; i < MAX_PIECE_GROUP_SIZE; ++i)
+				writer.write<uint8_t>(static_cast<uint8_t>(m_pieces[i]));
+			writer.write<uint8_t>(0);
+
+			writer.write<uint64_t>(m_table_size);
+			writer.write<uint64_t>(m_compress_size);
+			writer.write<uint64_t>(m_unique_placement_indices.size());
+			for (size_t i = 0; i < MAX_PIECE_GROUP_SIZE; ++i)
+				writer.write<uint64_t>(m_weights[i]);
+
+			writer.write(as_bytes(m_placements));
+			writer.write(as_bytes(m_mirr_placement_index));
+			writer.zero_align(sizeof(uint64_t));
+			writer.write(as_bytes(m_unique_placement_indices));
+			writer.write(as_bytes(m_unique_to_non_unique));
+			writer.write(Const_Span(reinterpret_cast<const uint8_t*>(m_raw_index_by_square), sizeof(m_raw_index_by_square)));
+
+			writer.write_end_checksum(PIECE_GROUP_CACHE_CHECKSUM_INIT_VALUE);
+		}
+
+		std::filesystem::rename(partial_path, path);
+	}
+	catch (std::exception& e)
+	{
+		printf("WARNING: Failed to write piece group cache %s: %s\n", path.string().c_str(), e.what());
+		std::error_code ec;
+		std::filesystem::remove(partial_path, ec);
+	}
+}
+
+std::unique_ptr<Piece_Group> Piece_Group::try_load_from_cache(const std::filesystem::path& path, const std::vector<Piece>& pcs)
+{
+	std::error_code ec;
+	const size_t file_size = std::filesystem::file_size(path, ec);
+	if (ec || file_size < PIECE_GROUP_CACHE_HEADER_SIZE)
+		return nullptr;
+
+	Memory_Mapped_File file;
+	if (!file.open_readonly(path))
+		return nullptr;
+
+	Serial_Memory_Reader reader(file.data_span());
+
+	if (   reader.read<uint32_t>() != PIECE_GROUP_CACHE_MAGIC
+		|| reader.read<uint32_t>() != piece_group_cache_build_key()
+		|| reader.read<uint32_t>() != sizeof(Placement_Index)
+		|| reader.read<uint32_t>() != pcs.size())
+		return nullptr;
+
+	std::unique_ptr<Piece_Group> group(new Piece_Group());
+	group->m_num_pieces = pcs.size();
+	group->m_opp_piece_group = nullptr;
+	for (size_t i = 0; i < MAX_PIECE_GROUP_SIZE; ++i)
+	{
+		group->m_pieces[i] = static_cast<Piece>(reader.read<uint8_t>());
+		if (i < pcs.size() && group->m_pieces[i] != pcs[i])
+			return nullptr;
+	}
+	reader.advance(1);
+
+	group->m_table_size = reader.read<uint64_t>();
+	group->m_compress_size = reader.read<uint64_t>();
+	const size_t num_raw_placements = reader.read<uint64_t>();
+	for (size_t i = 0; i < MAX_PIECE_GROUP_SIZE; ++i)
+		group->m_weights[i] = reader.read<uint64_t>();
+
+	if (   group->m_table_size > Placement_Index::MAX_INDEX
+		|| group->m_compress_size > group->m_table_size
+		|| num_raw_placements > std::numeric_limits<uint32_t>::max()
+		|| file_size != piece_group_cache_file_size(group->m_table_size, num_raw_placements)
+		|| !reader.is_end_checksum_ok(PIECE_GROUP_CACHE_CHECKSUM_INIT_VALUE))
+		return nullptr;
+
+	group->m_placements.resize(group->m_table_size);
+	group->m_mirr_placement_index.resize(group->m_table_size);
+	group->m_unique_placement_indices.resize(num_raw_placements);
+	group->m_unique_to_non_unique.resize(num_raw_placements);
+
+	reader.read(as_writable_bytes(group->m_placements));
+	reader.read(as_writable_bytes(group->m_mirr_placement_index));
+	reader.align(sizeof(uint64_t));
+	reader.read(as_writable_bytes(group->m_unique_placement_indices));
+	reader.read(as_writable_bytes(group->m_unique_to_non_unique));
+	reader.read(Span(reinterpret_cast<uint8_t*>(group->m_raw_index_by_square), sizeof(group->m_raw_index_by_square)));
+
+	return group;
+}
+
+void set_piece_group_cache_dir(const std::filesystem::path& dir)
+{
+	if (!dir.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		if (ec)
+		{
+			printf("WARNING: Cannot create piece group cache directory %s, the cache is disabled.\n", dir.string().c_str());
+			s_piece_group_cache_dir.clear();
+			return;
+		}
+	}
+
+	s_piece_group_cache_dir = dir;
+}
+
+// The color is part of the name because the board is not symmetric for pawns,
+// and on case-insensitive filesystems the case of the piece letters doesn't tell them apart.
+NODISCARD static std::string piece_group_cache_file_name(const std::vector<Piece>& pcs)
+{
+	std::string name = piece_color(pcs[0]) == WHITE ? "w_" : "b_";
+	for (const Piece pc : pcs)
+		name += piece_to_char(pc);
+	return name + ".pgroup";
+}
+
+std::unique_ptr<Piece_Group> make_piece_group(const std::vector<Piece>& pcs)
+{
+	if (s_piece_group_cache_dir.empty())
+		return std::make_unique<Piece_Group>(pcs);
+
+	const std::filesystem::path path = path_join(s_piece_group_cache_dir, piece_group_cache_file_name(pcs));
+	if (auto group = Piece_Group::try_load_from_cache(path, pcs))
+		return group;
+
+	auto group = std::make_unique<Piece_Group>(pcs);
+	group->save_to_cache(path);
+	return group;
+}
+
+void prebuild_piece_groups(In_Out_Param<Thread_Pool> thread_pool, const Unique_Piece_Configs& configs)
+{
+	// A group is made together with the one of the opposite color,
+	// so they are listed by their class and counts only.
+	std::set<std::tuple<Piece_Type_Class, size_t, size_t>> keys;
+	for (const Piece_Config& ps : configs)
+	{
+		const auto pc = ps.piece_counts();
+		for (const Color color : { WHITE, BLACK })
+		{
+			keys.emplace(DEFENDERS, pc[piece_make(color, ADVISOR)], pc[piece_make(color, BISHOP)]);
+			keys.emplace(ROOKS, pc[piece_make(color, ROOK)], 0);
+			keys.emplace(KNIGHTS, pc[piece_make(color, KNIGHT)], 0);
+			keys.emplace(CANNONS, pc[piece_make(color, CANNON)], 0);
+			keys.emplace(PAWNS, pc[piece_make(color, PAWN)], 0);
+		}
 	}
+
+	const std::vector<std::tuple<Piece_Type_Class, size_t, size_t>> jobs(keys.begin(), keys.end());
+	std::atomic<size_t> next_job(0);
+
+	thread_pool->run_sync_task_on_all_threads([&](size_t) {
+		for (size_t i = next_job++; i < jobs.size(); i = next_job++)
+		{
+			const auto [pt_class, first, second] = jobs[i];
+			try
+			{
+				switch (pt_class)
+				{
+				case DEFENDERS:
+					(void)piece_group<DEFENDERS>(std::make_pair(first, second), WHITE);
+					break;
+				case ROOKS:
+					(void)piece_group<ROOKS>(first, WHITE);
+					break;
+				case KNIGHTS:
+					(void)piece_group<KNIGHTS>(first, WHITE);
+					break;
+				case CANNONS:
+					(void)piece_group<CANNONS>(first, WHITE);
+					break;
+				case PAWNS:
+					(void)piece_group<PAWNS>(first, WHITE);
+					break;
+				default:
+					ASSUME(false);
+				}
+			}
+			catch (std::exception&)
+			{
+				// Groups that can't be made fail again where they are used, and are reported there.
+			}
+		}
+	});
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "egtb_file_index.h"
+
 #include "chess/piece_config.h"
 
 #include "util/defines.h"
@@ -7,10 +9,13 @@
 #include "util/fixed_vector.h"
 #include "util/enum.h"
 #include "util/filesystem.h"
+#include "util/param.h"
+#include "util/thread_pool.h"
 #include "util/utility.h"
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <filesystem>
 #include <mutex>
@@ -33,6 +38,41 @@ enum struct EGTB_Magic : uint64_t
 	DTM_MAGIC = 0xc7b382a6,
 };
 
+// The scheme used to form board indices from placements of piece groups.
+// CARTESIAN indexes the Cartesian product of the placements of all groups.
+// FREE_PIECE_RELATIVE indexes one group consisting of a single free attacker
+// relative to the squares not occupied by the other groups, so positions where
+// that piece collides with another one are not indexed.
+enum struct Board_Index_Layout : uint32_t
+{
+	CARTESIAN = 0,
+	FREE_PIECE_RELATIVE = 1
+};
+
+// The order of the piece groups in the board index, from the group with weight 1.
+// BY_CLASS takes them in the order of Piece_Class. BY_MOBILITY puts groups with
+// many moves and few placements first, so that quiet moves, which change the index
+// of a single group, mostly land near the position they are made from.
+// With either order the relative group of FREE_PIECE_RELATIVE goes last.
+enum struct Board_Index_Group_Order : uint32_t
+{
+	BY_CLASS = 0,
+	BY_MOBILITY = 1
+};
+
+// Version of the board index scheme beyond the choice of layout, that is of
+// how placements and board indices are enumerated. Saved in the table files,
+// tables made with another version have to be regenerated.
+constexpr uint32_t EGTB_INDEX_SCHEME_VERSION = 1;
+
+// Returns the magic value stored in the file for the given table kind and layout.
+// Tables with the CARTESIAN layout keep the original magic values,
+// so the layout of a file can always be told from its magic.
+NODISCARD inline uint32_t egtb_file_magic(EGTB_Magic magic, Board_Index_Layout layout)
+{
+	return static_cast<uint32_t>(magic) ^ (static_cast<uint32_t>(layout) << 28);
+}
+
 // Each EGTB has at most two tables, one per color.
 // This function converts the number of tables to the list of colors of these tables.
 NODISCARD inline Fixed_Vector<Color, 2> egtb_table_colors(size_t table_num)
@@ -282,6 +322,14 @@ struct Piece_Group
 	// The list of pieces is NOT validated. It must contain pieces of only one class.
 	Piece_Group(const std::vector<Piece>& pcs);
 
+	// Writes the lookup tables of this group to a cache file, see make_piece_group.
+	// Failures are reported and otherwise ignored, the group is then made again next time.
+	void save_to_cache(const std::filesystem::path& path) const;
+
+	// Reads a group written by save_to_cache. Returns nothing if the file doesn't exist,
+	// is damaged, or was written by another version or for other pieces.
+	NODISCARD static std::unique_ptr<Piece_Group> try_load_from_cache(const std::filesystem::path& path, const std::vector<Piece>& pcs);
+
 	// Returns the compound index (base and mirrored) corresponding to a given placement.
 	NODISCARD INLINE Full_Placement_Index compound_index(const Placement& sq_list) const
 	{
@@ -332,6 +380,11 @@ struct Piece_Group
 		return m_table_size;
 	}
 
+	// Returns an estimate of the number of quiet moves of the pieces in this group:
+	// the sum over its pieces of the moves on an empty board, averaged over the squares
+	// the piece can be on. Needs the attack tables to be initialized.
+	NODISCARD double estimated_mobility() const;
+
 	// Adds a link to the same piece group but for the opposite color.
 	// Should only be used during initialization phase.
 	INLINE void link_to_opp_piece_group(const Piece_Group& other)
@@ -362,6 +415,9 @@ struct Piece_Group
 	}
 
 private:
+	// Used by try_load_from_cache, which fills all members.
+	Piece_Group() = default;
+
 	size_t m_num_pieces;
 	Piece m_pieces[MAX_PIECE_GROUP_SIZE];
 
@@ -398,12 +454,13 @@ private:
 	// (as computed by non_unique_placement_index)
 	std::vector<uint32_t> m_unique_to_non_unique;
 
-	// A lookup table that gives the non-unique (raw) placement index
-	// difference after a quiet move.
-	// m_diff_on_move[i][from][to] gives a difference for when a piece
-	// at index `i` is moved from the square `from` to the square `to`.
-	// Sizes of dimensions by square index are expanded to a power of 2 to speed up lookup.
-	int32_t m_diff_on_move[MAX_PIECE_GROUP_SIZE][ceil_to_power_of_2(static_cast<size_t>(SQUARE_NB))][ceil_to_power_of_2(static_cast<size_t>(SQUARE_NB))];
+	// The part of the non-unique (raw) placement index contributed by each piece on each square.
+	// m_raw_index_by_square[i][sq] is m_weights[i] * possible_sq_index(m_pieces[i], sq),
+	// or 0 for squares the piece can't be on. The raw index is the sum of these over the pieces,
+	// so a quiet move of the piece at index `i` from `from` to `to` changes it by
+	// m_raw_index_by_square[i][to] - m_raw_index_by_square[i][from].
+	// This takes 2.5 KB, where a table of the differences by [i][from][to] took 458 KB per group.
+	int32_t m_raw_index_by_square[MAX_PIECE_GROUP_SIZE][SQUARE_NB];
 
 	// The piece group for the same group but with pieces of the opposite color.
 	const Piece_Group* m_opp_piece_group;
@@ -439,13 +496,14 @@ private:
 		// the contract is that we will find something.
 		static_assert(MAX_PIECE_GROUP_SIZE == 7);
 		const Square from = move.from();
-		if (list[0] == from) return m_diff_on_move[0][from][move.to()];
-		if (list[1] == from) return m_diff_on_move[1][from][move.to()];
-		if (list[2] == from) return m_diff_on_move[2][from][move.to()];
-		if (list[3] == from) return m_diff_on_move[3][from][move.to()];
-		if (list[4] == from) return m_diff_on_move[4][from][move.to()];
-		if (list[5] == from) return m_diff_on_move[5][from][move.to()];
-		if (list[6] == from) return m_diff_on_move[6][from][move.to()];
+		const Square to = move.to();
+		if (list[0] == from) return m_raw_index_by_square[0][to] - m_raw_index_by_square[0][from];
+		if (list[1] == from) return m_raw_index_by_square[1][to] - m_raw_index_by_square[1][from];
+		if (list[2] == from) return m_raw_index_by_square[2][to] - m_raw_index_by_square[2][from];
+		if (list[3] == from) return m_raw_index_by_square[3][to] - m_raw_index_by_square[3][from];
+		if (list[4] == from) return m_raw_index_by_square[4][to] - m_raw_index_by_square[4][from];
+		if (list[5] == from) return m_raw_index_by_square[5][to] - m_raw_index_by_square[5][from];
+		if (list[6] == from) return m_raw_index_by_square[6][to] - m_raw_index_by_square[6][from];
 
 		ASSUME(false);
 		return 0;
@@ -454,12 +512,23 @@ private:
 
 ENUM_ENABLE_OPERATOR_INC(Piece_Group::Placement_Index);
 
+// Sets the directory where constructed piece groups are cached between runs.
+// Making the larger groups means enumerating millions of placements, loading
+// them from the cache only needs the tables to be read back.
+// Empty disables the cache, which is the default.
+// Must be called before any piece group is made.
+void set_piece_group_cache_dir(const std::filesystem::path& dir);
+
+// Loads the piece group from the cache directory, or constructs it and adds it to the cache.
+NODISCARD std::unique_ptr<Piece_Group> make_piece_group(const std::vector<Piece>& pcs);
+
 // Returns a Piece_Group object corresponding to the given piece class 
 // and piece counts within that class (key), for the given color.
 // The DEFENDERS class has an implied single king, and the key is (num_advisors, num_bishops).
 // For other classes the key is the number of the pieces in the class (since they are mono-piece classes).
 // Piece_Group objects are lazily initialized and cached globally.
-// This function is not thread-safe.
+// The groups are made outside of the lock, so different groups can be made
+// by different threads at the same time, see prebuild_piece_groups.
 template <Piece_Type_Class PIECE_CLASS>
 NODISCARD const Piece_Group* piece_group(
 	std::conditional_t<PIECE_CLASS == DEFENDERS, 
@@ -479,63 +548,70 @@ NODISCARD const Piece_Group* piece_group(
 		std::map<size_t, std::unique_ptr<Piece_Group>>
 	> s_groups[COLOR_NB];
 
-	std::unique_lock lock(s_mutex);
-
 	auto& groups = std::get<PIECE_CLASS>(s_groups[color]);
-	auto iter = groups.find(key);
-	if (iter == groups.end())
+	auto& opp_groups = std::get<PIECE_CLASS>(s_groups[color_opp(color)]);
+
 	{
-		std::vector<Piece> pieces;
-		if constexpr (PIECE_CLASS == DEFENDERS)
-		{
-			pieces.emplace_back(piece_make(color, KING));
-			for (size_t i = 0; i < key.first; ++i)
-				pieces.emplace_back(piece_make(color, ADVISOR));
-			for (size_t i = 0; i < key.second; ++i)
-				pieces.emplace_back(piece_make(color, BISHOP));
-		}
-		else if constexpr (PIECE_CLASS == ROOKS)
-		{
-			for (size_t i = 0; i < key; ++i)
-				pieces.emplace_back(piece_make(color, ROOK));
-		}
-		else if constexpr (PIECE_CLASS == KNIGHTS)
-		{
-			for (size_t i = 0; i < key; ++i)
-				pieces.emplace_back(piece_make(color, KNIGHT));
-		}
-		else if constexpr (PIECE_CLASS == CANNONS)
-		{
-			for (size_t i = 0; i < key; ++i)
-				pieces.emplace_back(piece_make(color, CANNON));
-		}
-		else if constexpr (PIECE_CLASS == PAWNS)
-		{
-			for (size_t i = 0; i < key; ++i)
-				pieces.emplace_back(piece_make(color, PAWN));
-		}
-		else
-			ASSUME(false);
+		std::unique_lock lock(s_mutex);
 
-		if (pieces.empty())
-			return nullptr;
+		auto iter = groups.find(key);
+		if (iter != groups.end())
+			return &*(iter->second);
+	}
 
-		auto [it, inserted] = groups.try_emplace(key, std::make_unique<Piece_Group>(pieces));
-		if (inserted)
-		{
-			for (auto& p : pieces)
-				p = piece_opp_color(p);
-			auto& opp_groups = std::get<PIECE_CLASS>(s_groups[color_opp(color)]);
-			auto [it_opp, inserted_opp] = opp_groups.try_emplace(key, std::make_unique<Piece_Group>(pieces));
-			ASSERT(inserted_opp);
-			it_opp->second->link_to_opp_piece_group(*(it->second));
-			it->second->link_to_opp_piece_group(*(it_opp->second));
-		}
+	std::vector<Piece> pieces;
+	if constexpr (PIECE_CLASS == DEFENDERS)
+	{
+		pieces.emplace_back(piece_make(color, KING));
+		for (size_t i = 0; i < key.first; ++i)
+			pieces.emplace_back(piece_make(color, ADVISOR));
+		for (size_t i = 0; i < key.second; ++i)
+			pieces.emplace_back(piece_make(color, BISHOP));
+	}
+	else if constexpr (PIECE_CLASS == ROOKS)
+	{
+		for (size_t i = 0; i < key; ++i)
+			pieces.emplace_back(piece_make(color, ROOK));
+	}
+	else if constexpr (PIECE_CLASS == KNIGHTS)
+	{
+		for (size_t i = 0; i < key; ++i)
+			pieces.emplace_back(piece_make(color, KNIGHT));
+	}
+	else if constexpr (PIECE_CLASS == CANNONS)
+	{
+		for (size_t i = 0; i < key; ++i)
+			pieces.emplace_back(piece_make(color, CANNON));
+	}
+	else if constexpr (PIECE_CLASS == PAWNS)
+	{
+		for (size_t i = 0; i < key; ++i)
+			pieces.emplace_back(piece_make(color, PAWN));
+	}
+	else
+		ASSUME(false);
 
-		return &*(it->second);
+	if (pieces.empty())
+		return nullptr;
+
+	auto group = make_piece_group(pieces);
+	for (auto& p : pieces)
+		p = piece_opp_color(p);
+	auto opp_group = make_piece_group(pieces);
+
+	std::unique_lock lock(s_mutex);
+
+	// Another thread may have made the same group in the meantime, then ours is dropped.
+	auto [it, inserted] = groups.try_emplace(key, std::move(group));
+	if (inserted)
+	{
+		auto [it_opp, inserted_opp] = opp_groups.try_emplace(key, std::move(opp_group));
+		ASSERT(inserted_opp);
+		it_opp->second->link_to_opp_piece_group(*(it->second));
+		it->second->link_to_opp_piece_group(*(it_opp->second));
 	}
 
-	return &*(iter->second);
+	return &*(it->second);
 }
 
 // Fills the references to Piece_Group objects for each class
@@ -552,6 +628,10 @@ INLINE void fill_set_ids_from_piece_counts(Out_Param<const Piece_Group* [PIECE_C
 	}
 }
 
+// Makes all piece groups used by the piece configurations, in parallel.
+// Otherwise they are made one at a time as the configurations are first used.
+void prebuild_piece_groups(In_Out_Param<Thread_Pool> thread_pool, const Unique_Piece_Configs& configs);
+
 // Represents a board index. It is used to index positions within an EGTB.
 // It is formed by combining Piece_Group-local indices for all relevant groups.
 enum Board_Index : size_t
@@ -581,6 +661,9 @@ struct EGTB_Paths
 	static inline const std::string DTC_EXT = ".lzdtc";
 	static inline const std::string DTM_EXT = ".lzdtm";
 	static inline const std::string INFO_EXT = ".info";
+	static inline const std::string DTC_CHECKPOINT_EXT = ".dtc.ckpt";
+	static inline const std::string DTM_CHECKPOINT_EXT = ".dtm.ckpt";
+	static inline const std::string PACK_EXT = ".tbpack";
 
 	EGTB_Paths()
 	{
@@ -606,6 +689,13 @@ struct EGTB_Paths
 		m_tmp_path = std::move(s);
 	}
 
+	// Prefix for the names of temporary files of decompressed sub tables and of checkpoints.
+	// Needed when multiple tables that share sub tables are generated at the same time.
+	void set_tmp_file_prefix(std::string s)
+	{
+		m_tmp_file_prefix = std::move(s);
+	}
+
 	void init_directories() const
 	{
 		std::filesystem::create_directories(m_tmp_path);
@@ -619,28 +709,59 @@ struct EGTB_Paths
 
 	NODISCARD bool find_wdl_file(const Piece_Config& ps, std::filesystem::path* tb = nullptr, bool gen = false) const
 	{
-		const std::string& ext = gen ? WDL_GEN_EXT : WDL_EXT;
-		return find_tb_file(ps, ext, m_wdl_paths, tb);
+		return find_tb_file(ps, gen ? EGTB_Table_Kind::WDL_GEN : EGTB_Table_Kind::WDL, m_wdl_paths, tb);
 	}
 
 	NODISCARD bool find_dtm_file(const Piece_Config& ps, std::filesystem::path* tb = nullptr) const
 	{
-		return find_tb_file(ps, DTM_EXT, m_dtm_paths, tb);
+		return find_tb_file(ps, EGTB_Table_Kind::DTM, m_dtm_paths, tb);
 	}
 
 	NODISCARD bool find_dtc_file(const Piece_Config& ps, std::filesystem::path* tb = nullptr) const
 	{
-		return find_tb_file(ps, DTC_EXT, m_dtc_paths, tb);
+		return find_tb_file(ps, EGTB_Table_Kind::DTC, m_dtc_paths, tb);
+	}
+
+	// The lookups use an index of the directories made when they are first needed.
+	// Tables saved by this process are added to it as they are saved, tables
+	// saved by other processes have to be announced with this.
+	void refresh_tb_files(const Piece_Config& ps) const
+	{
+		const std::string name = ps.name();
+		for (const auto& dir : m_wdl_paths)
+		{
+			refresh_egtb_table_file(path_join(dir, name + WDL_EXT));
+			refresh_egtb_table_file(path_join(dir, name + WDL_GEN_EXT));
+		}
+		for (const auto& dir : m_dtc_paths)
+			refresh_egtb_table_file(path_join(dir, name + DTC_EXT));
+		for (const auto& dir : m_dtm_paths)
+			refresh_egtb_table_file(path_join(dir, name + DTM_EXT));
 	}
 
 	NODISCARD std::filesystem::path dtm_tmp_path(const Piece_Config& ps, Color c) const
 	{
-		return path_join(m_tmp_path, ps.name() + DTM_TMP_EXT[c]);
+		return path_join(m_tmp_path, m_tmp_file_prefix + ps.name() + DTM_TMP_EXT[c]);
 	}
 
 	NODISCARD std::filesystem::path wdl_tmp_path(const Piece_Config& ps, Color c) const
 	{
-		return path_join(m_tmp_path, ps.name() + WDL_TMP_EXT[c]);
+		return path_join(m_tmp_path, m_tmp_file_prefix + ps.name() + WDL_TMP_EXT[c]);
+	}
+
+	NODISCARD std::filesystem::path dtc_checkpoint_path(const Piece_Config& ps) const
+	{
+		return path_join(m_tmp_path, m_tmp_file_prefix + ps.name() + DTC_CHECKPOINT_EXT);
+	}
+
+	NODISCARD std::filesystem::path dtm_checkpoint_path(const Piece_Config& ps) const
+	{
+		return path_join(m_tmp_path, m_tmp_file_prefix + ps.name() + DTM_CHECKPOINT_EXT);
+	}
+
+	NODISCARD std::filesystem::path piece_group_cache_path() const
+	{
+		return path_join(m_tmp_path, "piece_groups");
 	}
 
 	NODISCARD std::filesystem::path wdl_save_path(const Piece_Config& ps) const
@@ -675,26 +796,26 @@ struct EGTB_Paths
 
 private:
 	std::filesystem::path m_tmp_path = "./tmp/";
+	std::string m_tmp_file_prefix;
 	std::vector<std::filesystem::path> m_dtc_paths = { "./dtc/" };
 	std::vector<std::filesystem::path> m_dtm_paths = { "./dtm/" };
 	std::vector<std::filesystem::path> m_wdl_paths = { "./wdl/" };
 
+	// Tables in packs get the same path a plain file would have,
+	// open_table_file maps it to the pack.
 	NODISCARD bool find_tb_file(
 		const Piece_Config& ps,
-		const std::string& ext,
+		EGTB_Table_Kind kind,
 		const std::vector<std::filesystem::path>& paths,
 		std::filesystem::path* tb = nullptr
 	) const
 	{
-		const std::string name = ps.name() + ext;
-
 		for (const auto& dir : paths)
 		{
-			const auto path = path_join(dir, name);
-			if (std::filesystem::exists(path))
+			if (find_egtb_table_file(dir, ps, kind).has_value())
 			{
 				if (tb != nullptr)
-					*tb = path;
+					*tb = path_join(dir, ps.name() + egtb_table_kind_ext(kind));
 				return true;
 			}
 		}
@@ -1249,6 +1370,30 @@ struct DTM_Final_Entry : public DTM_Entry_Base
 
 using DTM_Any_Entry = std::variant<DTM_Intermediate_Entry, DTM_Final_Entry>;
 
+// The entries of a table stored as a single value that differ from it.
+template <typename EntryT>
+struct EGTB_Exceptions
+{
+	// In increasing order.
+	std::vector<uint32_t> positions;
+	std::vector<EntryT> values;
+
+	NODISCARD const EntryT* find(Board_Index pos) const
+	{
+		const auto it = std::lower_bound(positions.begin(), positions.end(), pos);
+		if (it == positions.end() || *it != pos)
+			return nullptr;
+
+		return &values[it - positions.begin()];
+	}
+
+	void clear()
+	{
+		positions.clear();
+		values.clear();
+	}
+};
+
 template <typename MainEntryT, typename... OtherEntryTs>
 struct EGTB_File_For_Probe
 {
@@ -1264,7 +1409,9 @@ struct EGTB_File_For_Probe
 		const Piece_Config& ps,
 		std::filesystem::path sub_evtb,
 		const std::filesystem::path tmp[COLOR_NB],
-		EGTB_Magic evtb_magic
+		EGTB_Magic evtb_magic,
+		const std::filesystem::path& wdl_path,
+		const std::filesystem::path wdl_tmp[COLOR_NB]
 	);
 
 	static size_t uncompressed_file_size(size_t num_entries)
@@ -1273,7 +1420,8 @@ struct EGTB_File_For_Probe
 	}
 
 	EGTB_File_For_Probe() :
-		m_is_singular_draw{ false, false }
+		m_is_singular{ false, false },
+		m_single_val{ 0, 0 }
 	{
 	}
 
@@ -1305,7 +1453,16 @@ struct EGTB_File_For_Probe
 			m_tmp_files.track_path(egtb_files.dtm_tmp_path(ps, BLACK))
 		};
 
-		load_egtb_table(out_param(*this), ps, path, tmp, EGTB_Magic::DTM_MAGIC);
+		// Tables stored without their draws are expanded with the WDL table.
+		std::filesystem::path wdl_path;
+		(void)egtb_files.find_wdl_file(ps, &wdl_path);
+
+		const std::filesystem::path wdl_tmp[COLOR_NB] = {
+			egtb_files.wdl_tmp_path(ps, WHITE),
+			egtb_files.wdl_tmp_path(ps, BLACK)
+		};
+
+		load_egtb_table(out_param(*this), ps, path, tmp, EGTB_Magic::DTM_MAGIC, wdl_path, wdl_tmp);
 	}
 
 	void close()
@@ -1313,14 +1470,17 @@ struct EGTB_File_For_Probe
 		m_files[WHITE].close();
 		m_files[BLACK].close();
 		m_tmp_files.clear();
-		m_is_singular_draw[WHITE] = m_is_singular_draw[BLACK] = false;
+		m_is_singular[WHITE] = m_is_singular[BLACK] = false;
+		m_single_val[WHITE] = m_single_val[BLACK] = 0;
+		m_exceptions[WHITE].clear();
+		m_exceptions[BLACK].clear();
 	}
 
 	template <size_t N = NUM_ENTRY_VARIANTS>
 	NODISCARD std::enable_if_t<N == 1, MainEntryT> read(Color color, Board_Index pos) const
 	{
-		if (m_is_singular_draw[color])
-			return MainEntryT::make_draw();
+		if (m_is_singular[color])
+			return read_singular<MainEntryT>(color, pos);
 
 		MainEntryT entry;
 		std::memcpy(&entry, m_files[color].data() + pos * sizeof(MainEntryT), sizeof(MainEntryT));
@@ -1330,18 +1490,44 @@ struct EGTB_File_For_Probe
 	template<typename T, size_t N = NUM_ENTRY_VARIANTS>
 	NODISCARD std::enable_if_t<N != 1, T> read(Color color, Board_Index pos) const
 	{
-		if (m_is_singular_draw[color])
-			return T::make_draw();
+		if (m_is_singular[color])
+			return read_singular<T>(color, pos);
 
 		T entry;
 		std::memcpy(&entry, m_files[color].data() + pos * sizeof(T), sizeof(T));
 		return entry;
 	}
 
+	// The decompressed entries of a table, empty if it is singular.
+	NODISCARD Const_Span<uint8_t> entries(Color color) const
+	{
+		if (m_is_singular[color])
+			return Const_Span<uint8_t>();
+
+		return m_files[color].data_span();
+	}
+
 private:
-	bool m_is_singular_draw[COLOR_NB];
+	// Singular tables may have exceptions, which are looked up without decompressing anything.
+	bool m_is_singular[COLOR_NB];
+	Underlying_Entry_Type m_single_val[COLOR_NB];
+	EGTB_Exceptions<Underlying_Entry_Type> m_exceptions[COLOR_NB];
 	Memory_Mapped_File m_files[COLOR_NB];
 	Temporary_File_Tracker m_tmp_files;
+
+	template <typename T>
+	NODISCARD T read_singular(Color color, Board_Index pos) const
+	{
+		static_assert(sizeof(T) == sizeof(Underlying_Entry_Type));
+
+		const Underlying_Entry_Type* exception = m_exceptions[color].find(pos);
+		const Underlying_Entry_Type raw = exception != nullptr ? *exception : m_single_val[color];
+
+		// Copied from the bytes, like the entries read from the files.
+		T entry;
+		std::memcpy(&entry, reinterpret_cast<const uint8_t*>(&raw), sizeof(T));
+		return entry;
+	}
 };
 
 template <>
@@ -1404,12 +1590,17 @@ struct EGTB_File_For_Probe<WDL_Entry>
 		m_tmp_files.clear();
 		m_is_singular[WHITE] = m_is_singular[BLACK] = false;
 		m_single_val[WHITE] = m_single_val[BLACK] = WDL_Entry::DRAW;
+		m_exceptions[WHITE].clear();
+		m_exceptions[BLACK].clear();
 	}
 
 	NODISCARD WDL_Entry read(Color color, Board_Index pos) const
 	{
 		if (m_is_singular[color])
-			return m_single_val[color];
+		{
+			const WDL_Entry* exception = m_exceptions[color].find(pos);
+			return exception != nullptr ? *exception : m_single_val[color];
+		}
 
 		Packed_WDL_Entries entry;
 		std::memcpy(&entry, m_files[color].data() + pos / 4 * sizeof(Packed_WDL_Entries), sizeof(Packed_WDL_Entries));
@@ -1417,8 +1608,10 @@ struct EGTB_File_For_Probe<WDL_Entry>
 	}
 
 private:
+	// Singular tables may have exceptions, which are looked up without decompressing anything.
 	bool m_is_singular[COLOR_NB];
 	WDL_Entry m_single_val[COLOR_NB];
+	EGTB_Exceptions<WDL_Entry> m_exceptions[COLOR_NB];
 	Memory_Mapped_File m_files[COLOR_NB];
 	Temporary_File_Tracker m_tmp_files;
 };
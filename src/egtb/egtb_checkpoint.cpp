@@ -0,0 +1,270 @@
+#include "egtb_checkpoint.h"
+
+#include "egtb_compress.h"
+
+#include "util/compress.h"
+#include "util/memory.h"
+#include "util/utility.h"
+
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+EGTB_Checkpoint::EGTB_Checkpoint(
+	std::filesystem::path path,
+	const Piece_Config& ps,
+	EGTB_Magic kind,
+	size_t num_positions,
+	Board_Index_Layout layout,
+	Board_Index_Group_Order group_order,
+	std::chrono::seconds interval
+) :
+	m_path(std::move(path)),
+	m_name(ps.name()),
+	m_kind(kind),
+	m_num_positions(num_positions),
+	m_layout(layout),
+	m_group_order(group_order),
+	m_interval(interval),
+	m_last_save_time(std::chrono::steady_clock::now())
+{
+}
+
+void EGTB_Checkpoint::save(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const EGTB_Checkpoint_State& state,
+	const std::vector<Const_Span<uint8_t>>& sections
+)
+{
+	if (!is_enabled())
+		return;
+
+	wait();
+
+	const auto start_time = std::chrono::steady_clock::now();
+
+	std::vector<std::pair<size_t, std::vector<std::vector<uint8_t>>>> compressed_sections;
+	for (const auto& section : sections)
+	{
+		compressed_sections.emplace_back(
+			section.size(),
+			compress_blocks(
+				thread_pool,
+				section,
+				BLOCK_SIZE,
+				std::make_unique<LZ4_Compress_Helper>(nullptr, LZ4HC_CLEVEL_MIN),
+				"checkpoint"
+			)
+		);
+	}
+
+	size_t file_size =
+		  sizeof(uint32_t) * 2
+		+ sizeof(uint64_t) * 2
+		+ sizeof(uint32_t) * 2
+		+ sizeof(uint16_t) + m_name.size()
+		+ sizeof(uint32_t) * 2
+		+ sizeof(uint64_t) * state.counters.size()
+		+ sizeof(uint32_t);
+
+	for (const auto& [raw_size, blocks] : compressed_sections)
+	{
+		file_size += sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint32_t) * blocks.size();
+		for (const auto& block : blocks)
+			file_size += block.size();
+	}
+
+	file_size += sizeof(uint64_t); // checksum
+
+	m_writer = std::thread([
+		path = m_path,
+		partial_path = partial_path(),
+		name = m_name,
+		kind = m_kind,
+		num_positions = m_num_positions,
+		layout = m_layout,
+		group_order = m_group_order,
+		state,
+		compressed_sections = std::move(compressed_sections),
+		file_size
+	]() {
+		try
+		{
+			{
+				Memory_Mapped_File file;
+				if (!file.create(partial_path, file_size))
+					throw std::runtime_error("Cannot create checkpoint file.");
+
+				Serial_Memory_Writer writer(file.data_span());
+
+				writer.write<uint32_t>(MAGIC);
+				writer.write<uint32_t>(VERSION);
+				writer.write<uint64_t>(static_cast<uint64_t>(kind));
+				writer.write<uint64_t>(num_positions);
+				writer.write<uint32_t>(static_cast<uint32_t>(layout));
+				writer.write<uint32_t>(static_cast<uint32_t>(group_order));
+				writer.write<uint16_t>(narrowing_static_cast<uint16_t>(name.size()));
+				writer.write(Const_Span(reinterpret_cast<const uint8_t*>(name.data()), name.size()));
+
+				writer.write<uint32_t>(static_cast<uint32_t>(state.stage));
+				writer.write<uint32_t>(narrowing_static_cast<uint32_t>(state.counters.size()));
+				for (const uint64_t c : state.counters)
+					writer.write<uint64_t>(c);
+
+				writer.write<uint32_t>(narrowing_static_cast<uint32_t>(compressed_sections.size()));
+				for (const auto& [raw_size, blocks] : compressed_sections)
+				{
+					writer.write<uint64_t>(raw_size);
+					writer.write<uint32_t>(narrowing_static_cast<uint32_t>(blocks.size()));
+					for (const auto& block : blocks)
+						writer.write<uint32_t>(narrowing_static_cast<uint32_t>(block.size()));
+					for (const auto& block : blocks)
+						writer.write(Const_Span(block));
+				}
+
+				writer.write_end_checksum(EGTB_CHECKSUM_INIT_VALUE);
+			}
+
+			std::filesystem::rename(partial_path, path);
+		}
+		catch (std::exception& e)
+		{
+			printf("WARNING: Failed to write checkpoint %s: %s\n", path.string().c_str(), e.what());
+			std::error_code ec;
+			std::filesystem::remove(partial_path, ec);
+		}
+	});
+
+	m_last_save_time = std::chrono::steady_clock::now();
+
+	printf("Checkpoint taken in %s\n", format_elapsed_time(start_time, m_last_save_time).c_str());
+}
+
+std::optional<EGTB_Checkpoint_State> EGTB_Checkpoint::load_state()
+{
+	if (!is_enabled())
+		return std::nullopt;
+
+	wait();
+
+	std::error_code ec;
+	std::filesystem::remove(partial_path(), ec);
+
+	if (!std::filesystem::exists(m_path))
+		return std::nullopt;
+
+	m_loaded_file.close();
+	if (!m_loaded_file.open_readonly(m_path))
+		return std::nullopt;
+
+	Serial_Memory_Reader reader(m_loaded_file.data_span());
+	if (!reader.is_end_checksum_ok(EGTB_CHECKSUM_INIT_VALUE))
+	{
+		printf("WARNING: Ignoring corrupted checkpoint %s\n", m_path.string().c_str());
+		m_loaded_file.close();
+		return std::nullopt;
+	}
+
+	const uint32_t magic = reader.read<uint32_t>();
+	const uint32_t version = reader.read<uint32_t>();
+	const uint64_t kind = reader.read<uint64_t>();
+	const uint64_t num_positions = reader.read<uint64_t>();
+	const uint32_t layout = reader.read<uint32_t>();
+	const uint32_t group_order = reader.read<uint32_t>();
+	std::string name(reader.read<uint16_t>(), '\0');
+	reader.read(Span(reinterpret_cast<uint8_t*>(name.data()), name.size()));
+
+	if (   magic != MAGIC
+		|| version != VERSION
+		|| kind != static_cast<uint64_t>(m_kind)
+		|| num_positions != m_num_positions
+		|| layout != static_cast<uint32_t>(m_layout)
+		|| group_order != static_cast<uint32_t>(m_group_order)
+		|| name != m_name)
+	{
+		printf("WARNING: Ignoring incompatible checkpoint %s\n", m_path.string().c_str());
+		m_loaded_file.close();
+		return std::nullopt;
+	}
+
+	EGTB_Checkpoint_State state;
+	state.stage = static_cast<EGTB_Checkpoint_Stage>(reader.read<uint32_t>());
+	state.counters.resize(reader.read<uint32_t>());
+	for (auto& c : state.counters)
+		c = reader.read<uint64_t>();
+
+	m_loaded_sections_offset = reader.num_bytes_read();
+
+	return state;
+}
+
+void EGTB_Checkpoint::restore(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const std::vector<Span<uint8_t>>& sections
+)
+{
+	if (m_loaded_file.data() == nullptr)
+		throw std::runtime_error("No checkpoint loaded.");
+
+	Serial_Memory_Reader reader(m_loaded_file.data_span());
+	reader.advance(m_loaded_sections_offset);
+
+	if (reader.read<uint32_t>() != sections.size())
+		throw std::runtime_error("Checkpoint section count mismatch.");
+
+	// Gather all blocks first, then decompress them in parallel.
+	std::vector<std::pair<Span<uint8_t>, Const_Span<uint8_t>>> blocks;
+	for (const auto& section : sections)
+	{
+		const uint64_t raw_size = reader.read<uint64_t>();
+		const uint32_t num_blocks = reader.read<uint32_t>();
+		if (raw_size != section.size() || num_blocks != ceil_div(raw_size, BLOCK_SIZE))
+			throw std::runtime_error("Checkpoint section size mismatch.");
+
+		std::vector<uint32_t> block_sizes(num_blocks);
+		for (auto& s : block_sizes)
+			s = reader.read<uint32_t>();
+
+		for (uint32_t i = 0; i < num_blocks; ++i)
+		{
+			blocks.emplace_back(section.nth_chunk(i, BLOCK_SIZE), Const_Span(reader.caret(), block_sizes[i]));
+			reader.advance(block_sizes[i]);
+		}
+	}
+
+	std::atomic<size_t> next_block_id(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		const LZ4_Decompress_Helper helper(LZ4_Dict::load(Const_Span<uint8_t>()), BLOCK_SIZE);
+		for (;;)
+		{
+			const size_t block_id = next_block_id.fetch_add(1);
+			if (block_id >= blocks.size())
+				return;
+
+			auto& [dst, src] = blocks[block_id];
+			const auto data = helper.decompress(src, dst.size());
+			std::memcpy(dst.data(), data.data(), data.size());
+		}
+	});
+
+	m_loaded_file.close();
+
+	printf("Restored generation state from checkpoint %s\n", m_path.string().c_str());
+}
+
+void EGTB_Checkpoint::wait()
+{
+	if (m_writer.joinable())
+		m_writer.join();
+}
+
+void EGTB_Checkpoint::remove()
+{
+	wait();
+	m_loaded_file.close();
+
+	std::error_code ec;
+	std::filesystem::remove(m_path, ec);
+	std::filesystem::remove(partial_path(), ec);
+}
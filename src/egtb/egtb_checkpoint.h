@@ -0,0 +1,140 @@
+#pragma once
+
+#include "egtb.h"
+
+#include "chess/piece_config.h"
+
+#include "util/defines.h"
+#include "util/param.h"
+#include "util/span.h"
+#include "util/thread_pool.h"
+#include "util/filesystem.h"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Generation phases after which the state can be saved and restored.
+// The meaning of the counters stored with each stage is up to the generator.
+enum struct EGTB_Checkpoint_Stage : uint32_t
+{
+	NONE = 0,
+	INITIALIZED,
+	BUILD_STEPS,
+	BUILD_STEPS_FINISHED,
+	BUILD_CHECK_CHASE
+};
+
+struct EGTB_Checkpoint_State
+{
+	EGTB_Checkpoint_Stage stage = EGTB_Checkpoint_Stage::NONE;
+	std::vector<uint64_t> counters;
+};
+
+// Periodically dumps the generator state (entry arrays, bitmaps and loop counters)
+// to a single file in the tmp directory, so that a crashed or killed generation
+// can be continued from the last saved iteration instead of from scratch.
+// The sections are compressed with fast LZ4 on the thread pool, which is
+// the only part the generation has to wait for. Writing to disk happens
+// on a background thread, and the file is renamed into place only when complete,
+// so there is always at most one valid checkpoint for a table.
+struct EGTB_Checkpoint
+{
+	static constexpr uint32_t MAGIC = 0x6b70c3e5;
+	static constexpr uint32_t VERSION = 4;
+	static constexpr size_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+	// Creates a disabled checkpoint that never saves or loads anything.
+	EGTB_Checkpoint() :
+		m_kind(EGTB_Magic::DTM_MAGIC),
+		m_num_positions(0),
+		m_layout(Board_Index_Layout::CARTESIAN),
+		m_group_order(Board_Index_Group_Order::BY_CLASS),
+		m_interval(0),
+		m_last_save_time(std::chrono::steady_clock::now())
+	{
+	}
+
+	// A zero interval disables checkpointing. The index layout and group order
+	// are stored, as checkpoints of the same table made with others
+	// usually have the same number of positions, but a different index.
+	EGTB_Checkpoint(
+		std::filesystem::path path,
+		const Piece_Config& ps,
+		EGTB_Magic kind,
+		size_t num_positions,
+		Board_Index_Layout layout,
+		Board_Index_Group_Order group_order,
+		std::chrono::seconds interval
+	);
+
+	EGTB_Checkpoint(const EGTB_Checkpoint&) = delete;
+	EGTB_Checkpoint(EGTB_Checkpoint&&) = delete;
+
+	EGTB_Checkpoint& operator=(const EGTB_Checkpoint&) = delete;
+	EGTB_Checkpoint& operator=(EGTB_Checkpoint&&) = delete;
+
+	~EGTB_Checkpoint()
+	{
+		wait();
+	}
+
+	NODISCARD bool is_enabled() const
+	{
+		return m_interval.count() > 0;
+	}
+
+	// Whether enough time has passed since the last save (or construction).
+	NODISCARD bool is_due() const
+	{
+		return is_enabled() && std::chrono::steady_clock::now() - m_last_save_time >= m_interval;
+	}
+
+	// Compresses the sections synchronously and writes them out asynchronously.
+	// A previous write still in progress is waited for first.
+	void save(
+		In_Out_Param<Thread_Pool> thread_pool,
+		const EGTB_Checkpoint_State& state,
+		const std::vector<Const_Span<uint8_t>>& sections
+	);
+
+	// Opens the checkpoint file, if present, and returns the state stored in it.
+	// Checkpoints that fail validation, or belong to a different table, are ignored.
+	NODISCARD std::optional<EGTB_Checkpoint_State> load_state();
+
+	// Decompresses the sections of the checkpoint opened by load_state().
+	// The number and sizes of the sections must match the saved ones.
+	// Throws std::runtime_error on mismatch.
+	void restore(
+		In_Out_Param<Thread_Pool> thread_pool,
+		const std::vector<Span<uint8_t>>& sections
+	);
+
+	// Waits for the pending write to finish.
+	void wait();
+
+	// Removes the checkpoint file. To be used after the table has been saved.
+	void remove();
+
+private:
+	std::filesystem::path m_path;
+	std::string m_name;
+	EGTB_Magic m_kind;
+	size_t m_num_positions;
+	Board_Index_Layout m_layout;
+	Board_Index_Group_Order m_group_order;
+	std::chrono::seconds m_interval;
+	std::chrono::steady_clock::time_point m_last_save_time;
+
+	std::thread m_writer;
+	Memory_Mapped_File m_loaded_file;
+	size_t m_loaded_sections_offset = 0;
+
+	NODISCARD std::filesystem::path partial_path() const
+	{
+		return std::filesystem::path(m_path).concat(".part");
+	}
+};
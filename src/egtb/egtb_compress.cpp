@@ -1,52 +1,65 @@
 ﻿#include "egtb_compress.h"
 
 #include "egtb_gen.h"
+#include "egtb_metadata.h"
 
 #include "util/allocation.h"
 #include "util/progress_bar.h"
 #include "util/filesystem.h"
 #include "util/memory.h"
 
-static void prepare_wdl_entries_for_compression(Span<WDL_Entry> data)
+#include <algorithm>
+#include <chrono>
+#include <optional>
+
+// Overwrites each run of illegal entries with the value that continues
+// the surrounding entries best. Illegal entries are never probed.
+template <typename EntryT>
+static void fill_illegal_runs(Span<EntryT> data, EntryT illegal)
 {
 	const size_t size = data.size();
 	for (size_t begin = 0, end = 0; begin < size; begin = end)
 	{
-		while (begin < size && data[begin] != WDL_Entry::ILLEGAL)
+		while (begin < size && data[begin] != illegal)
 			++begin;
 
 		if (begin == size)
 			break;
 
-		ASSERT(data[begin] == WDL_Entry::ILLEGAL);
+		ASSERT(data[begin] == illegal);
 
 		end = begin + 1;
-		while (end < size && data[end] == WDL_Entry::ILLEGAL)
+		while (end < size && data[end] == illegal)
 			++end;
 
-		ASSERT(data[end - 1] == WDL_Entry::ILLEGAL);
-		ASSERT(end == size || data[end] != WDL_Entry::ILLEGAL);
+		ASSERT(data[end - 1] == illegal);
+		ASSERT(end == size || data[end] != illegal);
 
 		/*                       begin           end
 								 V               V
 			0120120121012110210213333333333333333032031032123
 		*/
 
-		WDL_Entry fill_value = WDL_Entry::ILLEGAL;
+		EntryT fill_value = illegal;
 		if (begin > 1 && data[begin - 2] == data[begin - 1])
 			fill_value = data[begin - 1];
-		else if (end < size - 1 && (data[end] == data[end + 1] || data[end + 1] == WDL_Entry::ILLEGAL))
+		else if (end < size - 1 && (data[end] == data[end + 1] || data[end + 1] == illegal))
 			fill_value = data[end];
 		else if (begin > 0)
 			fill_value = data[begin - 1];
 		else if (end < size)
 			fill_value = data[end];
 
-		if (fill_value != WDL_Entry::ILLEGAL)
+		if (fill_value != illegal)
 			std::fill(data.begin() + begin, data.begin() + end, fill_value);
 	}
 }
 
+static void prepare_wdl_entries_for_compression(Span<WDL_Entry> data)
+{
+	fill_illegal_runs(data, WDL_Entry::ILLEGAL);
+}
+
 static void prepare_packed_wdl_entries_for_compression(Span<Packed_WDL_Entries> data)
 {
 	if (data.size() == 0)
@@ -79,227 +92,540 @@ void prepare_evtb_for_compression(In_Out_Param<Thread_Pool> thread_pool, Span<Pa
 	});
 }
 
-std::optional<LZ4_Dict> make_dict_for_evtb(
-	Const_Span<Packed_WDL_Entries> data
+constexpr size_t EVTB_DICT_MAX_SIZE = 1024 * 32;
+constexpr size_t EVTB_DICT_SAMPLE_SIZE = 4096;
+
+// Copies the blocks of WDL_BLOCK_SIZE a dictionary is trained on.
+NODISCARD static std::vector<uint8_t> sample_evtb_blocks(
+	Const_Span<Packed_WDL_Entries> data,
+	size_t sample_blocks,
+	size_t sample_stride
 )
 {
-	constexpr size_t DICT_MAX_SIZE = 1024 * 32;
-	constexpr size_t MAX_TOTAL_SAMPLES_SIZE = DICT_MAX_SIZE * 1024;
-	constexpr size_t SAMPLE_BLOCK_SIZE = 4096;
-	constexpr size_t MIN_BLOCKS_TO_MAKE_DICT = 256;
-
 	const size_t block_cnt = data.size() / WDL_BLOCK_SIZE;
+	const size_t split = sample_stride != 0 ? sample_stride : std::max(block_cnt / std::min(sample_blocks, block_cnt), (size_t)1);
+	const size_t num_blocks_to_use = std::min(sample_blocks, ceil_div(block_cnt, split));
+
+	std::vector<uint8_t> samples(num_blocks_to_use * WDL_BLOCK_SIZE);
+	for (size_t i = 0; i < num_blocks_to_use; ++i)
+		std::memcpy(
+			samples.data() + i * WDL_BLOCK_SIZE,
+			data.data() + i * split * WDL_BLOCK_SIZE,
+			WDL_BLOCK_SIZE
+		);
 
-	if (block_cnt >= MIN_BLOCKS_TO_MAKE_DICT)
-	{
-		const size_t num_blocks_to_use = std::min(MAX_TOTAL_SAMPLES_SIZE / WDL_BLOCK_SIZE, block_cnt);
-		const size_t split = std::max(block_cnt / num_blocks_to_use, (size_t)1);
-		const size_t buf_size = num_blocks_to_use * WDL_BLOCK_SIZE;
-
-		auto dist_buf = cpp20::make_unique_for_overwrite<Packed_WDL_Entries[]>(buf_size);
+	return samples;
+}
 
-		for (size_t i = 0; i < num_blocks_to_use; ++i)
-			std::memcpy(
-				dist_buf.get() + i * WDL_BLOCK_SIZE, 
-				data.data() + i * split * WDL_BLOCK_SIZE, 
-				WDL_BLOCK_SIZE
-			);
+std::optional<LZ4_Dict> make_dict_for_evtb(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<Packed_WDL_Entries> data,
+	size_t sample_blocks,
+	size_t sample_stride
+)
+{
+	const size_t block_cnt = data.size() / WDL_BLOCK_SIZE;
 
-		return LZ4_Dict::make(
-			Const_Span(reinterpret_cast<const uint8_t*>(dist_buf.get()), buf_size), 
-			DICT_MAX_SIZE, 
-			SAMPLE_BLOCK_SIZE
-		);
+	if (block_cnt >= MIN_BLOCKS_TO_MAKE_DICT && sample_blocks != 0)
+	{
+		const std::vector<uint8_t> samples = sample_evtb_blocks(data, sample_blocks, sample_stride);
+		LZ4_Dict dict = LZ4_Dict::make(thread_pool, Const_Span(samples), EVTB_DICT_MAX_SIZE, EVTB_DICT_SAMPLE_SIZE, WDL_BLOCK_SIZE);
+		if (!dict.empty())
+			return dict;
 	}
 
 	return std::nullopt;
 }
 
-Compressed_EGTB save_compress_evtb(
-	In_Out_Param<Thread_Pool> thread_pool,
-	Const_Span<Packed_WDL_Entries> lpSrcData,
-	Color color,
-	const EGTB_Info& info
-)
+// Compression isn't allowed to get further ahead than this many blocks per thread
+// of the first block that isn't written yet.
+constexpr size_t SAVE_BLOCKS_IN_FLIGHT_PER_THREAD = 4;
+
+// Counts how often filling the runs of illegal entries paid off.
+struct Illegal_Fill_Stats
 {
-	const std::string task_name = std::string("save_compress_evtb ") + std::to_string(static_cast<int>(color));
+	std::atomic<size_t> num_blocks_with_illegal{ 0 };
+	std::atomic<size_t> num_blocks_filled{ 0 };
+	std::atomic<uint64_t> size_saved{ 0 };
+};
+
+// A table stored as its most common entry and the entries that differ from it.
+struct Table_Exceptions
+{
+	uint16_t default_value = 0;
+	size_t num_exceptions = 0;
+
+	// The positions as uint32_t in increasing order, then the values.
+	std::vector<uint8_t> data;
+};
+
+// A table to be saved. Everything that determines the layout of the file
+// up to the compressed data is known before the table is compressed.
+struct Table_To_Save
+{
+	bool is_singular = false;
+	WDL_Entry single_val = WDL_Entry::DRAW;
+
+	Const_Span<uint8_t> src;
+	size_t block_size = 0;
+
+	// Only for the codecs that have levels.
+	int level = 0;
+
+	// WDL only.
+	WDL_Codec codec = WDL_Codec::LZ4;
+	std::optional<LZ4_Dict> dict;
+	size_t offset_bits = 4;
 
-	if (info.draw_cnt[color] + info.lose_cnt[color] == 0)
+	// DTC and DTM only.
+	bool is_big_order = false;
+	EGTB_Codec egtb_codec = EGTB_Codec::LZMA;
+	EGTB_Block_Layout layout = EGTB_Block_Layout::INTERLEAVED;
+
+	// ZSTD only, nothing if no dictionary pays for its size.
+	std::optional<ZSTD_Dict> zstd_dict;
+
+	// Entry values by rank, empty if the table is not mapped.
+	std::vector<uint16_t> value_map;
+	std::unique_ptr<uint8_t[]> rank_of_value;
+
+	// Only if the illegal entries are to be filled.
+	std::unique_ptr<Illegal_Fill_Stats> fill_stats;
+
+	// Only if the table is stored without its draws, src then points into it.
+	std::unique_ptr<uint8_t[]> sparse_entries;
+
+	// Only if the table is stored as exceptions instead of blocks.
+	std::optional<Table_Exceptions> exceptions;
+
+	// Known after the table is compressed.
+	Compressed_Block_Layout compressed;
+
+	NODISCARD size_t num_blocks() const
 	{
-		printf("%s: singular\n", task_name.c_str());
-		return Compressed_EGTB::make_singular(WDL_Entry::WIN);
+		return ceil_div(src.size(), block_size);
 	}
 
-	if (info.win_cnt[color] + info.lose_cnt[color] == 0)
+	NODISCARD size_t tail_size() const
 	{
-		printf("%s: singular\n", task_name.c_str());
-		return Compressed_EGTB::make_singular(WDL_Entry::DRAW);
+		return src.size() % block_size;
 	}
 
-	if (info.win_cnt[color] + info.draw_cnt[color] == 0)
+	NODISCARD bool has_blocks() const
 	{
-		printf("%s: singular\n", task_name.c_str());
-		return Compressed_EGTB::make_singular(WDL_Entry::LOSE);
+		return !is_singular && !exceptions.has_value();
 	}
 
-	auto dict = make_dict_for_evtb(lpSrcData);
+	void set_singular(WDL_Entry val)
+	{
+		is_singular = true;
+		single_val = val;
+	}
+};
 
-	auto raw_data = Const_Span(reinterpret_cast<const uint8_t*>(lpSrcData.data()), lpSrcData.size());
+// A file being written. Compressed blocks are written at their final offsets
+// as soon as they are known, the header is written when all tables are done.
+struct Table_File_Being_Saved
+{
+	EGTB_Save_Target target;
+	std::filesystem::path partial_path;
+	Positional_File file;
+	size_t header_size = 0;
+	size_t data_offset[COLOR_NB]{ 0, 0 };
+	size_t end = 0;
+};
+
+NODISCARD static bool is_table_saved(const std::vector<EGTB_Save_Target>& targets, Color color)
+{
+	return std::any_of(targets.begin(), targets.end(), [color](const EGTB_Save_Target& target) { return target.has_table(color); });
+}
 
-	auto compressed_blocks = compress_blocks(
-		thread_pool,
-		raw_data,
-		WDL_BLOCK_SIZE,
-		std::make_unique<LZ4_Compress_Helper>(dict.has_value() ? &*dict : nullptr),
-		task_name
-	);
+NODISCARD static uint64_t compute_file_checksum(const Positional_File& file, size_t size, uint64_t init)
+{
+	constexpr size_t BUFFER_SIZE = 16 * 1024 * 1024;
 
-	return Compressed_EGTB(
-		std::move(compressed_blocks),
-		WDL_BLOCK_SIZE,
-		raw_data.size() % WDL_BLOCK_SIZE,
-		std::move(dict),
-		false
-	);
+	auto buffer = cpp20::make_unique_for_overwrite<uint8_t[]>(BUFFER_SIZE);
+
+	XXH64_state_t* state = XXH64_createState();
+	XXH64_reset(state, init);
+
+	for (size_t offset = 0; offset < size; offset += BUFFER_SIZE)
+	{
+		const Span chunk(buffer.get(), std::min(BUFFER_SIZE, size - offset));
+		file.read(offset, chunk);
+		XXH64_update(state, chunk.data(), chunk.size());
+	}
+
+	const uint64_t checksum = XXH64_digest(state);
+	XXH64_freeState(state);
+
+	return checksum;
 }
 
-Compressed_EGTB save_compress_egtb(
+// Compresses the tables contained in any of the targets and saves all targets.
+// Files are written under a temporary name and renamed when complete,
+// so that a table is never visible in a partial state.
+template <typename HeaderSizeF, typename WriteHeaderF, typename MakeCompressorF>
+static void save_table_files(
 	In_Out_Param<Thread_Pool> thread_pool,
-	Const_Span<uint8_t> lpSrcData,
-	Color color,
-	const EGTB_Info& info,
-	bool is_big
+	Table_To_Save tables[COLOR_NB],
+	const std::vector<EGTB_Save_Target>& targets,
+	const std::string& task_name,
+	HeaderSizeF&& header_size,
+	WriteHeaderF&& write_header,
+	MakeCompressorF&& make_compressor
 )
 {
-	static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+	std::vector<Table_File_Being_Saved> files(targets.size());
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		Table_File_Being_Saved& f = files[i];
+		f.target = targets[i];
+		f.partial_path = std::filesystem::path(f.target.path).concat(".part");
+		if (!f.file.create(f.partial_path))
+			print_and_abort("Could not create %s\n", f.partial_path.string().c_str());
+
+		f.header_size = header_size(tables, f.target.table_colors);
+		f.end = f.header_size;
+	}
+
+	for (const Color color : { WHITE, BLACK })
+	{
+		Table_To_Save& t = tables[color];
+
+		std::vector<Table_File_Being_Saved*> files_with_table;
+		for (Table_File_Being_Saved& f : files)
+			if (f.target.has_table(color))
+				files_with_table.emplace_back(&f);
+
+		if (files_with_table.empty() || t.is_singular)
+			continue;
+
+		for (Table_File_Being_Saved* f : files_with_table)
+			f->data_offset[color] = f->end;
+
+		if (t.exceptions.has_value())
+		{
+			for (const Table_File_Being_Saved* f : files_with_table)
+				f->file.write(f->data_offset[color], Const_Span(t.exceptions->data));
+
+			t.compressed.total_size = t.exceptions->data.size();
+
+			for (Table_File_Being_Saved* f : files_with_table)
+				f->end = ceil_to_multiple(f->data_offset[color] + t.compressed.total_size, (size_t)64);
+
+			continue;
+		}
+
+		t.compressed = compress_blocks_streaming(
+			thread_pool,
+			t.src,
+			t.block_size,
+			make_compressor(t),
+			task_name + " " + std::to_string(static_cast<int>(color)),
+			SAVE_BLOCKS_IN_FLIGHT_PER_THREAD * thread_pool->num_workers(),
+			true,
+			[&](size_t block_id, size_t offset, Const_Span<uint8_t> block) {
+				for (const Table_File_Being_Saved* f : files_with_table)
+					f->file.write(f->data_offset[color] + offset, block);
+			}
+		);
+
+		if (t.compressed.num_deduplicated != 0)
+			printf(
+				"%s %d: %zu duplicate blocks stored once, %zu bytes saved\n",
+				task_name.c_str(),
+				static_cast<int>(color),
+				t.compressed.num_deduplicated,
+				t.compressed.deduplicated_size
+			);
 
-	const std::string task_name = std::string("save_compress_egtb ") + std::to_string(static_cast<int>(color));
+		for (Table_File_Being_Saved* f : files_with_table)
+			f->end = ceil_to_multiple(f->data_offset[color] + t.compressed.total_size, (size_t)64);
+	}
 
-	if (info.win_cnt[color] + info.lose_cnt[color] == 0)
+	for (Table_File_Being_Saved& f : files)
 	{
-		printf("%s: singular\n", task_name.c_str());
-		return Compressed_EGTB::make_singular(WDL_Entry::DRAW);
+		std::vector<uint8_t> header(f.header_size);
+		Serial_Memory_Writer writer(Span(header.data(), header.size()));
+
+		write_header(writer, tables, f.target.table_colors);
+
+		if (writer.num_bytes_written() != f.header_size)
+			print_and_abort("file size is wrong.\n");
+
+		f.file.write(0, Const_Span(header));
+
+		// The padding after the last table may not have been written yet,
+		// so extend the file to its full size before reading it back.
+		const uint64_t zero = 0;
+		f.file.write(f.end, Const_Span(reinterpret_cast<const uint8_t*>(&zero), sizeof(zero)));
+
+		const uint64_t checksum = compute_file_checksum(f.file, f.end, EGTB_CHECKSUM_INIT_VALUE);
+		f.file.write(f.end, Const_Span(reinterpret_cast<const uint8_t*>(&checksum), sizeof(checksum)));
+
+		f.file.close();
+
+		std::filesystem::rename(f.partial_path, f.target.path);
+		refresh_egtb_table_file(f.target.path);
 	}
+}
+
+// Returns the table as exceptions to its most common entry, unless they take
+// more than max_size bytes. read_entry(pos) returns the entry at pos.
+template <typename EntryT, typename ReadF>
+NODISCARD static std::optional<Table_Exceptions> find_table_exceptions(
+	In_Out_Param<Thread_Pool> thread_pool,
+	size_t num_positions,
+	size_t max_size,
+	ReadF&& read_entry
+)
+{
+	static_assert(sizeof(EntryT) <= sizeof(uint16_t));
+
+	constexpr size_t NUM_VALUES = size_t(1) << (sizeof(EntryT) * CHAR_BIT);
+	constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+	// Positions are stored in 32 bits.
+	if (num_positions > std::numeric_limits<uint32_t>::max())
+		return std::nullopt;
+
+	const size_t num_chunks = ceil_div(num_positions, CHUNK_SIZE);
+
+	std::vector<std::vector<size_t>> counts(thread_pool->num_workers(), std::vector<size_t>(NUM_VALUES, 0));
+	std::atomic<size_t> next_chunk(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		std::vector<size_t>& thread_counts = counts[thread_id];
+		for (;;)
+		{
+			const size_t chunk = next_chunk.fetch_add(1);
+			if (chunk >= num_chunks)
+				return;
 
-	auto compressed_blocks = compress_blocks(
+			const size_t end = std::min(num_positions, (chunk + 1) * CHUNK_SIZE);
+			for (size_t pos = chunk * CHUNK_SIZE; pos < end; ++pos)
+				thread_counts[read_entry(pos)] += 1;
+		}
+	});
+
+	for (size_t thread_id = 1; thread_id < counts.size(); ++thread_id)
+		for (size_t value = 0; value < NUM_VALUES; ++value)
+			counts[0][value] += counts[thread_id][value];
+
+	const EntryT default_value = static_cast<EntryT>(std::max_element(counts[0].begin(), counts[0].end()) - counts[0].begin());
+	const size_t num_exceptions = num_positions - counts[0][default_value];
+	if (num_exceptions * (sizeof(uint32_t) + sizeof(EntryT)) > max_size)
+		return std::nullopt;
+
+	std::vector<std::vector<uint32_t>> positions_by_chunk(num_chunks);
+	next_chunk = 0;
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		for (;;)
+		{
+			const size_t chunk = next_chunk.fetch_add(1);
+			if (chunk >= num_chunks)
+				return;
+
+			const size_t end = std::min(num_positions, (chunk + 1) * CHUNK_SIZE);
+			for (size_t pos = chunk * CHUNK_SIZE; pos < end; ++pos)
+				if (read_entry(pos) != default_value)
+					positions_by_chunk[chunk].emplace_back(static_cast<uint32_t>(pos));
+		}
+	});
+
+	Table_Exceptions exceptions;
+	exceptions.default_value = default_value;
+	exceptions.num_exceptions = num_exceptions;
+	exceptions.data.resize(num_exceptions * (sizeof(uint32_t) + sizeof(EntryT)));
+
+	Serial_Memory_Writer writer(Span(exceptions.data.data(), exceptions.data.size()));
+	for (const auto& positions : positions_by_chunk)
+		for (const uint32_t pos : positions)
+			writer.write<uint32_t>(pos);
+	for (const auto& positions : positions_by_chunk)
+		for (const uint32_t pos : positions)
+			writer.write<EntryT>(read_entry(pos));
+
+	return exceptions;
+}
+
+// Exceptions are not considered above this size per block, whether they
+// are smaller than the blocks is only known by compressing them.
+constexpr size_t MAX_EXCEPTIONS_SIZE_PER_BLOCK = 4 * 1024;
+
+// Stores the table as exceptions to its most common entry if that is smaller
+// than its blocks with the given compressor. The table is compressed to find
+// out unless the exceptions are smaller than the offsets of its blocks.
+template <typename EntryT, typename ReadF>
+static void maybe_store_as_exceptions(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Table_To_Save& t,
+	size_t num_positions,
+	size_t size_without_data,
+	std::unique_ptr<Compress_Helper> compressor,
+	const std::string& task_name,
+	ReadF&& read_entry
+)
+{
+	std::optional<Table_Exceptions> exceptions = find_table_exceptions<EntryT>(
 		thread_pool,
-		lpSrcData,
-		BLOCK_SIZE,
-		std::make_unique<LZMA_Compress_Helper>(),
-		task_name
+		num_positions,
+		t.num_blocks() * MAX_EXCEPTIONS_SIZE_PER_BLOCK,
+		std::forward<ReadF>(read_entry)
 	);
+	if (!exceptions.has_value())
+		return;
 
-	return Compressed_EGTB(
-		std::move(compressed_blocks),
-		BLOCK_SIZE,
-		lpSrcData.size() % BLOCK_SIZE,
-		std::nullopt,
-		is_big
-	);
+	if (exceptions->data.size() > size_without_data)
+	{
+		const Compressed_Block_Layout blocks = compress_blocks_streaming(
+			thread_pool,
+			t.src,
+			t.block_size,
+			std::move(compressor),
+			task_name + " blocks",
+			SAVE_BLOCKS_IN_FLIGHT_PER_THREAD * thread_pool->num_workers(),
+			true,
+			[](size_t, size_t, Const_Span<uint8_t>) {}
+		);
+
+		if (exceptions->data.size() >= size_without_data + blocks.total_size)
+			return;
+	}
+
+	printf("%s: stored as %zu exceptions, %zu bytes\n", task_name.c_str(), exceptions->num_exceptions, exceptions->data.size());
+	t.exceptions = std::move(exceptions);
 }
 
-void save_evtb_table(
+// The metadata section of a file with the given tables.
+// compression_time_ms is filled in when the header is written.
+NODISCARD static EGTB_File_Metadata make_file_metadata(
 	const Piece_Config& ps,
-	const Compressed_EGTB save_info[COLOR_NB],
-	std::filesystem::path file_path,
-	const Fixed_Vector<Color, 2> table_colors,
-	EGTB_Magic magic
+	const Table_To_Save tables[COLOR_NB],
+	const Fixed_Vector<Color, 2>& table_colors,
+	bool is_wdl,
+	const EGTB_Generation_Stats* generation,
+	bool save_times
 )
 {
-	size_t file_size = 8; // 文件头8字节
-	size_t offset_bits[COLOR_NB] = { 4, 4 };
+	EGTB_File_Metadata metadata;
+	metadata.has_times = save_times;
+	if (generation != nullptr)
+		metadata.generation = *generation;
 
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			file_size += 2;
-		else
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
 		{
-			offset_bits[i] = t.total_compressed_size() <= 0xffffffff ? 4 : 6;
-			file_size += 20;
+			metadata.codecs.emplace_back(EGTB_METADATA_NO_CODEC);
+			metadata.block_sizes.emplace_back(0);
+			continue;
 		}
+
+		metadata.codecs.emplace_back(is_wdl ? static_cast<uint8_t>(t.codec) : static_cast<uint8_t>(t.egtb_codec));
+		metadata.block_sizes.emplace_back(narrowing_static_cast<uint32_t>(t.block_size));
 	}
 
+	const Piece_Config_For_Gen epsi(ps);
+	metadata.layout = epsi.board_index_layout();
+	for (const Piece_Class set : epsi.group_order())
+		metadata.group_order.emplace_back(static_cast<uint8_t>(set));
+
+	return metadata;
+}
+
+NODISCARD static uint64_t milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+NODISCARD static size_t evtb_header_size(const Table_To_Save tables[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors, size_t metadata_size)
+{
+	size_t size = 8 + metadata_size; // 文件头8字节, 元数据
+
+	for (const Color i : table_colors)
+		size += tables[i].is_singular ? 2 : tables[i].exceptions.has_value() ? 6 : 20;
+
 	// 字典大小
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
 			continue;
 
-		file_size += 2;
-		if (t.dict().has_value())
+		size += 2;
+		if (t.dict.has_value())
 		{
-			file_size += t.dict()->size();
-			if (file_size & 1)
-				file_size += 1;
+			size += t.dict->size();
+			if (size & 1)
+				size += 1;
 		}
 	}
-	// 偏移量写入
-	for (const Color i : table_colors)
-	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			continue;
-
-		file_size += (offset_bits[i] + 2) * t.num_blocks();
-	}
-
-	file_size = ceil_to_multiple(file_size, (size_t)64);
 
+	// 偏移量写入
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
 			continue;
 
-		file_size += t.total_compressed_size();
-		file_size = ceil_to_multiple(file_size, (size_t)64);
+		size += (t.offset_bits + 2) * t.num_blocks();
 	}
 
-	// file_size is found.
-
-	Memory_Mapped_File write_map;
-	if (!write_map.create(file_path.c_str(), file_size + 8))
-		abort();
-
-	Serial_Memory_Writer writer(write_map.data_span());
+	return ceil_to_multiple(size, (size_t)64);
+}
 
-	writer.write<uint32_t>(narrowing_static_cast<uint32_t>(magic));
+static void write_evtb_header(
+	Serial_Memory_Writer& writer,
+	const Piece_Config& ps,
+	EGTB_Magic magic,
+	const Table_To_Save tables[COLOR_NB],
+	const Fixed_Vector<Color, 2>& table_colors,
+	const EGTB_File_Metadata& metadata
+)
+{
+	writer.write<uint32_t>(egtb_file_magic(magic, Piece_Config_For_Gen(ps).board_index_layout()) | EGTB_METADATA_MAGIC_FLAG);
 	writer.write<uint32_t>(narrowing_static_cast<uint32_t>((ps.min_material_key().value() << 2ull) + table_colors.size()));
+	write_egtb_metadata(writer, metadata);
 
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		const Table_To_Save& t = tables[i];
+		if (t.is_singular)
 		{
 			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(EGTB_SINGULAR_FLAG));
-			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.single_val()));
+			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.single_val));
+		}
+		else if (t.exceptions.has_value())
+		{
+			writer.write<uint8_t>(EGTB_EXCEPTIONS_FLAG);
+			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.exceptions->default_value));
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.exceptions->num_exceptions));
 		}
 		else
 		{
-			writer.write<uint8_t>(0);
-			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(offset_bits[i]));
+			writer.write<uint8_t>(static_cast<uint8_t>(t.codec));
+			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.offset_bits));
 
 			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(t.tail_size()));
-			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.block_size()));
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.block_size));
 			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.num_blocks()));
-			writer.write<uint64_t>(narrowing_static_cast<uint64_t>(t.total_compressed_size()));
+			writer.write<uint64_t>(narrowing_static_cast<uint64_t>(t.compressed.total_size));
 		}
 	}
 
 	// 字典写入
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
 			continue;
 
-		if (t.dict().has_value())
+		if (t.dict.has_value())
 		{
-			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(t.dict()->size()));
-			writer.write(Const_Span(t.dict()->data(), t.dict()->size()));
+			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(t.dict->size()));
+			writer.write(Const_Span(t.dict->data(), t.dict->size()));
 			writer.zero_align(2);
 		}
 		else
@@ -309,316 +635,1802 @@ void save_evtb_table(
 	// 偏移量写入
 	for (const Color i : table_colors)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
 			continue;
 
-		size_t offset = 0;
-		for (const auto& block : t.compressed_blocks())
+		for (size_t idx = 0; idx < t.num_blocks(); ++idx)
 		{
-			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(block.size()));
+			const size_t block_size = t.compressed.sizes[idx];
+			const size_t offset = t.compressed.offsets[idx];
+
+			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(block_size));
 			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(offset));
 
-			if (offset_bits[i] == 6)
+			if (t.offset_bits == 6)
 				writer.write<uint16_t>(narrowing_static_cast<uint16_t>(offset >> 32));
-
-			offset += block.size();
 		}
 	}
 
 	writer.zero_align(64);
+}
 
-	for (const Color i : table_colors)
+NODISCARD static std::unique_ptr<Compress_Helper> make_wdl_compressor(const Table_To_Save& t)
+{
+	switch (t.codec)
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			continue;
+	case WDL_Codec::LZ4:
+		return std::make_unique<LZ4_Compress_Helper>(t.dict.has_value() ? &*t.dict : nullptr, t.level);
 
-		for (const auto& block : t.compressed_blocks())
-			writer.write(Const_Span(block));
-
-		writer.zero_align(64);
+	case WDL_Codec::RC2:
+		return std::make_unique<RC2_Compress_Helper>();
 	}
 
-	if (writer.num_bytes_written() != file_size)
-		print_and_abort("file size is wrong.\n");
-
-	writer.write_end_checksum(static_cast<uint64_t>(EGTB_CHECKSUM_INIT_VALUE));
-
-	write_map.close();
+	ASSUME(false);
 }
 
-void save_egtb_table(
+void save_evtb_table(
+	In_Out_Param<Thread_Pool> thread_pool,
 	const Piece_Config& ps,
-	const Compressed_EGTB save_info[COLOR_NB],
-	std::filesystem::path file_path,
-	const Fixed_Vector<Color, 2> table_colors,
-	EGTB_Magic magic
+	const Const_Span<Packed_WDL_Entries> src[COLOR_NB],
+	const EGTB_Info& info,
+	const EGTB_Generation_Stats* generation,
+	const std::vector<EGTB_Save_Target>& targets,
+	EGTB_Magic magic,
+	const WDL_Save_Settings& settings
 )
 {
-	size_t file_size = 8; // 文件头8字节
-
-	for (const Color i : table_colors)
-		file_size += save_info[i].is_singular() ? 2 : 22;
-
-	// 偏移量写入
-	for (const Color i : table_colors)
-	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			continue;
+	const auto start_time = std::chrono::steady_clock::now();
 
-		file_size += t.num_blocks() * 8;
-	}
+	const std::string task_name = "save_compress_evtb";
 
-	file_size = ceil_to_multiple(file_size, (size_t)64);
+	Table_To_Save tables[COLOR_NB];
 
-	for (const Color i : table_colors)
+	for (const Color color : { WHITE, BLACK })
 	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		if (!is_table_saved(targets, color))
 			continue;
 
-		file_size += t.total_compressed_size();
-		file_size = ceil_to_multiple(file_size, (size_t)64);
-	}
-
-	// file_size is found.
+		Table_To_Save& t = tables[color];
 
-	Memory_Mapped_File write_map;
-	write_map.create(file_path.c_str(), file_size + 8);
+		const std::string color_task_name = task_name + " " + std::to_string(static_cast<int>(color));
 
-	Serial_Memory_Writer writer(write_map.data_span());
-
-	writer.write<uint32_t>(narrowing_static_cast<uint32_t>(magic));
-	writer.write<uint32_t>(narrowing_static_cast<uint32_t>((ps.min_material_key().value() << 2ull) + table_colors.size()));
-
-	for (const Color i : table_colors)
-	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
+		if (info.draw_cnt[color] + info.lose_cnt[color] == 0)
 		{
-			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(EGTB_SINGULAR_FLAG));
-			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.single_val()));
+			printf("%s: singular\n", color_task_name.c_str());
+			t.set_singular(WDL_Entry::WIN);
 		}
-		else
+		else if (info.win_cnt[color] + info.lose_cnt[color] == 0)
 		{
-			writer.write<uint8_t>(0);
-			writer.write<uint8_t>(t.is_big_order());
-
-			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.tail_size()));
-			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.block_size()));
-			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.num_blocks()));
-			writer.write<uint64_t>(narrowing_static_cast<uint64_t>(t.total_compressed_size()));
+			printf("%s: singular\n", color_task_name.c_str());
+			t.set_singular(WDL_Entry::DRAW);
 		}
-	}
-
-	// 偏移量写入
-	for (const Color i : table_colors)
-	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			continue;
-
-		size_t offset = 0;
-		for (const auto& block : t.compressed_blocks())
+		else if (info.win_cnt[color] + info.draw_cnt[color] == 0)
+		{
+			printf("%s: singular\n", color_task_name.c_str());
+			t.set_singular(WDL_Entry::LOSE);
+		}
+		else
 		{
-			ASSERT(block.size() < (1 << 20));
-			writer.write<uint64_t>((offset << 20) + block.size());
-			offset += block.size();
+			t.src = Const_Span(reinterpret_cast<const uint8_t*>(src[color].data()), src[color].size());
+			t.codec = settings.codec;
+			t.block_size = settings.effective_block_size();
+			t.level = settings.lz4_level();
+			if (settings.codec == WDL_Codec::LZ4)
+				t.dict = make_dict_for_evtb(thread_pool, src[color], settings.dict_sample_blocks, settings.dict_sample_stride);
+
+			// The offsets table comes before the data, so its entry size has to be
+			// chosen before the compressed size is known.
+			const size_t max_compressed_size = t.num_blocks() * make_wdl_compressor(t)->compress_bound(t.block_size);
+			t.offset_bits = max_compressed_size <= 0xffffffff ? 4 : 6;
+
+			const Const_Span<Packed_WDL_Entries> entries = src[color];
+			maybe_store_as_exceptions<uint8_t>(
+				thread_pool,
+				t,
+				Piece_Config_For_Gen(ps).num_positions(),
+				(t.dict.has_value() ? t.dict->size() : 0) + (t.offset_bits + 2) * t.num_blocks(),
+				make_wdl_compressor(t),
+				color_task_name,
+				[entries](size_t pos) {
+					return static_cast<uint8_t>(get_wdl_value(entries[pos / WDL_ENTRY_PACK_RATIO], pos % WDL_ENTRY_PACK_RATIO));
+				}
+			);
 		}
 	}
 
-	writer.zero_align(64);
-
-	for (const Color i : table_colors)
-	{
-		const Compressed_EGTB& t = save_info[i];
-		if (t.is_singular())
-			continue;
+	save_table_files(
+		thread_pool,
+		tables,
+		targets,
+		task_name,
+		[&](const Table_To_Save ts[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors) {
+			return evtb_header_size(ts, table_colors, egtb_metadata_size(make_file_metadata(ps, ts, table_colors, true, generation, settings.save_times)));
+		},
+		[&](Serial_Memory_Writer& writer, const Table_To_Save ts[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors) {
+			EGTB_File_Metadata metadata = make_file_metadata(ps, ts, table_colors, true, generation, settings.save_times);
+			metadata.compression_time_ms = milliseconds_since(start_time);
+			write_evtb_header(writer, ps, magic, ts, table_colors, metadata);
+		},
+		make_wdl_compressor
+	);
+}
 
-		for (const auto& block : t.compressed_blocks())
-			writer.write(Const_Span(block));
-		writer.zero_align(64);
-	}
+// The block of a DTM table with separated rule bits starts with one of these.
+enum struct DTM_Rule_Plane_Block_Mode : uint8_t
+{
+	// No entry has rule bits, the entries are stored as they are.
+	INTERLEAVED = 0,
 
-	if (writer.num_bytes_written() != file_size)
-		print_and_abort("file size is wrong.\n");
+	// The entries without rule bits, then the rule bits in nibbles.
+	SEPARATE = 1
+};
 
-	writer.write_end_checksum(static_cast<uint64_t>(EGTB_CHECKSUM_INIT_VALUE));
+// The rest of an illegal entry. Can't be an actual entry without rule bits,
+// because scores don't reach DTM_SCORE_MASK.
+constexpr uint16_t DTM_ILLEGAL_WITHOUT_RULE_BITS = DTM_ILLEGAL & ~DTM_RULE_MASK;
+static_assert(static_cast<uint16_t>(DTM_SCORE_MAX) < static_cast<uint16_t>(DTM_SCORE_MASK));
 
-	write_map.close();
+NODISCARD static size_t dtm_rule_plane_size(size_t num_entries)
+{
+	return ceil_div(num_entries, (size_t)2);
 }
 
-Compressed_EGTB::Compressed_EGTB(
-	std::vector<std::vector<uint8_t>>&& compressed_blocks,
-	size_t src_blk_sz,
-	size_t tail_blk_sz,
-	std::optional<LZ4_Dict> d,
-	bool is_big
-) :
-	m_is_singular(false),
-	m_is_big_order(is_big),
-	m_single_val(WDL_Entry::DRAW),
-	m_block_size(src_blk_sz),
-	m_tail_size(tail_blk_sz),
-	m_compressed_blocks(std::move(compressed_blocks)),
-	m_total_compressed_size(0),
-	m_dict(std::move(d))
+NODISCARD static bool has_any_rule_bits(Const_Span<uint8_t> src)
 {
-	for (const auto& block : this->m_compressed_blocks)
-		m_total_compressed_size += block.size();
+	for (size_t i = 0; i < src.size(); i += sizeof(uint16_t))
+	{
+		uint16_t entry;
+		std::memcpy(&entry, src.data() + i, sizeof(uint16_t));
+		if (entry != DTM_ILLEGAL && (entry & DTM_RULE_MASK) != 0)
+			return true;
+	}
+
+	return false;
 }
 
-void load_evtb_table(
-	Out_Param<WDL_File_For_Probe> evtb,
-	const Piece_Config& ps,
-	std::filesystem::path sub_evtb,
-	const std::filesystem::path tmp[COLOR_NB],
-	EGTB_Magic evtb_magic
-)
+// dst receives the entries without their rule bits, followed by the
+// rule bits of consecutive entries packed in the nibbles of a byte.
+static void separate_dtm_rule_bits(Const_Span<uint8_t> src, Span<uint8_t> dst)
 {
-	Memory_Mapped_File map_file;
-	if (!map_file.open_readonly(sub_evtb.c_str()))
-		throw std::runtime_error("Could not open WDL file trying to load " + sub_evtb.string());
-
-	const Const_Span<uint8_t> input = map_file.data_span();
+	const size_t num_entries = src.size() / sizeof(uint16_t);
+	ASSERT(dst.size() == src.size() + dtm_rule_plane_size(num_entries));
 
-	if ((input.size() & 63) != 8)
-		throw std::runtime_error("Invalid WDL file size trying to load " + sub_evtb.string());
+	uint8_t* rule_plane = dst.data() + src.size();
+	std::memset(rule_plane, 0, dtm_rule_plane_size(num_entries));
 
-	Serial_Memory_Reader reader(input);
+	for (size_t i = 0; i < num_entries; ++i)
+	{
+		uint16_t entry;
+		std::memcpy(&entry, src.data() + i * sizeof(uint16_t), sizeof(uint16_t));
 
-	if (!reader.is_end_checksum_ok(static_cast<uint64_t>(EGTB_CHECKSUM_INIT_VALUE)))
-		throw std::runtime_error("Invalid WDL file checksum trying to load " + sub_evtb.string());
+		uint16_t rest = DTM_ILLEGAL_WITHOUT_RULE_BITS;
+		if (entry != DTM_ILLEGAL)
+		{
+			rest = entry & ~DTM_RULE_MASK;
+			rule_plane[i / 2] |= static_cast<uint8_t>((entry >> 12) << (i % 2 * 4));
+		}
 
-	size_t block_cnt[COLOR_NB]{ 0, 0 };
-	size_t block_size[COLOR_NB]{ 0, 0 };
-	size_t tail_size[COLOR_NB]{ 0, 0 };
+		std::memcpy(dst.data() + i * sizeof(uint16_t), &rest, sizeof(uint16_t));
+	}
+}
 
-	size_t dict_size[COLOR_NB]{ 0, 0 };
-	const uint8_t* lp_dict[COLOR_NB]{ nullptr, nullptr };
-	size_t offset_bits[COLOR_NB]{ 0, 0 };
-	const uint8_t* data[COLOR_NB]{ nullptr, nullptr };
-	size_t data_size[COLOR_NB]{ 0, 0 };
-	const uint8_t* offset_tb[COLOR_NB]{ nullptr, nullptr };
+static void merge_dtm_rule_bits(Const_Span<uint8_t> src, Span<uint8_t> dst)
+{
+	const size_t num_entries = dst.size() / sizeof(uint16_t);
+	ASSERT(src.size() == dst.size() + dtm_rule_plane_size(num_entries));
 
-	const uint32_t magic = reader.read<uint32_t>();
+	const uint8_t* rule_plane = src.data() + dst.size();
 
-	if (magic != narrowing_static_cast<uint32_t>(evtb_magic))
-		throw std::runtime_error("Invalid WDL file magic trying to load " + sub_evtb.string());
+	for (size_t i = 0; i < num_entries; ++i)
+	{
+		uint16_t entry;
+		std::memcpy(&entry, src.data() + i * sizeof(uint16_t), sizeof(uint16_t));
 
-	const uint32_t key_and_table_num = reader.read<uint32_t>();
-	const Material_Key key = static_cast<Material_Key>(key_and_table_num >> 2u);
-	if (key != ps.min_material_key())
-		throw std::runtime_error("Wrong material key in WDL file " + sub_evtb.string());
+		if (entry == DTM_ILLEGAL_WITHOUT_RULE_BITS)
+			entry = DTM_ILLEGAL;
+		else
+			entry |= static_cast<uint16_t>(((rule_plane[i / 2] >> (i % 2 * 4)) & 0xf) << 12);
 
-	const size_t table_num = key_and_table_num & 3;
-	const Fixed_Vector<Color, 2> table_colors = egtb_table_colors(table_num);
+		std::memcpy(dst.data() + i * sizeof(uint16_t), &entry, sizeof(uint16_t));
+	}
+}
 
-	for (const Color i : table_colors)
+// Compresses DTM blocks with the rule bits separated from the rest
+// of the entries, with another compressor.
+struct DTM_Rule_Plane_Compress_Helper : public Compress_Helper
+{
+	DTM_Rule_Plane_Compress_Helper(std::unique_ptr<Compress_Helper> inner) :
+		m_inner(std::move(inner))
 	{
-		if (reader.read<uint8_t>() & 0x80)
-		{
-			evtb->m_is_singular[i] = true;
-			evtb->m_single_val[i] = static_cast<WDL_Entry>(reader.read<uint8_t>());
-		}
-		else
-		{
-			evtb->m_is_singular[i] = false;
+	}
 
-			offset_bits[i] = reader.read<uint8_t>();
-			tail_size[i] = reader.read<uint16_t>();
-			block_size[i] = reader.read<uint32_t>();
-			block_cnt[i] = reader.read<uint32_t>();
-			data_size[i] = reader.read<uint64_t>();
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return 1 + m_inner->compress_bound(size + dtm_rule_plane_size(size / sizeof(uint16_t)));
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override
+	{
+		std::vector<uint8_t> compressed(compress_bound(src.size()));
+		compressed.resize(compress(Span(compressed.data(), compressed.size()), src));
+		return compressed;
+	}
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override
+	{
+		ASSERT(src.size() % sizeof(uint16_t) == 0);
+
+		if (dest.size() < compress_bound(src.size()))
+			throw std::runtime_error("Destination buffer not sufficient for DTM rule plane compression.");
+
+		const Span<uint8_t> inner_dest(dest.data() + 1, dest.size() - 1);
+
+		if (!has_any_rule_bits(src))
+		{
+			dest[0] = static_cast<uint8_t>(DTM_Rule_Plane_Block_Mode::INTERLEAVED);
+			return 1 + m_inner->compress(inner_dest, src);
+		}
+
+		m_planes.resize(src.size() + dtm_rule_plane_size(src.size() / sizeof(uint16_t)));
+		separate_dtm_rule_bits(src, Span(m_planes.data(), m_planes.size()));
+
+		dest[0] = static_cast<uint8_t>(DTM_Rule_Plane_Block_Mode::SEPARATE);
+		return 1 + m_inner->compress(inner_dest, Const_Span(m_planes.data(), m_planes.size()));
+	}
+
+	NODISCARD std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<DTM_Rule_Plane_Compress_Helper>(m_inner->clone());
+	}
+
+private:
+	std::unique_ptr<Compress_Helper> m_inner;
+	std::vector<uint8_t> m_planes;
+};
+
+// The inner decompressor must accept blocks of the size of the
+// entries plus the rule plane.
+struct DTM_Rule_Plane_Decompress_Helper : public Decompress_Helper
+{
+	DTM_Rule_Plane_Decompress_Helper(std::unique_ptr<Decompress_Helper> inner, size_t max_output_size) :
+		m_inner(std::move(inner)),
+		m_output_buffer(cpp20::make_unique_for_overwrite<uint8_t[]>(max_output_size)),
+		m_max_output_size(max_output_size)
+	{
+	}
+
+	NODISCARD static size_t max_inner_output_size(size_t max_output_size)
+	{
+		return max_output_size + dtm_rule_plane_size(max_output_size / sizeof(uint16_t));
+	}
+
+	NODISCARD Const_Span<uint8_t> decompress(Const_Span<uint8_t> src, size_t expected_size) const override
+	{
+		if (src.empty() || expected_size > m_max_output_size || expected_size % sizeof(uint16_t) != 0)
+			throw std::runtime_error("Invalid DTM block with separate rule bits.");
+
+		const Const_Span<uint8_t> inner_src(src.data() + 1, src.size() - 1);
+
+		switch (static_cast<DTM_Rule_Plane_Block_Mode>(src[0]))
+		{
+		case DTM_Rule_Plane_Block_Mode::INTERLEAVED:
+			return m_inner->decompress(inner_src, expected_size);
+
+		case DTM_Rule_Plane_Block_Mode::SEPARATE:
+		{
+			const size_t planes_size = expected_size + dtm_rule_plane_size(expected_size / sizeof(uint16_t));
+			const Const_Span<uint8_t> planes = m_inner->decompress(inner_src, planes_size);
+			merge_dtm_rule_bits(planes, Span(m_output_buffer.get(), expected_size));
+			return Const_Span(m_output_buffer.get(), expected_size);
+		}
+
+		default:
+			throw std::runtime_error("Unknown mode of a DTM block with separate rule bits.");
+		}
+	}
+
+private:
+	std::unique_ptr<Decompress_Helper> m_inner;
+	std::unique_ptr<uint8_t[]> m_output_buffer;
+	size_t m_max_output_size;
+};
+
+// Stores each 16-bit entry as the 8-bit rank of its value, with another compressor.
+struct Value_Map_Compress_Helper : public Compress_Helper
+{
+	Value_Map_Compress_Helper(std::unique_ptr<Compress_Helper> inner, const uint8_t* rank_of_value) :
+		m_inner(std::move(inner)),
+		m_rank_of_value(rank_of_value)
+	{
+	}
+
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return m_inner->compress_bound(size / sizeof(uint16_t));
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override
+	{
+		return m_inner->compress(map(src));
+	}
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override
+	{
+		return m_inner->compress(dest, map(src));
+	}
+
+	NODISCARD std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<Value_Map_Compress_Helper>(m_inner->clone(), m_rank_of_value);
+	}
+
+private:
+	std::unique_ptr<Compress_Helper> m_inner;
+	const uint8_t* m_rank_of_value;
+	std::vector<uint8_t> m_ranks;
+
+	NODISCARD Const_Span<uint8_t> map(Const_Span<uint8_t> src)
+	{
+		ASSERT(src.size() % sizeof(uint16_t) == 0);
+
+		m_ranks.resize(src.size() / sizeof(uint16_t));
+		for (size_t i = 0; i < m_ranks.size(); ++i)
+		{
+			uint16_t value;
+			std::memcpy(&value, src.data() + i * sizeof(uint16_t), sizeof(uint16_t));
+			m_ranks[i] = m_rank_of_value[value];
+		}
+
+		return Const_Span(m_ranks.data(), m_ranks.size());
+	}
+};
+
+struct Value_Map_Decompress_Helper : public Decompress_Helper
+{
+	// The inner decompressor must accept blocks of half the max_output_size.
+	Value_Map_Decompress_Helper(std::unique_ptr<Decompress_Helper> inner, std::vector<uint16_t> value_map, size_t max_output_size) :
+		m_inner(std::move(inner)),
+		m_value_map(std::move(value_map)),
+		m_output_buffer(cpp20::make_unique_for_overwrite<uint8_t[]>(max_output_size)),
+		m_max_output_size(max_output_size)
+	{
+		// Invalid ranks map to the illegal value, instead of reading out of bounds.
+		m_value_map.resize(MAX_VALUE_MAP_SIZE, DTM_ILLEGAL);
+	}
+
+	NODISCARD Const_Span<uint8_t> decompress(Const_Span<uint8_t> src, size_t expected_size) const override
+	{
+		if (expected_size > m_max_output_size || expected_size % sizeof(uint16_t) != 0)
+			throw std::runtime_error("Invalid size of a block with mapped values.");
+
+		const Const_Span<uint8_t> ranks = m_inner->decompress(src, expected_size / sizeof(uint16_t));
+		for (size_t i = 0; i < ranks.size(); ++i)
+			std::memcpy(m_output_buffer.get() + i * sizeof(uint16_t), &m_value_map[ranks[i]], sizeof(uint16_t));
+
+		return Const_Span(m_output_buffer.get(), expected_size);
+	}
+
+private:
+	std::unique_ptr<Decompress_Helper> m_inner;
+	std::vector<uint16_t> m_value_map;
+	std::unique_ptr<uint8_t[]> m_output_buffer;
+	size_t m_max_output_size;
+};
+
+// DTC entries use the same values for illegal positions and draws.
+constexpr uint16_t ILLEGAL_EGTB_ENTRY = DTM_ILLEGAL;
+constexpr uint16_t DRAW_EGTB_ENTRY = 0;
+
+// Compresses blocks of DTC or DTM entries that may contain illegal entries
+// with another compressor. Blocks with illegal entries are compressed twice,
+// once with them stored as draws and once with their runs filled to continue
+// the neighbouring entries, and the smaller result is kept.
+// Storing them as draws usually wins, as the illegal positions repeat
+// with the placement of the pieces and then match well.
+// Either way the files never contain illegal entries, the remaining ones
+// of blocks without any legal entry are stored as draws.
+struct Illegal_Fill_Compress_Helper : public Compress_Helper
+{
+	Illegal_Fill_Compress_Helper(std::unique_ptr<Compress_Helper> inner, Illegal_Fill_Stats* stats) :
+		m_inner(std::move(inner)),
+		m_stats(stats)
+	{
+	}
+
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return m_inner->compress_bound(size);
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override
+	{
+		std::vector<uint8_t> compressed(compress_bound(src.size()));
+		compressed.resize(compress(Span(compressed.data(), compressed.size()), src));
+		return compressed;
+	}
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override
+	{
+		ASSERT(src.size() % sizeof(uint16_t) == 0);
+
+		m_entries.resize(src.size() / sizeof(uint16_t));
+		std::memcpy(m_entries.data(), src.data(), src.size());
+
+		const Const_Span<uint8_t> entries(reinterpret_cast<const uint8_t*>(m_entries.data()), src.size());
+
+		if (std::find(m_entries.begin(), m_entries.end(), ILLEGAL_EGTB_ENTRY) == m_entries.end())
+			return m_inner->compress(dest, entries);
+
+		m_stats->num_blocks_with_illegal.fetch_add(1);
+
+		m_filled_entries = m_entries;
+		fill_illegal_runs(Span(m_filled_entries.data(), m_filled_entries.size()), ILLEGAL_EGTB_ENTRY);
+		std::replace(m_filled_entries.begin(), m_filled_entries.end(), ILLEGAL_EGTB_ENTRY, DRAW_EGTB_ENTRY);
+
+		std::replace(m_entries.begin(), m_entries.end(), ILLEGAL_EGTB_ENTRY, DRAW_EGTB_ENTRY);
+		const size_t size = m_inner->compress(dest, entries);
+
+		if (m_filled_entries == m_entries)
+			return size;
+
+		m_buffer.resize(compress_bound(src.size()));
+		const size_t filled_size = m_inner->compress(
+			Span(m_buffer.data(), m_buffer.size()),
+			Const_Span(reinterpret_cast<const uint8_t*>(m_filled_entries.data()), src.size())
+		);
+
+		if (filled_size >= size)
+			return size;
+
+		m_stats->num_blocks_filled.fetch_add(1);
+		m_stats->size_saved.fetch_add(size - filled_size);
+
+		std::memcpy(dest.data(), m_buffer.data(), filled_size);
+		return filled_size;
+	}
+
+	NODISCARD std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<Illegal_Fill_Compress_Helper>(m_inner->clone(), m_stats);
+	}
+
+private:
+	std::unique_ptr<Compress_Helper> m_inner;
+	Illegal_Fill_Stats* m_stats;
+	std::vector<uint16_t> m_entries;
+	std::vector<uint16_t> m_filled_entries;
+	std::vector<uint8_t> m_buffer;
+};
+
+// Returns the values of the entries ordered by decreasing frequency,
+// or nothing if there are too many different values to map them.
+// With illegal_as_draw, illegal entries are counted as draws, as most of them
+// are stored as draws and the rest continue the values around them.
+NODISCARD static std::vector<uint16_t> make_value_map(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> src,
+	bool illegal_as_draw
+)
+{
+	constexpr size_t CHUNK_SIZE = 1024 * 1024;
+	constexpr size_t NUM_VALUES = size_t(1) << 16;
+
+	std::vector<std::vector<uint64_t>> thread_counts(thread_pool->num_workers(), std::vector<uint64_t>(NUM_VALUES, 0));
+
+	std::atomic<size_t> next_chunk_id(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		std::vector<uint64_t>& counts = thread_counts[thread_id];
+		for (;;)
+		{
+			const auto chunk = src.nth_chunk(next_chunk_id.fetch_add(1), CHUNK_SIZE);
+			if (chunk.empty())
+				return;
+
+			for (size_t i = 0; i + sizeof(uint16_t) <= chunk.size(); i += sizeof(uint16_t))
+			{
+				uint16_t value;
+				std::memcpy(&value, chunk.data() + i, sizeof(uint16_t));
+				counts[value] += 1;
+			}
+		}
+	});
+
+	if (illegal_as_draw)
+	{
+		for (auto& counts : thread_counts)
+		{
+			counts[DRAW_EGTB_ENTRY] += counts[ILLEGAL_EGTB_ENTRY];
+			counts[ILLEGAL_EGTB_ENTRY] = 0;
+		}
+	}
+
+	std::vector<std::pair<uint64_t, uint16_t>> used_values;
+	for (size_t value = 0; value < NUM_VALUES; ++value)
+	{
+		uint64_t count = 0;
+		for (const auto& counts : thread_counts)
+			count += counts[value];
+
+		if (count != 0)
+			used_values.emplace_back(count, narrowing_static_cast<uint16_t>(value));
+	}
+
+	if (used_values.size() > MAX_VALUE_MAP_SIZE)
+		return {};
+
+	// Ties are broken by value, so that the mapping is deterministic.
+	std::sort(used_values.begin(), used_values.end(), [](const auto& lhs, const auto& rhs) {
+		return lhs.first != rhs.first ? lhs.first > rhs.first : lhs.second < rhs.second;
+	});
+
+	std::vector<uint16_t> value_map;
+	for (const auto& [count, value] : used_values)
+		value_map.emplace_back(value);
+
+	return value_map;
+}
+
+NODISCARD static std::unique_ptr<Compress_Helper> make_egtb_codec_compressor(const Table_To_Save& t)
+{
+	switch (t.egtb_codec)
+	{
+	case EGTB_Codec::LZMA:
+		return std::make_unique<LZMA_Compress_Helper>(t.level, narrowing_static_cast<unsigned int>(t.block_size));
+
+	case EGTB_Codec::LZ4:
+		return std::make_unique<LZ4_Compress_Helper>(nullptr, t.level);
+
+	case EGTB_Codec::ZSTD:
+		return std::make_unique<ZSTD_Compress_Helper>(t.zstd_dict.has_value() ? &*t.zstd_dict : nullptr, t.level);
+	}
+
+	ASSUME(false);
+}
+
+// Wraps the compressor of the codec into the ones of the layout and the storage options.
+// fill_stats must be given if the table may contain illegal entries.
+NODISCARD static std::unique_ptr<Compress_Helper> wrap_egtb_compressor(
+	const Table_To_Save& t,
+	std::unique_ptr<Compress_Helper> compressor,
+	bool with_value_map,
+	Illegal_Fill_Stats* fill_stats
+)
+{
+	if (with_value_map && !t.value_map.empty())
+		compressor = std::make_unique<Value_Map_Compress_Helper>(std::move(compressor), t.rank_of_value.get());
+	else if (t.layout == EGTB_Block_Layout::SEPARATE_RULE_BITS)
+		compressor = std::make_unique<DTM_Rule_Plane_Compress_Helper>(std::move(compressor));
+
+	if (fill_stats != nullptr)
+		compressor = std::make_unique<Illegal_Fill_Compress_Helper>(std::move(compressor), fill_stats);
+
+	return compressor;
+}
+
+// fill_stats must be given if the table may contain illegal entries.
+NODISCARD static std::unique_ptr<Compress_Helper> make_egtb_compressor(
+	const Table_To_Save& t,
+	bool with_value_map,
+	Illegal_Fill_Stats* fill_stats
+)
+{
+	return wrap_egtb_compressor(t, make_egtb_codec_compressor(t), with_value_map, fill_stats);
+}
+
+// Keeps the blocks it is given instead of compressing them, to get samples of the
+// blocks as the codec sees them, after the transformations of the other compressors.
+struct Sample_Collector_Compress_Helper : public Compress_Helper
+{
+	Sample_Collector_Compress_Helper(std::vector<uint8_t>* samples, std::vector<size_t>* sample_sizes) :
+		m_samples(samples),
+		m_sample_sizes(sample_sizes)
+	{
+	}
+
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return size;
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override
+	{
+		(void)compress(Span<uint8_t>(), src);
+		return {};
+	}
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override
+	{
+		(void)dest;
+		m_samples->insert(m_samples->end(), src.begin(), src.end());
+		m_sample_sizes->emplace_back(src.size());
+		return 0;
+	}
+
+	NODISCARD std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<Sample_Collector_Compress_Helper>(m_samples, m_sample_sizes);
+	}
+
+private:
+	std::vector<uint8_t>* m_samples;
+	std::vector<size_t>* m_sample_sizes;
+};
+
+// Returns nothing for tables with fewer blocks than this.
+constexpr size_t MIN_BLOCKS_TO_MAKE_ZSTD_DICT = 8;
+constexpr size_t ZSTD_DICT_SAMPLE_BLOCKS = 128;
+
+// Larger dictionaries hardly compress DTC and DTM blocks any better.
+constexpr size_t ZSTD_DICT_MAX_SIZE = 8 * 1024;
+
+// Ranks dictionaries like the higher levels do, in a fraction of the time.
+constexpr int ZSTD_DICT_EVAL_MAX_LEVEL = 9;
+
+// Trains the zstd dictionary of a table on evenly spaced blocks, after the
+// value map and the layout are applied to them. Returns nothing if no
+// dictionary pays for its size.
+NODISCARD static std::optional<ZSTD_Dict> make_zstd_dict_for_egtb(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Table_To_Save& t
+)
+{
+	if (t.num_blocks() < MIN_BLOCKS_TO_MAKE_ZSTD_DICT)
+		return std::nullopt;
+
+	const size_t num_samples = std::min(ZSTD_DICT_SAMPLE_BLOCKS, t.num_blocks());
+
+	std::vector<uint8_t> samples;
+	std::vector<size_t> sample_sizes;
+	const std::unique_ptr<Compress_Helper> collector = wrap_egtb_compressor(
+		t,
+		std::make_unique<Sample_Collector_Compress_Helper>(&samples, &sample_sizes),
+		true,
+		nullptr
+	);
+
+	// Every fourth block is held out to judge the dictionaries, those come last.
+	std::vector<uint16_t> entries;
+	for (const bool held_out : { false, true })
+	{
+		for (size_t i = 0; i < num_samples; ++i)
+		{
+			if ((i % 4 == 3) != held_out)
+				continue;
+
+			const Const_Span<uint8_t> block = t.src.nth_chunk(i * t.num_blocks() / num_samples, t.block_size);
+			entries.resize(block.size() / sizeof(uint16_t));
+			std::memcpy(entries.data(), block.data(), block.size());
+
+			// The entries the illegal ones get when they are not filled.
+			if (t.fill_stats != nullptr)
+				std::replace(entries.begin(), entries.end(), ILLEGAL_EGTB_ENTRY, DRAW_EGTB_ENTRY);
+
+			(void)collector->compress(Const_Span(reinterpret_cast<const uint8_t*>(entries.data()), block.size()));
+		}
+	}
+
+	ZSTD_Dict dict = ZSTD_Dict::make(
+		thread_pool,
+		Const_Span(samples.data(), samples.size()),
+		sample_sizes,
+		ZSTD_DICT_MAX_SIZE,
+		std::min(t.level, ZSTD_DICT_EVAL_MAX_LEVEL)
+	);
+	if (dict.empty())
+		return std::nullopt;
+
+	return dict;
+}
+
+NODISCARD static size_t zstd_dict_header_size(const Table_To_Save& t)
+{
+	if (t.egtb_codec != EGTB_Codec::ZSTD)
+		return 0;
+
+	const size_t dict_size = t.zstd_dict.has_value() ? t.zstd_dict->size() : 0;
+	return 2 + ceil_to_multiple(dict_size, (size_t)2);
+}
+
+// Compresses a few evenly spaced blocks with and without the value map,
+// to report the gain without compressing the whole table twice.
+static void sample_value_map_gain(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Table_To_Save& t,
+	Out_Param<EGTB_Value_Map_Stats> stats,
+	Color color
+)
+{
+	constexpr size_t MAX_SAMPLE_BLOCKS = 8;
+
+	// The sampled blocks are not counted in the statistics of the table.
+	Illegal_Fill_Stats sample_fill_stats;
+	Illegal_Fill_Stats* fill_stats = t.fill_stats != nullptr ? &sample_fill_stats : nullptr;
+
+	const size_t num_samples = std::min(MAX_SAMPLE_BLOCKS, t.num_blocks());
+
+	std::atomic<uint64_t> size_without(0);
+	std::atomic<uint64_t> size_with(0);
+	std::atomic<size_t> next_job_id(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t) {
+		for (;;)
+		{
+			const size_t job_id = next_job_id.fetch_add(1);
+			if (job_id >= num_samples * 2)
+				return;
+
+			const bool with_value_map = job_id % 2;
+			const size_t block_id = job_id / 2 * t.num_blocks() / num_samples;
+			const auto block = t.src.nth_chunk(block_id, t.block_size);
+
+			const size_t size = make_egtb_compressor(t, with_value_map, fill_stats)->compress(block).size();
+			(with_value_map ? size_with : size_without).fetch_add(size);
+		}
+	});
+
+	stats->sampled_size[color] = size_without.load();
+	stats->sampled_mapped_size[color] = size_with.load();
+}
+
+NODISCARD static size_t egtb_header_size(const Table_To_Save tables[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors, size_t metadata_size)
+{
+	size_t size = 8 + metadata_size; // 文件头8字节, 元数据
+
+	for (const Color i : table_colors)
+		size += tables[i].is_singular ? 2 : tables[i].exceptions.has_value() ? 8 : 22;
+
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (t.has_blocks() && !t.value_map.empty())
+			size += 2 + t.value_map.size() * 2;
+	}
+
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (t.has_blocks())
+			size += zstd_dict_header_size(t);
+	}
+
+	// 偏移量写入
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
+			continue;
+
+		size += t.num_blocks() * 8;
+	}
+
+	return ceil_to_multiple(size, (size_t)64);
+}
+
+static void write_egtb_header(
+	Serial_Memory_Writer& writer,
+	const Piece_Config& ps,
+	EGTB_Magic magic,
+	const Table_To_Save tables[COLOR_NB],
+	const Fixed_Vector<Color, 2>& table_colors,
+	const EGTB_File_Metadata& metadata
+)
+{
+	writer.write<uint32_t>(egtb_file_magic(magic, Piece_Config_For_Gen(ps).board_index_layout()) | EGTB_METADATA_MAGIC_FLAG);
+	writer.write<uint32_t>(narrowing_static_cast<uint32_t>((ps.min_material_key().value() << 2ull) + table_colors.size()));
+	write_egtb_metadata(writer, metadata);
+
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (t.is_singular)
+		{
+			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(EGTB_SINGULAR_FLAG));
+			writer.write<uint8_t>(narrowing_static_cast<uint8_t>(t.single_val));
+		}
+		else if (t.exceptions.has_value())
+		{
+			writer.write<uint8_t>(EGTB_EXCEPTIONS_FLAG);
+			writer.write<uint8_t>(0);
+			writer.write<uint16_t>(t.exceptions->default_value);
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.exceptions->num_exceptions));
+		}
+		else
+		{
+			const uint8_t codec_bits = static_cast<uint8_t>(static_cast<uint8_t>(t.egtb_codec) << EGTB_CODEC_SHIFT);
+			const uint8_t value_map_flag = t.value_map.empty() ? 0 : EGTB_VALUE_MAP_FLAG;
+			const uint8_t sparse_flag = t.sparse_entries == nullptr ? 0 : EGTB_SPARSE_FLAG;
+			writer.write<uint8_t>(static_cast<uint8_t>(t.layout) | codec_bits | value_map_flag | sparse_flag);
+			writer.write<uint8_t>(t.is_big_order);
+
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.tail_size()));
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.block_size));
+			writer.write<uint32_t>(narrowing_static_cast<uint32_t>(t.num_blocks()));
+			writer.write<uint64_t>(narrowing_static_cast<uint64_t>(t.compressed.total_size));
+		}
+	}
+
+	// Inverse of the value mapping.
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks() || t.value_map.empty())
+			continue;
+
+		writer.write<uint16_t>(narrowing_static_cast<uint16_t>(t.value_map.size()));
+		for (const uint16_t value : t.value_map)
+			writer.write<uint16_t>(value);
+	}
+
+	// zstd dictionaries, empty if a table has none.
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks() || t.egtb_codec != EGTB_Codec::ZSTD)
+			continue;
+
+		if (t.zstd_dict.has_value())
+		{
+			writer.write<uint16_t>(narrowing_static_cast<uint16_t>(t.zstd_dict->size()));
+			writer.write(Const_Span(t.zstd_dict->data(), t.zstd_dict->size()));
+			writer.zero_align(2);
+		}
+		else
+			writer.write<uint16_t>(0);
+	}
+
+	// 偏移量写入
+	for (const Color i : table_colors)
+	{
+		const Table_To_Save& t = tables[i];
+		if (!t.has_blocks())
+			continue;
+
+		for (size_t idx = 0; idx < t.num_blocks(); ++idx)
+		{
+			const size_t block_size = t.compressed.sizes[idx];
+			ASSERT(block_size < (1 << 20));
+			writer.write<uint64_t>((t.compressed.offsets[idx] << 20) + block_size);
+		}
+	}
+
+	writer.zero_align(64);
+}
+
+// Copies the 16-bit entries of the positions set in bits, in index order.
+NODISCARD static std::unique_ptr<uint8_t[]> gather_entries(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> src,
+	const EGTB_Bits& bits,
+	Out_Param<size_t> num_gathered
+)
+{
+	// In positions. Must be a multiple of the bits per element of EGTB_Bits.
+	constexpr size_t CHUNK_SIZE = 1024 * 1024;
+
+	const size_t num_positions = src.size() / sizeof(uint16_t);
+	ASSERT(bits.size() == num_positions);
+
+	const size_t num_chunks = ceil_div(num_positions, CHUNK_SIZE);
+	std::vector<size_t> chunk_offsets(num_chunks + 1, 0);
+
+	auto for_each_chunk = [&](auto&& func) {
+		std::atomic<size_t> next_chunk_id(0);
+		thread_pool->run_sync_task_on_all_threads([&](size_t) {
+			for (;;)
+			{
+				const size_t chunk_id = next_chunk_id.fetch_add(1);
+				if (chunk_id >= num_chunks)
+					return;
+
+				func(chunk_id, chunk_id * CHUNK_SIZE, std::min((chunk_id + 1) * CHUNK_SIZE, num_positions));
+			}
+		});
+	};
+
+	for_each_chunk([&](size_t chunk_id, size_t begin, size_t end) {
+		size_t count = 0;
+		for (const Board_Index pos : bits.set_bits(begin, end))
+		{
+			(void)pos;
+			count += 1;
+		}
+		chunk_offsets[chunk_id + 1] = count;
+	});
+
+	for (size_t i = 0; i < num_chunks; ++i)
+		chunk_offsets[i + 1] += chunk_offsets[i];
+
+	*num_gathered = chunk_offsets[num_chunks];
+	auto gathered = cpp20::make_unique_for_overwrite<uint8_t[]>(chunk_offsets[num_chunks] * sizeof(uint16_t));
+
+	for_each_chunk([&](size_t chunk_id, size_t begin, size_t end) {
+		uint8_t* dst = gathered.get() + chunk_offsets[chunk_id] * sizeof(uint16_t);
+		for (const Board_Index pos : bits.set_bits(begin, end))
+		{
+			std::memcpy(dst, src.data() + pos * sizeof(uint16_t), sizeof(uint16_t));
+			dst += sizeof(uint16_t);
+		}
+	});
+
+	return gathered;
+}
+
+std::optional<EGTB_Value_Map_Stats> save_egtb_table(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const Const_Span<uint8_t> src[COLOR_NB],
+	const EGTB_Info& info,
+	const EGTB_Generation_Stats* generation,
+	bool is_big,
+	const std::vector<EGTB_Save_Target>& targets,
+	EGTB_Magic magic,
+	const EGTB_Save_Settings& settings,
+	const EGTB_Bits* decisive_bits
+)
+{
+	const auto start_time = std::chrono::steady_clock::now();
+
+	const bool map_values = settings.map_values;
+	const bool fill_illegal = settings.fill_illegal;
+
+	const std::string task_name = "save_compress_egtb";
+
+	Table_To_Save tables[COLOR_NB];
+
+	for (const Color color : { WHITE, BLACK })
+	{
+		if (!is_table_saved(targets, color))
+			continue;
+
+		Table_To_Save& t = tables[color];
+
+		if (info.win_cnt[color] + info.lose_cnt[color] == 0)
+		{
+			printf("%s %d: singular\n", task_name.c_str(), static_cast<int>(color));
+			t.set_singular(WDL_Entry::DRAW);
+		}
+		else
+		{
+			t.src = src[color];
+			t.block_size = settings.effective_block_size();
+			t.level = settings.effective_level();
+			t.is_big_order = is_big;
+			t.egtb_codec = settings.codec;
+			t.layout = settings.layout;
+			if (fill_illegal)
+				t.fill_stats = std::make_unique<Illegal_Fill_Stats>();
+
+			if (decisive_bits != nullptr)
+			{
+				size_t num_entries;
+				t.sparse_entries = gather_entries(thread_pool, t.src, decisive_bits[color], out_param(num_entries));
+				t.src = Const_Span(t.sparse_entries.get(), num_entries * sizeof(uint16_t));
+
+				printf(
+					"%s %d: %zu of %zu entries stored without draws\n",
+					task_name.c_str(),
+					static_cast<int>(color),
+					num_entries,
+					src[color].size() / sizeof(uint16_t)
+				);
+			}
+		}
+	}
+
+	std::optional<EGTB_Value_Map_Stats> value_map_stats;
+	if (map_values)
+	{
+		value_map_stats.emplace();
+
+		for (const Color color : { WHITE, BLACK })
+		{
+			Table_To_Save& t = tables[color];
+			if (!is_table_saved(targets, color) || t.is_singular)
+				continue;
+
+			t.value_map = make_value_map(thread_pool, t.src, fill_illegal);
+			if (t.value_map.empty())
+				continue;
+
+			// The ranks replace the rule bits as well.
+			t.layout = EGTB_Block_Layout::INTERLEAVED;
+
+			t.rank_of_value = std::make_unique<uint8_t[]>(size_t(1) << 16);
+			for (size_t rank = 0; rank < t.value_map.size(); ++rank)
+				t.rank_of_value[t.value_map[rank]] = narrowing_static_cast<uint8_t>(rank);
+
+			value_map_stats->num_values[color] = narrowing_static_cast<uint16_t>(t.value_map.size());
+			sample_value_map_gain(thread_pool, t, out_param(*value_map_stats), color);
+
+			printf(
+				"%s %d: %zu values mapped, sampled gain x%.3f\n",
+				task_name.c_str(),
+				static_cast<int>(color),
+				t.value_map.size(),
+				value_map_stats->sampled_gain(color)
+			);
+		}
+	}
+
+	for (const Color color : { WHITE, BLACK })
+	{
+		Table_To_Save& t = tables[color];
+		if (!is_table_saved(targets, color) || t.is_singular || t.egtb_codec != EGTB_Codec::ZSTD)
+			continue;
+
+		t.zstd_dict = make_zstd_dict_for_egtb(thread_pool, t);
+
+		printf(
+			"%s %d: zstd dictionary of %zu bytes\n",
+			task_name.c_str(),
+			static_cast<int>(color),
+			t.zstd_dict.has_value() ? t.zstd_dict->size() : 0
+		);
+	}
+
+	for (const Color color : { WHITE, BLACK })
+	{
+		Table_To_Save& t = tables[color];
+		if (!is_table_saved(targets, color) || t.is_singular)
+			continue;
+
+		// The fill statistics are only for the blocks that are saved.
+		Illegal_Fill_Stats unused_fill_stats;
+		const Const_Span<uint8_t> entries = src[color];
+		maybe_store_as_exceptions<uint16_t>(
+			thread_pool,
+			t,
+			entries.size() / sizeof(uint16_t),
+			t.num_blocks() * 8 + (t.value_map.empty() ? 0 : 2 + t.value_map.size() * 2) + zstd_dict_header_size(t),
+			make_egtb_compressor(t, true, t.fill_stats != nullptr ? &unused_fill_stats : nullptr),
+			task_name + " " + std::to_string(static_cast<int>(color)),
+			[entries](size_t pos) {
+				// Illegal entries are never probed, they are stored as draws.
+				uint16_t entry;
+				std::memcpy(&entry, entries.data() + pos * sizeof(uint16_t), sizeof(uint16_t));
+				return entry == ILLEGAL_EGTB_ENTRY ? DRAW_EGTB_ENTRY : entry;
+			}
+		);
+
+		if (!t.exceptions.has_value())
+			continue;
+
+		t.sparse_entries.reset();
+		t.value_map.clear();
+		t.rank_of_value.reset();
+		t.fill_stats.reset();
+		t.zstd_dict.reset();
+		if (value_map_stats.has_value())
+			value_map_stats->num_values[color] = 0;
+	}
+
+	save_table_files(
+		thread_pool,
+		tables,
+		targets,
+		task_name,
+		[&](const Table_To_Save ts[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors) {
+			return egtb_header_size(ts, table_colors, egtb_metadata_size(make_file_metadata(ps, ts, table_colors, false, generation, settings.save_times)));
+		},
+		[&](Serial_Memory_Writer& writer, const Table_To_Save ts[COLOR_NB], const Fixed_Vector<Color, 2>& table_colors) {
+			EGTB_File_Metadata metadata = make_file_metadata(ps, ts, table_colors, false, generation, settings.save_times);
+			metadata.compression_time_ms = milliseconds_since(start_time);
+			write_egtb_header(writer, ps, magic, ts, table_colors, metadata);
+		},
+		[](const Table_To_Save& t) {
+			return make_egtb_compressor(t, true, t.fill_stats.get());
+		}
+	);
+
+	for (const Color color : { WHITE, BLACK })
+	{
+		const Table_To_Save& t = tables[color];
+		if (t.fill_stats == nullptr)
+			continue;
+
+		printf(
+			"%s %d: illegal entries filled in %zu of %zu blocks, %llu bytes saved\n",
+			task_name.c_str(),
+			static_cast<int>(color),
+			t.fill_stats->num_blocks_filled.load(),
+			t.fill_stats->num_blocks_with_illegal.load(),
+			static_cast<unsigned long long>(t.fill_stats->size_saved.load())
+		);
+	}
+
+	return value_map_stats;
+}
+
+NODISCARD static bool is_magic_of_any_layout(uint32_t magic, EGTB_Magic kind)
+{
+	return
+		   magic == egtb_file_magic(kind, Board_Index_Layout::CARTESIAN)
+		|| magic == egtb_file_magic(kind, Board_Index_Layout::FREE_PIECE_RELATIVE);
+}
+
+// The start of a table file, up to the table descriptors.
+struct Table_File_Start
+{
+	Fixed_Vector<Color, 2> table_colors;
+	std::optional<EGTB_File_Metadata> metadata;
+};
+
+// Returns whether the tables of a file were saved with the group order that ps has now.
+NODISCARD static bool has_current_group_order(const Piece_Config_For_Gen& epsi, const std::optional<EGTB_File_Metadata>& metadata)
+{
+	const Const_Span<Piece_Class> current = epsi.group_order();
+
+	if (!metadata.has_value() || metadata->group_order.empty())
+	{
+		const Piece_Config_For_Gen by_class(epsi, epsi.board_index_layout(), Board_Index_Group_Order::BY_CLASS);
+		return std::equal(current.begin(), current.end(), by_class.group_order().begin(), by_class.group_order().end());
+	}
+
+	return std::equal(current.begin(), current.end(), metadata->group_order.begin(), metadata->group_order.end(),
+		[](Piece_Class lhs, uint8_t rhs) {
+			return static_cast<uint8_t>(lhs) == rhs;
+		}
+	);
+}
+
+// Checks the magic and the material key, and reads the metadata section if there is one.
+// Unless any_layout is set the file must have the board index layout and the group order of ps.
+NODISCARD static Table_File_Start read_table_file_start(
+	Serial_Memory_Reader& reader,
+	const Piece_Config& ps,
+	EGTB_Magic kind,
+	bool any_layout,
+	const std::string& file_name,
+	const std::filesystem::path& path
+)
+{
+	const Piece_Config_For_Gen epsi(ps);
+
+	const uint32_t magic_and_flags = reader.read<uint32_t>();
+	const uint32_t magic = magic_and_flags & ~EGTB_METADATA_MAGIC_FLAG;
+
+	if (any_layout ? !is_magic_of_any_layout(magic, kind) : magic != egtb_file_magic(kind, epsi.board_index_layout()))
+	{
+		if (is_magic_of_any_layout(magic, kind))
+			throw std::runtime_error(file_name + " has a different board index layout, it has to be regenerated " + path.string());
+		throw std::runtime_error("Invalid " + file_name + " magic trying to load " + path.string());
+	}
+
+	const uint32_t key_and_table_num = reader.read<uint32_t>();
+	if (Material_Key(key_and_table_num >> 2) != ps.min_material_key())
+		throw std::runtime_error("Wrong material key in " + file_name + " " + path.string());
+
+	Table_File_Start start;
+	start.table_colors = egtb_table_colors(key_and_table_num & 3);
+
+	if (magic_and_flags & EGTB_METADATA_MAGIC_FLAG)
+	{
+		try
+		{
+			start.metadata = read_egtb_metadata(reader);
+		}
+		catch (const std::runtime_error& e)
+		{
+			throw std::runtime_error(std::string(e.what()) + " In " + path.string());
+		}
+
+		if (start.metadata->index_scheme_version != EGTB_INDEX_SCHEME_VERSION)
+			throw std::runtime_error(file_name + " has a different board index scheme version, it has to be regenerated " + path.string());
+	}
+
+	if (!any_layout && !has_current_group_order(epsi, start.metadata))
+		throw std::runtime_error(file_name + " has a different piece group order, it has to be regenerated " + path.string());
+
+	return start;
+}
+
+bool is_egtb_file_intact(const std::filesystem::path& path)
+{
+	Memory_Mapped_File map_file;
+	if (!open_table_file(out_param(map_file), path))
+		return false;
+
+	return is_egtb_data_intact(map_file.data_span());
+}
+
+bool is_egtb_data_intact(Const_Span<uint8_t> input)
+{
+	if ((input.size() & 63) != 8)
+		return false;
+
+	Serial_Memory_Reader reader(input);
+	return reader.is_end_checksum_ok(static_cast<uint64_t>(EGTB_CHECKSUM_INIT_VALUE));
+}
+
+EGTB_File_Summary read_table_file_summary(
+	const std::filesystem::path& path,
+	const Piece_Config& ps,
+	EGTB_Magic magic
+)
+{
+	Memory_Mapped_File map_file;
+	if (!open_table_file(out_param(map_file), path))
+		throw std::runtime_error("Could not open table file " + path.string());
+
+	Serial_Memory_Reader reader(map_file.data_span());
+
+	Table_File_Start start = read_table_file_start(reader, ps, magic, true, "table file", path);
+
+	EGTB_File_Summary summary;
+	summary.table_colors = start.table_colors;
+	summary.metadata = std::move(start.metadata);
+
+	if (magic == EGTB_Magic::WDL_MAGIC)
+		return summary;
+
+	// Same layout as written by write_egtb_header.
+	for (const Color color : summary.table_colors)
+	{
+		(void)color;
+
+		const uint8_t flags = reader.read<uint8_t>();
+		if (flags & EGTB_SINGULAR_FLAG)
+			reader.advance(1);
+		else if (flags == EGTB_EXCEPTIONS_FLAG)
+			reader.advance(1 + 2 + 4);
+		else
+		{
+			summary.is_big_order |= reader.read<uint8_t>() != 0;
+			reader.advance(4 + 4 + 4 + 8);
+		}
+	}
+
+	return summary;
+}
+
+void print_table_file_header(const std::filesystem::path& path)
+{
+	const auto table = parse_egtb_table_file_name(path.filename().string());
+	if (!table.has_value())
+		throw std::runtime_error("Not a table file name " + path.string());
+
+	const Piece_Config& ps = table->first;
+	const bool is_wdl = table->second == EGTB_Table_Kind::WDL || table->second == EGTB_Table_Kind::WDL_GEN;
+	const EGTB_Magic magic =
+		is_wdl ? EGTB_Magic::WDL_MAGIC
+		: table->second == EGTB_Table_Kind::DTC ? EGTB_Magic::DTC_MAGIC
+		: EGTB_Magic::DTM_MAGIC;
+
+	const EGTB_File_Summary summary = read_table_file_summary(path, ps, magic);
+
+	printf("%s\n", path.string().c_str());
+	printf("material: %s, tables: %zu\n", ps.name().c_str(), summary.table_colors.size());
+
+	if (summary.metadata.has_value())
+		print_egtb_metadata(*summary.metadata, is_wdl);
+	else
+		printf("no metadata section\n");
+}
+
+// Reads the exceptions of a table stored with EGTB_EXCEPTIONS_FLAG.
+template <typename EntryT>
+static void read_table_exceptions(
+	Const_Span<uint8_t> data,
+	size_t num_exceptions,
+	size_t num_positions,
+	EGTB_Exceptions<EntryT>& exceptions,
+	const std::filesystem::path& path
+)
+{
+	Serial_Memory_Reader reader(data);
+
+	exceptions.positions.resize(num_exceptions);
+	exceptions.values.resize(num_exceptions);
+
+	for (size_t i = 0; i < num_exceptions; ++i)
+	{
+		exceptions.positions[i] = reader.read<uint32_t>();
+		if (exceptions.positions[i] >= num_positions || (i != 0 && exceptions.positions[i] <= exceptions.positions[i - 1]))
+			throw std::runtime_error("Invalid exception positions in " + path.string());
+	}
+
+	for (size_t i = 0; i < num_exceptions; ++i)
+	{
+		std::memcpy(&exceptions.values[i], reader.caret(), sizeof(EntryT));
+		reader.advance(sizeof(EntryT));
+	}
+}
+
+// A table of a WDL file, pointing into the mapped file.
+struct WDL_Table_In_File
+{
+	bool is_singular = false;
+	WDL_Entry single_val = WDL_Entry::DRAW;
+
+	// Stored as exceptions to single_val, is_singular is false then.
+	bool has_exceptions = false;
+	size_t num_exceptions = 0;
+
+	WDL_Codec codec = WDL_Codec::LZ4;
+	size_t offset_bits = 0;
+	size_t tail_size = 0;
+	size_t block_size = 0;
+	size_t block_cnt = 0;
+	size_t data_size = 0;
+	Const_Span<uint8_t> dict;
+	const uint8_t* offset_tb = nullptr;
+	const uint8_t* data = nullptr;
+
+	NODISCARD bool has_blocks() const
+	{
+		return !is_singular && !has_exceptions;
+	}
+
+	NODISCARD size_t uncompressed_size() const
+	{
+		const size_t num_full_sized_blocks =
+			tail_size != 0
+			? block_cnt - 1
+			: block_cnt;
+		return block_size * num_full_sized_blocks + tail_size;
+	}
+
+	NODISCARD size_t decode_size(size_t idx) const
+	{
+		return
+			idx == block_cnt - 1 && tail_size
+			? tail_size
+			: block_size;
+	}
+
+	NODISCARD Const_Span<uint8_t> compressed_block(size_t idx) const
+	{
+		Serial_Memory_Reader block_reader(Const_Span(offset_tb + (offset_bits + 2) * idx, 2 + 4 + 2));
+		const size_t size = block_reader.read<uint16_t>();
+		size_t data_offset = block_reader.read<uint32_t>();
+		if (offset_bits == 6)
+		{
+			const size_t hi = block_reader.read<uint16_t>();
+			data_offset += hi << 32;
+		}
+
+		return Const_Span(data + data_offset, size);
+	}
+
+	NODISCARD std::unique_ptr<Decompress_Helper> make_decompressor() const
+	{
+		switch (codec)
+		{
+		case WDL_Codec::LZ4:
+			// We prepend the dictionary to the output data, because
+			// LZ4_decompress_safe_usingDict uses a fast-path when the
+			// dictionary is immediately before the output.
+			return std::make_unique<LZ4_Decompress_Helper>(LZ4_Dict::load(dict), block_size);
+
+		case WDL_Codec::RC2:
+			return std::make_unique<RC2_Decompress_Helper>(block_size);
+		}
+
+		ASSUME(false);
+	}
+};
+
+// Checks and parses the WDL file headers.
+// Returns the colors of the tables contained in the file.
+NODISCARD static Fixed_Vector<Color, 2> read_evtb_tables(
+	WDL_Table_In_File tables[COLOR_NB],
+	Const_Span<uint8_t> input,
+	const Piece_Config& ps,
+	const std::filesystem::path& sub_evtb,
+	EGTB_Magic evtb_magic
+)
+{
+	if ((input.size() & 63) != 8)
+		throw std::runtime_error("Invalid WDL file size trying to load " + sub_evtb.string());
+
+	Serial_Memory_Reader reader(input);
+
+	if (!reader.is_end_checksum_ok(static_cast<uint64_t>(EGTB_CHECKSUM_INIT_VALUE)))
+		throw std::runtime_error("Invalid WDL file checksum trying to load " + sub_evtb.string());
+
+	const Fixed_Vector<Color, 2> table_colors = read_table_file_start(reader, ps, evtb_magic, false, "WDL file", sub_evtb).table_colors;
+
+	for (const Color i : table_colors)
+	{
+		WDL_Table_In_File& t = tables[i];
+
+		const uint8_t flags = reader.read<uint8_t>();
+		if (flags & EGTB_SINGULAR_FLAG)
+		{
+			t.is_singular = true;
+			t.single_val = static_cast<WDL_Entry>(reader.read<uint8_t>());
+		}
+		else if (flags == EGTB_EXCEPTIONS_FLAG)
+		{
+			t.has_exceptions = true;
+			t.single_val = static_cast<WDL_Entry>(reader.read<uint8_t>());
+			t.num_exceptions = reader.read<uint32_t>();
+			t.data_size = t.num_exceptions * (sizeof(uint32_t) + sizeof(WDL_Entry));
+		}
+		else
+		{
+			if (flags > static_cast<uint8_t>(WDL_Codec::RC2))
+				throw std::runtime_error("Unknown WDL codec in " + sub_evtb.string());
+
+			t.codec = static_cast<WDL_Codec>(flags);
+			t.offset_bits = reader.read<uint8_t>();
+			t.tail_size = reader.read<uint16_t>();
+			t.block_size = reader.read<uint32_t>();
+			t.block_cnt = reader.read<uint32_t>();
+			t.data_size = reader.read<uint64_t>();
 		}
 	}
 
 	for (const Color i : table_colors)
 	{
-		if (evtb->m_is_singular[i])
+		if (!tables[i].has_blocks())
 			continue;
 
-		dict_size[i] = reader.read<uint16_t>();
-		if (dict_size[i] != 0)
+		const size_t dict_size = reader.read<uint16_t>();
+		if (dict_size != 0)
 		{
-			lp_dict[i] = reader.caret();
-			reader.advance(dict_size[i]);
+			tables[i].dict = Const_Span(reader.caret(), dict_size);
+			reader.advance(dict_size);
 			reader.align(2);
 		}
 	}
 
 	for (const Color i : table_colors)
 	{
-		if (evtb->m_is_singular[i])
+		if (!tables[i].has_blocks())
 			continue;
 
-		offset_tb[i] = reader.caret();
-		reader.advance((2 + offset_bits[i]) * block_cnt[i]);
+		tables[i].offset_tb = reader.caret();
+		reader.advance((2 + tables[i].offset_bits) * tables[i].block_cnt);
 	}
 
 	for (const Color i : table_colors)
 	{
-		if (evtb->m_is_singular[i])
+		if (tables[i].is_singular)
 			continue;
 
 		reader.align(64);
-		data[i] = reader.caret();
-		reader.advance(data_size[i]);
+		tables[i].data = reader.caret();
+		reader.advance(tables[i].data_size);
 	}
 
 	for (const Color i : table_colors)
 	{
-		if (evtb->m_is_singular[i])
+		if (!tables[i].has_blocks())
 			continue;
 
-		ASSERT(data[i] != nullptr);
-		ASSERT(offset_tb[i] != nullptr);
-
-		Memory_Mapped_File out_map(Memory_Mapped_File::Access_Advice::RANDOM);
-		const size_t num_full_sized_blocks =
-			tail_size[i] != 0
-			? block_cnt[i] - 1
-			: block_cnt[i];
-		const size_t file_sz = block_size[i] * num_full_sized_blocks + tail_size[i];
-		if (file_sz != evtb->uncompressed_file_size(Piece_Config_For_Gen(ps).num_positions()))
+		if (tables[i].uncompressed_size() != WDL_File_For_Probe::uncompressed_file_size(Piece_Config_For_Gen(ps).num_positions()))
 			throw std::runtime_error("Invalid decompressed size of WDL table from " + sub_evtb.string());
+	}
 
-		out_map.create(tmp[i].c_str(), file_sz);
+	return table_colors;
+}
+
+void load_evtb_table(
+	Out_Param<WDL_File_For_Probe> evtb,
+	const Piece_Config& ps,
+	std::filesystem::path sub_evtb,
+	const std::filesystem::path tmp[COLOR_NB],
+	EGTB_Magic evtb_magic
+)
+{
+	Memory_Mapped_File map_file;
+	if (!open_table_file(out_param(map_file), sub_evtb))
+		throw std::runtime_error("Could not open WDL file trying to load " + sub_evtb.string());
+
+	WDL_Table_In_File tables[COLOR_NB];
+	const Fixed_Vector<Color, 2> table_colors = read_evtb_tables(tables, map_file.data_span(), ps, sub_evtb, evtb_magic);
+
+	for (const Color i : table_colors)
+	{
+		const WDL_Table_In_File& t = tables[i];
+
+		evtb->m_is_singular[i] = !t.has_blocks();
+		if (!t.has_blocks())
+		{
+			evtb->m_single_val[i] = t.single_val;
+			if (t.has_exceptions)
+				read_table_exceptions(
+					Const_Span(t.data, t.data_size),
+					t.num_exceptions,
+					Piece_Config_For_Gen(ps).num_positions(),
+					evtb->m_exceptions[i],
+					sub_evtb
+				);
+			continue;
+		}
+
+		ASSERT(t.data != nullptr);
+		ASSERT(t.offset_tb != nullptr);
+
+		Memory_Mapped_File out_map(Memory_Mapped_File::Access_Advice::RANDOM);
+		out_map.create(tmp[i].c_str(), t.uncompressed_size());
 
 		Serial_Memory_Writer writer(out_map.data_span());
 
-		// We prepend the dictionary to the output data, because
-		// LZ4_decompress_safe_usingDict uses a fast-path when the
-		// dictionary is immediately before the output.
-		const auto dict = LZ4_Dict::load(Const_Span(lp_dict[i], lp_dict[i] + dict_size[i]));
-		LZ4_Decompress_Helper dc_helper(dict, block_size[i]);
+		const std::unique_ptr<Decompress_Helper> dc_helper = t.make_decompressor();
 
-		for (size_t idx = 0; idx < block_cnt[i]; ++idx)
+		for (size_t idx = 0; idx < t.block_cnt; ++idx)
+		{
+			const Const_Span<uint8_t> decompressed = dc_helper->decompress(t.compressed_block(idx), t.decode_size(idx));
+			writer.write(decompressed);
+		}
+
+		evtb->m_files[i] = std::move(out_map);
+	}
+}
+
+// Decodes all blocks single threaded until at least MIN_DURATION passes.
+// Returns the average time per pass.
+NODISCARD static std::chrono::nanoseconds time_block_decoding(
+	const Decompress_Helper& dc_helper,
+	const std::vector<std::vector<uint8_t>>& blocks,
+	Const_Span<uint8_t> src,
+	size_t block_size
+)
+{
+	using namespace std::chrono_literals;
+
+	constexpr auto MIN_DURATION = 200ms;
+
+	const auto start = std::chrono::steady_clock::now();
+	size_t num_passes = 0;
+	auto elapsed = std::chrono::steady_clock::duration::zero();
+	while (elapsed < MIN_DURATION)
+	{
+		for (size_t idx = 0; idx < blocks.size(); ++idx)
+		{
+			// Blocks were already checked, the result is not needed.
+			(void)dc_helper.decompress(Const_Span(blocks[idx]), src.nth_chunk(idx, block_size).size());
+		}
+
+		num_passes += 1;
+		elapsed = std::chrono::steady_clock::now() - start;
+	}
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed) / num_passes;
+}
+
+NODISCARD static std::vector<uint8_t> decode_wdl_table(const WDL_Table_In_File& t)
+{
+	std::vector<uint8_t> src(t.uncompressed_size());
+	Serial_Memory_Writer writer(Span(src.data(), src.size()));
+	const std::unique_ptr<Decompress_Helper> dc_helper = t.make_decompressor();
+	for (size_t idx = 0; idx < t.block_cnt; ++idx)
+		writer.write(dc_helper->decompress(t.compressed_block(idx), t.decode_size(idx)));
+	return src;
+}
+
+void benchmark_wdl_codecs(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path
+)
+{
+	Memory_Mapped_File map_file;
+	if (!open_table_file(out_param(map_file), path))
+		throw std::runtime_error("Could not open WDL file trying to load " + path.string());
+
+	WDL_Table_In_File tables[COLOR_NB];
+	const Fixed_Vector<Color, 2> table_colors = read_evtb_tables(tables, map_file.data_span(), ps, path, EGTB_Magic::WDL_MAGIC);
+
+	for (const Color color : table_colors)
+	{
+		const WDL_Table_In_File& t = tables[color];
+		if (t.is_singular)
+		{
+			printf("%s %d: singular\n", ps.name().c_str(), static_cast<int>(color));
+			continue;
+		}
+
+		if (t.has_exceptions)
+		{
+			printf("%s %d: %zu exceptions\n", ps.name().c_str(), static_cast<int>(color), t.num_exceptions);
+			continue;
+		}
+
+		// The tables are recompressed from the decompressed content,
+		// which was already prepared for compression when saved.
+		const std::vector<uint8_t> src = decode_wdl_table(t);
+
+		const size_t num_entries = Piece_Config_For_Gen(ps).num_positions();
+
+		for (const WDL_Codec codec : { WDL_Codec::LZ4, WDL_Codec::RC2 })
 		{
-			Serial_Memory_Reader block_reader(Const_Span(offset_tb[i] + (offset_bits[i] + 2) * idx, 2 + 4 + 2));
-			const size_t size = block_reader.read<uint16_t>();
-			size_t data_offset = block_reader.read<uint32_t>();
-			if (offset_bits[i] == 6)
+			Table_To_Save table;
+			table.src = Const_Span(src);
+			table.codec = codec;
+			table.level = WDL_Save_Settings().lz4_level();
+			if (codec == WDL_Codec::LZ4)
 			{
-				const size_t hi = block_reader.read<uint16_t>();
-				data_offset += hi << 32;
+				table.block_size = WDL_BLOCK_SIZE;
+				table.dict = make_dict_for_evtb(thread_pool, Const_Span(reinterpret_cast<const Packed_WDL_Entries*>(src.data()), src.size()));
 			}
+			else
+				table.block_size = RC2_WDL_BLOCK_SIZE;
 
-			const uint8_t* src_data = data[i] + data_offset;
+			const std::string codec_name = codec == WDL_Codec::LZ4 ? "LZ4" : "RC2";
 
-			const size_t decode_size =
-				idx == block_cnt[i] - 1 && tail_size[i]
-				? tail_size[i]
-				: block_size[i];
+			const std::vector<std::vector<uint8_t>> blocks = compress_blocks(
+				thread_pool,
+				table.src,
+				table.block_size,
+				make_wdl_compressor(table),
+				"benchmark " + codec_name
+			);
 
-			const Const_Span<uint8_t> decompressed = dc_helper.decompress(Const_Span(src_data, size), decode_size);
-			writer.write(decompressed);
+			// Same layout as in the file, apart from the header.
+			size_t compressed_size = table.dict.has_value() ? table.dict->size() : 0;
+			compressed_size += (2 + 4) * blocks.size();
+			for (const auto& block : blocks)
+				compressed_size += block.size();
+
+			std::unique_ptr<Decompress_Helper> dc_helper;
+			if (codec == WDL_Codec::LZ4)
+				dc_helper = std::make_unique<LZ4_Decompress_Helper>(table.dict.has_value() ? *table.dict : LZ4_Dict::load(Const_Span<uint8_t>()), table.block_size);
+			else
+				dc_helper = std::make_unique<RC2_Decompress_Helper>(table.block_size);
+
+			for (size_t idx = 0; idx < blocks.size(); ++idx)
+			{
+				const Const_Span<uint8_t> expected = table.src.nth_chunk(idx, table.block_size);
+				const Const_Span<uint8_t> decompressed = dc_helper->decompress(Const_Span(blocks[idx]), expected.size());
+				if (std::memcmp(decompressed.data(), expected.data(), expected.size()) != 0)
+					print_and_abort("%s round trip failed for block %zu.\n", codec_name.c_str(), idx);
+			}
+
+			const std::chrono::nanoseconds decode_time = time_block_decoding(*dc_helper, blocks, table.src, table.block_size);
+
+			printf(
+				"%s %d %s: %zu bytes, %.4f bits/entry, %.3f ns/entry decode\n",
+				ps.name().c_str(),
+				static_cast<int>(color),
+				codec_name.c_str(),
+				compressed_size,
+				compressed_size * 8.0 / num_entries,
+				static_cast<double>(decode_time.count()) / num_entries
+			);
 		}
+	}
+}
 
-		evtb->m_files[i] = std::move(out_map);
+void benchmark_wdl_dicts(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path
+)
+{
+	constexpr size_t SAMPLE_BLOCK_COUNTS[] = { 32, 64, 128, 256, 512, 1024 };
+
+	Memory_Mapped_File map_file;
+	if (!open_table_file(out_param(map_file), path))
+		throw std::runtime_error("Could not open WDL file trying to load " + path.string());
+
+	WDL_Table_In_File tables[COLOR_NB];
+	const Fixed_Vector<Color, 2> table_colors = read_evtb_tables(tables, map_file.data_span(), ps, path, EGTB_Magic::WDL_MAGIC);
+
+	for (const Color color : table_colors)
+	{
+		const WDL_Table_In_File& t = tables[color];
+		if (!t.has_blocks())
+		{
+			printf("%s %d: no blocks\n", ps.name().c_str(), static_cast<int>(color));
+			continue;
+		}
+
+		const std::vector<uint8_t> src = decode_wdl_table(t);
+		const Const_Span<Packed_WDL_Entries> entries(reinterpret_cast<const Packed_WDL_Entries*>(src.data()), src.size());
+		const size_t block_cnt = src.size() / WDL_BLOCK_SIZE;
+
+		auto compressed_size = [&](std::optional<LZ4_Dict> dict) {
+			Table_To_Save table;
+			table.src = Const_Span(src);
+			table.codec = WDL_Codec::LZ4;
+			table.level = WDL_Save_Settings().lz4_level();
+			table.block_size = WDL_BLOCK_SIZE;
+			table.dict = std::move(dict);
+
+			const std::vector<std::vector<uint8_t>> blocks = compress_blocks(
+				thread_pool,
+				table.src,
+				table.block_size,
+				make_wdl_compressor(table),
+				"benchmark dict"
+			);
+
+			size_t size = table.dict.has_value() ? table.dict->size() : 0;
+			for (const auto& block : blocks)
+				size += block.size();
+			return size;
+		};
+
+		auto print_result = [&](const char* trainer, size_t num_samples, double train_ms, size_t dict_size, size_t size) {
+			printf(
+				"%s %d %s, %zu blocks: %.1f ms training, %zu bytes dict, %zu bytes\n",
+				ps.name().c_str(),
+				static_cast<int>(color),
+				trainer,
+				num_samples,
+				train_ms,
+				dict_size,
+				size
+			);
+		};
+
+		auto milliseconds_since = [](std::chrono::steady_clock::time_point start) {
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		// Blocks are sampled even from tables too small to get a dictionary when saved.
+		printf("%s %d no dict, %zu blocks: %zu bytes\n", ps.name().c_str(), static_cast<int>(color), block_cnt, compressed_size(std::nullopt));
+
+		if (block_cnt == 0)
+			continue;
+
+		// The single threaded trainer used before, on the default samples.
+		{
+			const std::vector<uint8_t> samples = sample_evtb_blocks(entries, DEFAULT_DICT_SAMPLE_BLOCKS, 0);
+			const size_t sample_count = samples.size() / EVTB_DICT_SAMPLE_SIZE;
+			const std::vector<size_t> sample_sizes(sample_count, EVTB_DICT_SAMPLE_SIZE);
+			std::vector<uint8_t> dict(EVTB_DICT_MAX_SIZE);
+
+			const auto start = std::chrono::steady_clock::now();
+			const size_t dict_size = ZDICT_trainFromBuffer(
+				dict.data(),
+				dict.size(),
+				samples.data(),
+				sample_sizes.data(),
+				narrowing_static_cast<unsigned int>(sample_count)
+			);
+			const double train_ms = milliseconds_since(start);
+
+			dict.resize(ZDICT_isError(dict_size) ? 0 : dict_size);
+			print_result("ZDICT_trainFromBuffer", samples.size() / WDL_BLOCK_SIZE, train_ms, dict.size(), compressed_size(LZ4_Dict::load(Const_Span(dict))));
+		}
+
+		auto bench_trainer = [&](size_t sample_blocks, size_t sample_stride) {
+			const std::vector<uint8_t> samples = sample_evtb_blocks(entries, sample_blocks, sample_stride);
+
+			const auto start = std::chrono::steady_clock::now();
+			LZ4_Dict dict = LZ4_Dict::make(thread_pool, Const_Span(samples), EVTB_DICT_MAX_SIZE, EVTB_DICT_SAMPLE_SIZE, WDL_BLOCK_SIZE);
+			const double train_ms = milliseconds_since(start);
+
+			const size_t dict_size = dict.size();
+			print_result(sample_stride == 0 ? "fastCover" : "fastCover, stride 1", samples.size() / WDL_BLOCK_SIZE, train_ms, dict_size, compressed_size(std::move(dict)));
+		};
+
+		for (const size_t sample_blocks : SAMPLE_BLOCK_COUNTS)
+		{
+			bench_trainer(sample_blocks, 0);
+			if (sample_blocks >= block_cnt)
+				break;
+		}
+
+		// The first blocks only, instead of spread over the table.
+		bench_trainer(DEFAULT_DICT_SAMPLE_BLOCKS, 1);
+	}
+}
+
+// The zstd dictionary is only used by ZSTD, and may be empty.
+NODISCARD static std::unique_ptr<Decompress_Helper> make_egtb_codec_decompressor(
+	EGTB_Codec codec,
+	Const_Span<uint8_t> zstd_dict,
+	size_t max_output_size
+)
+{
+	switch (codec)
+	{
+	case EGTB_Codec::LZMA:
+		return std::make_unique<LZMA_Decompress_Helper>(max_output_size);
+
+	case EGTB_Codec::LZ4:
+		return std::make_unique<LZ4_Decompress_Helper>(LZ4_Dict::load(Const_Span<uint8_t>()), max_output_size);
+
+	case EGTB_Codec::ZSTD:
+		return std::make_unique<ZSTD_Decompress_Helper>(ZSTD_Dict::load(zstd_dict), max_output_size);
 	}
+
+	ASSUME(false);
 }
 
 void load_egtb_table(
@@ -626,11 +2438,13 @@ void load_egtb_table(
 	const Piece_Config& ps,
 	std::filesystem::path sub_evtb,
 	const std::filesystem::path tmp[COLOR_NB],
-	EGTB_Magic egtb_magic
+	EGTB_Magic egtb_magic,
+	const std::filesystem::path& wdl_path,
+	const std::filesystem::path wdl_tmp[COLOR_NB]
 )
 {
 	Memory_Mapped_File map_file;
-	if (!map_file.open_readonly(sub_evtb.c_str()))
+	if (!open_table_file(out_param(map_file), sub_evtb))
 		throw std::runtime_error("Could not open DTM file trying to load " + sub_evtb.string());
 
 	const Const_Span<uint8_t> input = map_file.data_span();
@@ -646,35 +2460,58 @@ void load_egtb_table(
 	size_t block_cnt[COLOR_NB]{ 0, 0 };
 	size_t block_size[COLOR_NB]{ 0, 0 };
 	size_t tail_size[COLOR_NB]{ 0, 0 };
+	EGTB_Block_Layout layout[COLOR_NB]{ EGTB_Block_Layout::INTERLEAVED, EGTB_Block_Layout::INTERLEAVED };
+	bool has_value_map[COLOR_NB]{ false, false };
+	bool is_sparse[COLOR_NB]{ false, false };
+	bool has_exceptions[COLOR_NB]{ false, false };
+	size_t num_exceptions[COLOR_NB]{ 0, 0 };
+	EGTB_Codec codec[COLOR_NB]{ EGTB_Codec::LZMA, EGTB_Codec::LZMA };
+	std::vector<uint16_t> value_map[COLOR_NB];
+	Const_Span<uint8_t> zstd_dict[COLOR_NB];
 
 	const uint8_t* data[COLOR_NB]{ nullptr, nullptr };
 	size_t data_size[COLOR_NB]{ 0, 0 };
 	const uint8_t* offset_tb[COLOR_NB]{ nullptr, nullptr };
 
-	const uint32_t magic = reader.read<uint32_t>();
-	if (magic != narrowing_static_cast<uint32_t>(egtb_magic))
-		throw std::runtime_error("Invalid DTM file magic trying to load " + sub_evtb.string());
-
-	const uint32_t key_and_table_num = reader.read<uint32_t>();
-	const Material_Key key = Material_Key(key_and_table_num >> 2);
-	if (key != ps.min_material_key())
-		throw std::runtime_error("Wrong material key in DTM file " + sub_evtb.string());
-
-	const size_t table_num = key_and_table_num & 3;
-	const Fixed_Vector<Color, 2> table_colors = egtb_table_colors(table_num);
+	const Fixed_Vector<Color, 2> table_colors = read_table_file_start(reader, ps, egtb_magic, false, "DTM file", sub_evtb).table_colors;
 
 	for (const Color i : table_colors)
 	{
-		if (reader.read<uint8_t>() & narrowing_static_cast<uint8_t>(EGTB_SINGULAR_FLAG))
+		const uint8_t flags = reader.read<uint8_t>();
+		if (flags & narrowing_static_cast<uint8_t>(EGTB_SINGULAR_FLAG))
 		{
-			egtb->m_is_singular_draw[i] = true;
+			egtb->m_is_singular[i] = true;
+			egtb->m_single_val[i] = DRAW_EGTB_ENTRY;
 			const WDL_Entry single_val = static_cast<WDL_Entry>(reader.read<uint8_t>());
 			if (single_val != WDL_Entry::DRAW)
 				throw std::runtime_error("Invalid single_val (not draw) in DTM table.");
 		}
+		else if (flags == EGTB_EXCEPTIONS_FLAG)
+		{
+			egtb->m_is_singular[i] = true;
+			has_exceptions[i] = true;
+
+			reader.advance(1);
+			egtb->m_single_val[i] = reader.read<uint16_t>();
+			num_exceptions[i] = reader.read<uint32_t>();
+			data_size[i] = num_exceptions[i] * (sizeof(uint32_t) + DTM_File_For_Probe::ENTRY_SIZE);
+		}
 		else
 		{
-			egtb->m_is_singular_draw[i] = false;
+			egtb->m_is_singular[i] = false;
+
+			has_value_map[i] = flags & EGTB_VALUE_MAP_FLAG;
+			is_sparse[i] = flags & EGTB_SPARSE_FLAG;
+
+			const uint8_t codec_id = (flags & EGTB_CODEC_MASK) >> EGTB_CODEC_SHIFT;
+			if (codec_id > static_cast<uint8_t>(EGTB_Codec::ZSTD))
+				throw std::runtime_error("Unknown codec in DTM file " + sub_evtb.string());
+			codec[i] = static_cast<EGTB_Codec>(codec_id);
+
+			const uint8_t layout_id = flags & ~(EGTB_VALUE_MAP_FLAG | EGTB_SPARSE_FLAG | EGTB_CODEC_MASK);
+			if (layout_id > static_cast<uint8_t>(EGTB_Block_Layout::SEPARATE_RULE_BITS))
+				throw std::runtime_error("Unknown block layout in DTM file " + sub_evtb.string());
+			layout[i] = static_cast<EGTB_Block_Layout>(layout_id);
 
 			reader.advance(1);
 			tail_size[i] = reader.read<uint32_t>();
@@ -686,7 +2523,31 @@ void load_egtb_table(
 
 	for (const Color i : table_colors)
 	{
-		if (egtb->m_is_singular_draw[i])
+		if (egtb->m_is_singular[i] || !has_value_map[i])
+			continue;
+
+		const size_t num_values = reader.read<uint16_t>();
+		if (num_values == 0 || num_values > MAX_VALUE_MAP_SIZE)
+			throw std::runtime_error("Invalid value map in DTM file " + sub_evtb.string());
+
+		for (size_t j = 0; j < num_values; ++j)
+			value_map[i].emplace_back(reader.read<uint16_t>());
+	}
+
+	for (const Color i : table_colors)
+	{
+		if (egtb->m_is_singular[i] || codec[i] != EGTB_Codec::ZSTD)
+			continue;
+
+		const size_t dict_size = reader.read<uint16_t>();
+		zstd_dict[i] = Const_Span(reader.caret(), dict_size);
+		reader.advance(dict_size);
+		reader.align(2);
+	}
+
+	for (const Color i : table_colors)
+	{
+		if (egtb->m_is_singular[i])
 			continue;
 
 		offset_tb[i] = reader.caret();
@@ -695,7 +2556,7 @@ void load_egtb_table(
 
 	for (const Color i : table_colors)
 	{
-		if (egtb->m_is_singular_draw[i])
+		if (egtb->m_is_singular[i] && !has_exceptions[i])
 			continue;
 
 		reader.align(64);
@@ -703,9 +2564,22 @@ void load_egtb_table(
 		reader.advance(data_size[i]);
 	}
 
+	// Destroyed after the WDL table, which is only loaded for sparse tables.
+	Temporary_File_Tracker wdl_tmp_files;
+	std::optional<WDL_File_For_Probe> wdl;
+
 	for (const Color i : table_colors)
 	{
-		if (egtb->m_is_singular_draw[i])
+		if (has_exceptions[i])
+			read_table_exceptions(
+				Const_Span(data[i], data_size[i]),
+				num_exceptions[i],
+				Piece_Config_For_Gen(ps).num_positions(),
+				egtb->m_exceptions[i],
+				sub_evtb
+			);
+
+		if (egtb->m_is_singular[i])
 			continue;
 
 		ASSERT(data[i] != nullptr);
@@ -716,15 +2590,70 @@ void load_egtb_table(
 			tail_size[i] != 0
 			? block_cnt[i] - 1
 			: block_cnt[i];
-		const size_t file_sz = block_size[i] * num_full_sized_blocks + tail_size[i];
-		if (file_sz != egtb->uncompressed_file_size(Piece_Config_For_Gen(ps).num_positions()))
+		const size_t num_positions = Piece_Config_For_Gen(ps).num_positions();
+		const size_t file_sz = egtb->uncompressed_file_size(num_positions);
+		if (!is_sparse[i] && block_size[i] * num_full_sized_blocks + tail_size[i] != file_sz)
 			throw std::runtime_error("Invalid decompressed size of DTM table from " + sub_evtb.string());
 
+		if (is_sparse[i] && !wdl.has_value())
+		{
+			if (wdl_path.empty())
+				throw std::runtime_error("DTM table without draws needs the WDL file, trying to load " + sub_evtb.string());
+
+			wdl.emplace();
+			wdl_tmp_files.track_path(wdl_tmp[WHITE]);
+			wdl_tmp_files.track_path(wdl_tmp[BLACK]);
+			load_evtb_table(out_param(*wdl), ps, wdl_path, wdl_tmp, EGTB_Magic::WDL_MAGIC);
+		}
+
 		out_map.create(tmp[i].c_str(), file_sz);
 
 		Serial_Memory_Writer writer(out_map.data_span());
 
-		LZMA_Decompress_Helper dc_helper(block_size[i] * DTM_File_For_Probe::ENTRY_SIZE);
+		// Writes the stored entries of a sparse table at the positions
+		// that are decisive in the WDL table, and draws in between.
+		size_t next_pos = 0;
+		auto skip_draws = [&]() {
+			while (next_pos < num_positions)
+			{
+				const WDL_Entry value = wdl->read(i, static_cast<Board_Index>(next_pos));
+				if (value == WDL_Entry::WIN || value == WDL_Entry::LOSE)
+					break;
+
+				writer.write<uint16_t>(DRAW_EGTB_ENTRY);
+				next_pos += 1;
+			}
+		};
+		auto write_sparse = [&](Const_Span<uint8_t> entries) {
+			for (size_t j = 0; j < entries.size(); j += sizeof(uint16_t))
+			{
+				skip_draws();
+				if (next_pos == num_positions)
+					throw std::runtime_error("DTM table without draws doesn't match the WDL table " + sub_evtb.string());
+
+				writer.write(Const_Span(entries.data() + j, sizeof(uint16_t)));
+				next_pos += 1;
+			}
+		};
+
+		auto make_codec_decompressor = [codec = codec[i], dict = zstd_dict[i]](size_t max_output_size) {
+			return make_egtb_codec_decompressor(codec, dict, max_output_size);
+		};
+
+		std::unique_ptr<Decompress_Helper> dc_helper;
+		if (has_value_map[i])
+			dc_helper = std::make_unique<Value_Map_Decompress_Helper>(
+				make_codec_decompressor(block_size[i] / sizeof(uint16_t)),
+				std::move(value_map[i]),
+				block_size[i]
+			);
+		else if (layout[i] == EGTB_Block_Layout::SEPARATE_RULE_BITS)
+			dc_helper = std::make_unique<DTM_Rule_Plane_Decompress_Helper>(
+				make_codec_decompressor(DTM_Rule_Plane_Decompress_Helper::max_inner_output_size(block_size[i])),
+				block_size[i]
+			);
+		else
+			dc_helper = make_codec_decompressor(block_size[i] * DTM_File_For_Probe::ENTRY_SIZE);
 
 		for (size_t idx = 0; idx < block_cnt[i]; ++idx)
 		{
@@ -741,10 +2670,131 @@ void load_egtb_table(
 				? tail_size[i]
 				: block_size[i];
 
-			const Const_Span<uint8_t> decompressed = dc_helper.decompress(Const_Span(p_src, data_size), decode_size);
-			writer.write(decompressed);
+			const Const_Span<uint8_t> decompressed = dc_helper->decompress(Const_Span(p_src, data_size), decode_size);
+			if (is_sparse[i])
+				write_sparse(decompressed);
+			else
+				writer.write(decompressed);
+		}
+
+		if (is_sparse[i])
+		{
+			skip_draws();
+			if (next_pos != num_positions)
+				throw std::runtime_error("DTM table without draws doesn't match the WDL table " + sub_evtb.string());
 		}
 
 		egtb->m_files[i] = std::move(out_map);
 	}
 }
+
+void benchmark_egtb_codecs(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path,
+	EGTB_Magic magic,
+	const std::filesystem::path tmp[COLOR_NB],
+	const std::filesystem::path& wdl_path,
+	const std::filesystem::path wdl_tmp[COLOR_NB]
+)
+{
+	struct Codec_Config
+	{
+		EGTB_Codec codec;
+		int level;
+		size_t block_size;
+	};
+
+	constexpr Codec_Config CONFIGS[] = {
+		{ EGTB_Codec::LZMA, LZMA_Compress_Helper::DEFAULT_LEVEL, EGTB_BLOCK_SIZE },
+		{ EGTB_Codec::LZMA, LZMA_Compress_Helper::DEFAULT_LEVEL, ZSTD_TABLE_BLOCK_SIZE },
+		{ EGTB_Codec::ZSTD, ZSTD_Compress_Helper::DEFAULT_LEVEL, 32 * 1024 },
+		{ EGTB_Codec::ZSTD, ZSTD_Compress_Helper::DEFAULT_LEVEL, 64 * 1024 },
+		{ EGTB_Codec::ZSTD, ZSTD_Compress_Helper::DEFAULT_LEVEL, 128 * 1024 },
+		{ EGTB_Codec::ZSTD, ZSTD_Compress_Helper::DEFAULT_LEVEL, 256 * 1024 },
+		{ EGTB_Codec::ZSTD, 22, 128 * 1024 }
+	};
+
+	const char* const table_name = magic == EGTB_Magic::DTC_MAGIC ? "DTC" : "DTM";
+
+	DTM_File_For_Probe egtb;
+	load_egtb_table(out_param(egtb), ps, path, tmp, magic, wdl_path, wdl_tmp);
+
+	const EGTB_File_Summary summary = read_table_file_summary(path, ps, magic);
+	const size_t num_entries = Piece_Config_For_Gen(ps).num_positions();
+
+	for (const Color color : summary.table_colors)
+	{
+		const Const_Span<uint8_t> src = egtb.entries(color);
+		if (src.empty())
+		{
+			printf("%s %s %d: singular\n", ps.name().c_str(), table_name, static_cast<int>(color));
+			continue;
+		}
+
+		for (const Codec_Config& config : CONFIGS)
+		{
+			const std::string config_name =
+				std::string(config.codec == EGTB_Codec::LZMA ? "LZMA" : "ZSTD")
+				+ " " + std::to_string(config.level)
+				+ " " + std::to_string(config.block_size / 1024) + "K";
+
+			const auto start = std::chrono::steady_clock::now();
+
+			// The entries as they are, without a value map or a rule plane.
+			Table_To_Save t;
+			t.src = src;
+			t.block_size = config.block_size;
+			t.level = config.level;
+			t.is_big_order = summary.is_big_order;
+			t.egtb_codec = config.codec;
+			if (config.codec == EGTB_Codec::ZSTD)
+				t.zstd_dict = make_zstd_dict_for_egtb(thread_pool, t);
+
+			const std::vector<std::vector<uint8_t>> blocks = compress_blocks(
+				thread_pool,
+				t.src,
+				t.block_size,
+				make_egtb_compressor(t, false, nullptr),
+				"benchmark " + config_name
+			);
+
+			const double compress_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+			// Same layout as in the file, apart from the rest of the header.
+			size_t compressed_size = zstd_dict_header_size(t) + 8 * blocks.size();
+			for (const auto& block : blocks)
+				compressed_size += block.size();
+
+			const Const_Span<uint8_t> dict =
+				t.zstd_dict.has_value()
+				? Const_Span(t.zstd_dict->data(), t.zstd_dict->size())
+				: Const_Span<uint8_t>();
+			const std::unique_ptr<Decompress_Helper> dc_helper = make_egtb_codec_decompressor(t.egtb_codec, dict, t.block_size);
+
+			for (size_t idx = 0; idx < blocks.size(); ++idx)
+			{
+				const Const_Span<uint8_t> expected = t.src.nth_chunk(idx, t.block_size);
+				const Const_Span<uint8_t> decompressed = dc_helper->decompress(Const_Span(blocks[idx]), expected.size());
+				if (std::memcmp(decompressed.data(), expected.data(), expected.size()) != 0)
+					print_and_abort("%s round trip failed for block %zu.\n", config_name.c_str(), idx);
+			}
+
+			const std::chrono::nanoseconds decode_time = time_block_decoding(*dc_helper, blocks, t.src, t.block_size);
+
+			printf(
+				"%s %s %d %s: %zu bytes, %.4f bits/entry, %zu bytes dict, %.1f ms compression, %.1f us/block, %.3f ns/entry decode\n",
+				ps.name().c_str(),
+				table_name,
+				static_cast<int>(color),
+				config_name.c_str(),
+				compressed_size,
+				compressed_size * 8.0 / num_entries,
+				t.zstd_dict.has_value() ? t.zstd_dict->size() : 0,
+				compress_ms,
+				static_cast<double>(decode_time.count()) / 1000.0 / blocks.size(),
+				static_cast<double>(decode_time.count()) / num_entries
+			);
+		}
+	}
+}
@@ -1,6 +1,7 @@
 ﻿#pragma once
 
 #include "egtb.h"
+#include "egtb_metadata.h"
 
 #include "util/defines.h"
 #include "util/param.h"
@@ -9,106 +10,234 @@
 #include "util/thread_pool.h"
 #include "util/compress.h"
 
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <string>
 #include <vector>
 #include <optional>
 
+struct EGTB_Bits;
+
 constexpr uint8_t EGTB_SINGULAR_FLAG = 0x80;
+constexpr uint8_t EGTB_VALUE_MAP_FLAG = 0x40;
+// The DTC or DTM table stores only the entries of positions that are a win
+// or a loss in the WDL file of the same configuration, all others are draws.
+constexpr uint8_t EGTB_SPARSE_FLAG = 0x20;
+// The table is stored as its most common entry and the positions and values of
+// the entries that differ from it, instead of compressed blocks.
+constexpr uint8_t EGTB_EXCEPTIONS_FLAG = 0x10;
 constexpr uint64_t EGTB_CHECKSUM_INIT_VALUE = 0xf0f0f0f0f0f0;
 
 constexpr size_t WDL_BLOCK_SIZE = 64 * 1024;
 
-struct Compressed_EGTB
+// Compressed block sizes are stored in 16 bits, and a block that RC2
+// can't compress is stored with one more byte than its size.
+constexpr size_t RC2_WDL_BLOCK_SIZE = 32 * 1024;
+
+// Identifies how the blocks of a WDL table are compressed.
+// Stored in the flags byte of the table header.
+enum struct WDL_Codec : uint8_t
 {
-	static Compressed_EGTB make_singular(WDL_Entry sv)
-	{
-		Compressed_EGTB info{};
-		info.set_singular(sv);
-		return info;
-	}
+	LZ4 = 0,
 
-	Compressed_EGTB(
-		std::vector<std::vector<uint8_t>>&& compressed_blocks,
-		size_t src_blk_sz,
-		size_t tail_blk_sz,
-		std::optional<LZ4_Dict> d,
-		bool is_big
-	);
-
-	Compressed_EGTB() :
-		m_is_singular(false),
-		m_is_big_order(false),
-		m_single_val(WDL_Entry::DRAW),
-		m_block_size(0),
-		m_tail_size(0),
-		m_total_compressed_size(0)
-	{
-	}
+	// Adaptive binary range coder conditioned on the preceding entries,
+	// see RC2_Compress_Helper. Smaller, but much slower to decode.
+	RC2 = 1
+};
 
-	NODISCARD bool is_singular() const
-	{
-		return m_is_singular;
-	}
+// How the entries of a DTC or DTM block are arranged before compression.
+// Stored in the flags byte of the table header.
+enum struct EGTB_Block_Layout : uint8_t
+{
+	// Entries as they are in memory.
+	INTERLEAVED = 0,
+
+	// DTM only. The rule bits are sparse, so blocks that have any store
+	// the entries without them, followed by the rule bits of all entries.
+	// The WIN flag stays with the score, as they are strongly correlated.
+	SEPARATE_RULE_BITS = 1
+};
+
+// Identifies how the blocks of a DTC or DTM table are compressed.
+// Stored in the flags byte of the table header, see EGTB_CODEC_SHIFT.
+enum struct EGTB_Codec : uint8_t
+{
+	LZMA = 0,
+
+	// Much faster to compress and to load, but the files are larger.
+	LZ4 = 1,
+
+	// With a dictionary trained on the table, stored in the header, and smaller
+	// blocks than LZMA by default. Faster to decode a block, a bit larger files.
+	ZSTD = 2
+};
+
+constexpr uint8_t EGTB_CODEC_SHIFT = 2;
+constexpr uint8_t EGTB_CODEC_MASK = 0x0c;
+
+// Compressed DTC and DTM block sizes are stored in 20 bits.
+constexpr size_t EGTB_BLOCK_SIZE = 1024 * 1024;
+
+// Smaller blocks compress too badly to be of any use.
+constexpr size_t MIN_TABLE_BLOCK_SIZE = 4 * 1024;
+
+// The default block size of DTC and DTM tables compressed with zstd.
+constexpr size_t ZSTD_TABLE_BLOCK_SIZE = 128 * 1024;
 
-	NODISCARD WDL_Entry single_val() const
+// The LZ4 dictionary of a WDL table is trained on up to this many
+// blocks of WDL_BLOCK_SIZE. Tables with fewer blocks than
+// MIN_BLOCKS_TO_MAKE_DICT get no dictionary.
+constexpr size_t DEFAULT_DICT_SAMPLE_BLOCKS = 512;
+constexpr size_t MIN_BLOCKS_TO_MAKE_DICT = 256;
+
+// How WDL tables are compressed. The codec and the block size are stored
+// in the table header, the level is only needed for compression.
+struct WDL_Save_Settings
+{
+	WDL_Codec codec = WDL_Codec::LZ4;
+
+	// Zero for the strongest level. Only LZ4 has levels, from 1 to LZ4HC_CLEVEL_MAX.
+	int level = 0;
+
+	// Zero for the largest block size of the codec, which is also the most it can be.
+	size_t block_size = 0;
+
+	// LZ4 only. How many blocks the dictionary is trained on, and every how
+	// many blocks one is taken. A stride of zero spreads them over the table.
+	// More samples give a slightly better dictionary, training takes longer.
+	size_t dict_sample_blocks = DEFAULT_DICT_SAMPLE_BLOCKS;
+	size_t dict_sample_stride = 0;
+
+	// Stores the generation and compression times in the metadata section.
+	// Without them the files of the same tables are the same bytes.
+	bool save_times = true;
+
+	// The fast draft preset, for development and validation runs.
+	// Keeps the block size.
+	void use_draft_preset()
 	{
-		ASSERT(m_is_singular);
-		return m_single_val;
+		codec = WDL_Codec::LZ4;
+		level = 1;
 	}
 
-	NODISCARD size_t block_size() const
+	NODISCARD int lz4_level() const
 	{
-		return m_block_size;
+		return level == 0 ? LZ4HC_CLEVEL_MAX : level;
 	}
 
-	NODISCARD size_t tail_size() const
+	NODISCARD size_t effective_block_size() const
 	{
-		return m_tail_size;
+		const size_t max_block_size = codec == WDL_Codec::LZ4 ? WDL_BLOCK_SIZE : RC2_WDL_BLOCK_SIZE;
+		if (block_size == 0)
+			return max_block_size;
+
+		return std::clamp(block_size, MIN_TABLE_BLOCK_SIZE, max_block_size) / MIN_TABLE_BLOCK_SIZE * MIN_TABLE_BLOCK_SIZE;
 	}
+};
+
+// How DTC or DTM tables are compressed and stored.
+struct EGTB_Save_Settings
+{
+	EGTB_Codec codec = EGTB_Codec::LZMA;
 
-	NODISCARD const auto& compressed_blocks() const
+	// Zero for the strongest level of the codec.
+	int level = 0;
+
+	// Zero for the default block size of the codec, EGTB_BLOCK_SIZE for all but zstd.
+	// EGTB_BLOCK_SIZE is also the most it can be.
+	size_t block_size = 0;
+
+	// DTM only.
+	EGTB_Block_Layout layout = EGTB_Block_Layout::INTERLEAVED;
+
+	// Stores the entries as ranks of their values by frequency, when a table
+	// has few distinct values. The .info files then get the sampled gain.
+	bool map_values = false;
+
+	// Lets each block store its illegal entries either as draws or as the
+	// values around them, whichever compresses better.
+	bool fill_illegal = false;
+
+	// Stores the tables without the positions that are draws in the WDL tables,
+	// the generators pass these positions to save_egtb_table.
+	bool omit_draws = false;
+
+	// Stores the generation and compression times in the metadata section.
+	// Without them the files of the same tables are the same bytes.
+	bool save_times = true;
+
+	// The fast draft preset, for development and validation runs. Saving takes
+	// about a tenth of the time of the defaults, the files are larger.
+	// Keeps the block size and the storage options.
+	void use_draft_preset()
 	{
-		return m_compressed_blocks;
+		codec = EGTB_Codec::LZ4;
+		level = 1;
 	}
 
-	NODISCARD size_t total_compressed_size() const
+	NODISCARD int effective_level() const
 	{
-		return m_total_compressed_size;
+		if (level != 0)
+			return level;
+
+		switch (codec)
+		{
+		case EGTB_Codec::LZMA:
+			return LZMA_Compress_Helper::DEFAULT_LEVEL;
+
+		case EGTB_Codec::LZ4:
+			return LZ4HC_CLEVEL_MAX;
+
+		case EGTB_Codec::ZSTD:
+			return ZSTD_Compress_Helper::DEFAULT_LEVEL;
+		}
+
+		ASSUME(false);
 	}
 
-	NODISCARD const auto& dict() const
+	NODISCARD size_t effective_block_size() const
 	{
-		return m_dict;
+		if (block_size == 0)
+			return codec == EGTB_Codec::ZSTD ? ZSTD_TABLE_BLOCK_SIZE : EGTB_BLOCK_SIZE;
+
+		return std::clamp(block_size, MIN_TABLE_BLOCK_SIZE, EGTB_BLOCK_SIZE) / MIN_TABLE_BLOCK_SIZE * MIN_TABLE_BLOCK_SIZE;
 	}
+};
 
-	NODISCARD bool is_big_order() const
+// DTC and DTM entries can be stored as 8-bit ranks of their values,
+// if a table doesn't have more distinct values than this.
+constexpr size_t MAX_VALUE_MAP_SIZE = 256;
+
+// What mapping the entries to ranks by frequency gave for a saved table.
+// The gain is measured on a sample of blocks, compressed both ways.
+struct EGTB_Value_Map_Stats
+{
+	EGTB_Value_Map_Stats()
 	{
-		return m_is_big_order;
+		std::memset(this, 0, sizeof(EGTB_Value_Map_Stats));
 	}
 
-	NODISCARD size_t num_blocks() const
+	NODISCARD double sampled_gain(Color color) const
 	{
-		return m_compressed_blocks.size();
+		return sampled_mapped_size[color] != 0 ? static_cast<double>(sampled_size[color]) / sampled_mapped_size[color] : 1.0;
 	}
 
-private:
-	bool m_is_singular;
-	bool m_is_big_order;
-
-	WDL_Entry m_single_val;
-
-	size_t m_block_size;
-	size_t m_tail_size;
-
-	std::vector<std::vector<uint8_t>> m_compressed_blocks;
-	size_t m_total_compressed_size;
+	// Zero if the table is not mapped.
+	uint16_t num_values[COLOR_NB];
+	uint64_t sampled_size[COLOR_NB];
+	uint64_t sampled_mapped_size[COLOR_NB];
+};
 
-	std::optional<LZ4_Dict> m_dict;
+// A table file to save, and which of the tables of the piece configuration it contains.
+struct EGTB_Save_Target
+{
+	std::filesystem::path path;
+	Fixed_Vector<Color, 2> table_colors;
 
-	void set_singular(WDL_Entry val)
+	NODISCARD bool has_table(Color color) const
 	{
-		m_is_singular = true;
-		m_single_val = val;
+		return std::find(table_colors.begin(), table_colors.end(), color) != table_colors.end();
 	}
 };
 
@@ -117,41 +246,89 @@ void prepare_evtb_for_compression(
 	Span<Packed_WDL_Entries> data
 );
 
+// Returns nothing for tables with fewer than MIN_BLOCKS_TO_MAKE_DICT blocks,
+// or if no dictionary pays for its size.
+// The sampled blocks are taken every sample_stride blocks, or spread
+// over the table if it is zero.
 NODISCARD std::optional<LZ4_Dict> make_dict_for_evtb(
-	Const_Span<Packed_WDL_Entries> data
-);
-
-NODISCARD Compressed_EGTB save_compress_evtb(
 	In_Out_Param<Thread_Pool> thread_pool,
-	Const_Span<Packed_WDL_Entries> src,
-	Color color,
-	const EGTB_Info& info
+	Const_Span<Packed_WDL_Entries> data,
+	size_t sample_blocks = DEFAULT_DICT_SAMPLE_BLOCKS,
+	size_t sample_stride = 0
 );
 
-NODISCARD Compressed_EGTB save_compress_egtb(
+// Compresses the WDL tables contained in any of the targets and saves the targets.
+// Each compressed block is written to the files as soon as its offset is known,
+// so only a bounded number of compressed blocks is held in memory.
+// The file is written under a temporary name and renamed when complete.
+// A table with few entries different from the most common one is stored as
+// exceptions to it instead, if that is smaller than the compressed blocks.
+// The header gets a metadata section with the generation stats, if given,
+// and with how the tables are stored.
+void save_evtb_table(
 	In_Out_Param<Thread_Pool> thread_pool,
-	Const_Span<uint8_t> src,
-	Color color,
+	const Piece_Config& ps,
+	const Const_Span<Packed_WDL_Entries> src[COLOR_NB],
 	const EGTB_Info& info,
-	bool is_big
+	const EGTB_Generation_Stats* generation,
+	const std::vector<EGTB_Save_Target>& targets,
+	EGTB_Magic magic,
+	const WDL_Save_Settings& settings
 );
 
-void save_evtb_table(
+// Same as save_evtb_table, for DTC and DTM tables.
+// With map_values, each table with few enough distinct values is stored
+// as ranks of the values by frequency, and statistics of that are returned.
+// With fill_illegal, the tables may contain illegal entries. Each block with
+// them is stored either with them as draws or with their runs filled with values
+// continuing the neighbouring entries, whichever compresses better.
+// Without it illegal entries must have been replaced.
+// If decisive_bits is given, it has the positions of each saved table that are
+// a win or a loss in the saved WDL table, and only their entries are stored.
+NODISCARD std::optional<EGTB_Value_Map_Stats> save_egtb_table(
+	In_Out_Param<Thread_Pool> thread_pool,
 	const Piece_Config& ps,
-	const Compressed_EGTB save_info[COLOR_NB],
-	std::filesystem::path file_path,
-	const Fixed_Vector<Color, 2> table_colors,
-	EGTB_Magic magic
+	const Const_Span<uint8_t> src[COLOR_NB],
+	const EGTB_Info& info,
+	const EGTB_Generation_Stats* generation,
+	bool is_big,
+	const std::vector<EGTB_Save_Target>& targets,
+	EGTB_Magic magic,
+	const EGTB_Save_Settings& settings,
+	const EGTB_Bits* decisive_bits
 );
 
-void save_egtb_table(
+// What the header of a saved table file has besides the tables themselves,
+// for tools that rewrite the file.
+struct EGTB_File_Summary
+{
+	Fixed_Vector<Color, 2> table_colors;
+
+	// DTC and DTM only, the is_big argument the file was saved with.
+	bool is_big_order = false;
+
+	// Nothing for files saved before the metadata section existed.
+	std::optional<EGTB_File_Metadata> metadata;
+};
+
+// Only the header is read, the loaders check the rest.
+NODISCARD EGTB_File_Summary read_table_file_summary(
+	const std::filesystem::path& path,
 	const Piece_Config& ps,
-	const Compressed_EGTB save_info[COLOR_NB],
-	std::filesystem::path file_path,
-	const Fixed_Vector<Color, 2> table_colors,
 	EGTB_Magic magic
 );
 
+// Prints the header of a table file and its metadata section, for the dump_header tool.
+// The kind of table and the material are taken from the file name.
+void print_table_file_header(const std::filesystem::path& path);
+
+// Checks the size and the end checksum of a saved table file.
+// Doesn't throw, a missing file is reported as not intact.
+NODISCARD bool is_egtb_file_intact(const std::filesystem::path& path);
+
+// Same as is_egtb_file_intact, for a table file that is already in memory.
+NODISCARD bool is_egtb_data_intact(Const_Span<uint8_t> input);
+
 void load_evtb_table(
 	Out_Param<WDL_File_For_Probe> evtb,
 	const Piece_Config& ps,
@@ -160,10 +337,47 @@ void load_evtb_table(
 	EGTB_Magic evtb_magic
 );
 
+// Recompresses the WDL tables of the file with each codec and prints
+// the compressed sizes and the single threaded decoding speed.
+void benchmark_wdl_codecs(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path
+);
+
+// Trains LZ4 dictionaries for the WDL tables of the file from different numbers
+// of sampled blocks, and prints the training time and the compressed sizes.
+// The single threaded trainer of zstd is included for comparison.
+void benchmark_wdl_dicts(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path
+);
+
+// The WDL file is loaded, to the given temporary files, only if
+// the file has sparse tables. It may be missing otherwise.
 void load_egtb_table(
 	Out_Param<DTM_File_For_Probe> egtb,
 	const Piece_Config& ps,
 	std::filesystem::path sub_evtb,
 	const std::filesystem::path tmp[COLOR_NB],
-	EGTB_Magic evtb_magic
-);
\ No newline at end of file
+	EGTB_Magic evtb_magic,
+	const std::filesystem::path& wdl_path,
+	const std::filesystem::path wdl_tmp[COLOR_NB]
+);
+
+// Recompresses the DTC or DTM tables of the file with LZMA and with zstd, at
+// a few levels and block sizes, and prints the compressed sizes, the time
+// to compress with the pool and the single threaded decoding time per block,
+// which is what a probe that misses the cache waits for.
+// The tables are loaded like with load_egtb_table, and recompressed with
+// their draws, as plain entries without a value map or a rule plane.
+void benchmark_egtb_codecs(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path,
+	EGTB_Magic magic,
+	const std::filesystem::path tmp[COLOR_NB],
+	const std::filesystem::path& wdl_path,
+	const std::filesystem::path wdl_tmp[COLOR_NB]
+);
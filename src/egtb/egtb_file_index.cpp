@@ -0,0 +1,224 @@
+#include "egtb_file_index.h"
+
+#include "egtb.h"
+#include "egtb_pack.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+static constexpr EGTB_Table_Kind ALL_TABLE_KINDS[] = {
+	EGTB_Table_Kind::WDL,
+	EGTB_Table_Kind::WDL_GEN,
+	EGTB_Table_Kind::DTC,
+	EGTB_Table_Kind::DTM
+};
+
+const std::string& egtb_table_kind_ext(EGTB_Table_Kind kind)
+{
+	switch (kind)
+	{
+	case EGTB_Table_Kind::WDL:
+		return EGTB_Paths::WDL_EXT;
+	case EGTB_Table_Kind::WDL_GEN:
+		return EGTB_Paths::WDL_GEN_EXT;
+	case EGTB_Table_Kind::DTC:
+		return EGTB_Paths::DTC_EXT;
+	case EGTB_Table_Kind::DTM:
+		return EGTB_Paths::DTM_EXT;
+	}
+
+	throw std::runtime_error("Unknown table kind.");
+}
+
+// ".lzw.gen" has to be matched on the whole suffix, path::extension would only give ".gen".
+std::optional<std::pair<Piece_Config, EGTB_Table_Kind>> parse_egtb_table_file_name(const std::string& file_name)
+{
+	for (const EGTB_Table_Kind kind : ALL_TABLE_KINDS)
+	{
+		const std::string& ext = egtb_table_kind_ext(kind);
+		if (file_name.size() <= ext.size() || file_name.compare(file_name.size() - ext.size(), ext.size(), ext) != 0)
+			continue;
+
+		const std::string name = file_name.substr(0, file_name.size() - ext.size());
+		if (!Piece_Config::is_constructible_from(name))
+			return std::nullopt;
+
+		return std::make_pair(Piece_Config(name), kind);
+	}
+
+	return std::nullopt;
+}
+
+using Table_Key = std::pair<uint32_t, EGTB_Table_Kind>;
+
+struct Loaded_Pack
+{
+	std::filesystem::path path;
+	std::vector<EGTB_Pack_Entry> entries;
+
+	NODISCARD const EGTB_Pack_Entry* find(const Table_Key& key) const
+	{
+		EGTB_Pack_Entry needle{};
+		needle.material_key = key.first;
+		needle.kind = key.second;
+
+		const auto it = std::lower_bound(entries.begin(), entries.end(), needle);
+		if (it == entries.end() || it->material_key != needle.material_key || it->kind != needle.kind)
+			return nullptr;
+
+		return &*it;
+	}
+};
+
+struct Table_Directory
+{
+	std::map<Table_Key, EGTB_File_Location> plain_files;
+	std::vector<Loaded_Pack> packs;
+
+	NODISCARD std::optional<EGTB_File_Location> find(const Table_Key& key) const
+	{
+		const auto it = plain_files.find(key);
+		if (it != plain_files.end())
+			return it->second;
+
+		for (const auto& pack : packs)
+		{
+			if (const EGTB_Pack_Entry* entry = pack.find(key))
+			{
+				EGTB_File_Location location;
+				location.file = pack.path;
+				location.offset = entry->offset;
+				location.size = entry->size;
+				location.is_packed = true;
+				return location;
+			}
+		}
+
+		return std::nullopt;
+	}
+};
+
+NODISCARD static Table_Directory scan_table_directory(const std::filesystem::path& dir)
+{
+	Table_Directory result;
+
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::directory_iterator(dir, ec))
+	{
+		if (!entry.is_regular_file(ec))
+			continue;
+
+		const std::filesystem::path& path = entry.path();
+		if (path.extension() == EGTB_Paths::PACK_EXT)
+		{
+			auto entries = read_pack_index(path);
+			if (!entries.has_value())
+			{
+				printf("WARNING: Ignoring invalid pack %s\n", path.string().c_str());
+				continue;
+			}
+
+			result.packs.push_back(Loaded_Pack{ path, std::move(*entries) });
+		}
+		else if (const auto table = parse_egtb_table_file_name(path.filename().string()))
+		{
+			EGTB_File_Location location;
+			location.file = path;
+			location.size = entry.file_size(ec);
+			result.plain_files[Table_Key(table->first.base_material_key().value(), table->second)] = std::move(location);
+		}
+	}
+
+	// Make the lookup order independent of the order the directory is listed in.
+	std::sort(result.packs.begin(), result.packs.end(), [](const Loaded_Pack& lhs, const Loaded_Pack& rhs) {
+		return lhs.path < rhs.path;
+	});
+
+	return result;
+}
+
+// The directory names are normalized so that "./wdl/", "wdl" and the parent
+// of "./wdl/KRK.lzw" are all the same directory.
+NODISCARD static std::string table_directory_key(const std::filesystem::path& dir)
+{
+	return (dir / "").lexically_normal().string();
+}
+
+struct Table_File_Index
+{
+	// Calls func with the index of the directory, scanning it the first time.
+	template <typename FuncT>
+	decltype(auto) with_directory(const std::filesystem::path& dir, FuncT&& func)
+	{
+		std::unique_lock lock(m_mutex);
+
+		auto it = m_dirs.find(table_directory_key(dir));
+		if (it == m_dirs.end())
+			it = m_dirs.emplace(table_directory_key(dir), scan_table_directory(dir)).first;
+
+		return func(it->second);
+	}
+
+	NODISCARD static Table_File_Index& instance()
+	{
+		static Table_File_Index index;
+		return index;
+	}
+
+private:
+	std::mutex m_mutex;
+	std::map<std::string, Table_Directory> m_dirs;
+};
+
+std::optional<EGTB_File_Location> find_egtb_table_file(
+	const std::filesystem::path& dir,
+	const Piece_Config& ps,
+	EGTB_Table_Kind kind
+)
+{
+	const Table_Key key(ps.base_material_key().value(), kind);
+	return Table_File_Index::instance().with_directory(dir, [&](const Table_Directory& d) {
+		return d.find(key);
+	});
+}
+
+void refresh_egtb_table_file(const std::filesystem::path& path)
+{
+	const auto table = parse_egtb_table_file_name(path.filename().string());
+	if (!table.has_value())
+		return;
+
+	const Table_Key key(table->first.base_material_key().value(), table->second);
+
+	std::error_code ec;
+	const auto size = std::filesystem::file_size(path, ec);
+
+	Table_File_Index::instance().with_directory(path.parent_path(), [&](Table_Directory& d) {
+		if (ec)
+		{
+			d.plain_files.erase(key);
+			return;
+		}
+
+		EGTB_File_Location location;
+		location.file = path;
+		location.size = size;
+		d.plain_files[key] = std::move(location);
+	});
+}
+
+bool open_table_file(Out_Param<Memory_Mapped_File> file, const std::filesystem::path& path)
+{
+	if (const auto table = parse_egtb_table_file_name(path.filename().string()))
+	{
+		const auto location = find_egtb_table_file(path.parent_path(), table->first, table->second);
+		if (location.has_value() && location->is_packed)
+			return file->open_readonly(location->file, location->offset, location->size);
+	}
+
+	return file->open_readonly(path);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "chess/piece_config.h"
+
+#include "util/defines.h"
+#include "util/filesystem.h"
+#include "util/param.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+
+// Kinds of table files that can be looked up in the index and stored in a pack.
+// The values are stored in the pack index, so they must not change.
+enum struct EGTB_Table_Kind : uint32_t
+{
+	WDL = 0,
+	WDL_GEN = 1,
+	DTC = 2,
+	DTM = 3
+};
+
+// Where the contents of a table file are. For a plain file that is the whole file,
+// for a table in a pack it's a range of the pack.
+struct EGTB_File_Location
+{
+	std::filesystem::path file;
+	size_t offset = 0;
+	size_t size = 0;
+	bool is_packed = false;
+};
+
+// Returns the file name extension of the kind of table.
+NODISCARD const std::string& egtb_table_kind_ext(EGTB_Table_Kind kind);
+
+// Splits a table file name into the piece configuration and the kind of table.
+// Returns nothing for names of other files.
+NODISCARD std::optional<std::pair<Piece_Config, EGTB_Table_Kind>> parse_egtb_table_file_name(const std::string& file_name);
+
+// The table directories are listed once, the first time a table is looked up in them,
+// and the tables found there (plain files and the contents of packs) are indexed
+// by material key and kind. Lookups after that don't touch the filesystem.
+// Plain files take precedence over packed ones.
+// Returns nothing if the directory doesn't have the table.
+NODISCARD std::optional<EGTB_File_Location> find_egtb_table_file(
+	const std::filesystem::path& dir,
+	const Piece_Config& ps,
+	EGTB_Table_Kind kind
+);
+
+// Updates the index entry of a plain table file after it was written, replaced
+// or removed, by this process or another one. Other paths are ignored.
+void refresh_egtb_table_file(const std::filesystem::path& path);
+
+// Opens a table file by the path EGTB_Paths gave for it. When it's in a pack
+// only its range of the pack is mapped. Returns false if it could not be opened.
+NODISCARD bool open_table_file(Out_Param<Memory_Mapped_File> file, const std::filesystem::path& path);
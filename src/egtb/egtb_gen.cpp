@@ -3,7 +3,9 @@
 Position_For_Gen::Position_For_Gen(const Piece_Config_For_Gen& info, Board_Index pos, Color turn) :
 	m_epsi(&info),
 	m_turn(turn),
-	m_cached_board_index(BOARD_INDEX_NONE)
+	m_cached_board_index(BOARD_INDEX_NONE),
+	m_cached_color_swapped_board_index(BOARD_INDEX_NONE),
+	m_cached_relative_board_index(BOARD_INDEX_NONE)
 {
 	set_board_index(pos);
 }
@@ -11,7 +13,9 @@ Position_For_Gen::Position_For_Gen(const Piece_Config_For_Gen& info, Board_Index
 Position_For_Gen::Position_For_Gen(const Position_For_Gen& parent, Move move, Board_Index next_ix, bool mirr) :
 	m_epsi(parent.m_epsi),
 	m_turn(color_opp(parent.m_turn)),
-	m_cached_board_index(BOARD_INDEX_NONE)
+	m_cached_board_index(BOARD_INDEX_NONE),
+	m_cached_color_swapped_board_index(BOARD_INDEX_NONE),
+	m_cached_relative_board_index(BOARD_INDEX_NONE)
 {
 	set_board_index(next_ix);
 
@@ -26,9 +30,60 @@ Position_For_Gen::Position_For_Gen(const Position_For_Gen& parent, Move move, Bo
 	}
 }
 
-EGTB_Generator::EGTB_Generator(const Piece_Config& ps) :
-	m_epsi(ps)
+void Position_For_Gen::init_color_swapped_index() const
 {
+	Color_Swapped_Index& swapped = m_color_swapped_index;
+
+	const bool is_initialized = m_cached_color_swapped_board_index != BOARD_INDEX_NONE;
+
+	swapped.board_index[0] = m_epsi->compose_board_index([&](const Piece_Group& info, Piece_Class set) {
+		const Piece_Class opp_set = opp_piece_class(set);
+		if (!is_initialized || m_index[opp_set] != m_color_swapped_source_index[opp_set])
+			swapped.group_index[set] = info.compound_index(m_epsi->squares(m_index, opp_set).with_mirrored_ranks());
+		return swapped.group_index[set].base();
+	});
+
+	swapped.board_index[1] = m_epsi->compose_board_index([&](const Piece_Group& info, Piece_Class set) {
+		return swapped.group_index[set].mirr();
+	});
+
+	const Piece_Class compress = m_epsi->compress_id();
+	swapped.mirr = swapped.group_index[compress].base() >= m_epsi->group(compress).compress_size();
+
+	if (m_epsi->board_index_layout() == Board_Index_Layout::FREE_PIECE_RELATIVE)
+	{
+		Decomposed_Board_Index index[2];
+		for (Piece_Class set = PIECE_CLASS_START; set < PIECE_CLASS_END; ++set)
+		{
+			index[0][set] = swapped.group_index[set].base();
+			index[1][set] = swapped.group_index[set].mirr();
+		}
+		swapped.relative[0] = m_epsi->relative_piece(index[0]);
+		swapped.relative[1] = m_epsi->relative_piece(index[1]);
+	}
+
+	m_cached_color_swapped_board_index = m_board_index;
+	m_color_swapped_source_index = m_index;
+}
+
+void Position_For_Gen::init_relative_index() const
+{
+	const Decomposed_Board_Index mirr_index = m_epsi->mirr_decomposed_index(m_index);
+
+	m_relative_index.board_index[0] = m_board_index;
+	m_relative_index.board_index[1] = m_epsi->compose_board_index(mirr_index);
+	m_relative_index.relative[0] = m_epsi->relative_piece(m_index);
+	m_relative_index.relative[1] = m_epsi->relative_piece(mirr_index);
+
+	m_cached_relative_board_index = m_board_index;
+}
+
+EGTB_Generator::EGTB_Generator(const Piece_Config& ps, std::shared_ptr<const EGTB_Legal_Positions> legal_positions) :
+	m_epsi(ps),
+	m_legal_positions(std::move(legal_positions))
+{
+	ASSERT(m_legal_positions == nullptr || m_legal_positions->num_positions() == m_epsi.num_positions());
+
 	const auto [mat_key, mir_key] = m_epsi.material_keys();
 
 	m_is_symmetric = mat_key == mir_key;
@@ -48,6 +103,12 @@ EGTB_Generator::EGTB_Generator(const Piece_Config& ps) :
 	}
 }
 
+void EGTB_Generator::acquire_legal_positions(In_Out_Param<Thread_Pool> thread_pool)
+{
+	if (m_legal_positions == nullptr)
+		m_legal_positions = std::make_shared<const EGTB_Legal_Positions>(thread_pool, m_epsi);
+}
+
 Board_Index EGTB_Generator::next_cap_index(const Position_For_Gen& pos_for_gen, Move move) const
 {
 	const auto& pos = pos_for_gen.board();
@@ -98,6 +159,53 @@ enum struct Quiet_Index_Type
 	MIRROR, NORMAL
 };
 
+// Same as quiet_index, but for the FREE_PIECE_RELATIVE layout, where a move
+// of any group can also change the rank of the relative group.
+template <Quiet_Index_Type MIRR>
+static auto relative_quiet_index(
+	const Piece_Config_For_Gen& epsi,
+	const Position_For_Gen& pos_for_gen,
+	Move move,
+	Piece_Class id,
+	Piece_Group::Full_Placement_Index ix,
+	Out_Param<bool> mirr
+)
+{
+	const auto& relative = pos_for_gen.relative_index();
+	const auto& index = pos_for_gen.index();
+	const Piece_Group& group = epsi.group(id);
+
+	auto index_after_move = [&](const bool use_mirr) {
+		return
+			use_mirr
+			? epsi.change_single_group_index(
+				relative.board_index[1], relative.relative[1], group.mirr_index(index[id]), ix.mirr(), id,
+				sq_file_mirror(move.from()), sq_file_mirror(move.to()))
+			: epsi.change_single_group_index(
+				relative.board_index[0], relative.relative[0], index[id], ix.base(), id,
+				move.from(), move.to());
+	};
+
+	const bool lr_mirror = id == epsi.compress_id() && ix.base() >= group.compress_size();
+
+	*mirr = lr_mirror;
+
+	if constexpr (MIRR == Quiet_Index_Type::NORMAL)
+		return index_after_move(lr_mirror);
+	else
+	{
+		Fixed_Vector<Board_Index, 2> ix_tb;
+		if (!lr_mirror)
+			ix_tb.emplace_back(index_after_move(false));
+		if (id == epsi.compress_id() && (lr_mirror || ix.is_mirrored_same()))
+		{
+			*mirr = true;
+			ix_tb.emplace_back(index_after_move(true));
+		}
+		return ix_tb;
+	}
+}
+
 template <Quiet_Index_Type MIRR>
 static auto quiet_index(
 	const Piece_Config_For_Gen& epsi, 
@@ -121,6 +229,9 @@ static auto quiet_index(
 	const Piece_Group::Full_Placement_Index ix = group.compound_index_after_quiet_move(index[id], move);
 	const bool lr_mirror = ix.base() >= group.compress_size();
 
+	if (epsi.board_index_layout() == Board_Index_Layout::FREE_PIECE_RELATIVE)
+		return relative_quiet_index<MIRR>(epsi, pos_for_gen, move, id, ix, mirr);
+
 	if (id != epsi.compress_id() || !lr_mirror)
 	{
 		const Board_Index pre_idx = epsi.change_single_group_index(current_pos, index[id], ix.base(), id);
@@ -152,12 +263,78 @@ static auto quiet_index(
 		return ix_tb;
 }
 
+// Same as quiet_index, but the resulting position has the colors swapped.
+// The moved group is changed in the cached color swapped index of the position,
+// which may also change whether the files are mirrored.
+template <Quiet_Index_Type MIRR>
+static auto color_swapped_quiet_index(
+	const Piece_Config_For_Gen& epsi,
+	const Position_For_Gen& pos_for_gen,
+	Move move,
+	Out_Param<bool> mirr
+)
+{
+	const auto& swapped = pos_for_gen.color_swapped_index();
+
+	const Square from = move.from();
+	const Square to = move.to();
+	const Piece_Class id = opp_piece_class(piece_class(pos_for_gen.board().piece_on(from)));
+	const Piece_Class compress = epsi.compress_id();
+
+	const Piece_Group& group = epsi.group(id);
+	const Piece_Group::Full_Placement_Index old_ix = swapped.group_index[id];
+	const Piece_Group::Full_Placement_Index new_ix = group.compound_index_after_quiet_move(
+		old_ix.base(), 
+		Move(sq_rank_mirror(from), sq_rank_mirror(to))
+	);
+	const Piece_Group::Full_Placement_Index compress_ix = id == compress ? new_ix : swapped.group_index[compress];
+	const bool lr_mirror = compress_ix.base() >= epsi.group(compress).compress_size();
+
+	auto index = [&](const bool use_mirr) {
+		if (epsi.board_index_layout() == Board_Index_Layout::FREE_PIECE_RELATIVE)
+		{
+			auto swap_square = [use_mirr](Square sq) {
+				return use_mirr ? sq_file_mirror(sq_rank_mirror(sq)) : sq_rank_mirror(sq);
+			};
+			return
+				use_mirr
+				? epsi.change_single_group_index(
+					swapped.board_index[1], swapped.relative[1], old_ix.mirr(), new_ix.mirr(), id, 
+					swap_square(from), swap_square(to))
+				: epsi.change_single_group_index(
+					swapped.board_index[0], swapped.relative[0], old_ix.base(), new_ix.base(), id, 
+					swap_square(from), swap_square(to));
+		}
+
+		return 
+			use_mirr
+			? epsi.change_single_group_index(swapped.board_index[1], old_ix.mirr(), new_ix.mirr(), id)
+			: epsi.change_single_group_index(swapped.board_index[0], old_ix.base(), new_ix.base(), id);
+	};
+
+	*mirr = lr_mirror;
+
+	if constexpr (MIRR == Quiet_Index_Type::NORMAL)
+		return index(lr_mirror);
+	else
+	{
+		// Both indices of a left-right symmetric placement are used, like in quiet_index.
+		Fixed_Vector<Board_Index, 2> ix_tb;
+		ix_tb.emplace_back(index(lr_mirror));
+		if (compress_ix.is_mirrored_same())
+			ix_tb.emplace_back(index(true));
+		return ix_tb;
+	}
+}
+
 Fixed_Vector<Board_Index, 2> EGTB_Generator::next_quiet_index_with_mirror(
 	const Position_For_Gen& pos_for_gen,
 	Move move
 ) const
 {
 	bool mirr;
+	if (m_is_symmetric)
+		return color_swapped_quiet_index<Quiet_Index_Type::MIRROR>(m_epsi, pos_for_gen, move, out_param(mirr));
 	return quiet_index<Quiet_Index_Type::MIRROR>(m_epsi, pos_for_gen, move, out_param(mirr));
 }
 
@@ -167,7 +344,7 @@ Board_Index EGTB_Generator::next_quiet_index(
 ) const
 {
 	bool mirr;
-	return quiet_index<Quiet_Index_Type::NORMAL>(m_epsi, pos_for_gen, move, out_param(mirr));
+	return next_quiet_index(pos_for_gen, move, out_param(mirr));
 }
 
 Board_Index EGTB_Generator::next_quiet_index(
@@ -176,11 +353,228 @@ Board_Index EGTB_Generator::next_quiet_index(
 	Out_Param<bool> mirr
 ) const
 {
+	if (m_is_symmetric)
+		return color_swapped_quiet_index<Quiet_Index_Type::NORMAL>(m_epsi, pos_for_gen, move, mirr);
 	return quiet_index<Quiet_Index_Type::NORMAL>(m_epsi, pos_for_gen, move, mirr);
 }
 
-Shared_Board_Index_Iterator EGTB_Generator::make_gen_iterator() const
+Board_Index EGTB_Generator::color_swapped_index(const Position_For_Gen& pos_for_gen) const
+{
+	const auto& swapped = pos_for_gen.color_swapped_index();
+	return swapped.board_index[swapped.mirr];
+}
+
+Position_For_Gen EGTB_Generator::next_position(
+	const Position_For_Gen& parent, 
+	Move move, 
+	Board_Index next_ix, 
+	bool mirr
+) const
+{
+	// With the colors swapped the side to move stays the same,
+	// and the board has to be recreated from the index.
+	if (m_is_symmetric)
+		return Position_For_Gen(m_epsi, next_ix, parent.board().turn());
+
+	return Position_For_Gen(parent, move, next_ix, mirr);
+}
+
+// The chunks are a multiple of 64 positions, so the threads can set
+// the bits of their positions in EGTB_Bits without atomics.
+NODISCARD static Shared_Board_Index_Iterator make_gen_iterator(const Piece_Config_For_Gen& epsi)
 {
 	static constexpr size_t CHUNK_SIZE = CACHE_LINE_SIZE * CHAR_BIT * 64;
-	return Shared_Board_Index_Iterator(BOARD_INDEX_ZERO, static_cast<Board_Index>(m_epsi.num_positions()), CHUNK_SIZE);
+	return Shared_Board_Index_Iterator(BOARD_INDEX_ZERO, static_cast<Board_Index>(epsi.num_positions()), CHUNK_SIZE);
+}
+
+Shared_Board_Index_Iterator EGTB_Generator::make_gen_iterator() const
+{
+	return ::make_gen_iterator(m_epsi);
+}
+
+EGTB_Legal_Positions::EGTB_Legal_Positions(In_Out_Param<Thread_Pool> thread_pool, const Piece_Config_For_Gen& epsi) :
+	m_num_positions(epsi.num_positions()),
+	m_num_legal{}
+{
+	const auto table_colors = egtb_table_colors(EGTB_Generator::num_tables_for_generation(epsi));
+
+	for (const Color c : table_colors)
+		m_bits[c] = EGTB_Bits(m_num_positions);
+
+	std::atomic<size_t> num_legal[COLOR_NB] = { 0, 0 };
+
+	auto gen_iterator = ::make_gen_iterator(epsi);
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		size_t sp_num_legal[COLOR_NB] = { 0, 0 };
+
+		for (Position_For_Gen& pos_gen : gen_iterator.boards(epsi))
+		{
+			if (!pos_gen.is_legal())
+				continue;
+
+			const Board_Index pos = pos_gen.board_index();
+			for (const Color c : table_colors)
+			{
+				pos_gen.set_turn(c);
+				if (!pos_gen.board().is_legal())
+					continue;
+
+				m_bits[c].set_bit(pos);
+				sp_num_legal[c] += 1;
+			}
+		}
+
+		for (const Color c : table_colors)
+			num_legal[c] += sp_num_legal[c];
+	});
+
+	for (const Color c : table_colors)
+		m_num_legal[c] = num_legal[c];
+}
+
+void benchmark_board_index_group_orders(In_Out_Param<Thread_Pool> thread_pool, const Piece_Config& ps, size_t num_sample_positions)
+{
+	static constexpr size_t MAX_NUM_RUNS = 256;
+	static constexpr size_t PAGE_SIZE = 4096;
+
+	for (const Board_Index_Group_Order order : { Board_Index_Group_Order::BY_CLASS, Board_Index_Group_Order::BY_MOBILITY })
+	{
+		const Piece_Config_For_Gen epsi(ps, Piece_Config_For_Gen::preferred_board_index_layout(), order);
+		const size_t num_positions = epsi.num_positions();
+
+		printf("%s %s, groups by weight:", ps.name().c_str(), order == Board_Index_Group_Order::BY_CLASS ? "by class" : "by mobility");
+		for (const Piece_Class set : epsi.group_order())
+			printf(" %d (x%zu)", static_cast<int>(set), epsi.group_weight(set));
+		printf("\n");
+
+		// Stands for the tables the generators look up at the targets.
+		const Huge_Array<uint16_t> entries(num_positions);
+
+		const size_t num_runs = std::min(MAX_NUM_RUNS, num_positions);
+		const size_t run_size = std::min(ceil_div(num_sample_positions, num_runs), num_positions / num_runs);
+
+		std::atomic<size_t> next_run(0);
+		std::atomic<uint64_t> num_moves(0);
+		std::atomic<uint64_t> num_off_page(0);
+		std::atomic<uint64_t> sum_log2_stride(0);
+		// Keeps the lookups from being optimized away.
+		std::atomic<uint64_t> checksum(0);
+
+		const auto start_time = std::chrono::steady_clock::now();
+
+		thread_pool->run_sync_task_on_all_threads([&](size_t) {
+			uint64_t thread_moves = 0;
+			uint64_t thread_off_page = 0;
+			uint64_t thread_log2_stride = 0;
+			uint64_t thread_checksum = 0;
+
+			for (size_t run = next_run++; run < num_runs; run = next_run++)
+			{
+				const Board_Index begin = static_cast<Board_Index>(run * (num_positions / num_runs));
+				Position_For_Gen gen_pos(epsi, begin);
+
+				for (size_t i = 0; i < run_size; ++i, ++gen_pos)
+				{
+					if (!gen_pos.is_legal())
+						continue;
+
+					const Board_Index pos = gen_pos.board_index();
+					for (const Color turn : { WHITE, BLACK })
+					{
+						gen_pos.set_turn(turn);
+						for (const Move move : gen_pos.board().gen_pseudo_legal_quiets())
+						{
+							bool mirr;
+							const Board_Index next_ix = quiet_index<Quiet_Index_Type::NORMAL>(epsi, gen_pos, move, out_param(mirr));
+							const size_t stride = next_ix > pos ? next_ix - pos : pos - next_ix;
+
+							thread_checksum += entries[next_ix];
+							thread_moves += 1;
+							thread_off_page += stride * sizeof(uint16_t) >= PAGE_SIZE;
+							thread_log2_stride += stride != 0 ? msb(stride) : 0;
+						}
+					}
+				}
+			}
+
+			num_moves += thread_moves;
+			num_off_page += thread_off_page;
+			sum_log2_stride += thread_log2_stride;
+			checksum += thread_checksum;
+		});
+
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		const double n = static_cast<double>(std::max<uint64_t>(num_moves.load(), 1));
+
+		printf(
+			"%s %s: %llu moves, %.2f M moves/s, mean log2 stride %.2f, %.1f%% leave the 4 KiB page\n",
+			ps.name().c_str(),
+			order == Board_Index_Group_Order::BY_CLASS ? "by class" : "by mobility",
+			static_cast<unsigned long long>(num_moves.load()),
+			num_moves.load() / seconds / 1e6,
+			sum_log2_stride.load() / n,
+			100.0 * num_off_page.load() / n
+		);
+	}
+}
+
+void benchmark_quiet_index_updates(const Piece_Config& ps, size_t num_sample_positions, size_t num_passes)
+{
+	struct Update
+	{
+		const Piece_Group* group;
+		Piece_Group::Placement_Index index;
+		Move move;
+	};
+
+	const Piece_Config_For_Gen epsi(ps);
+	const size_t num_positions = epsi.num_positions();
+
+	// The quiet moves of the positions of a few evenly spaced runs, in the order
+	// the generators would make them, so that the groups take turns like there.
+	static constexpr size_t MAX_NUM_RUNS = 256;
+	const size_t num_runs = std::min(MAX_NUM_RUNS, num_positions);
+	const size_t run_size = std::min(ceil_div(num_sample_positions, num_runs), num_positions / num_runs);
+
+	std::vector<Update> updates;
+	for (size_t run = 0; run < num_runs; ++run)
+	{
+		Position_For_Gen gen_pos(epsi, static_cast<Board_Index>(run * (num_positions / num_runs)));
+		for (size_t i = 0; i < run_size; ++i, ++gen_pos)
+		{
+			if (!gen_pos.is_legal())
+				continue;
+
+			for (const Color turn : { WHITE, BLACK })
+			{
+				gen_pos.set_turn(turn);
+				for (const Move move : gen_pos.board().gen_pseudo_legal_quiets())
+				{
+					const Piece_Class id = piece_class(gen_pos.board().piece_on(move.from()));
+					updates.push_back(Update{ &epsi.group(id), gen_pos.index()[id], move });
+				}
+			}
+		}
+	}
+
+	// Keeps the updates from being optimized away.
+	uint64_t checksum = 0;
+
+	const auto start_time = std::chrono::steady_clock::now();
+
+	for (size_t pass = 0; pass < num_passes; ++pass)
+		for (const Update& update : updates)
+			checksum += update.group->compound_index_after_quiet_move(update.index, update.move).base();
+
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	const double num_updates = static_cast<double>(std::max<size_t>(updates.size() * num_passes, 1));
+
+	printf(
+		"%s: %zu quiet moves x %zu passes, %.2f ns per index update (checksum %llx)\n",
+		ps.name().c_str(),
+		updates.size(),
+		num_passes,
+		seconds * 1e9 / num_updates,
+		static_cast<unsigned long long>(checksum)
+	);
 }
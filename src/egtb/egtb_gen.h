@@ -25,6 +25,7 @@
 #include <type_traits>
 #include <chrono>
 #include <climits>
+#include <cmath>
 #include <utility>
 #include <optional>
 #include <filesystem>
@@ -34,7 +35,7 @@ struct Piece_Config_For_Gen : public Piece_Config
 private:
 	static constexpr size_t MAX_NUM_POSITIONS = 0xffffffffffffull;
 
-	NODISCARD static bool try_init(Piece_Config_For_Gen& info)
+	NODISCARD static bool try_init(Piece_Config_For_Gen& info, Board_Index_Layout preferred_layout, Board_Index_Group_Order group_order)
 	{
 		info.m_both_sides_have_free_attackers = 
 			   info.has_any_free_attackers(WHITE)
@@ -47,38 +48,113 @@ private:
 		fill_set_ids_from_piece_counts(out_param(info.m_groups), pc);
 
 		info.m_compress_id = compute_compress_id(info.m_groups);
+		info.m_relative_id = 
+			preferred_layout == Board_Index_Layout::FREE_PIECE_RELATIVE
+			? compute_relative_id(info.m_groups, info.m_compress_id)
+			: PIECE_CLASS_NONE;
+		info.m_layout = 
+			info.m_relative_id == PIECE_CLASS_NONE
+			? Board_Index_Layout::CARTESIAN
+			: Board_Index_Layout::FREE_PIECE_RELATIVE;
 
 		memset(info.m_weight_by_group, 0, sizeof(info.m_weight_by_group));
 		info.m_num_populated_classes = 0;
+		info.m_group_order = group_order;
 
-		size_t w = 1;
 		for (Piece_Class i = PIECE_CLASS_START; i < PIECE_CLASS_END; ++i)
 		{
-			if (info.m_groups[i] != nullptr)
-			{
+			if (info.m_groups[i] == nullptr)
+				continue;
+
+			if (i == info.m_relative_id)
+				info.m_num_positions_by_group[i] = SQUARE_NB - (info.num_pieces() - 1);
+			else
 				info.m_num_positions_by_group[i] =
 					i == info.m_compress_id
 					? info.m_groups[i]->compress_size()
 					: info.m_groups[i]->table_size();
+		}
 
+		// The relative group goes last, so that it has the largest weight.
+		for (Piece_Class i = PIECE_CLASS_START; i < PIECE_CLASS_END; ++i)
+			if (info.m_groups[i] != nullptr && i != info.m_relative_id)
 				info.m_populated_classes[info.m_num_populated_classes++] = i;
-				info.m_weight_by_group[i] = w;
-				if (w != 1)
-					info.m_weight_divider_by_group[i] = w;
-				const size_t next_w = w * info.m_num_positions_by_group[i];
-				if (next_w < w || next_w > MAX_NUM_POSITIONS)
-				{
-					info.m_num_positions = std::numeric_limits<size_t>::max();
-					return false;
-				}
-				w = next_w;
+
+		if (group_order == Board_Index_Group_Order::BY_MOBILITY)
+		{
+			// A quiet move of a group changes the board index by about its weight times its
+			// number of placements, so the sum over groups of mobility times the log of the
+			// weight is what is minimized. Like for weighted completion time, that is done
+			// by ordering by the log of the number of placements over the mobility.
+			double key[PIECE_CLASS_NB];
+			for (size_t j = 0; j < info.m_num_populated_classes; ++j)
+			{
+				const Piece_Class i = info.m_populated_classes[j];
+				key[i] = std::log2(static_cast<double>(info.m_num_positions_by_group[i])) / info.m_groups[i]->estimated_mobility();
 			}
+
+			std::stable_sort(info.m_populated_classes, info.m_populated_classes + info.m_num_populated_classes, [&key](Piece_Class lhs, Piece_Class rhs) {
+				return key[lhs] < key[rhs];
+			});
+		}
+
+		if (info.m_relative_id != PIECE_CLASS_NONE)
+			info.m_populated_classes[info.m_num_populated_classes++] = info.m_relative_id;
+
+		size_t w = 1;
+		for (size_t j = 0; j < info.m_num_populated_classes; ++j)
+		{
+			const Piece_Class i = info.m_populated_classes[j];
+			info.m_weight_by_group[i] = w;
+			if (w != 1)
+				info.m_weight_divider_by_group[i] = w;
+			const size_t next_w = w * info.m_num_positions_by_group[i];
+			if (next_w < w || next_w > MAX_NUM_POSITIONS)
+			{
+				info.m_num_positions = std::numeric_limits<size_t>::max();
+				info.m_num_cartesian_positions = std::numeric_limits<size_t>::max();
+				return false;
+			}
+			w = next_w;
 		}
 		info.m_num_positions = w;
+		info.m_num_cartesian_positions =
+			info.m_relative_id == PIECE_CLASS_NONE
+			? w
+			: w / info.m_num_positions_by_group[info.m_relative_id] * SQUARE_NB;
 		return true;
 	}
 
 public:
+	// A set of squares, for computing the rank of a square among the squares not in the set.
+	struct Square_Set
+	{
+		uint64_t bits[2] = { 0, 0 };
+
+		void add(Square sq)
+		{
+			bits[sq >> 6] |= 1ull << (sq & 63);
+		}
+
+		// The number of squares in the set that are below `end`.
+		NODISCARD size_t count_below(size_t end) const
+		{
+			return
+				end >= 64
+				? popcnt(bits[0]) + popcnt(bits[1] & ((1ull << (end - 64)) - 1))
+				: popcnt(bits[0] & ((1ull << end) - 1));
+		}
+	};
+
+	// The square of the relative piece, its rank, and the squares of the other pieces.
+	// Used for updating the board index after a quiet move without composing it again.
+	struct Relative_Piece
+	{
+		Square square;
+		size_t rank;
+		Square_Set others;
+	};
+
 	NODISCARD static std::optional<size_t> num_positions_safe(const Piece_Config& ps)
 	{
 		bool ok;
@@ -90,17 +166,41 @@ public:
 
 	}
 
-	explicit Piece_Config_For_Gen(const Piece_Config& ps) :
+	// The layout used for all piece configurations that allow it.
+	// Tables are probed with the same layout, so it must be set before
+	// anything is generated, and all sub tables must have been generated with it.
+	static void set_preferred_board_index_layout(Board_Index_Layout layout)
+	{
+		s_preferred_layout = layout;
+	}
+
+	NODISCARD static Board_Index_Layout preferred_board_index_layout()
+	{
+		return s_preferred_layout;
+	}
+
+	// The group order used for all piece configurations.
+	// Same as the layout, it must be set before anything is generated.
+	static void set_board_index_group_order(Board_Index_Group_Order group_order)
+	{
+		s_group_order = group_order;
+	}
+
+	explicit Piece_Config_For_Gen(
+		const Piece_Config& ps,
+		Board_Index_Layout preferred_layout = s_preferred_layout,
+		Board_Index_Group_Order group_order = s_group_order
+	) :
 		Piece_Config(ps)
 	{
-		if (!try_init(*this))
+		if (!try_init(*this, preferred_layout, group_order))
 			throw std::runtime_error("Piece set too large, would overflow size.");
 	}
 
 	Piece_Config_For_Gen(const Piece_Config& ps, Out_Param<bool> ok) :
 		Piece_Config(ps)
 	{
-		*ok = try_init(*this);
+		*ok = try_init(*this, s_preferred_layout, s_group_order);
 	}
 
 	template <bool ASSUME_LEGAL>
@@ -146,6 +246,25 @@ public:
 
 	void step_to_next(In_Out_Param<Decomposed_Board_Index> index) const
 	{
+		if (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE)
+		{
+			// The squares of the relative group depend on all other groups.
+			size_t rank = relative_rank(*index);
+			size_t i = 0;
+			for (; i + 1 < m_num_populated_classes; ++i)
+			{
+				const Piece_Class ix = m_populated_classes[i];
+				if (++index[ix] == m_num_positions_by_group[ix])
+					index[ix] = Piece_Group::ZERO_INDEX;
+				else
+					break;
+			}
+			if (i + 1 == m_num_populated_classes)
+				rank += 1;
+			index[m_relative_id] = relative_placement_index(*index, rank);
+			return;
+		}
+
 		for (size_t i = 0; i < m_num_populated_classes; ++i)
 		{
 			const Piece_Class ix = m_populated_classes[i];
@@ -166,22 +285,31 @@ public:
 			index[ix] = narrowing_static_cast<Piece_Group::Placement_Index>(static_cast<size_t>(current_pos) / m_weight_divider_by_group[ix]);
 			current_pos -= index[ix] * m_weight_by_group[ix];
 		}
-		index[0] = narrowing_static_cast<Piece_Group::Placement_Index>(current_pos);
+		index[m_populated_classes[0]] = narrowing_static_cast<Piece_Group::Placement_Index>(current_pos);
+
+		// So far the index of the relative group is its rank.
+		if (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE)
+			index[m_relative_id] = relative_placement_index(*index, index[m_relative_id]);
 	}
 
 	NODISCARD Board_Index compose_board_index(const Decomposed_Board_Index& index_tb) const
 	{
 		Board_Index index = BOARD_INDEX_ZERO;
-		for (size_t i = 0; i < m_num_populated_classes; ++i)
+		for (size_t i = 0; i < num_cartesian_classes(); ++i)
 		{
 			const Piece_Class ix = m_populated_classes[i];
 			index += m_weight_by_group[ix] * index_tb[ix];
 		}
+		if (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE)
+			index += m_weight_by_group[m_relative_id] * relative_rank(index_tb);
 		return index;
 	}
 
 	NODISCARD Board_Index compose_mirr_board_index(const Decomposed_Board_Index& index_tb) const
 	{
+		if (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE)
+			return compose_board_index(mirr_decomposed_index(index_tb));
+
 		Board_Index index = BOARD_INDEX_ZERO;
 		for (size_t i = 0; i < m_num_populated_classes; ++i)
 		{
@@ -191,10 +319,22 @@ public:
 		return index;
 	}
 
-	template <typename F>
+	template <typename F, typename = std::enable_if_t<std::is_invocable_v<F, const Piece_Group&, Piece_Class>>>
 	NODISCARD Board_Index compose_board_index(F&& func) const
 	{
 		static_assert(std::is_same_v<decltype(&F::operator()), Piece_Group::Placement_Index(F::*)(const Piece_Group&, Piece_Class) const>);
+
+		if (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE)
+		{
+			Decomposed_Board_Index index_tb;
+			for (size_t i = 0; i < m_num_populated_classes; ++i)
+			{
+				const Piece_Class ix = m_populated_classes[i];
+				index_tb[ix] = func(*m_groups[ix], ix);
+			}
+			return compose_board_index(index_tb);
+		}
+
 		Board_Index index = BOARD_INDEX_ZERO;
 		for (size_t i = 0; i < m_num_populated_classes; ++i)
 		{
@@ -204,6 +344,8 @@ public:
 		return index;
 	}
 
+	// Only valid for the CARTESIAN layout, with FREE_PIECE_RELATIVE 
+	// a change of any group can change the rank of the relative group.
 	NODISCARD Board_Index change_single_group_index(
 		Board_Index pos,
 		Piece_Group::Placement_Index old_index,
@@ -211,6 +353,7 @@ public:
 		Piece_Class set
 	) const
 	{
+		ASSERT(m_layout == Board_Index_Layout::CARTESIAN);
 		const ptrdiff_t diff = static_cast<ptrdiff_t>(new_index) - static_cast<ptrdiff_t>(old_index);
 		return pos + diff * static_cast<ptrdiff_t>(m_weight_by_group[set]);
 	}
@@ -220,6 +363,102 @@ public:
 		return m_num_positions;
 	}
 
+	NODISCARD Relative_Piece relative_piece(const Decomposed_Board_Index& index_tb) const
+	{
+		ASSERT(m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE);
+
+		Relative_Piece relative;
+		relative.square = m_groups[m_relative_id]->squares(index_tb[m_relative_id])[0];
+		relative.others = squares_of_other_groups(index_tb);
+		relative.rank = static_cast<size_t>(relative.square) - relative.others.count_below(relative.square);
+		return relative;
+	}
+
+	// Same as change_single_group_index, but for the FREE_PIECE_RELATIVE layout.
+	// The group is changed by a quiet move from `from` to `to`, and `relative` is of the position before the move.
+	NODISCARD Board_Index change_single_group_index(
+		Board_Index pos,
+		const Relative_Piece& relative,
+		Piece_Group::Placement_Index old_index,
+		Piece_Group::Placement_Index new_index,
+		Piece_Class set,
+		Square from,
+		Square to
+	) const
+	{
+		ASSERT(m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE);
+
+		ptrdiff_t rank_diff;
+		if (set == m_relative_id)
+			rank_diff = 
+				  static_cast<ptrdiff_t>(static_cast<size_t>(to) - relative.others.count_below(to)) 
+				- static_cast<ptrdiff_t>(relative.rank);
+		else
+		{
+			rank_diff = (from < relative.square) - (to < relative.square);
+			pos += (static_cast<ptrdiff_t>(new_index) - static_cast<ptrdiff_t>(old_index)) * static_cast<ptrdiff_t>(m_weight_by_group[set]);
+		}
+
+		return pos + rank_diff * static_cast<ptrdiff_t>(m_weight_by_group[m_relative_id]);
+	}
+
+	// Returns the index with the placement of each group mirrored.
+	NODISCARD Decomposed_Board_Index mirr_decomposed_index(const Decomposed_Board_Index& index_tb) const
+	{
+		Decomposed_Board_Index mirr_index_tb;
+		for (size_t i = 0; i < m_num_populated_classes; ++i)
+		{
+			const Piece_Class ix = m_populated_classes[i];
+			mirr_index_tb[ix] = m_groups[ix]->mirr_index(index_tb[ix]);
+		}
+		return mirr_index_tb;
+	}
+
+	// Returns whether pieces of different groups are on the same square.
+	// fill_board fails exactly for such positions.
+	NODISCARD bool has_colliding_pieces(const Decomposed_Board_Index& index_tb) const
+	{
+		Square_Set occupied;
+		size_t num_pieces = 0;
+		for (size_t i = 0; i < m_num_populated_classes; ++i)
+		{
+			const Piece_Class ix = m_populated_classes[i];
+			for (const Square sq : m_groups[ix]->squares(index_tb[ix]))
+			{
+				occupied.add(sq);
+				num_pieces += 1;
+			}
+		}
+		return occupied.count_below(SQUARE_NB) != num_pieces;
+	}
+
+	// The number of positions the CARTESIAN layout would have.
+	NODISCARD size_t num_cartesian_positions() const
+	{
+		return m_num_cartesian_positions;
+	}
+
+	NODISCARD Board_Index_Layout board_index_layout() const
+	{
+		return m_layout;
+	}
+
+	NODISCARD Board_Index_Group_Order board_index_group_order() const
+	{
+		return m_group_order;
+	}
+
+	// The populated piece classes, from the one with weight 1.
+	NODISCARD Const_Span<Piece_Class> group_order() const
+	{
+		return Const_Span(m_populated_classes, m_num_populated_classes);
+	}
+
+	NODISCARD size_t group_weight(Piece_Class set) const
+	{
+		return m_weight_by_group[set];
+	}
+
 	NODISCARD bool both_sides_have_free_attackers() const
 	{
 		return m_both_sides_have_free_attackers;
@@ -243,10 +482,18 @@ public:
 	}
 
 private:
+	static inline Board_Index_Layout s_preferred_layout = Board_Index_Layout::CARTESIAN;
+	static inline Board_Index_Group_Order s_group_order = Board_Index_Group_Order::BY_CLASS;
+
 	size_t m_num_positions;
+	size_t m_num_cartesian_positions;
 	size_t m_num_populated_classes;
+	// With the FREE_PIECE_RELATIVE layout the relative group is the last one.
 	Piece_Class m_populated_classes[PIECE_CLASS_NB];
 	Piece_Class m_compress_id;
+	Piece_Class m_relative_id;
+	Board_Index_Layout m_layout;
+	Board_Index_Group_Order m_group_order;
 	bool m_both_sides_have_free_attackers;
 	const Piece_Group* m_groups[PIECE_CLASS_NB];
 	size_t m_num_positions_by_group[PIECE_CLASS_NB];
@@ -273,11 +520,99 @@ private:
 
 		return compress_id;
 	}
+
+	// The relative group is a single free attacker, it can be on any square
+	// that isn't occupied by other pieces. The compress group is excluded, 
+	// because its index would no longer be independent of the other groups.
+	NODISCARD static Piece_Class compute_relative_id(const Piece_Group* set_id[PIECE_CLASS_NB], Piece_Class compress_id)
+	{
+		Piece_Class relative_id = PIECE_CLASS_NONE;
+		for (Piece_Class i = PIECE_CLASS_START; i < PIECE_CLASS_END; ++i)
+		{
+			if (set_id[i] == nullptr || i == compress_id)
+				continue;
+
+			if (set_id[i]->size() == 1 && set_id[i]->table_size() == SQUARE_NB)
+				relative_id = i;
+		}
+
+		return relative_id;
+	}
+
+	NODISCARD size_t num_cartesian_classes() const
+	{
+		return m_num_populated_classes - (m_layout == Board_Index_Layout::FREE_PIECE_RELATIVE);
+	}
+
+	NODISCARD Square_Set squares_of_other_groups(const Decomposed_Board_Index& index_tb) const
+	{
+		Square_Set occupied;
+		for (size_t i = 0; i < num_cartesian_classes(); ++i)
+		{
+			const Piece_Class ix = m_populated_classes[i];
+			for (const Square sq : m_groups[ix]->squares(index_tb[ix]))
+				occupied.add(sq);
+		}
+		return occupied;
+	}
+
+	// The index of the square of the relative piece among the squares not occupied by other groups.
+	NODISCARD size_t relative_rank(const Decomposed_Board_Index& index_tb) const
+	{
+		const Square sq = m_groups[m_relative_id]->squares(index_tb[m_relative_id])[0];
+		return static_cast<size_t>(sq) - squares_of_other_groups(index_tb).count_below(sq);
+	}
+
+	// The inverse of relative_rank, the other groups are taken from `index_tb`.
+	NODISCARD Piece_Group::Placement_Index relative_placement_index(const Decomposed_Board_Index& index_tb, size_t rank) const
+	{
+		const Square_Set occupied = squares_of_other_groups(index_tb);
+
+		// The smallest fixed point is a free square with `rank` free squares below it.
+		size_t sq = rank;
+		for (;;)
+		{
+			const size_t next_sq = rank + occupied.count_below(sq + 1);
+			if (next_sq == sq)
+				break;
+			sq = next_sq;
+		}
+		ASSERT(sq < SQUARE_NB);
+
+		Piece_Group::Placement placement;
+		placement.add(static_cast<Square>(sq));
+		return m_groups[m_relative_id]->compound_index(placement).base();
+	}
 };
 
 // NOTE: this struct is not "const thread-safe"
 struct Position_For_Gen
 {
+	// The placement with the colors of all pieces swapped (and ranks mirrored to match),
+	// used for symmetric piece configurations, where it's in the same table.
+	struct Color_Swapped_Index
+	{
+		// Indices of the swapped placement of each group, with files not mirrored.
+		Piece_Group::Full_Placement_Index group_index[PIECE_CLASS_NB];
+
+		// Board indices of the swapped placement, by whether files are mirrored.
+		Board_Index board_index[2];
+
+		// Whether the files have to be mirrored to get the canonical board index.
+		bool mirr;
+
+		// Only with the FREE_PIECE_RELATIVE layout, by whether files are mirrored.
+		Piece_Config_For_Gen::Relative_Piece relative[2];
+	};
+
+	// The board index and the relative piece, with and without files mirrored.
+	// Only used with the FREE_PIECE_RELATIVE layout.
+	struct Relative_Index
+	{
+		Board_Index board_index[2];
+		Piece_Config_For_Gen::Relative_Piece relative[2];
+	};
+
 	Position_For_Gen(const Piece_Config_For_Gen& info, Board_Index pos, Color turn = WHITE);
 
 	// Constructs a child position of the passed `parent`, 
@@ -316,6 +651,22 @@ struct Position_For_Gen
 		return m_index;
 	}
 
+	// Computed once per board index, as all children are usually looked up.
+	NODISCARD const Color_Swapped_Index& color_swapped_index() const
+	{
+		if (m_board_index != m_cached_color_swapped_board_index)
+			init_color_swapped_index();
+		return m_color_swapped_index;
+	}
+
+	// Computed once per board index, as all children are usually looked up.
+	NODISCARD const Relative_Index& relative_index() const
+	{
+		if (m_board_index != m_cached_relative_board_index)
+			init_relative_index();
+		return m_relative_index;
+	}
+
 	void get_fen(Span<char> out) const
 	{
 		init_board<true>();
@@ -356,6 +707,18 @@ private:
 	static_assert(std::is_trivial_v<Position>);
 	mutable Position m_board;
 	mutable bool m_legal;
+
+	mutable Board_Index m_cached_color_swapped_board_index;
+	mutable Color_Swapped_Index m_color_swapped_index;
+	// The index the groups of m_color_swapped_index were computed for,
+	// so that only the changed groups are recomputed when iterating.
+	mutable Decomposed_Board_Index m_color_swapped_source_index;
+
+	mutable Board_Index m_cached_relative_board_index;
+	mutable Relative_Index m_relative_index;
+
+	void init_color_swapped_index() const;
+	void init_relative_index() const;
 	
 	template <bool ASSUME_LEGAL>
 	void init_board() const
@@ -425,6 +788,17 @@ struct EGTB_Bits
 		return m_num_bits;
 	}
 
+	// Raw view of the underlying storage, for dumping and restoring the bits.
+	NODISCARD Const_Span<uint8_t> data_span() const
+	{
+		return Const_Span(reinterpret_cast<const uint8_t*>(m_elements.data()), m_elements.size() * sizeof(Underlying_Storage_Type));
+	}
+
+	NODISCARD Span<uint8_t> data_span()
+	{
+		return Span(reinterpret_cast<uint8_t*>(m_elements.data()), m_elements.size() * sizeof(Underlying_Storage_Type));
+	}
+
 	NODISCARD bool empty() const
 	{
 		for (const auto& element : m_elements)
@@ -860,6 +1234,11 @@ struct EGTB_File_For_Gen : public EGTB_File_For_Gen_Consistency_Check<MainEntryT
 		return Const_Span(reinterpret_cast<const uint8_t*>(m_entries.data()), m_entries.size() * ENTRY_SIZE);
 	}
 
+	NODISCARD Span<uint8_t> data_span()
+	{
+		return Span(reinterpret_cast<uint8_t*>(m_entries.data()), m_entries.size() * ENTRY_SIZE);
+	}
+
 private:
 	Huge_Array<Underlying_Entry_Type> m_entries;
 };
@@ -1173,9 +1552,54 @@ private:
 	std::atomic<size_t> m_current_chunk_index;
 };
 
+// The positions of a piece configuration that are legal for each table color:
+// no two pieces on one square, the kings not facing each other
+// and the side not to move not in check.
+// Computed once before the generation of a configuration and shared by its
+// DTC and DTM generators, which don't set up the boards of illegal positions
+// or look anything up for them.
+struct EGTB_Legal_Positions
+{
+	EGTB_Legal_Positions(In_Out_Param<Thread_Pool> thread_pool, const Piece_Config_For_Gen& epsi);
+
+	EGTB_Legal_Positions(const EGTB_Legal_Positions&) = delete;
+	EGTB_Legal_Positions& operator=(const EGTB_Legal_Positions&) = delete;
+
+	// Memory needed for a configuration with num_positions positions and num_tables tables.
+	NODISCARD static size_t memory_required(size_t num_positions, size_t num_tables)
+	{
+		return num_positions * num_tables / CHAR_BIT;
+	}
+
+	// `table_color` is the color of the table the position is in,
+	// which is always WHITE for symmetric configurations.
+	NODISCARD bool is_legal(Board_Index pos, Color table_color) const
+	{
+		return m_bits[table_color].bit_is_set(pos);
+	}
+
+	NODISCARD size_t num_positions() const
+	{
+		return m_num_positions;
+	}
+
+	NODISCARD size_t num_legal(Color table_color) const
+	{
+		return m_num_legal[table_color];
+	}
+
+private:
+	size_t m_num_positions;
+	EGTB_Bits m_bits[COLOR_NB];
+	size_t m_num_legal[COLOR_NB];
+};
+
 struct EGTB_Generation_Info
 {
 	size_t num_positions;
+	// The number of positions with each board index layout, for comparison.
+	size_t num_cartesian_positions;
+	size_t num_relative_positions;
 	size_t uncompressed_size;
 	size_t uncompressed_sub_tb_size;
 	size_t memory_required_for_generation;
@@ -1183,7 +1607,9 @@ struct EGTB_Generation_Info
 
 struct EGTB_Generator
 {
-	EGTB_Generator(const Piece_Config& ps);
+	// The legal positions can be shared with the other generators of the configuration,
+	// without them they are computed when the generation starts.
+	EGTB_Generator(const Piece_Config& ps, std::shared_ptr<const EGTB_Legal_Positions> legal_positions = nullptr);
 
 	NODISCARD inline Fixed_Vector<Color, 2> table_colors() const
 	{
@@ -1191,6 +1617,13 @@ struct EGTB_Generator
 		return ::egtb_table_colors(table_num);
 	}
 
+	// The number of tables held in memory during generation.
+	NODISCARD static size_t num_tables_for_generation(const Piece_Config& ps)
+	{
+		const auto [mat_key, mir_key] = ps.material_keys();
+		return mat_key == mir_key ? 1 : 2;
+	}
+
 protected:
 	Piece_Config_For_Gen m_epsi;
 
@@ -1200,12 +1633,94 @@ protected:
 	Color m_sub_read_color_by_capture[PIECE_NB];
 	bool m_sub_needs_mirror_by_capture[PIECE_NB];
 
+	// Symmetric configurations are generated for white to move only.
+	// The black to move position at some index is the same as the color swapped
+	// white to move position, so the tables of black are never allocated.
+	// Entries of black are looked up at the color swapped index instead,
+	// which is what the next_quiet_index functions return in this case.
 	bool m_is_symmetric;
 
+	// Only during the generation, see acquire_legal_positions.
+	std::shared_ptr<const EGTB_Legal_Positions> m_legal_positions;
+
+	// Computes the legal positions unless they were given to the constructor.
+	void acquire_legal_positions(In_Out_Param<Thread_Pool> thread_pool);
+
+	// Drops the reference to the legal positions, which are freed
+	// when the other generators sharing them are done too.
+	void release_legal_positions()
+	{
+		m_legal_positions.reset();
+	}
+
+	// The color of the table that holds the entries for the given side to move.
+	NODISCARD Color table_color(Color c) const
+	{
+		return m_is_symmetric ? WHITE : c;
+	}
+
+	// Debug builds check that a position looked up after a legal move is legal,
+	// which catches indices that don't match the boards. Lookups in the sub tables
+	// can't be checked, the legal positions of other configurations aren't computed.
+	void assert_legal_lookup(Board_Index pos, Color c) const
+	{
+		ASSERT(m_legal_positions == nullptr || m_legal_positions->is_legal(pos, table_color(c)));
+	}
+
 	NODISCARD Board_Index next_cap_index(const Position_For_Gen& pos_for_gen, Move move) const;
 	NODISCARD Board_Index next_quiet_index(const Position_For_Gen& pos_for_gen, Move move) const;
 	NODISCARD Board_Index next_quiet_index(const Position_For_Gen& pos_for_gen, Move move, Out_Param<bool> mirr) const;
 	NODISCARD Fixed_Vector<Board_Index, 2> next_quiet_index_with_mirror(const Position_For_Gen& pos_for_gen, Move move) const;
 
+	// The index of the white to move position with the colors of pos_for_gen swapped.
+	// The placement of pos_for_gen must be legal.
+	NODISCARD Board_Index color_swapped_index(const Position_For_Gen& pos_for_gen) const;
+
+	// The position after a quiet move, as stored in the table.
+	// `next_ix` and `mirr` must come from next_quiet_index.
+	NODISCARD Position_For_Gen next_position(const Position_For_Gen& parent, Move move, Board_Index next_ix, bool mirr) const;
+
+	// Maps a bitboard between the frames of a position and of the next position,
+	// as created by next_position. The mapping is its own inverse.
+	NODISCARD Bitboard to_next_position_frame(Bitboard bb, bool mirr) const
+	{
+		bb = bb.maybe_mirror_files(mirr);
+		return m_is_symmetric ? bb.mirror_ranks() : bb;
+	}
+
 	NODISCARD Shared_Board_Index_Iterator make_gen_iterator() const;
+
+	// Sets the bits of the positions that are a win or a loss by read_wdl(color, pos),
+	// for each table color. Used to save DTC and DTM tables without their draws.
+	template <typename FuncT>
+	void mark_decisive_positions(In_Out_Param<Thread_Pool> thread_pool, EGTB_Bits decisive_bits[COLOR_NB], FuncT&& read_wdl) const
+	{
+		for (const Color c : table_colors())
+			decisive_bits[c] = EGTB_Bits(m_epsi.num_positions());
+
+		auto gen_iterator = make_gen_iterator();
+		thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+			for (const Board_Index pos : gen_iterator.indices())
+			{
+				for (const Color c : table_colors())
+				{
+					const WDL_Entry value = read_wdl(c, pos);
+					if (value == WDL_Entry::WIN || value == WDL_Entry::LOSE)
+						decisive_bits[c].lock_set_bit(pos);
+				}
+			}
+		});
+	}
 };
+
+// Runs a pass over a sample of the positions like the ones of the generators,
+// looking up 16-bit entries at the targets of all quiet moves, with each group order.
+// Prints how far the targets are from the positions the moves are made from
+// and how fast the pass is. The sample is num_sample_positions positions in
+// evenly spaced runs, the whole table if it's smaller.
+void benchmark_board_index_group_orders(In_Out_Param<Thread_Pool> thread_pool, const Piece_Config& ps, size_t num_sample_positions);
+
+// Times Piece_Group::compound_index_after_quiet_move, the part of the board index
+// update after a quiet move that looks up the tables of the moved group, on the quiet
+// moves of a sample of the positions. Runs on one thread, over the moves num_passes times.
+void benchmark_quiet_index_updates(const Piece_Config& ps, size_t num_sample_positions, size_t num_passes);
@@ -18,11 +18,24 @@ constexpr size_t MAX_NEXT_TB_ENTRIES = 64;
 DTM_Generator::DTM_Generator(
 	const Piece_Config& ps, 
 	bool srb, 
-	const EGTB_Paths& egtb_files
+	const EGTB_Paths& egtb_files,
+	std::chrono::seconds checkpoint_interval,
+	const EGTB_Save_Settings& dtm_settings,
+	std::shared_ptr<const EGTB_Legal_Positions> legal_positions
 ) :
-	EGTB_Generator(ps),
+	EGTB_Generator(ps, std::move(legal_positions)),
 	m_egtb_files(egtb_files),
-	m_save_rule_bits(srb)
+	m_save_rule_bits(srb),
+	m_dtm_settings(dtm_settings),
+	m_checkpoint(
+		egtb_files.dtm_checkpoint_path(ps),
+		ps,
+		EGTB_Magic::DTM_MAGIC,
+		m_epsi.num_positions(),
+		m_epsi.board_index_layout(),
+		m_epsi.board_index_group_order(),
+		checkpoint_interval
+	)
 {
 	memset(m_sub_dtm_by_capture, 0, sizeof(m_sub_dtm_by_capture));
 }
@@ -52,38 +65,76 @@ void DTM_Generator::close_sub_egtb()
 	m_tmp_files.clear();
 }
 
+void DTM_Generator::maybe_save_checkpoint(
+	In_Out_Param<Thread_Pool> thread_pool,
+	EGTB_Checkpoint_Stage stage,
+	std::vector<uint64_t> counters,
+	std::initializer_list<const EGTB_Bits*> bits
+)
+{
+	if (!m_checkpoint.is_due())
+		return;
+
+	std::vector<Const_Span<uint8_t>> sections;
+	for (const Color c : table_colors())
+		sections.push_back(m_dtm_file[c].data_span());
+	for (const EGTB_Bits* b : bits)
+		sections.emplace_back(b->data_span());
+
+	m_checkpoint.save(thread_pool, EGTB_Checkpoint_State{ stage, std::move(counters) }, sections);
+}
+
+std::vector<uint64_t> DTM_Generator::restore_checkpoint(
+	In_Out_Param<Thread_Pool> thread_pool,
+	std::initializer_list<EGTB_Bits*> bits
+)
+{
+	ASSERT(m_resume_state.has_value());
+
+	std::vector<Span<uint8_t>> sections;
+	for (const Color c : table_colors())
+		sections.emplace_back(m_dtm_file[c].data_span());
+	for (EGTB_Bits* b : bits)
+		sections.emplace_back(b->data_span());
+
+	m_checkpoint.restore(thread_pool, sections);
+
+	std::vector<uint64_t> counters = std::move(m_resume_state->counters);
+	m_resume_state.reset();
+	return counters;
+}
+
 void DTM_Generator::save_egtb(In_Out_Param<Thread_Pool> thread_pool, const EGTB_Info& info)
 {
 	const std::string info_path = m_egtb_files.dtm_info_save_path(m_epsi).string();
 	const std::string egtb_path = m_egtb_files.dtm_save_path(m_epsi).string();
 
 	// 压缩写入egtb
-	Compressed_EGTB save_info[COLOR_NB];
-	for (const Color me : { WHITE, BLACK })
-	{
-		save_info[me] = save_compress_egtb(
-			thread_pool, 
-			m_dtm_file[me].data_span(),
-			me, 
-			info, 
-			m_save_rule_bits
-		);
+	const Const_Span<uint8_t> src[COLOR_NB] = { m_dtm_file[WHITE].data_span(), m_dtm_file[BLACK].data_span() };
+	const std::optional<EGTB_Value_Map_Stats> value_map_stats = save_egtb_table(
+		thread_pool,
+		m_epsi,
+		src,
+		info,
+		&m_generation_stats,
+		m_save_rule_bits,
+		{ { egtb_path, table_colors() } },
+		EGTB_Magic::DTM_MAGIC,
+		m_dtm_settings,
+		m_decisive_bits[WHITE].empty() ? nullptr : m_decisive_bits
+	);
 
-		if (m_is_symmetric)
-			break;
-	}
 	{
-		const auto colors = table_colors();
-		save_egtb_table(m_epsi, save_info, egtb_path, colors, EGTB_Magic::DTM_MAGIC);
-
 		const size_t file_size = std::filesystem::file_size(egtb_path);
-		const size_t uncompressed_size = colors.size() * m_epsi.num_positions() * sizeof(DTM_Final_Entry);
+		const size_t uncompressed_size = table_colors().size() * m_epsi.num_positions() * sizeof(DTM_Final_Entry);
 		const double compression_ratio = static_cast<double>(uncompressed_size) / file_size;
 		printf("Saved compressed DTM file. Compression ratio: x%.2f\n", compression_ratio);
 	}
 
 	std::ofstream fp(info_path, std::ios_base::binary);
 	fp.write(reinterpret_cast<const char*>(&info), sizeof(EGTB_Info));
+	if (value_map_stats.has_value())
+		fp.write(reinterpret_cast<const char*>(&*value_map_stats), sizeof(EGTB_Value_Map_Stats));
 	fp.close();
 }
 
@@ -112,10 +163,14 @@ std::pair<DTM_Any_Entry, WDL_Entry> DTM_Generator::make_initial_entry(const Posi
 {
 	auto& pos = pos_gen.board();
 
-	if (!pos.is_legal())
-		return { DTM_Final_Entry::make_illegal(), WDL_Entry::ILLEGAL };
+	ASSERT(pos.is_legal());
 
+	// The WDL table must have been generated with the same index,
+	// otherwise it would have illegal entries at legal positions.
 	const WDL_Entry value = m_wdl_file.read(pos.turn(), pos_gen.board_index());
+	if (value == WDL_Entry::ILLEGAL)
+		print_and_abort("%s: WDL table has an illegal entry at legal position %llu\n", m_epsi.name().c_str(), static_cast<unsigned long long>(pos_gen.board_index()));
+
 	if (value == WDL_Entry::DRAW)
 		return { DTM_Final_Entry::make_draw(), value };
 
@@ -175,7 +230,7 @@ void DTM_Generator::sp_init_entries(
 			return;
 
 		const Color c = sc == WDL_Entry::WIN ? me : color_opp(me);
-		update_max(max_step[c], score);
+		update_max(max_step[table_color(c)], score);
 	};
 
 	size_t i = 0;
@@ -185,15 +240,15 @@ void DTM_Generator::sp_init_entries(
 		const Board_Index current_pos = pos_gen.board_index();
 		ASSERT(current_pos == m_epsi.compose_board_index(pos_gen.index()));
 
-		if (!pos_gen.is_legal())
+		for (const Color me : table_colors())
 		{
-			write_dtm(current_pos, WHITE, DTM_Final_Entry::make_illegal());
-			write_dtm(current_pos, BLACK, DTM_Final_Entry::make_illegal());
-			continue;
-		}
+			// Neither the board is set up nor the WDL table probed.
+			if (!m_legal_positions->is_legal(current_pos, me))
+			{
+				write_dtm(current_pos, me, DTM_Final_Entry::make_illegal());
+				continue;
+			}
 
-		for (const Color me : { WHITE, BLACK })
-		{
 			pos_gen.set_turn(me);
 
 			const auto [entry, sc] = make_initial_entry(pos_gen);
@@ -204,7 +259,7 @@ void DTM_Generator::sp_init_entries(
 				},
 				[&, sc=sc](DTM_Intermediate_Entry entry) {
 					write_dtm(current_pos, me, entry);
-					m_unknown_bits[me].set_bit(current_pos);
+					unknown_bits(me).set_bit(current_pos);
 					update_max_step(me, sc, entry.cap_score());
 				}
 			), entry);
@@ -237,7 +292,11 @@ void DTM_Generator::init_entries(In_Out_Param<Thread_Pool> thread_pool)
 
 void DTM_Generator::build_steps(In_Out_Param<Thread_Pool> thread_pool, Color root_color, In_Out_Param<EGTB_Bits_Pool> tmp_bits)
 {
-	ASSUME(m_max_build_step[WHITE] >= 1 && m_max_build_step[BLACK] >= 1);
+	// Already done before the checkpoint was taken.
+	if (   is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED)
+		|| is_resuming_at(EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE)
+		|| (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS) && m_resume_state->counters[2] > static_cast<uint64_t>(root_color)))
+		return;
 
 	const auto start_time = std::chrono::steady_clock::now();
 
@@ -245,12 +304,32 @@ void DTM_Generator::build_steps(In_Out_Param<Thread_Pool> thread_pool, Color roo
 	EGTB_Bits win_bits = tmp_bits->acquire_cleared(thread_pool);
 	EGTB_Bits gen_bits = tmp_bits->acquire_dirty();
 
-	load_direct(thread_pool, root_color, out_param(gen_bits));
-
 	Color me = root_color;
 	Color opp = color_opp(root_color);
 	DTM_Score new_step = DTM_SCORE_ZERO;
-	for (DTM_Score n = static_cast<DTM_Score>(1);; ++n, std::swap(me, opp))
+	DTM_Score first_step = static_cast<DTM_Score>(1);
+
+	if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS))
+	{
+		const auto counters = restore_checkpoint(
+			thread_pool, 
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK], &gen_bits, &win_bits }
+		);
+		m_max_build_step[WHITE] = static_cast<DTM_Score>(counters[0]);
+		m_max_build_step[BLACK] = static_cast<DTM_Score>(counters[1]);
+		first_step = static_cast<DTM_Score>(counters[3] + 1);
+		new_step = static_cast<DTM_Score>(counters[4]);
+
+		// Odd steps are done by the root color.
+		if ((first_step & 1) == 0)
+			std::swap(me, opp);
+	}
+	else
+		load_direct(thread_pool, root_color, out_param(gen_bits));
+
+	ASSUME(m_max_build_step[WHITE] >= 1 && m_max_build_step[BLACK] >= 1);
+
+	for (DTM_Score n = first_step;; ++n, std::swap(me, opp))
 	{
 		printf("build step %zu\r", static_cast<size_t>(n));
 		fflush(stdout);
@@ -268,6 +347,19 @@ void DTM_Generator::build_steps(In_Out_Param<Thread_Pool> thread_pool, Color roo
 
 		if (n >= m_max_build_step[root_color] && !more_work)
 			break;
+
+		maybe_save_checkpoint(
+			thread_pool,
+			EGTB_Checkpoint_Stage::BUILD_STEPS,
+			{ 
+				static_cast<uint64_t>(m_max_build_step[WHITE].load()), 
+				static_cast<uint64_t>(m_max_build_step[BLACK].load()), 
+				static_cast<uint64_t>(root_color),
+				static_cast<uint64_t>(n),
+				static_cast<uint64_t>(new_step)
+			},
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK], &gen_bits, &win_bits }
+		);
 	}
 
 	tmp_bits->release(std::move(pre_bits));
@@ -328,11 +420,11 @@ bool DTM_Generator::sp_gen_pre_bits(
 				win_bits->set_bit(current_pos);
 
 				ASSERT(is_unknown(current_pos, me));
-				m_unknown_bits[me].clear_bit(current_pos);
+				unknown_bits(me).clear_bit(current_pos);
 			}
 		}
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 
 		auto& board = pos_gen.board();
 		ASSERT(board.is_legal());
@@ -409,7 +501,7 @@ bool DTM_Generator::sp_save_win(
 		DTM_Final_Entry new_entry = DTM_Final_Entry::copy_rule(entry);
 		new_entry.set_score_win(n);
 		write_dtm(current_pos, me, new_entry);
-		m_unknown_bits[me].clear_bit(current_pos);
+		unknown_bits(me).clear_bit(current_pos);
 		gen_bits->set_bit(current_pos);
 		win_bits->set_bit(current_pos);
 
@@ -452,14 +544,14 @@ bool DTM_Generator::sp_prove_lose(
 	bool add_new = false;
 	for (const Board_Index current_pos : gen_iterator->indices(pre_bits))
 	{
-		if (m_wdl_file.read(me, current_pos) != WDL_Entry::LOSE)
+		if (m_wdl_file.read(table_color(me), current_pos) != WDL_Entry::LOSE)
 			continue;
 
 		const auto entry = read_dtm<DTM_Intermediate_Entry>(current_pos, me);
 		if (is_unknown(current_pos, me) && entry.is_cap_win())
 			continue;
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		auto& board = pos_gen.board();
 		ASSERT(board.is_legal());
 
@@ -498,7 +590,7 @@ bool DTM_Generator::sp_prove_lose(
 			DTM_Final_Entry new_entry = DTM_Final_Entry::copy_rule(entry);
 			new_entry.set_score_lose(steps);
 			write_dtm(current_pos, me, new_entry);
-			m_unknown_bits[me].clear_bit(current_pos);
+			unknown_bits(me).clear_bit(current_pos);
 			gen_bits->set_bit(current_pos);
 
 			add_new = true;
@@ -549,7 +641,7 @@ bool DTM_Generator::sp_remove_fake(
 			continue;
 			
 		auto new_entry = entry;
-		const WDL_Entry sc = m_wdl_file.read(me, current_pos);
+		const WDL_Entry sc = m_wdl_file.read(table_color(me), current_pos);
 		if (   sc == bad_type 
 			&& new_entry.has_flag(flag_chase_good)
 			&& !new_entry.has_flag(flag_chase_bad))
@@ -559,7 +651,7 @@ bool DTM_Generator::sp_remove_fake(
 
 		if (new_entry.is_ban(TypeV))
 		{
-			Position_For_Gen pos_gen(m_epsi, current_pos, me);
+			Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 			new_entry =
 				TypeV == WDL_Entry::WIN
 				? check_remove_win(pos_gen, new_entry)
@@ -651,7 +743,7 @@ bool DTM_Generator::sp_load_bits(
 
 	const EGTB_Bits& bits = 
 		TypeV == Load_Bits_Type::LOAD_LOSE_CHANGE 
-		? m_unknown_bits[me] 
+		? unknown_bits(me) 
 		: *pre_bits;
 			
 	DTM_Score max_crv = DTM_SCORE_ZERO;
@@ -670,12 +762,12 @@ bool DTM_Generator::sp_load_bits(
 		{
 			if constexpr (TypeV == Load_Bits_Type::LOAD_LOSE_CHANGE)
 				if (entry.score() < n)
-					m_unknown_bits[me].clear_bit(current_pos);
+					unknown_bits(me).clear_bit(current_pos);
 
 			continue;
 		}
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		auto& board = pos_gen.board();
 
 		ASSERT(board.is_legal());
@@ -774,7 +866,7 @@ bool DTM_Generator::check_double_chase_win(
 {
 	const Color opp = color_opp(me);
 
-	Position_For_Gen next_pos_gen(pos_gen, evt_move, next_idx, mirr);
+	Position_For_Gen next_pos_gen = next_position(pos_gen, evt_move, next_idx, mirr);
 	auto& next_board = next_pos_gen.board();
 
 	DTM_Score min_step = DTM_SCORE_MAX;
@@ -811,7 +903,7 @@ bool DTM_Generator::check_double_chase_win(
 	if (!pos_gen.board().is_move_evasion(evt_move, out_param(evtbb)))
 		print_and_abort("Expected evt move");
 
-	return next_board.always_has_attack_after_quiet_moves(move_tb, evtbb.maybe_mirror_files(mirr));
+	return next_board.always_has_attack_after_quiet_moves(move_tb, to_next_position_frame(evtbb, mirr));
 }
 
 void DTM_Generator::loop_init_check_chase(In_Out_Param<Thread_Pool> thread_pool, In_Out_Param<EGTB_Bits_Pool> tmp_bits)
@@ -823,7 +915,7 @@ void DTM_Generator::loop_init_check_chase(In_Out_Param<Thread_Pool> thread_pool,
 
 	init_check_chase(thread_pool, inout_param(rule_bits));
 
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
 	{
 		const Color opp = color_opp(me);
 		size_t i = 0;
@@ -831,7 +923,7 @@ void DTM_Generator::loop_init_check_chase(In_Out_Param<Thread_Pool> thread_pool,
 		{
 			printf("remove_fake %d %zu\r", me, ++i);
 			fflush(stdout);
-			if (!remove_fake(thread_pool, opp, WDL_Entry::LOSE, inout_param(rule_bits[opp])))
+			if (!remove_fake(thread_pool, opp, WDL_Entry::LOSE, inout_param(rule_bits[table_color(opp)])))
 				break;
 
 			printf("remove_fake %d %zu\r", me, ++i);
@@ -858,19 +950,31 @@ void DTM_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 	EGTB_Bits gen_bits = tmp_bits->acquire_dirty();
 	EGTB_Bits win_bits = tmp_bits->acquire_dirty();
 
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
 	{
+		// Already done before the checkpoint was taken.
+		if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE) && m_resume_state->counters[0] > static_cast<uint64_t>(me))
+			continue;
+
 		const auto start_time = std::chrono::steady_clock::now();
 
 		const Color opp = color_opp(me);
 		m_max_step = static_cast<DTM_Score>(5); // 后面会修改
 
-		m_unknown_bits[WHITE] = tmp_bits->acquire_cleared(thread_pool);
-		m_unknown_bits[BLACK] = tmp_bits->acquire_cleared(thread_pool);
-
-		second_init(thread_pool, me);
+		for (const Color turn : table_colors())
+			m_unknown_bits[turn] = tmp_bits->acquire_cleared(thread_pool);
 
 		DTM_Score n = static_cast<DTM_Score>(3);
+
+		if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE))
+		{
+			const auto counters = restore_checkpoint(thread_pool, { &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] });
+			n = static_cast<DTM_Score>(counters[1] + 1);
+			m_max_step = static_cast<DTM_Score>(counters[2]);
+		}
+		else
+			second_init(thread_pool, me);
+
 		for (; n <= m_max_step && n < DTM_SCORE_MAX; ++n)
 		{
 			printf("build step %zu\r", static_cast<size_t>(n));
@@ -890,10 +994,17 @@ void DTM_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 						break;
 				}
 			}
+
+			maybe_save_checkpoint(
+				thread_pool,
+				EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE,
+				{ static_cast<uint64_t>(me), static_cast<uint64_t>(n), static_cast<uint64_t>(m_max_step.load()) },
+				{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] }
+			);
 		}
 
-		tmp_bits->release(std::move(m_unknown_bits[WHITE]));
-		tmp_bits->release(std::move(m_unknown_bits[BLACK]));
+		for (const Color turn : table_colors())
+			tmp_bits->release(std::move(m_unknown_bits[turn]));
 
 		const auto end_time = std::chrono::steady_clock::now();
 
@@ -915,7 +1026,7 @@ void DTM_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 
 void DTM_Generator::gen_rule_lose(In_Out_Param<Thread_Pool> thread_pool, In_Out_Param<EGTB_Bits_Pool> tmp_bits)
 {
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
 	{
 		EGTB_Bits opp_bits = tmp_bits->acquire_dirty();
 		EGTB_Bits me_bits = tmp_bits->acquire_dirty();
@@ -942,42 +1053,86 @@ void DTM_Generator::gen(In_Out_Param<Thread_Pool> thread_pool)
 {
 	printf("%s gen dtm start...\n", m_epsi.name().c_str());
 
-	for (const Color me : { WHITE, BLACK })
+	m_gen_start_time = std::chrono::steady_clock::now();
+
+	acquire_legal_positions(thread_pool);
+
+	for (const Color me : table_colors())
 		m_dtm_file[me].create(m_epsi.num_positions());
 
 	open_sub_egtb();
 
-	EGTB_Bits_Pool tmp_bits(5, m_epsi.num_positions());
+	EGTB_Bits_Pool tmp_bits(3 + table_colors().size(), m_epsi.num_positions());
+
+	for (const Color me : table_colors())
+		m_unknown_bits[me] = tmp_bits.acquire_cleared(thread_pool);
 
-	m_unknown_bits[WHITE] = tmp_bits.acquire_cleared(thread_pool);
-	m_unknown_bits[BLACK] = tmp_bits.acquire_cleared(thread_pool);
+	m_resume_state = m_checkpoint.load_state();
+
+	if (!m_resume_state.has_value())
+	{
+		init_entries(thread_pool);
 
-	init_entries(thread_pool);
+		loop_init_check_chase(thread_pool, inout_param(tmp_bits));
 
-	loop_init_check_chase(thread_pool, inout_param(tmp_bits));
+		//第二步，迭代获取输赢信息
 
-	//第二步，迭代获取输赢信息
+		gen_rule_lose(thread_pool, inout_param(tmp_bits));
 
-	gen_rule_lose(thread_pool, inout_param(tmp_bits));
+		maybe_save_checkpoint(
+			thread_pool,
+			EGTB_Checkpoint_Stage::INITIALIZED,
+			{ static_cast<uint64_t>(m_max_build_step[WHITE].load()), static_cast<uint64_t>(m_max_build_step[BLACK].load()) },
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] }
+		);
+	}
+	else if (is_resuming_at(EGTB_Checkpoint_Stage::INITIALIZED))
+	{
+		const auto counters = restore_checkpoint(thread_pool, { &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] });
+		m_max_build_step[WHITE] = static_cast<DTM_Score>(counters[0]);
+		m_max_build_step[BLACK] = static_cast<DTM_Score>(counters[1]);
+	}
 
-	build_steps(thread_pool, WHITE, inout_param(tmp_bits));
-	build_steps(thread_pool, BLACK, inout_param(tmp_bits));
+	for (const Color root_color : table_colors())
+		build_steps(thread_pool, root_color, inout_param(tmp_bits));
 
-	tmp_bits.release(std::move(m_unknown_bits[WHITE]));
-	tmp_bits.release(std::move(m_unknown_bits[BLACK]));
+	for (const Color me : table_colors())
+		tmp_bits.release(std::move(m_unknown_bits[me]));
+
+	if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED))
+		restore_checkpoint(thread_pool, {});
+	else if (!m_resume_state.has_value())
+		maybe_save_checkpoint(thread_pool, EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED, {}, {});
 
 	loop_build_check_chase(thread_pool, inout_param(tmp_bits));
 
-	const EGTB_Info info = check_dtm_egtb(thread_pool);
+	if (m_resume_state.has_value())
+		print_and_abort("Checkpoint stage %u was not restored\n", static_cast<unsigned>(m_resume_state->stage));
+
+	m_info = check_dtm_egtb(thread_pool);
+	m_generation_stats = make_egtb_generation_stats(m_info, m_gen_start_time);
+
+	if (m_dtm_settings.omit_draws)
+		mark_decisive_positions(thread_pool, m_decisive_bits, [this](Color c, Board_Index pos) {
+			return m_wdl_file.read(c, pos);
+		});
+
 	close_sub_egtb();
+	release_legal_positions();
+}
 
-	// Release some memory for compression.
-	tmp_bits.clear();
+void DTM_Generator::save_dtm(In_Out_Param<Thread_Pool> thread_pool)
+{
+	save_egtb(thread_pool, m_info);
 
-	save_egtb(thread_pool, info);
+	// Only now the generation doesn't have to be repeated.
+	m_checkpoint.remove();
 
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
+	{
 		m_dtm_file[me].close();
+		m_decisive_bits[me] = EGTB_Bits();
+	}
 }
 
 DTM_Intermediate_Entry DTM_Generator::check_remove_lose(Position_For_Gen& pos_gen, DTM_Intermediate_Entry tt) const
@@ -998,7 +1153,7 @@ DTM_Intermediate_Entry DTM_Generator::check_remove_lose(Position_For_Gen& pos_ge
 		if (!in_check)
 			return true;
 
-		Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+		Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 		auto& next_board = next_pos_gen.board();
 
 		for (const Move move2 : next_board.gen_pseudo_legal_quiets())
@@ -1107,7 +1262,7 @@ DTM_Intermediate_Entry DTM_Generator::check_remove_win(Position_For_Gen& pos_gen
 				|| !board.is_move_evasion(move, out_param(evt_piecebb)))
 				continue;
 
-			Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+			Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 			auto& next_board = next_pos_gen.board();
 
 			for (const Move move2 : next_board.gen_pseudo_legal_quiets())
@@ -1119,7 +1274,7 @@ DTM_Intermediate_Entry DTM_Generator::check_remove_win(Position_For_Gen& pos_gen
 				if (   entry2.is_legal()
 					&& entry2.has_flag(DTM_FLAG_CHASE_WIN)
 					&& next_board.has_attack_after_quiet_move(move2, out_param(capbb))
-					&& (capbb & evt_piecebb.maybe_mirror_files(mirr)))
+					&& (capbb & to_next_position_frame(evt_piecebb, mirr)))
 					return tt;
 			}
 		}
@@ -1132,6 +1287,19 @@ DTM_Intermediate_Entry DTM_Generator::check_remove_win(Position_For_Gen& pos_gen
 
 EGTB_Info DTM_Generator::check_dtm_egtb(In_Out_Param<Thread_Pool> thread_pool)
 {
+	// Statistics of black are still reported for symmetric configurations.
+	// It reads the white table, so it has to be done before sp_check_dtm_egtb replaces illegal entries.
+	std::vector<EGTB_Info> swapped_infos;
+	if (m_is_symmetric)
+	{
+		auto swapped_gen_iterator = make_gen_iterator();
+		swapped_infos = thread_pool->run_sync_task_on_all_threads(
+			[&](size_t thread_id) {
+				return sp_check_color_swapped_dtm_egtb(inout_param(swapped_gen_iterator));
+			}
+		);
+	}
+
 	auto gen_iterator = make_gen_iterator();
 	auto infos = thread_pool->run_sync_task_on_all_threads(
 		[&](size_t thread_id) {
@@ -1142,7 +1310,10 @@ EGTB_Info DTM_Generator::check_dtm_egtb(In_Out_Param<Thread_Pool> thread_pool)
 	EGTB_Info info;
 	for (const Color c : { WHITE, BLACK })
 	{
-		info.consolidate_from(infos.begin(), infos.end(), c);
+		if (c == BLACK && m_is_symmetric)
+			info.consolidate_from(swapped_infos.begin(), swapped_infos.end(), c);
+		else
+			info.consolidate_from(infos.begin(), infos.end(), c);
 
 		if (info.longest_win[c] != 0)
 		{
@@ -1160,14 +1331,16 @@ EGTB_Info DTM_Generator::sp_check_dtm_egtb(In_Out_Param<Shared_Board_Index_Itera
 
 	for (const Board_Index current_pos : gen_iterator->indices())
 	{
-		for (const Color c : { WHITE, BLACK })
+		for (const Color c : table_colors())
 		{
 			auto entry = read_dtm<DTM_Final_Entry>(current_pos, c);
-			const WDL_Entry sc = m_wdl_file.read(c, current_pos);
+			ASSERT(entry.is_legal() == m_legal_positions->is_legal(current_pos, c));
 
-			if (!entry.is_legal())
+			if (!m_legal_positions->is_legal(current_pos, c))
 			{
-				write_dtm(current_pos, c, DTM_Final_Entry::make_draw());
+				// With fill_illegal they are left for save_egtb_table to fill.
+				if (!m_dtm_settings.fill_illegal)
+					write_dtm(current_pos, c, DTM_Final_Entry::make_draw());
 				info.illegal_cnt[c] += 1;
 
 				continue;
@@ -1178,6 +1351,8 @@ EGTB_Info DTM_Generator::sp_check_dtm_egtb(In_Out_Param<Shared_Board_Index_Itera
 				write_dtm(current_pos, c, entry);
 			}
 
+			const WDL_Entry sc = m_wdl_file.read(c, current_pos);
+
 			auto on_wrong_result = [&](const char* result_str) {
 				char fen[MAX_FEN_LENGTH];
 				Position_For_Gen pos_gen(m_epsi, current_pos, c);
@@ -1220,6 +1395,74 @@ EGTB_Info DTM_Generator::sp_check_dtm_egtb(In_Out_Param<Shared_Board_Index_Itera
 	return info;
 }
 
+EGTB_Info DTM_Generator::sp_check_color_swapped_dtm_egtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator)
+{
+	ASSERT(m_is_symmetric);
+
+	EGTB_Info info;
+
+	// Only the placement is needed for the color swapped index, so the boards are never set up.
+	// A black to move position is illegal exactly when the color swapped one is,
+	// except when pieces collide (see DTC_Generator::sp_gen_color_swapped_evtb).
+	for (const Position_For_Gen& pos_gen : gen_iterator->boards(m_epsi))
+	{
+		const Board_Index current_pos = pos_gen.board_index();
+
+		if (   m_epsi.board_index_layout() == Board_Index_Layout::FREE_PIECE_RELATIVE
+			&& m_epsi.has_colliding_pieces(pos_gen.index()))
+		{
+			info.illegal_cnt[BLACK] += 1;
+			continue;
+		}
+
+		const auto entry = read_dtm<DTM_Final_Entry>(color_swapped_index(pos_gen), WHITE);
+
+		// Must agree with the black WDL table, which was generated separately.
+		const WDL_Entry sc = m_wdl_file.read(BLACK, current_pos);
+
+		auto on_wrong_result = [&](const char* result_str) {
+			char fen[MAX_FEN_LENGTH];
+			Position_For_Gen black_pos_gen(m_epsi, current_pos, BLACK);
+			black_pos_gen.get_fen(Span(fen));
+			print_and_abort("%d find different! %s  %llu\n%s\n", BLACK, result_str, current_pos, fen);
+		};
+
+		if (!entry.is_legal())
+			info.illegal_cnt[BLACK] += 1;
+		else if (entry.score() == 0)
+		{
+			if (sc != WDL_Entry::DRAW)
+				on_wrong_result("DRAW");
+
+			info.draw_cnt[BLACK] += 1;
+		}
+		else if (entry.is_lose())
+		{
+			if (sc != WDL_Entry::LOSE)
+				on_wrong_result("LOSE");
+
+			info.lose_cnt[BLACK] += 1;
+		}
+		else if (entry.is_win())
+		{
+			if (sc != WDL_Entry::WIN)
+				on_wrong_result("WIN");
+
+			info.win_cnt[BLACK] += 1;
+
+			if (entry.score() > info.longest_win[BLACK])
+			{
+				info.longest_win[BLACK] = narrowing_static_cast<uint16_t>(entry.score());
+				info.longest_idx[BLACK] = current_pos;
+			}
+		}
+		else
+			on_wrong_result("NONE");
+	}
+
+	return info;
+}
+
 DTM_Final_Entry DTM_Generator::read_sub_tb_dtm(
 	const Position_For_Gen& pos_gen,
 	Move move
@@ -1247,7 +1490,7 @@ void DTM_Generator::sp_second_init(In_Out_Param<Shared_Board_Index_Iterator> gen
 			if (turn == root_color
 				? entry.is_win() && entry.score() > 2
 				: entry.is_lose() && entry.score() > 1)
-				m_unknown_bits[turn].set_bit(current_pos);
+				unknown_bits(turn).set_bit(current_pos);
 		}
 	}
 }
@@ -1276,7 +1519,7 @@ void DTM_Generator::sp_init_check_chase(
 		const Board_Index current_pos = pos_gen.board_index();
 		bool in_check = false;
 
-		for (const Color me : { WHITE, BLACK })
+		for (const Color me : table_colors())
 		{
 			if (is_known(current_pos, me))
 				continue;
@@ -1310,15 +1553,16 @@ void DTM_Generator::sp_init_check_chase(
 				// Otherwise current_pos might not get marked correctly.
 				for (const Board_Index next_ix : next_quiet_index_with_mirror(pos_gen, move))
 				{
+					assert_legal_lookup(next_ix, opp);
 					if (is_known(next_ix, opp))
 						continue;
 
-					const WDL_Entry sc2 = m_wdl_file.read(opp, next_ix);
+					const WDL_Entry sc2 = m_wdl_file.read(table_color(opp), next_ix);
 					if ((sc == WDL_Entry::WIN) ? (sc2 == WDL_Entry::LOSE) : (!in_check && sc2 == WDL_Entry::WIN))
 					{
 						find = true;
 						lock_or_dtm(next_ix, opp, in_check ? DTM_FLAG_CHECK_LOSE : DTM_FLAG_CHASE_LOSE);
-						rule_bits[opp].lock_set_bit(next_ix);
+						rule_bits[table_color(opp)].lock_set_bit(next_ix);
 					}
 				}
 			}
@@ -1413,10 +1657,10 @@ void DTM_Generator::sp_find_rule_lose(
 			continue;
 		if (entry.has_flag(DTM_FLAG_CHECK_LOSE) && entry.has_flag(DTM_FLAG_CHASE_LOSE))
 			continue;
-		if (m_wdl_file.read(me, current_pos) != WDL_Entry::LOSE)
+		if (m_wdl_file.read(table_color(me), current_pos) != WDL_Entry::LOSE)
 			continue;
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		const auto& board = pos_gen.board();
 
 		Fixed_Vector<Board_Index, MAX_NEXT_TB_ENTRIES> next_tb;
@@ -1432,7 +1676,7 @@ void DTM_Generator::sp_find_rule_lose(
 			// 赢棋
 			if (  (   !(entry.has_flag(DTM_FLAG_CHECK_LOSE) && entry2.has_flag(DTM_FLAG_CHECK_WIN))
 					&& !(entry.has_flag(DTM_FLAG_CHASE_LOSE) && entry2.has_flag(DTM_FLAG_CHASE_WIN)))
-				|| (m_wdl_file.read(opp, next_ix) != WDL_Entry::WIN))
+				|| (m_wdl_file.read(table_color(opp), next_ix) != WDL_Entry::WIN))
 			{
 				is_rule_lose = false;
 				break;
@@ -1485,7 +1729,7 @@ void DTM_Generator::sp_save_rule_lose(
 			: DTM_SCORE_TERMINAL_LOSS
 		);
 		write_dtm(current_pos, me, new_entry);
-		m_unknown_bits[me].clear_bit(current_pos);
+		unknown_bits(me).clear_bit(current_pos);
 	}
 }
 
@@ -1512,7 +1756,7 @@ bool DTM_Generator::sp_remove_rule_lose(
 
 	for (const Board_Index current_pos : gen_iterator->indices(*gen_bits))
 	{
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		const auto& board = pos_gen.board();
 
 		bool find = false;
@@ -1585,7 +1829,7 @@ bool DTM_Generator::sp_change_win_pos(
 		if (entry.score() != n && entry.score() != n + 1)
 			continue;
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		auto& board = pos_gen.board();
 
 		ASSERT(board.is_legal());
@@ -1731,7 +1975,7 @@ bool DTM_Generator::sp_change_win_pos(
 				{
 					const auto& [next_ix, move, mirr] = next_tb[chase_ix];
 
-					Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+					Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 					auto& next_board = next_pos_gen.board();
 
 					Fixed_Vector<std::tuple<Board_Index, Move, bool>, MAX_NEXT_TB_ENTRIES> next_tb2;
@@ -1775,7 +2019,7 @@ bool DTM_Generator::sp_change_win_pos(
 						{
 							Bitboard evtbb;
 							if (   next_board.is_move_evasion(move2, out_param(evtbb))
-								&& (capbb & evtbb.maybe_mirror_files(mirr))
+								&& (capbb & to_next_position_frame(evtbb, mirr))
 								&& check_double_chase_win(next_pos_gen, move2, next_ix2, me, mirr2, max_step))
 							{
 								find_evt = true;
@@ -2,6 +2,8 @@
 
 #include "egtb.h"
 #include "egtb_gen.h"
+#include "egtb_checkpoint.h"
+#include "egtb_compress.h"
 
 #include "chess/chess.h"
 #include "chess/move.h"
@@ -14,6 +16,7 @@
 #include "util/progress_bar.h"
 
 #include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <map>
@@ -45,9 +48,15 @@ struct DTM_Generator : public EGTB_Generator
 
 		info.num_positions = *maybe_num_positions;
 
+		const Piece_Config_For_Gen relative_epsi(ps, Board_Index_Layout::FREE_PIECE_RELATIVE);
+		info.num_cartesian_positions = relative_epsi.num_cartesian_positions();
+		info.num_relative_positions = relative_epsi.num_positions();
+
+		const size_t num_tables = num_tables_for_generation(ps);
 		info.memory_required_for_generation =
-			  info.num_positions * (sizeof(DTM_Final_Entry) * 2)
-			+ info.num_positions * 5 / 8; // EGTB_Bits
+			  info.num_positions * (sizeof(DTM_Final_Entry) * num_tables)
+			+ info.num_positions * (3 + num_tables) / 8 // EGTB_Bits
+			+ EGTB_Legal_Positions::memory_required(info.num_positions, num_tables);
 
 		info.uncompressed_size = info.num_positions * (sizeof(DTM_Final_Entry) * 2);
 
@@ -63,11 +72,29 @@ struct DTM_Generator : public EGTB_Generator
 	DTM_Generator(
 		const Piece_Config& ps, 
 		bool srb,
-		const EGTB_Paths& egtb_files
+		const EGTB_Paths& egtb_files,
+		std::chrono::seconds checkpoint_interval = std::chrono::seconds(0),
+		const EGTB_Save_Settings& dtm_settings = EGTB_Save_Settings(),
+		std::shared_ptr<const EGTB_Legal_Positions> legal_positions = nullptr
 	);
 
+	// Generates the tables, they are saved by save_dtm().
 	void gen(In_Out_Param<Thread_Pool> thread_pool);
 
+	// Saves the DTM tables, must be called after gen(). Only the generated
+	// tables are needed, so it can run on another thread pool while the
+	// generation of other tables starts.
+	void save_dtm(In_Out_Param<Thread_Pool> thread_pool);
+
+	// The memory held until save_dtm() finishes.
+	NODISCARD size_t memory_held_for_saving() const
+	{
+		size_t memory = 0;
+		for (const Color me : table_colors())
+			memory += m_dtm_file[me].data_span().size() + m_decisive_bits[me].data_span().size();
+		return memory;
+	}
+
 protected:
 	WDL_File_For_Probe m_wdl_file;
 	DTM_File_For_Gen m_dtm_file[COLOR_NB];
@@ -81,44 +108,82 @@ protected:
 	EGTB_Paths m_egtb_files;
 	Temporary_File_Tracker m_tmp_files;
 	bool m_save_rule_bits;
+	EGTB_Save_Settings m_dtm_settings;
 
 	EGTB_Bits m_unknown_bits[COLOR_NB];
 
+	// Only with omit_draws, the positions saved in the DTM tables.
+	EGTB_Bits m_decisive_bits[COLOR_NB];
+
+	EGTB_Checkpoint m_checkpoint;
+	std::optional<EGTB_Checkpoint_State> m_resume_state;
+
+	EGTB_Info m_info;
+
+	// Saved with the tables, from the start of gen() until m_info is known.
+	std::chrono::steady_clock::time_point m_gen_start_time;
+	EGTB_Generation_Stats m_generation_stats;
+
+	NODISCARD inline EGTB_Bits& unknown_bits(const Color me)
+	{
+		return m_unknown_bits[table_color(me)];
+	}
+
 	NODISCARD inline bool is_known(const Board_Index pos, const Color me) const
 	{
-		return !m_unknown_bits[me].bit_is_set(pos);
+		return !m_unknown_bits[table_color(me)].bit_is_set(pos);
 	}
 
 	NODISCARD inline bool is_unknown(const Board_Index pos, const Color me) const
 	{
-		return m_unknown_bits[me].bit_is_set(pos);
+		return m_unknown_bits[table_color(me)].bit_is_set(pos);
 	}
 
 	template <typename EntryT>
 	NODISCARD inline EntryT read_dtm(const Board_Index pos, const Color me) const
 	{
-		return m_dtm_file[me].read<EntryT>(pos);
+		return m_dtm_file[table_color(me)].read<EntryT>(pos);
 	}
 
 	template <typename EntryT>
 	inline void write_dtm(const Board_Index pos, const Color me, const EntryT entry)
 	{
-		m_dtm_file[me].write(entry, pos);
+		m_dtm_file[table_color(me)].write(entry, pos);
 	}
 
 	inline void lock_or_dtm(const Board_Index pos, const Color me, DTM_Rule_Flag flag)
 	{
-		m_dtm_file[me].lock_add_flags(pos, flag);
+		m_dtm_file[table_color(me)].lock_add_flags(pos, flag);
 	}
 
 	inline void or_dtm(const Board_Index pos, const Color me, DTM_Rule_Flag flag)
 	{
-		m_dtm_file[me].add_flags(pos, flag);
+		m_dtm_file[table_color(me)].add_flags(pos, flag);
 	}
 
 	void open_sub_egtb();
 	void close_sub_egtb();
 
+	// Saves the entries, the given bitmaps and counters if the checkpoint interval has passed.
+	void maybe_save_checkpoint(
+		In_Out_Param<Thread_Pool> thread_pool,
+		EGTB_Checkpoint_Stage stage,
+		std::vector<uint64_t> counters,
+		std::initializer_list<const EGTB_Bits*> bits
+	);
+
+	// Restores the entries and the given bitmaps from m_resume_state and consumes it.
+	// Returns the saved counters.
+	std::vector<uint64_t> restore_checkpoint(
+		In_Out_Param<Thread_Pool> thread_pool,
+		std::initializer_list<EGTB_Bits*> bits
+	);
+
+	NODISCARD bool is_resuming_at(EGTB_Checkpoint_Stage stage) const
+	{
+		return m_resume_state.has_value() && m_resume_state->stage == stage;
+	}
+
 	void save_egtb(In_Out_Param<Thread_Pool> thread_pool, const EGTB_Info& info);
 
 	void init_entries(In_Out_Param<Thread_Pool> thread_pool);
@@ -337,6 +402,7 @@ protected:
 
 	NODISCARD EGTB_Info check_dtm_egtb(In_Out_Param<Thread_Pool> thread_pool);
 	NODISCARD EGTB_Info sp_check_dtm_egtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator);
+	NODISCARD EGTB_Info sp_check_color_swapped_dtm_egtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator);
 
 	void build_steps(In_Out_Param<Thread_Pool> thread_pool, Color root_color, In_Out_Param<EGTB_Bits_Pool> tmp_bits);
 
@@ -34,20 +34,77 @@ DTC_Generator::DTC_Generator(
 	const Piece_Config& ps,
 	bool save_wdl,
 	bool save_dtc,
-	const EGTB_Paths& egtb_files
+	const EGTB_Paths& egtb_files,
+	std::chrono::seconds checkpoint_interval,
+	const WDL_Save_Settings& wdl_settings,
+	const EGTB_Save_Settings& dtc_settings,
+	std::shared_ptr<const EGTB_Legal_Positions> legal_positions
 ) :
-	EGTB_Generator(ps),
+	EGTB_Generator(ps, std::move(legal_positions)),
 	m_egtb_files(egtb_files),
 	m_save_wdl(save_wdl),
 	m_save_dtc(save_dtc),
-	m_entry_order(DTC_Entry_Order::ORDER_64)
+	m_wdl_settings(wdl_settings),
+	m_dtc_settings(dtc_settings),
+	m_entry_order(DTC_Entry_Order::ORDER_64),
+	m_checkpoint(
+		egtb_files.dtc_checkpoint_path(ps),
+		ps,
+		EGTB_Magic::DTC_MAGIC,
+		m_epsi.num_positions(),
+		m_epsi.board_index_layout(),
+		m_epsi.board_index_group_order(),
+		checkpoint_interval
+	)
 {
+	// DTC entries have no rule bits to split off.
+	m_dtc_settings.layout = EGTB_Block_Layout::INTERLEAVED;
+
 	if (!save_wdl && !save_dtc)
 		return;
 
 	memset(m_sub_wdl_by_capture, 0, sizeof(m_sub_wdl_by_capture));
 }
 
+void DTC_Generator::maybe_save_checkpoint(
+	In_Out_Param<Thread_Pool> thread_pool,
+	EGTB_Checkpoint_Stage stage,
+	std::vector<uint64_t> counters,
+	std::initializer_list<const EGTB_Bits*> bits
+)
+{
+	if (!m_checkpoint.is_due())
+		return;
+
+	std::vector<Const_Span<uint8_t>> sections;
+	for (const Color c : table_colors())
+		sections.push_back(m_dtc_file[c].data_span());
+	for (const EGTB_Bits* b : bits)
+		sections.emplace_back(b->data_span());
+
+	m_checkpoint.save(thread_pool, EGTB_Checkpoint_State{ stage, std::move(counters) }, sections);
+}
+
+std::vector<uint64_t> DTC_Generator::restore_checkpoint(
+	In_Out_Param<Thread_Pool> thread_pool,
+	std::initializer_list<EGTB_Bits*> bits
+)
+{
+	ASSERT(m_resume_state.has_value());
+
+	std::vector<Span<uint8_t>> sections;
+	for (const Color c : table_colors())
+		sections.emplace_back(m_dtc_file[c].data_span());
+	for (EGTB_Bits* b : bits)
+		sections.emplace_back(b->data_span());
+
+	m_checkpoint.restore(thread_pool, sections);
+
+	std::vector<uint64_t> counters = std::move(m_resume_state->counters);
+	m_resume_state.reset();
+	return counters;
+}
+
 void DTC_Generator::open_sub_evtb()
 {
 	for (const Piece i : ALL_PIECES)
@@ -74,6 +131,22 @@ EGTB_Info DTC_Generator::gen_evtb(In_Out_Param<Thread_Pool> thread_pool)
 {
 	EGTB_Info info;
 
+	// The black WDL table of a symmetric configuration is still saved for generation.
+	// It's read from the white DTC table, before sp_gen_evtb replaces illegal entries.
+	std::vector<EGTB_Info> swapped_infos;
+	if (m_is_symmetric)
+	{
+		auto swapped_gen_iterator = make_gen_iterator();
+		swapped_infos = thread_pool->run_sync_task_on_all_threads(
+			[&](size_t thread_id) {
+				return TEMPLATE_DISPATCH(
+					(EGTB_Order_Template_Dispatch(m_entry_order)),
+					sp_gen_color_swapped_evtb, inout_param(swapped_gen_iterator)
+				);
+			}
+		);
+	}
+
 	auto gen_iterator = make_gen_iterator();
 	const auto infos = thread_pool->run_sync_task_on_all_threads(
 		[&](size_t thread_id) {
@@ -86,7 +159,10 @@ EGTB_Info DTC_Generator::gen_evtb(In_Out_Param<Thread_Pool> thread_pool)
 
 	for (const Color me : { WHITE, BLACK })
 	{
-		info.consolidate_from(infos.begin(), infos.end(), me);
+		if (me == BLACK && m_is_symmetric)
+			info.consolidate_from(swapped_infos.begin(), swapped_infos.end(), me);
+		else
+			info.consolidate_from(infos.begin(), infos.end(), me);
 
 		if (info.longest_win[me] > 0)
 		{
@@ -108,29 +184,26 @@ EGTB_Info DTC_Generator::sp_gen_evtb(In_Out_Param<Shared_Board_Index_Iterator> g
 
 	for (const Board_Index current_pos : gen_iterator->indices())
 	{
-		for (const Color me : { WHITE, BLACK })
+		for (const Color me : table_colors())
 		{
-			bool legal;
-			DTC_Score value;
+			const bool legal = m_legal_positions->is_legal(current_pos, me);
+			DTC_Score value = DTC_SCORE_ZERO;
 
 			const bool known = is_known(current_pos, me);
 
 			if (known)
 			{
 				const auto entry = read_dtc<DTC_Final_Entry>(current_pos, me);
-				legal = entry.is_legal();
+				ASSERT(entry.is_legal() == legal);
 				value = entry.value<ORDER>();
 			}
-			else
-			{
-				legal = true;
-				value = DTC_SCORE_ZERO;
-			}
 
 			WDL_Entry data;
 			if (!legal)
 			{
-				write_dtc(current_pos, me, DTC_Final_Entry::make_draw());
+				// With fill_illegal they are left for save_egtb_table to fill.
+				if (!m_dtc_settings.fill_illegal)
+					write_dtc(current_pos, me, DTC_Final_Entry::make_draw());
 				data = WDL_Entry::ILLEGAL;
 			}
 			else if (known && (value & 1))
@@ -157,91 +230,147 @@ EGTB_Info DTC_Generator::sp_gen_evtb(In_Out_Param<Shared_Board_Index_Iterator> g
 	return info;
 }
 
-void DTC_Generator::save_egtb(In_Out_Param<Thread_Pool> thread_pool)
+template <DTC_Entry_Order ORDER>
+EGTB_Info DTC_Generator::sp_gen_color_swapped_evtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator)
+{
+	ASSERT(m_is_symmetric);
+
+	EGTB_Info info;
+
+	// Only the placement is needed for the color swapped index, so the boards are never set up.
+	// A black to move position is illegal exactly when the color swapped one is,
+	// except when pieces collide, because then the color swapped index
+	// may not be of the same placement with the FREE_PIECE_RELATIVE layout.
+	for (const Position_For_Gen& pos_gen : gen_iterator->boards(m_epsi))
+	{
+		const Board_Index current_pos = pos_gen.board_index();
+
+		if (   m_epsi.board_index_layout() == Board_Index_Layout::FREE_PIECE_RELATIVE
+			&& m_epsi.has_colliding_pieces(pos_gen.index()))
+		{
+			info.add_result(BLACK, WDL_Entry::ILLEGAL);
+			m_wdl_file[BLACK].write(current_pos, WDL_Entry::ILLEGAL);
+			continue;
+		}
+
+		const Board_Index swapped_pos = color_swapped_index(pos_gen);
+
+		WDL_Entry data = WDL_Entry::DRAW;
+		if (is_known(swapped_pos, WHITE))
+		{
+			const auto entry = read_dtc<DTC_Final_Entry>(swapped_pos, WHITE);
+			const DTC_Score value = entry.value<ORDER>();
+
+			if (!entry.is_legal())
+				data = WDL_Entry::ILLEGAL;
+			else if (value & 1)
+				data = WDL_Entry::LOSE;
+			else if (value != 0)
+			{
+				data = WDL_Entry::WIN;
+				info.maybe_update_longest_win(BLACK, current_pos, value);
+			}
+		}
+
+		info.add_result(BLACK, data);
+
+		m_wdl_file[BLACK].write(current_pos, data);
+	}
+
+	return info;
+}
+
+void DTC_Generator::save_wdl(In_Out_Param<Thread_Pool> thread_pool)
 {
 	for (const Color me : { WHITE, BLACK })
 		m_wdl_file[me].create(m_epsi.num_positions());
 
-	EGTB_Info info = gen_evtb(thread_pool);
+	m_info = gen_evtb(thread_pool);
+	m_generation_stats = make_egtb_generation_stats(m_info, m_gen_start_time);
 
 	if (m_save_wdl)
 	{
 		const std::filesystem::path wdl_path = m_egtb_files.wdl_save_path(m_epsi);
 		const std::filesystem::path wdl_gen_path = m_egtb_files.wdl_gen_save_path(m_epsi);
 
-		Compressed_EGTB save_info[COLOR_NB];
-
 		for (const Color me : { WHITE, BLACK })
-		{
 			prepare_evtb_for_compression(thread_pool, m_wdl_file[me].entry_span());
 
-			save_info[me] = save_compress_evtb(
-				thread_pool,
-				m_wdl_file[me].entry_span(),
-				me, 
-				info
-			);
-		}
+		// Taken from the saved WDL tables, which are what the probing sees.
+		if (m_dtc_settings.omit_draws && m_save_dtc)
+			mark_decisive_positions(thread_pool, m_decisive_bits, [this](Color c, Board_Index pos) {
+				return get_wdl_value(m_wdl_file[c].entry_span()[pos / WDL_ENTRY_PACK_RATIO], pos % WDL_ENTRY_PACK_RATIO);
+			});
 
-		{
-			const auto colors = table_colors();
-			save_evtb_table(m_epsi, save_info, wdl_path, colors, EGTB_Magic::WDL_MAGIC);
+		std::vector<EGTB_Save_Target> targets{ { wdl_path, table_colors() } };
+		if (m_is_symmetric)
+			targets.push_back({ wdl_gen_path, { WHITE, BLACK } }); // force saving both tables
 
+		const Const_Span<Packed_WDL_Entries> src[COLOR_NB] = { m_wdl_file[WHITE].entry_span(), m_wdl_file[BLACK].entry_span() };
+		save_evtb_table(thread_pool, m_epsi, src, m_info, &m_generation_stats, targets, EGTB_Magic::WDL_MAGIC, m_wdl_settings);
+
+		{
 			const size_t file_size = std::filesystem::file_size(wdl_path);
-			const size_t uncompressed_size = colors.size() * m_epsi.num_positions() / WDL_ENTRY_PACK_RATIO;
+			const size_t uncompressed_size = table_colors().size() * m_epsi.num_positions() / WDL_ENTRY_PACK_RATIO;
 			const double compression_ratio = static_cast<double>(uncompressed_size) / file_size;
 			printf("Saved compressed WDL file. Compression ratio: x%.2f\n", compression_ratio);
 		}
 
 		if (m_is_symmetric)
 		{ 
-			// force saving both tables
-			save_evtb_table(m_epsi, save_info, wdl_gen_path, { WHITE, BLACK }, EGTB_Magic::WDL_MAGIC);
-
 			const size_t file_size = std::filesystem::file_size(wdl_gen_path);
 			const size_t uncompressed_size = 2 * m_epsi.num_positions() / WDL_ENTRY_PACK_RATIO;
 			const double compression_ratio = static_cast<double>(uncompressed_size) / file_size;
 			printf("Saved compressed WDL gen file. Compression ratio: x%.2f\n", compression_ratio);
 		}
-
-		for (const Color me : { WHITE, BLACK })
-			m_wdl_file[me].close();
 	}
 
+	for (const Color me : { WHITE, BLACK })
+		m_wdl_file[me].close();
+}
+
+void DTC_Generator::save_dtc(In_Out_Param<Thread_Pool> thread_pool)
+{
 	// 压缩写入egtb
 	if (m_save_dtc)
 	{
 		const std::filesystem::path info_path = m_egtb_files.dtc_info_save_path(m_epsi);
 		const std::filesystem::path dtc_path = m_egtb_files.dtc_save_path(m_epsi);
 
-		Compressed_EGTB save_info[COLOR_NB];
-
-		for (const Color me : { WHITE, BLACK })
-		{
-			save_info[me] = save_compress_egtb(
-				thread_pool,
-				m_dtc_file[me].data_span(),
-				me, 
-				info, 
-				m_entry_order == DTC_Entry_Order::ORDER_128
-			);
-
-			if (m_is_symmetric)
-				break;
-		}
+		const Const_Span<uint8_t> src[COLOR_NB] = { m_dtc_file[WHITE].data_span(), m_dtc_file[BLACK].data_span() };
+		const std::optional<EGTB_Value_Map_Stats> value_map_stats = save_egtb_table(
+			thread_pool,
+			m_epsi,
+			src,
+			m_info,
+			&m_generation_stats,
+			m_entry_order == DTC_Entry_Order::ORDER_128,
+			{ { dtc_path, table_colors() } },
+			EGTB_Magic::DTC_MAGIC,
+			m_dtc_settings,
+			m_decisive_bits[WHITE].empty() ? nullptr : m_decisive_bits
+		);
 
 		{
-			const auto colors = table_colors();
-			save_egtb_table(m_epsi, save_info, dtc_path, colors, EGTB_Magic::DTC_MAGIC);
-
 			const size_t file_size = std::filesystem::file_size(dtc_path);
-			const size_t uncompressed_size = colors.size() * m_epsi.num_positions() * sizeof(DTC_File_For_Gen::ENTRY_SIZE);
+			const size_t uncompressed_size = table_colors().size() * m_epsi.num_positions() * sizeof(DTC_File_For_Gen::ENTRY_SIZE);
 			const double compression_ratio = static_cast<double>(uncompressed_size) / file_size;
 			printf("Saved compressed DTC file. Compression ratio: x%.2f\n", compression_ratio);
 		}
 
 		std::ofstream fp(info_path, std::ios_base::binary);
-		fp.write(reinterpret_cast<const char*>(&info), sizeof(EGTB_Info));
+		fp.write(reinterpret_cast<const char*>(&m_info), sizeof(EGTB_Info));
+		if (value_map_stats.has_value())
+			fp.write(reinterpret_cast<const char*>(&*value_map_stats), sizeof(EGTB_Value_Map_Stats));
+	}
+
+	// Only now the generation doesn't have to be repeated.
+	m_checkpoint.remove();
+
+	for (const Color turn : table_colors())
+	{
+		m_dtc_file[turn].close();
+		m_decisive_bits[turn] = EGTB_Bits();
 	}
 }
 
@@ -257,7 +386,7 @@ bool DTC_Generator::sp_gen_pre_bits(
 
 	for (const Board_Index current_pos : gen_iterator->indices(gen_bits))
 	{
-		Position_For_Gen gen_pos(m_epsi, current_pos, me);
+		Position_For_Gen gen_pos(m_epsi, current_pos, table_color(me));
 
 		auto& board = gen_pos.board();
 		ASSERT(board.is_legal());
@@ -311,7 +440,7 @@ bool DTC_Generator::sp_save_win(
 	{
 		added_new = true;
 		write_dtc(current_pos, me, DTC_Final_Entry::make_score<ORDER>(n, m_max_order));
-		m_unknown_bits[me].clear_bit(current_pos);
+		unknown_bits(me).clear_bit(current_pos);
 		gen_bits->set_bit(current_pos);
 		win_bits->set_bit(current_pos);
 	}
@@ -360,7 +489,7 @@ bool DTC_Generator::sp_prove_lose(
 		if (entry.has_flag(DTC_FLAG_CAP_DRAW))
 			continue;
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 		auto& board = pos_gen.board();
 		ASSERT(board.is_legal());
 
@@ -373,6 +502,7 @@ bool DTC_Generator::sp_prove_lose(
 				continue;
 
 			const Board_Index next_ix = next_quiet_index(pos_gen, move);
+			assert_legal_lookup(next_ix, color_opp(me));
 			if (!win_bits.bit_is_set(next_ix))
 			{
 				lose = false;
@@ -384,7 +514,7 @@ bool DTC_Generator::sp_prove_lose(
 		{
 			added_new = true;
 			write_dtc(current_pos, me, DTC_Final_Entry::make_score<ORDER>(n, m_max_order));
-			m_unknown_bits[me].clear_bit(current_pos);
+			unknown_bits(me).clear_bit(current_pos);
 			gen_bits->set_bit(current_pos);
 		}
 	}
@@ -426,8 +556,7 @@ DTC_Any_Entry DTC_Generator::make_initial_entry(const Position_For_Gen& pos_gen)
 
 	auto& pos = pos_gen.board();
 
-	if (!pos.is_legal())
-		return DTC_Final_Entry::make_illegal();
+	ASSERT(pos.is_legal());
 
 	if (pos.is_draw())
 		return DTC_Final_Entry::make_draw();
@@ -489,15 +618,15 @@ void DTC_Generator::sp_init_entries(
 		const Board_Index current_pos = pos_gen.board_index();
 		ASSERT(current_pos == m_epsi.compose_board_index(pos_gen.index()));
 
-		if (!pos_gen.is_legal())
+		for (const Color us : table_colors())
 		{
-			write_dtc(current_pos, WHITE, DTC_Final_Entry::make_illegal());
-			write_dtc(current_pos, BLACK, DTC_Final_Entry::make_illegal());
-			continue;
-		}
+			// The board is not set up at all when the placement is illegal.
+			if (!m_legal_positions->is_legal(current_pos, us))
+			{
+				write_dtc(current_pos, us, DTC_Final_Entry::make_illegal());
+				continue;
+			}
 
-		for (const Color us : { WHITE, BLACK })
-		{
 			pos_gen.set_turn(us);
 
 			const DTC_Any_Entry result = make_initial_entry(pos_gen);
@@ -600,39 +729,73 @@ void DTC_Generator::gen(In_Out_Param<Thread_Pool> thread_pool)
 {
 	printf("%s gen dtc start...\n", m_epsi.name().c_str());
 
-	for (const Color turn : { WHITE, BLACK })
+	m_gen_start_time = std::chrono::steady_clock::now();
+
+	acquire_legal_positions(thread_pool);
+
+	for (const Color turn : table_colors())
 		m_dtc_file[turn].create(m_epsi.num_positions());
 
-	open_sub_evtb();
+	EGTB_Bits_Pool tmp_bits(3 + table_colors().size(), m_epsi.num_positions());
 
-	EGTB_Bits_Pool tmp_bits(5, m_epsi.num_positions());
+	for (const Color turn : table_colors())
+		m_unknown_bits[turn] = tmp_bits.acquire_cleared(thread_pool);
 
-	m_unknown_bits[WHITE] = tmp_bits.acquire_cleared(thread_pool);
-	m_unknown_bits[BLACK] = tmp_bits.acquire_cleared(thread_pool);
+	m_resume_state = m_checkpoint.load_state();
 
-	init_entries(thread_pool);
-	close_sub_evtb();
+	if (!m_resume_state.has_value())
+	{
+		open_sub_evtb();
+		init_entries(thread_pool);
+		close_sub_evtb();
+
+		maybe_save_checkpoint(
+			thread_pool, 
+			EGTB_Checkpoint_Stage::INITIALIZED, 
+			{}, 
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] }
+		);
+	}
+	else if (is_resuming_at(EGTB_Checkpoint_Stage::INITIALIZED))
+		restore_checkpoint(thread_pool, { &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] });
 
 	// 第二步，迭代获取输赢信息
 	m_max_order = DTC_ORDER_ZERO;
 	m_max_conv = DTC_SCORE_ZERO;
 	m_entry_order = DTC_Entry_Order::ORDER_64;
 
-	build_steps(thread_pool, WHITE, inout_param(tmp_bits));
-	build_steps(thread_pool, BLACK, inout_param(tmp_bits));
+	for (const Color root_color : table_colors())
+		build_steps(thread_pool, root_color, inout_param(tmp_bits));
+
+	if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED))
+	{
+		const auto counters = restore_checkpoint(thread_pool, { &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] });
+		m_max_conv = static_cast<DTC_Score>(counters[0]);
+	}
+	else if (!m_resume_state.has_value())
+	{
+		maybe_save_checkpoint(
+			thread_pool, 
+			EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED, 
+			{ static_cast<uint64_t>(m_max_conv) }, 
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] }
+		);
+	}
 
 	loop_build_check_chase(thread_pool, inout_param(tmp_bits));
 
+	if (m_resume_state.has_value())
+		print_and_abort("Checkpoint stage %u was not restored\n", static_cast<unsigned>(m_resume_state->stage));
+
 	// Release some memory for WDL tables and for compression.
 	tmp_bits.clear();
 
-	save_egtb(thread_pool);
+	save_wdl(thread_pool);
 
-	tmp_bits.release(std::move(m_unknown_bits[WHITE]));
-	tmp_bits.release(std::move(m_unknown_bits[BLACK]));
+	release_legal_positions();
 
-	for (const Color turn : { WHITE, BLACK })
-		m_dtc_file[turn].close();
+	for (const Color turn : table_colors())
+		tmp_bits.release(std::move(m_unknown_bits[turn]));
 }
 
 void DTC_Generator::build_steps(
@@ -641,18 +804,41 @@ void DTC_Generator::build_steps(
 	In_Out_Param<EGTB_Bits_Pool> tmp_bits
 )
 {
+	// Already done before the checkpoint was taken.
+	if (   is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS_FINISHED)
+		|| is_resuming_at(EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE)
+		|| (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS) && m_resume_state->counters[0] > static_cast<uint64_t>(root_color)))
+		return;
+
 	const auto start_time = std::chrono::steady_clock::now();
 
 	EGTB_Bits pre_bits = tmp_bits->acquire_dirty();
 	EGTB_Bits win_bits = tmp_bits->acquire_dirty();
 	EGTB_Bits gen_bits = tmp_bits->acquire_dirty();
 
-	load_win_bits(thread_pool, root_color, out_param(win_bits));
-
 	Color me = root_color;
 	Color opp = color_opp(root_color);
 	DTC_Score new_conv = DTC_SCORE_ZERO;
-	for (DTC_Score n = static_cast<DTC_Score>(1);; ++n, std::swap(me, opp))
+	DTC_Score first_conv = static_cast<DTC_Score>(1);
+
+	if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_STEPS))
+	{
+		const auto counters = restore_checkpoint(
+			thread_pool, 
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK], &gen_bits, &win_bits }
+		);
+		first_conv = static_cast<DTC_Score>(counters[1] + 1);
+		new_conv = static_cast<DTC_Score>(counters[2]);
+		m_max_conv = static_cast<DTC_Score>(counters[3]);
+
+		// Odd iterations are done by the root color.
+		if ((first_conv & 1) == 0)
+			std::swap(me, opp);
+	}
+	else
+		load_win_bits(thread_pool, root_color, out_param(win_bits));
+
+	for (DTC_Score n = first_conv;; ++n, std::swap(me, opp))
 	{
 		printf("build conv %zu\r", static_cast<size_t>(n));
 		fflush(stdout);
@@ -675,6 +861,18 @@ void DTC_Generator::build_steps(
 
 		if (n >= 2 && !more_work)
 			break;
+
+		maybe_save_checkpoint(
+			thread_pool,
+			EGTB_Checkpoint_Stage::BUILD_STEPS,
+			{ 
+				static_cast<uint64_t>(root_color), 
+				static_cast<uint64_t>(n), 
+				static_cast<uint64_t>(new_conv), 
+				static_cast<uint64_t>(m_max_conv) 
+			},
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK], &gen_bits, &win_bits }
+		);
 	};
 
 	tmp_bits->release(std::move(pre_bits));
@@ -708,7 +906,7 @@ bool DTC_Generator::sp_init_check_chase(
 		const Board_Index current_pos = pos_gen.board_index();
 		bool in_check = false;
 
-		for (const Color me : { WHITE, BLACK })
+		for (const Color me : table_colors())
 		{
 			if (is_known(current_pos, me))
 				continue;
@@ -737,6 +935,7 @@ bool DTC_Generator::sp_init_check_chase(
 				// Otherwise current_pos might not get marked correctly.
 				for (const Board_Index next_ix : next_quiet_index_with_mirror(pos_gen, move))
 				{
+					assert_legal_lookup(next_ix, opp);
 					if (is_unknown(next_ix, opp))
 					{
 						lock_or_dtc(next_ix, opp, in_check ? (DTC_FLAG_CHECK | DTC_FLAG_CHECK_LOSE) : (DTC_FLAG_CHASE | DTC_FLAG_CHASE_LOSE));
@@ -785,7 +984,7 @@ void DTC_Generator::sp_label_may_check_chase(
 
 	for (const Board_Index current_pos : gen_iterator->indices())
 	{
-		for (const Color me : { WHITE, BLACK })
+		for (const Color me : table_colors())
 		{
 			if (is_known(current_pos, me))
 				continue;
@@ -832,8 +1031,8 @@ void DTC_Generator::label_may_check_chase(
 	Out_Param<EGTB_Bits[COLOR_NB]> rule_bits
 )
 {
-	rule_bits[WHITE].clear(thread_pool);
-	rule_bits[BLACK].clear(thread_pool);
+	for (const Color me : table_colors())
+		rule_bits[me].clear(thread_pool);
 	auto gen_iterator = make_gen_iterator();
 	thread_pool->run_sync_task_on_all_threads(
 		[&](size_t thread_id) {
@@ -871,7 +1070,7 @@ bool DTC_Generator::sp_label_real_check_chase(
 				find_new = true;
 				write_dtc(current_pos, me, DTC_Final_Entry::make_score<ORDER>(DTC_SCORE_TERMINAL_LOSS, m_max_order));
 				gen_bits->set_bit(current_pos);
-				m_unknown_bits[me].clear_bit(current_pos);
+				unknown_bits(me).clear_bit(current_pos);
 			}
 
 			break;
@@ -925,7 +1124,7 @@ bool DTC_Generator::sp_remove_fake(
 		if (!entry.has_flag(flag_mask))
 			continue;
 
-		Position_For_Gen pos_gen(m_epsi, current_pos, me);
+		Position_For_Gen pos_gen(m_epsi, current_pos, table_color(me));
 
 		const auto new_entry =
 			(n & 1)
@@ -1042,7 +1241,7 @@ DTC_Intermediate_Entry DTC_Generator::check_remove_lose(
 			bool mirr;
 			const Board_Index next_ix = next_quiet_index(pos_gen, move, out_param(mirr));
 
-			Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+			Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 			auto& next_board = next_pos_gen.board();
 
 			bool find_no_check = false;
@@ -1418,7 +1617,7 @@ DTC_Intermediate_Entry DTC_Generator::check_remove_win(
 						              && entry.has_flag(DTC_FLAG_CHASE_WIN)
 						              && board.has_attack_after_quiet_move(move);
 
-			Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+			Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 			auto& next_board = next_pos_gen.board();
 
 			Move_List chase_list2;
@@ -1474,7 +1673,7 @@ DTC_Intermediate_Entry DTC_Generator::check_remove_win(
 				}
 			}
 
-			const Bitboard adjusted_evt_piecebb = evt_piecebb.maybe_mirror_files(mirr);
+			const Bitboard adjusted_evt_piecebb = to_next_position_frame(evt_piecebb, mirr);
 
 			if (   find_chase 
 				&& (!other_chase || TypeV <= Remove_Fake_Step::STEP_2))
@@ -1536,11 +1735,11 @@ DTC_Intermediate_Entry DTC_Generator::check_remove_win(
 			if constexpr (TypeV == Remove_Fake_Step::STEP_1)
 				return tt;
 
-			Position_For_Gen next_pos_gen(pos_gen, move, next_ix, mirr);
+			Position_For_Gen next_pos_gen = next_position(pos_gen, move, next_ix, mirr);
 			Move_List chase_list2;
 
 			if (   is_long_chase(next_pos_gen, inout_param(chase_list2))
-				&& is_actually_long_chase(next_pos_gen.board(), chase_list2, evt_piecebb.maybe_mirror_files(mirr)))
+				&& is_actually_long_chase(next_pos_gen.board(), chase_list2, to_next_position_frame(evt_piecebb, mirr)))
 				return tt;
 		}
 	}
@@ -1558,7 +1757,7 @@ bool DTC_Generator::remove_fake(
 {
 	bool rmv_new = false;
 
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
 	{
 		auto gen_iterator = make_gen_iterator();
 		const auto ret = thread_pool->run_sync_task_on_all_threads(
@@ -1586,7 +1785,7 @@ bool DTC_Generator::remove_fake_step4(
 {
 	bool rmv_new = false;
 
-	for (const Color me : { WHITE, BLACK })
+	for (const Color me : table_colors())
 	{
 		auto gen_iterator = make_gen_iterator();
 		const auto ret = thread_pool->run_sync_task_on_all_threads(
@@ -1696,12 +1895,25 @@ void DTC_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 
 	bool build_finish[COLOR_NB] = { false, false };
 
-	if (!init_check_chase(thread_pool))
-		return;
+	if (is_resuming_at(EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE))
+	{
+		const auto counters = restore_checkpoint(thread_pool, { &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] });
+		m_max_order = static_cast<DTC_Order>(counters[0]);
+		m_max_conv = static_cast<DTC_Score>(counters[1]);
+		m_entry_order = static_cast<DTC_Entry_Order>(counters[2]);
+		build_finish[WHITE] = counters[3];
+		build_finish[BLACK] = counters[4];
+	}
+	else
+	{
+		if (!init_check_chase(thread_pool))
+			return;
+
+		m_max_order = static_cast<DTC_Order>(1);
+	}
 
 	const auto start_time = std::chrono::steady_clock::now();
 
-	m_max_order = static_cast<DTC_Order>(1);
 	for (;;)
 	{
 		printf("order = %zu\n", static_cast<size_t>(m_max_order));
@@ -1714,10 +1926,14 @@ void DTC_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 		tmp_bits->release(std::move(rule_bits[WHITE]));
 		tmp_bits->release(std::move(rule_bits[BLACK]));
 
-		for (const Color me : { WHITE, BLACK })
+		bool all_finished = true;
+		for (const Color me : table_colors())
+		{
 			build_finish[me] = build_finish[me] || !build_check_chase(thread_pool, me, tmp_bits);
+			all_finished = all_finished && build_finish[me];
+		}
 
-		if (build_finish[WHITE] && build_finish[BLACK])
+		if (all_finished)
 			break;
 
 		++m_max_order;
@@ -1737,6 +1953,19 @@ void DTC_Generator::loop_build_check_chase(In_Out_Param<Thread_Pool> thread_pool
 			else if (m_max_order > DTC_ORDER_MAX_ORDER_128)
 				printf("order over 127, cap_score will be not exact...\n");
 		}
+
+		maybe_save_checkpoint(
+			thread_pool,
+			EGTB_Checkpoint_Stage::BUILD_CHECK_CHASE,
+			{
+				static_cast<uint64_t>(m_max_order),
+				static_cast<uint64_t>(m_max_conv),
+				static_cast<uint64_t>(m_entry_order),
+				static_cast<uint64_t>(build_finish[WHITE]),
+				static_cast<uint64_t>(build_finish[BLACK])
+			},
+			{ &m_unknown_bits[WHITE], &m_unknown_bits[BLACK] }
+		);
 	}
 
 	const auto end_time = std::chrono::steady_clock::now();
@@ -2,6 +2,8 @@
 
 #include "egtb.h"
 #include "egtb_gen.h"
+#include "egtb_checkpoint.h"
+#include "egtb_compress.h"
 
 #include "chess/chess.h"
 #include "chess/position.h"
@@ -17,6 +19,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <chrono>
 #include <cstdlib>
 
 struct DTC_Generator : public EGTB_Generator
@@ -40,9 +43,15 @@ struct DTC_Generator : public EGTB_Generator
 
 		info.num_positions = *maybe_num_positions;
 
+		const Piece_Config_For_Gen relative_epsi(ps, Board_Index_Layout::FREE_PIECE_RELATIVE);
+		info.num_cartesian_positions = relative_epsi.num_cartesian_positions();
+		info.num_relative_positions = relative_epsi.num_positions();
+
+		const size_t num_tables = num_tables_for_generation(ps);
 		info.memory_required_for_generation =
-			  info.num_positions * (sizeof(DTC_Final_Entry) * 2)
-			+ info.num_positions * 5 / 8; // EGTB_Bits
+			  info.num_positions * (sizeof(DTC_Final_Entry) * num_tables)
+			+ info.num_positions * (3 + num_tables) / 8 // EGTB_Bits
+			+ EGTB_Legal_Positions::memory_required(info.num_positions, num_tables);
 
 		info.uncompressed_size = info.num_positions * sizeof(WDL_Entry) * 2 / WDL_ENTRY_PACK_RATIO;
 
@@ -64,9 +73,15 @@ struct DTC_Generator : public EGTB_Generator
 
 		info.num_positions = *maybe_num_positions;
 
+		const Piece_Config_For_Gen relative_epsi(ps, Board_Index_Layout::FREE_PIECE_RELATIVE);
+		info.num_cartesian_positions = relative_epsi.num_cartesian_positions();
+		info.num_relative_positions = relative_epsi.num_positions();
+
+		const size_t num_tables = num_tables_for_generation(ps);
 		info.memory_required_for_generation =
-			  info.num_positions * (sizeof(DTC_Final_Entry) * 2)
-			+ info.num_positions * 5 / 8; // EGTB_Bits
+			  info.num_positions * (sizeof(DTC_Final_Entry) * num_tables)
+			+ info.num_positions * (3 + num_tables) / 8 // EGTB_Bits
+			+ EGTB_Legal_Positions::memory_required(info.num_positions, num_tables);
 
 		info.uncompressed_size = info.num_positions * (sizeof(DTC_Final_Entry) * 2);
 
@@ -83,11 +98,30 @@ struct DTC_Generator : public EGTB_Generator
 		const Piece_Config& ps, 
 		bool save_wdl,
 		bool save_dtc,
-		const EGTB_Paths& egtb_files
+		const EGTB_Paths& egtb_files,
+		std::chrono::seconds checkpoint_interval = std::chrono::seconds(0),
+		const WDL_Save_Settings& wdl_settings = WDL_Save_Settings(),
+		const EGTB_Save_Settings& dtc_settings = EGTB_Save_Settings(),
+		std::shared_ptr<const EGTB_Legal_Positions> legal_positions = nullptr
 	);
 
+	// Generates the tables and saves the WDL tables.
 	void gen(In_Out_Param<Thread_Pool> thread_pool);
 
+	// Saves the DTC tables, must be called after gen(). Only the generated
+	// tables are needed, so it can run on another thread pool while the
+	// generation of other tables starts.
+	void save_dtc(In_Out_Param<Thread_Pool> thread_pool);
+
+	// The memory held until save_dtc() finishes.
+	NODISCARD size_t memory_held_for_saving() const
+	{
+		size_t memory = 0;
+		for (const Color turn : table_colors())
+			memory += m_dtc_file[turn].data_span().size() + m_decisive_bits[turn].data_span().size();
+		return memory;
+	}
+
 protected:
 	WDL_File_For_Gen m_wdl_file[COLOR_NB];
 	DTC_File_For_Gen m_dtc_file[COLOR_NB];
@@ -102,43 +136,62 @@ protected:
 	Temporary_File_Tracker m_tmp_files;
 	bool m_save_wdl;
 	bool m_save_dtc;
+	WDL_Save_Settings m_wdl_settings;
+	EGTB_Save_Settings m_dtc_settings;
 
 	EGTB_Bits m_unknown_bits[COLOR_NB];
 
+	// Only with omit_draws, the positions saved in the DTC tables.
+	EGTB_Bits m_decisive_bits[COLOR_NB];
+
 	alignas(64) volatile DTC_Entry_Order m_entry_order;
 
+	EGTB_Checkpoint m_checkpoint;
+	std::optional<EGTB_Checkpoint_State> m_resume_state;
+
+	EGTB_Info m_info;
+
+	// Saved with the tables, from the start of gen() until m_info is known.
+	std::chrono::steady_clock::time_point m_gen_start_time;
+	EGTB_Generation_Stats m_generation_stats;
+
+	NODISCARD inline EGTB_Bits& unknown_bits(const Color me)
+	{
+		return m_unknown_bits[table_color(me)];
+	}
+
 	NODISCARD inline bool is_known(const Board_Index pos, const Color me) const
 	{
-		return !m_unknown_bits[me].bit_is_set(pos);
+		return !m_unknown_bits[table_color(me)].bit_is_set(pos);
 	}
 
 	NODISCARD inline bool is_unknown(const Board_Index pos, const Color me) const
 	{
-		return m_unknown_bits[me].bit_is_set(pos);
+		return m_unknown_bits[table_color(me)].bit_is_set(pos);
 	}
 
 	template <typename EntryT>
 	NODISCARD inline EntryT read_dtc(const Board_Index pos, const Color me) const
 	{
-		return m_dtc_file[me].read<EntryT>(pos);
+		return m_dtc_file[table_color(me)].read<EntryT>(pos);
 	}
 
 	template <typename EntryT>
 	inline void write_dtc(const Board_Index pos, const Color me, const EntryT entry)
 	{
-		m_dtc_file[me].write(entry, pos);
+		m_dtc_file[table_color(me)].write(entry, pos);
 	}
 
 	template <typename FlagT>
 	inline void lock_or_dtc(const Board_Index pos, const Color me, FlagT flag)
 	{
-		m_dtc_file[me].lock_add_flags(pos, flag);
+		m_dtc_file[table_color(me)].lock_add_flags(pos, flag);
 	}
 
 	template <typename FlagT>
 	inline void or_dtc(const Board_Index pos, const Color me, FlagT flag)
 	{
-		m_dtc_file[me].add_flags(pos, flag);
+		m_dtc_file[table_color(me)].add_flags(pos, flag);
 	}
 
 	template <DTC_Entry_Order ORDER>
@@ -153,7 +206,27 @@ protected:
 	void open_sub_evtb();
 	void close_sub_evtb();
 
-	void save_egtb(In_Out_Param<Thread_Pool> thread_pool);
+	// Saves the entries, the given bitmaps and counters if the checkpoint interval has passed.
+	void maybe_save_checkpoint(
+		In_Out_Param<Thread_Pool> thread_pool,
+		EGTB_Checkpoint_Stage stage,
+		std::vector<uint64_t> counters,
+		std::initializer_list<const EGTB_Bits*> bits
+	);
+
+	// Restores the entries and the given bitmaps from m_resume_state and consumes it.
+	// Returns the saved counters.
+	std::vector<uint64_t> restore_checkpoint(
+		In_Out_Param<Thread_Pool> thread_pool,
+		std::initializer_list<EGTB_Bits*> bits
+	);
+
+	NODISCARD bool is_resuming_at(EGTB_Checkpoint_Stage stage) const
+	{
+		return m_resume_state.has_value() && m_resume_state->stage == stage;
+	}
+
+	void save_wdl(In_Out_Param<Thread_Pool> thread_pool);
 
 	void init_entries(In_Out_Param<Thread_Pool> thread_pool);
 	void sp_init_entries(
@@ -264,6 +337,8 @@ protected:
 
 	template <DTC_Entry_Order ORDER>
 	NODISCARD EGTB_Info sp_gen_evtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator);
+	template <DTC_Entry_Order ORDER>
+	NODISCARD EGTB_Info sp_gen_color_swapped_evtb(In_Out_Param<Shared_Board_Index_Iterator> gen_iterator);
 	NODISCARD EGTB_Info gen_evtb(In_Out_Param<Thread_Pool> thread_pool);
 
 	void remove_fake_check_chase(
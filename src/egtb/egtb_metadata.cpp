@@ -0,0 +1,350 @@
+#include "egtb_metadata.h"
+
+#include "egtb_compress.h"
+
+#include "util/math.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#if !defined(EGTB_GENERATOR_BUILD_ID)
+#define EGTB_GENERATOR_BUILD_ID "unknown"
+#endif
+
+const char* egtb_generator_build_id()
+{
+	return EGTB_GENERATOR_BUILD_ID;
+}
+
+EGTB_Generation_Stats make_egtb_generation_stats(const EGTB_Info& info, std::chrono::steady_clock::time_point start_time)
+{
+	EGTB_Generation_Stats stats;
+	stats.info = info;
+	stats.generation_time_ms = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start_time
+	).count());
+	stats.finished_at = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::system_clock::now().time_since_epoch()
+	).count());
+	return stats;
+}
+
+// major version, minor version, size of the records
+constexpr size_t METADATA_PREFIX_SIZE = sizeof(uint16_t) * 2 + sizeof(uint32_t);
+
+constexpr size_t RECORD_HEADER_SIZE = sizeof(uint16_t) * 2;
+
+// Calls record(tag, value) for each record of the section, in the order they are written.
+template <typename FuncT>
+static void for_each_metadata_record(const EGTB_File_Metadata& metadata, FuncT&& record)
+{
+	auto bytes_of = [](const auto& array) {
+		return Const_Span(reinterpret_cast<const uint8_t*>(&array[0]), sizeof(array));
+	};
+	auto bytes_of_string = [](const char* str) {
+		return Const_Span(reinterpret_cast<const uint8_t*>(str), strnlen(str, MAX_FEN_LENGTH));
+	};
+
+	if (metadata.generation.has_value())
+	{
+		const EGTB_Info& info = metadata.generation->info;
+		record(EGTB_Metadata_Tag::WIN_COUNTS, bytes_of(info.win_cnt));
+		record(EGTB_Metadata_Tag::LOSE_COUNTS, bytes_of(info.lose_cnt));
+		record(EGTB_Metadata_Tag::DRAW_COUNTS, bytes_of(info.draw_cnt));
+		record(EGTB_Metadata_Tag::ILLEGAL_COUNTS, bytes_of(info.illegal_cnt));
+		record(EGTB_Metadata_Tag::LONGEST_WINS, bytes_of(info.longest_win));
+		record(EGTB_Metadata_Tag::LONGEST_INDICES, bytes_of(info.longest_idx));
+		record(EGTB_Metadata_Tag::LONGEST_FEN_WHITE, bytes_of_string(info.longest_fen[WHITE]));
+		record(EGTB_Metadata_Tag::LONGEST_FEN_BLACK, bytes_of_string(info.longest_fen[BLACK]));
+		record(EGTB_Metadata_Tag::LOOP_COUNTS, bytes_of(info.loop_cnt));
+	}
+
+	record(EGTB_Metadata_Tag::CODECS, Const_Span(metadata.codecs.data(), metadata.codecs.size()));
+	record(EGTB_Metadata_Tag::BLOCK_SIZES, Const_Span(reinterpret_cast<const uint8_t*>(metadata.block_sizes.data()), metadata.block_sizes.size() * sizeof(uint32_t)));
+
+	const uint32_t index_scheme[2] = { static_cast<uint32_t>(metadata.layout), metadata.index_scheme_version };
+	record(EGTB_Metadata_Tag::INDEX_SCHEME, bytes_of(index_scheme));
+	record(EGTB_Metadata_Tag::GROUP_ORDER, Const_Span(metadata.group_order.data(), metadata.group_order.size()));
+
+	if (metadata.generation.has_value())
+	{
+		const EGTB_Generation_Stats& generation = *metadata.generation;
+		record(EGTB_Metadata_Tag::BUILD_ID, Const_Span(reinterpret_cast<const uint8_t*>(generation.build_id.data()), generation.build_id.size()));
+		if (metadata.has_times)
+		{
+			record(EGTB_Metadata_Tag::GENERATION_TIME_MS, Const_Span(reinterpret_cast<const uint8_t*>(&generation.generation_time_ms), sizeof(uint64_t)));
+			record(EGTB_Metadata_Tag::FINISHED_AT, Const_Span(reinterpret_cast<const uint8_t*>(&generation.finished_at), sizeof(uint64_t)));
+		}
+	}
+
+	if (metadata.has_times)
+		record(EGTB_Metadata_Tag::COMPRESSION_TIME_MS, Const_Span(reinterpret_cast<const uint8_t*>(&metadata.compression_time_ms), sizeof(uint64_t)));
+}
+
+NODISCARD static size_t metadata_records_size(const EGTB_File_Metadata& metadata)
+{
+	size_t size = 0;
+	for_each_metadata_record(metadata, [&](EGTB_Metadata_Tag, Const_Span<uint8_t> value) {
+		size += RECORD_HEADER_SIZE + value.size();
+	});
+	return ceil_to_multiple(METADATA_PREFIX_SIZE + size, (size_t)8) - METADATA_PREFIX_SIZE;
+}
+
+size_t egtb_metadata_size(const EGTB_File_Metadata& metadata)
+{
+	return METADATA_PREFIX_SIZE + metadata_records_size(metadata);
+}
+
+void write_egtb_metadata(Serial_Memory_Writer& writer, const EGTB_File_Metadata& metadata)
+{
+	const size_t start = writer.num_bytes_written();
+	const size_t records_size = metadata_records_size(metadata);
+
+	writer.write<uint16_t>(EGTB_METADATA_MAJOR_VERSION);
+	writer.write<uint16_t>(EGTB_METADATA_MINOR_VERSION);
+	writer.write<uint32_t>(narrowing_static_cast<uint32_t>(records_size));
+
+	for_each_metadata_record(metadata, [&](EGTB_Metadata_Tag tag, Const_Span<uint8_t> value) {
+		writer.write<uint16_t>(static_cast<uint16_t>(tag));
+		writer.write<uint16_t>(narrowing_static_cast<uint16_t>(value.size()));
+		writer.write(value);
+	});
+
+	// The padding is zeros, it would be read as records of tag 0 and size 0.
+	while (writer.num_bytes_written() - start < METADATA_PREFIX_SIZE + records_size)
+		writer.write<uint8_t>(0);
+}
+
+EGTB_File_Metadata read_egtb_metadata(Serial_Memory_Reader& reader)
+{
+	if (static_cast<size_t>(reader.end() - reader.caret()) < METADATA_PREFIX_SIZE)
+		throw std::runtime_error("Truncated table file metadata.");
+
+	EGTB_File_Metadata metadata;
+	metadata.has_times = false;
+	metadata.major_version = reader.read<uint16_t>();
+	metadata.minor_version = reader.read<uint16_t>();
+	const size_t records_size = reader.read<uint32_t>();
+
+	if (metadata.major_version != EGTB_METADATA_MAJOR_VERSION)
+		throw std::runtime_error(
+			"Unsupported table file metadata version " + std::to_string(metadata.major_version)
+			+ "." + std::to_string(metadata.minor_version)
+			+ ", this program reads version " + std::to_string(EGTB_METADATA_MAJOR_VERSION) + ".x."
+		);
+
+	if (static_cast<size_t>(reader.end() - reader.caret()) < records_size)
+		throw std::runtime_error("Truncated table file metadata.");
+
+	const uint8_t* const records_end = reader.caret() + records_size;
+
+	auto generation = [&]() -> EGTB_Generation_Stats& {
+		if (!metadata.generation.has_value())
+		{
+			metadata.generation.emplace();
+			metadata.generation->build_id.clear();
+		}
+		return *metadata.generation;
+	};
+
+	while (static_cast<size_t>(records_end - reader.caret()) >= RECORD_HEADER_SIZE)
+	{
+		const auto tag = static_cast<EGTB_Metadata_Tag>(reader.read<uint16_t>());
+		const size_t size = reader.read<uint16_t>();
+		if (static_cast<size_t>(records_end - reader.caret()) < size)
+			throw std::runtime_error("Table file metadata record doesn't fit in the section.");
+
+		const Const_Span<uint8_t> value(reader.caret(), size);
+		reader.advance(size);
+
+		// Records of an unexpected size are treated as unknown.
+		auto read_into = [&](auto& dst) {
+			if (value.size() == sizeof(dst))
+				std::memcpy(&dst, value.data(), sizeof(dst));
+		};
+		auto read_string_into = [&](char* dst) {
+			std::memcpy(dst, value.data(), std::min(value.size(), MAX_FEN_LENGTH - 1));
+		};
+
+		switch (tag)
+		{
+		case EGTB_Metadata_Tag::WIN_COUNTS:
+			read_into(generation().info.win_cnt);
+			break;
+		case EGTB_Metadata_Tag::LOSE_COUNTS:
+			read_into(generation().info.lose_cnt);
+			break;
+		case EGTB_Metadata_Tag::DRAW_COUNTS:
+			read_into(generation().info.draw_cnt);
+			break;
+		case EGTB_Metadata_Tag::ILLEGAL_COUNTS:
+			read_into(generation().info.illegal_cnt);
+			break;
+		case EGTB_Metadata_Tag::LONGEST_WINS:
+			read_into(generation().info.longest_win);
+			break;
+		case EGTB_Metadata_Tag::LONGEST_INDICES:
+			read_into(generation().info.longest_idx);
+			break;
+		case EGTB_Metadata_Tag::LONGEST_FEN_WHITE:
+			read_string_into(generation().info.longest_fen[WHITE]);
+			break;
+		case EGTB_Metadata_Tag::LONGEST_FEN_BLACK:
+			read_string_into(generation().info.longest_fen[BLACK]);
+			break;
+		case EGTB_Metadata_Tag::LOOP_COUNTS:
+			read_into(generation().info.loop_cnt);
+			break;
+		case EGTB_Metadata_Tag::CODECS:
+			metadata.codecs.clear();
+			for (size_t i = 0; i < std::min<size_t>(value.size(), 2); ++i)
+				metadata.codecs.emplace_back(value[i]);
+			break;
+		case EGTB_Metadata_Tag::BLOCK_SIZES:
+			metadata.block_sizes.clear();
+			for (size_t i = 0; i < std::min<size_t>(value.size() / sizeof(uint32_t), 2); ++i)
+			{
+				uint32_t block_size;
+				std::memcpy(&block_size, value.data() + i * sizeof(uint32_t), sizeof(uint32_t));
+				metadata.block_sizes.emplace_back(block_size);
+			}
+			break;
+		case EGTB_Metadata_Tag::INDEX_SCHEME:
+			if (value.size() == sizeof(uint32_t) * 2)
+			{
+				uint32_t index_scheme[2];
+				std::memcpy(index_scheme, value.data(), sizeof(index_scheme));
+				metadata.layout = static_cast<Board_Index_Layout>(index_scheme[0]);
+				metadata.index_scheme_version = index_scheme[1];
+			}
+			break;
+		case EGTB_Metadata_Tag::GROUP_ORDER:
+			metadata.group_order.clear();
+			for (size_t i = 0; i < std::min<size_t>(value.size(), PIECE_CLASS_NB); ++i)
+				metadata.group_order.emplace_back(value[i]);
+			break;
+		case EGTB_Metadata_Tag::BUILD_ID:
+			generation().build_id.assign(reinterpret_cast<const char*>(value.data()), value.size());
+			break;
+		case EGTB_Metadata_Tag::GENERATION_TIME_MS:
+			read_into(generation().generation_time_ms);
+			metadata.has_times = true;
+			break;
+		case EGTB_Metadata_Tag::FINISHED_AT:
+			read_into(generation().finished_at);
+			metadata.has_times = true;
+			break;
+		case EGTB_Metadata_Tag::COMPRESSION_TIME_MS:
+			read_into(metadata.compression_time_ms);
+			metadata.has_times = true;
+			break;
+		default:
+			// Added by a newer minor version, or padding.
+			break;
+		}
+	}
+
+	reader.advance(records_end - reader.caret());
+
+	return metadata;
+}
+
+NODISCARD static const char* codec_name(uint8_t codec, bool is_wdl)
+{
+	if (codec == EGTB_METADATA_NO_CODEC)
+		return "none";
+
+	if (is_wdl)
+	{
+		switch (static_cast<WDL_Codec>(codec))
+		{
+		case WDL_Codec::LZ4:
+			return "LZ4";
+		case WDL_Codec::RC2:
+			return "RC2";
+		}
+	}
+	else
+	{
+		switch (static_cast<EGTB_Codec>(codec))
+		{
+		case EGTB_Codec::LZMA:
+			return "LZMA";
+		case EGTB_Codec::LZ4:
+			return "LZ4";
+		case EGTB_Codec::ZSTD:
+			return "ZSTD";
+		}
+	}
+
+	return "unknown";
+}
+
+NODISCARD static const char* piece_class_name(uint8_t set)
+{
+	static constexpr const char* NAMES[PIECE_CLASS_NB] = {
+		"white_defenders", "white_rooks", "white_knights", "white_cannons", "white_pawns",
+		"black_defenders", "black_rooks", "black_knights", "black_cannons", "black_pawns"
+	};
+
+	return set < PIECE_CLASS_NB ? NAMES[set] : "unknown";
+}
+
+void print_egtb_metadata(const EGTB_File_Metadata& metadata, bool is_wdl)
+{
+	printf("metadata version: %u.%u\n", metadata.major_version, metadata.minor_version);
+	printf("board index layout: %u, index scheme version: %u\n", static_cast<unsigned>(metadata.layout), metadata.index_scheme_version);
+
+	if (metadata.group_order.empty())
+		printf("group order: by class (not recorded)\n");
+	else
+	{
+		printf("group order:");
+		for (const uint8_t set : metadata.group_order)
+			printf(" %s", piece_class_name(set));
+		printf("\n");
+	}
+
+	for (size_t i = 0; i < metadata.codecs.size(); ++i)
+		printf("table %zu: codec %s, block size %u\n", i, codec_name(metadata.codecs[i], is_wdl), i < metadata.block_sizes.size() ? metadata.block_sizes[i] : 0);
+
+	if (metadata.has_times)
+		printf("compression time: %llu ms\n", static_cast<unsigned long long>(metadata.compression_time_ms));
+	else
+		printf("no times\n");
+
+	if (!metadata.generation.has_value())
+	{
+		printf("no generation stats\n");
+		return;
+	}
+
+	const EGTB_Generation_Stats& generation = *metadata.generation;
+	printf("build id: %s\n", generation.build_id.c_str());
+	if (metadata.has_times)
+	{
+		printf("generation time: %llu ms\n", static_cast<unsigned long long>(generation.generation_time_ms));
+		printf("finished at: %llu\n", static_cast<unsigned long long>(generation.finished_at));
+	}
+
+	const EGTB_Info& info = generation.info;
+	for (const Color color : { WHITE, BLACK })
+	{
+		printf("%s: win %llu, lose %llu, draw %llu, illegal %llu, loops %u\n",
+			color == WHITE ? "white" : "black",
+			static_cast<unsigned long long>(info.win_cnt[color]),
+			static_cast<unsigned long long>(info.lose_cnt[color]),
+			static_cast<unsigned long long>(info.draw_cnt[color]),
+			static_cast<unsigned long long>(info.illegal_cnt[color]),
+			static_cast<unsigned>(info.loop_cnt[color])
+		);
+		printf("%s: longest win %u at %llu, %s\n",
+			color == WHITE ? "white" : "black",
+			static_cast<unsigned>(info.longest_win[color]),
+			static_cast<unsigned long long>(info.longest_idx[color]),
+			info.longest_fen[color]
+		);
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "egtb.h"
+
+#include "util/defines.h"
+#include "util/memory.h"
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Set on the magic of table files that have a metadata section after the material key.
+// Files without it are from before the section existed and are still loaded.
+constexpr uint32_t EGTB_METADATA_MAGIC_FLAG = uint32_t(1) << 27;
+
+// A reader only accepts the major version it knows. Minor versions add records,
+// which older readers skip.
+constexpr uint16_t EGTB_METADATA_MAJOR_VERSION = 1;
+constexpr uint16_t EGTB_METADATA_MINOR_VERSION = 1;
+
+// Identifies the records of the metadata section. Each record is
+// uint16 tag, uint16 size in bytes, then the value.
+// Values with one element per table are in the order of the tables in the file.
+enum struct EGTB_Metadata_Tag : uint16_t
+{
+	// The EGTB_Info fields, one element per color.
+	WIN_COUNTS = 1,       // uint64[2]
+	LOSE_COUNTS = 2,      // uint64[2]
+	DRAW_COUNTS = 3,      // uint64[2]
+	ILLEGAL_COUNTS = 4,   // uint64[2]
+	LONGEST_WINS = 5,     // uint16[2]
+	LONGEST_INDICES = 6,  // uint64[2]
+	LONGEST_FEN_WHITE = 7, // string
+	LONGEST_FEN_BLACK = 8, // string
+	LOOP_COUNTS = 9,      // uint8[2]
+
+	// How the tables are stored.
+	CODECS = 16,          // uint8 per table, WDL_Codec or EGTB_Codec, 0xff if it has no blocks
+	BLOCK_SIZES = 17,     // uint32 per table, 0 if it has no blocks
+	INDEX_SCHEME = 18,    // uint32 Board_Index_Layout, uint32 EGTB_INDEX_SCHEME_VERSION
+	GROUP_ORDER = 19,     // uint8 Piece_Class per group, from the one with weight 1, since 1.1
+
+	// Where the tables come from.
+	BUILD_ID = 32,        // string
+	GENERATION_TIME_MS = 33, // uint64
+	FINISHED_AT = 34,     // uint64, seconds since the Unix epoch
+	COMPRESSION_TIME_MS = 35 // uint64
+};
+
+constexpr uint8_t EGTB_METADATA_NO_CODEC = 0xff;
+
+// Returns the build of the generator, stored with the tables it makes.
+// Set with -DEGTB_GENERATOR_BUILD_ID="...", the build scripts pass the git
+// revision. "unknown" otherwise, it's never taken from the clock, so that
+// builds of the same sources save the same tables.
+NODISCARD const char* egtb_generator_build_id();
+
+// How a table was generated. Given to the save functions by the generators,
+// and carried over from the old file when a table is recompressed.
+struct EGTB_Generation_Stats
+{
+	EGTB_Info info;
+	std::string build_id = egtb_generator_build_id();
+	uint64_t generation_time_ms = 0;
+	uint64_t finished_at = 0;
+};
+
+// Stats of a generation that started at start_time and has just finished.
+NODISCARD EGTB_Generation_Stats make_egtb_generation_stats(const EGTB_Info& info, std::chrono::steady_clock::time_point start_time);
+
+// The metadata section of a table file.
+// Records that a file doesn't have keep their defaults.
+struct EGTB_File_Metadata
+{
+	uint16_t major_version = EGTB_METADATA_MAJOR_VERSION;
+	uint16_t minor_version = EGTB_METADATA_MINOR_VERSION;
+
+	// Nothing for files saved without generation stats, e.g. recompressed old files.
+	std::optional<EGTB_Generation_Stats> generation;
+
+	Fixed_Vector<uint8_t, 2> codecs;
+	Fixed_Vector<uint32_t, 2> block_sizes;
+	Board_Index_Layout layout = Board_Index_Layout::CARTESIAN;
+	uint32_t index_scheme_version = EGTB_INDEX_SCHEME_VERSION;
+
+	// Empty for files saved before it was recorded, which all have
+	// the order of Board_Index_Group_Order::BY_CLASS.
+	Fixed_Vector<uint8_t, PIECE_CLASS_NB> group_order;
+
+	// Whether the generation and compression times are stored. They are the only
+	// records that differ between runs, without them the same tables are saved
+	// as the same bytes.
+	bool has_times = true;
+	uint64_t compression_time_ms = 0;
+};
+
+// Size of the section as written by write_egtb_metadata, a multiple of 8.
+NODISCARD size_t egtb_metadata_size(const EGTB_File_Metadata& metadata);
+
+void write_egtb_metadata(Serial_Memory_Writer& writer, const EGTB_File_Metadata& metadata);
+
+// Throws on a major version other than EGTB_METADATA_MAJOR_VERSION
+// and on records that don't fit in the section.
+NODISCARD EGTB_File_Metadata read_egtb_metadata(Serial_Memory_Reader& reader);
+
+// Prints all records, for the dump_header tool.
+// is_wdl selects how the codecs are named.
+void print_egtb_metadata(const EGTB_File_Metadata& metadata, bool is_wdl);
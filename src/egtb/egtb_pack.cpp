@@ -0,0 +1,186 @@
+#include "egtb_pack.h"
+
+#include "egtb_compress.h"
+
+#include "util/math.h"
+#include "util/memory.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+static constexpr size_t PACK_TABLE_ALIGNMENT = 64;
+
+std::optional<std::vector<EGTB_Pack_Entry>> read_pack_index(const std::filesystem::path& path)
+{
+	Memory_Mapped_File map_file;
+	if (!map_file.open_readonly(path))
+		return std::nullopt;
+
+	const Const_Span<uint8_t> input = map_file.data_span();
+	constexpr size_t FIXED_HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(uint64_t);
+	if (input.size() < FIXED_HEADER_SIZE + sizeof(uint64_t))
+		return std::nullopt;
+
+	Serial_Memory_Reader reader(input);
+	const uint32_t magic = reader.read<uint32_t>();
+	const uint32_t version = reader.read<uint32_t>();
+	const uint64_t num_entries = reader.read<uint64_t>();
+	if (magic != EGTB_PACK_MAGIC || version != EGTB_PACK_VERSION)
+		return std::nullopt;
+
+	const size_t index_size = FIXED_HEADER_SIZE + num_entries * sizeof(EGTB_Pack_Entry);
+	if (num_entries > input.size() / sizeof(EGTB_Pack_Entry) || index_size + sizeof(uint64_t) > input.size())
+		return std::nullopt;
+
+	uint64_t checksum;
+	std::memcpy(&checksum, input.data() + index_size, sizeof(checksum));
+	if (XXH64(input.data(), index_size, EGTB_CHECKSUM_INIT_VALUE) != checksum)
+		return std::nullopt;
+
+	std::vector<EGTB_Pack_Entry> entries(num_entries);
+	reader.read(Span(reinterpret_cast<uint8_t*>(entries.data()), index_size - FIXED_HEADER_SIZE));
+
+	for (const auto& entry : entries)
+		if (entry.offset > input.size() || entry.size > input.size() - entry.offset)
+			return std::nullopt;
+
+	return entries;
+}
+
+// is_egtb_file_intact goes through the file index, which may have the table in a pack.
+NODISCARD static bool is_plain_table_file_intact(const std::filesystem::path& path)
+{
+	Memory_Mapped_File map_file;
+	if (!map_file.open_readonly(path))
+		return false;
+
+	return is_egtb_data_intact(map_file.data_span());
+}
+
+size_t pack_table_files(const std::filesystem::path& pack_path, const std::vector<std::filesystem::path>& dirs)
+{
+	std::vector<EGTB_Pack_Entry> entries;
+	std::vector<std::filesystem::path> files;
+
+	for (const auto& dir : dirs)
+	{
+		for (const auto& dir_entry : std::filesystem::directory_iterator(dir))
+		{
+			if (!dir_entry.is_regular_file())
+				continue;
+
+			const auto table = parse_egtb_table_file_name(dir_entry.path().filename().string());
+			if (!table.has_value())
+				continue;
+
+			const std::string name = table->first.name();
+			if (name.size() > EGTB_Pack_Entry::MAX_NAME_LENGTH)
+				throw std::runtime_error("Table name too long to pack: " + name);
+
+			if (!is_plain_table_file_intact(dir_entry.path()))
+			{
+				printf("WARNING: Not packing damaged table %s\n", dir_entry.path().string().c_str());
+				continue;
+			}
+
+			EGTB_Pack_Entry entry{};
+			entry.material_key = table->first.base_material_key().value();
+			entry.kind = table->second;
+			entry.size = dir_entry.file_size();
+			std::memcpy(entry.name, name.data(), name.size());
+
+			entries.emplace_back(entry);
+			files.emplace_back(dir_entry.path());
+		}
+	}
+
+	std::vector<size_t> order(entries.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+		return entries[lhs] < entries[rhs];
+	});
+
+	const size_t index_size = sizeof(uint32_t) * 2 + sizeof(uint64_t) + entries.size() * sizeof(EGTB_Pack_Entry);
+	size_t file_size = ceil_to_multiple(index_size + sizeof(uint64_t), PACK_TABLE_ALIGNMENT);
+
+	std::vector<EGTB_Pack_Entry> sorted_entries;
+	for (const size_t i : order)
+	{
+		if (!sorted_entries.empty() && !(sorted_entries.back() < entries[i]))
+			throw std::runtime_error("Table found more than once: " + files[i].string());
+
+		sorted_entries.emplace_back(entries[i]);
+		sorted_entries.back().offset = file_size;
+		file_size = ceil_to_multiple(file_size + entries[i].size, PACK_TABLE_ALIGNMENT);
+	}
+
+	const std::filesystem::path partial_path = pack_path.string() + ".partial";
+	{
+		Memory_Mapped_File out;
+		if (!out.create(partial_path, file_size))
+			throw std::runtime_error("Could not create pack " + partial_path.string());
+
+		Serial_Memory_Writer writer(out.data_span());
+		writer.write<uint32_t>(EGTB_PACK_MAGIC);
+		writer.write<uint32_t>(EGTB_PACK_VERSION);
+		writer.write<uint64_t>(sorted_entries.size());
+		writer.write(Const_Span(reinterpret_cast<const uint8_t*>(sorted_entries.data()), sorted_entries.size() * sizeof(EGTB_Pack_Entry)));
+		writer.write<uint64_t>(XXH64(out.data(), index_size, EGTB_CHECKSUM_INIT_VALUE));
+
+		for (size_t i = 0; i < sorted_entries.size(); ++i)
+		{
+			const std::filesystem::path& path = files[order[i]];
+
+			Memory_Mapped_File in;
+			if (!in.open_readonly(path) || in.size() != sorted_entries[i].size)
+				throw std::runtime_error("Could not read table " + path.string());
+
+			writer.zero_align(PACK_TABLE_ALIGNMENT);
+			ASSERT(writer.num_bytes_written() == sorted_entries[i].offset);
+			writer.write(Const_Span(in.data(), in.size()));
+		}
+
+		writer.zero_align(PACK_TABLE_ALIGNMENT);
+	}
+
+	std::filesystem::rename(partial_path, pack_path);
+
+	return sorted_entries.size();
+}
+
+size_t unpack_table_files(const std::filesystem::path& pack_path, const std::filesystem::path& dir)
+{
+	const auto entries = read_pack_index(pack_path);
+	if (!entries.has_value())
+		throw std::runtime_error("Not a valid pack: " + pack_path.string());
+
+	Memory_Mapped_File in;
+	if (!in.open_readonly(pack_path))
+		throw std::runtime_error("Could not open pack " + pack_path.string());
+
+	std::filesystem::create_directories(dir);
+
+	for (const auto& entry : *entries)
+	{
+		const std::string name(entry.name, strnlen(entry.name, EGTB_Pack_Entry::MAX_NAME_LENGTH));
+		const std::filesystem::path path = path_join(dir, name + egtb_table_kind_ext(entry.kind));
+
+		{
+			Memory_Mapped_File out;
+			if (!out.create(path, entry.size))
+				throw std::runtime_error("Could not create table " + path.string());
+
+			std::memcpy(out.data(), in.data() + entry.offset, entry.size);
+		}
+
+		if (!is_plain_table_file_intact(path))
+			throw std::runtime_error("Unpacked table is damaged: " + path.string());
+
+		refresh_egtb_table_file(path);
+	}
+
+	return entries->size();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "egtb_file_index.h"
+
+#include "util/defines.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+// A pack stores many finished table files in a single file, so that
+// a directory of tens of thousands of small tables needs only one
+// file open and one directory entry.
+//
+// File layout:
+//   uint32 magic, uint32 version, uint64 number of tables
+//   entries sorted by (material key, kind), each
+//     uint32 base material key, uint32 kind, uint64 offset, uint64 size, char[32] name
+//   uint64 checksum of everything above
+//   the table files, byte for byte as they were saved, each aligned to 64 bytes
+//
+// The tables keep their own end checksums, so is_egtb_file_intact works on them as usual.
+struct EGTB_Pack_Entry
+{
+	static constexpr size_t MAX_NAME_LENGTH = 32;
+
+	uint32_t material_key;
+	EGTB_Table_Kind kind;
+	uint64_t offset;
+	uint64_t size;
+	char name[MAX_NAME_LENGTH];
+
+	NODISCARD friend bool operator<(const EGTB_Pack_Entry& lhs, const EGTB_Pack_Entry& rhs) noexcept
+	{
+		return lhs.material_key != rhs.material_key
+			? lhs.material_key < rhs.material_key
+			: lhs.kind < rhs.kind;
+	}
+};
+
+static_assert(sizeof(EGTB_Pack_Entry) == 56);
+
+constexpr uint32_t EGTB_PACK_MAGIC = 0x6b636170;
+constexpr uint32_t EGTB_PACK_VERSION = 1;
+
+// Reads and checks the index of a pack. Returns nothing if the file
+// can't be opened or is not a valid pack.
+NODISCARD std::optional<std::vector<EGTB_Pack_Entry>> read_pack_index(const std::filesystem::path& path);
+
+// Stores all table files found in the directories in a new pack.
+// Files that are not intact are reported and left out.
+// Throws if a table is found more than once. Returns the number of tables stored.
+size_t pack_table_files(const std::filesystem::path& pack_path, const std::vector<std::filesystem::path>& dirs);
+
+// Writes the tables of a pack back out as plain files into the directory.
+// Returns the number of tables written.
+size_t unpack_table_files(const std::filesystem::path& pack_path, const std::filesystem::path& dir);
@@ -0,0 +1,356 @@
+#include "egtb_recompress.h"
+
+#include "egtb_gen.h"
+
+#include "util/filesystem.h"
+#include "util/math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Must be a multiple of the bits per element of EGTB_Bits and of WDL_ENTRY_PACK_RATIO.
+static constexpr size_t RECOMPRESS_CHUNK_SIZE = 1024 * 1024;
+
+static const std::string RECOMPRESS_EXT = ".recompress";
+
+// Calls func(begin, end) for consecutive ranges of positions, on all threads.
+template <typename FuncT>
+static void for_each_chunk(In_Out_Param<Thread_Pool> thread_pool, size_t num_positions, FuncT&& func)
+{
+	const size_t num_chunks = ceil_div(num_positions, RECOMPRESS_CHUNK_SIZE);
+
+	std::atomic<size_t> next_chunk_id(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t) {
+		for (;;)
+		{
+			const size_t chunk_id = next_chunk_id.fetch_add(1);
+			if (chunk_id >= num_chunks)
+				return;
+
+			func(chunk_id * RECOMPRESS_CHUNK_SIZE, std::min((chunk_id + 1) * RECOMPRESS_CHUNK_SIZE, num_positions));
+		}
+	});
+}
+
+// Compares the tables of both files entry by entry, read(color, pos) returns them.
+// Throws with the first difference found.
+template <typename FileT, typename ReadFuncT>
+static void verify_same_entries(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const FileT& old_file,
+	const FileT& new_file,
+	const Fixed_Vector<Color, 2>& table_colors,
+	size_t num_positions,
+	ReadFuncT&& read
+)
+{
+	for (const Color color : table_colors)
+	{
+		std::atomic<size_t> first_difference(num_positions);
+		for_each_chunk(thread_pool, num_positions, [&](size_t begin, size_t end) {
+			for (size_t pos = begin; pos < end; ++pos)
+			{
+				if (read(old_file, color, static_cast<Board_Index>(pos)) == read(new_file, color, static_cast<Board_Index>(pos)))
+					continue;
+
+				size_t current = first_difference.load();
+				while (pos < current && !first_difference.compare_exchange_weak(current, pos))
+				{
+				}
+				return;
+			}
+		});
+
+		if (first_difference.load() != num_positions)
+			throw std::runtime_error(
+				"Recompressed table " + std::to_string(static_cast<int>(color))
+				+ " differs at position " + std::to_string(first_difference.load())
+			);
+	}
+}
+
+// Makes the paths of the decoded tables of a file, each load needs its own.
+static void make_tmp_paths(
+	std::filesystem::path tmp[COLOR_NB],
+	Temporary_File_Tracker& tmp_files,
+	EGTB_Paths paths,
+	const Piece_Config& ps,
+	const std::string& prefix,
+	bool wdl
+)
+{
+	paths.set_tmp_file_prefix(prefix);
+	for (const Color color : { WHITE, BLACK })
+		tmp[color] = tmp_files.track_path(wdl ? paths.wdl_tmp_path(ps, color) : paths.dtm_tmp_path(ps, color));
+}
+
+// Replaces the old file with the new one, or removes the new one if it failed.
+template <typename FuncT>
+static void replace_if_verified(const std::filesystem::path& path, const std::filesystem::path& new_path, FuncT&& save_and_verify)
+{
+	try
+	{
+		save_and_verify();
+	}
+	catch (...)
+	{
+		std::error_code ec;
+		std::filesystem::remove(new_path, ec);
+		throw;
+	}
+
+	std::filesystem::rename(new_path, path);
+	refresh_egtb_table_file(path);
+}
+
+// The generation stats of the old file are kept, a file saved before they
+// were stored gets none.
+NODISCARD static const EGTB_Generation_Stats* generation_stats_of(const EGTB_File_Summary& summary)
+{
+	return summary.metadata.has_value() && summary.metadata->generation.has_value()
+		? &*summary.metadata->generation
+		: nullptr;
+}
+
+static void recompress_wdl_file(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path,
+	const EGTB_Paths& paths,
+	const WDL_Save_Settings& settings
+)
+{
+	const EGTB_File_Summary summary = read_table_file_summary(path, ps, EGTB_Magic::WDL_MAGIC);
+	const size_t num_positions = Piece_Config_For_Gen(ps).num_positions();
+	const std::filesystem::path new_path = path.string() + RECOMPRESS_EXT;
+
+	Temporary_File_Tracker tmp_files;
+	std::filesystem::path old_tmp[COLOR_NB], src_tmp[COLOR_NB], new_tmp[COLOR_NB];
+	make_tmp_paths(old_tmp, tmp_files, paths, ps, "recompress_old_", true);
+	make_tmp_paths(src_tmp, tmp_files, paths, ps, "recompress_src_", true);
+	make_tmp_paths(new_tmp, tmp_files, paths, ps, "recompress_new_", true);
+
+	WDL_File_For_Probe old_file;
+	load_evtb_table(out_param(old_file), ps, path, old_tmp, EGTB_Magic::WDL_MAGIC);
+
+	// The decoded entries are already prepared for compression, only packed again here.
+	// The counts decide which tables are singular.
+	Memory_Mapped_File src_files[COLOR_NB];
+	Const_Span<Packed_WDL_Entries> src[COLOR_NB];
+	EGTB_Info info;
+	for (const Color color : summary.table_colors)
+	{
+		if (!src_files[color].create(src_tmp[color], WDL_File_For_Probe::uncompressed_file_size(num_positions)))
+			throw std::runtime_error("Could not create temporary file " + src_tmp[color].string());
+
+		Packed_WDL_Entries* entries = reinterpret_cast<Packed_WDL_Entries*>(src_files[color].data());
+		std::atomic<uint64_t> counts[4] = { 0, 0, 0, 0 };
+		for_each_chunk(thread_pool, num_positions, [&](size_t begin, size_t end) {
+			uint64_t chunk_counts[4] = { 0, 0, 0, 0 };
+			for (size_t pos = begin; pos < end; pos += WDL_ENTRY_PACK_RATIO)
+			{
+				WDL_Entry values[WDL_ENTRY_PACK_RATIO] = { WDL_Entry::DRAW, WDL_Entry::DRAW, WDL_Entry::DRAW, WDL_Entry::DRAW };
+				for (size_t i = 0; i < WDL_ENTRY_PACK_RATIO && pos + i < end; ++i)
+				{
+					values[i] = old_file.read(color, static_cast<Board_Index>(pos + i));
+					chunk_counts[static_cast<size_t>(values[i])] += 1;
+				}
+
+				entries[pos / WDL_ENTRY_PACK_RATIO] = pack_wdl_entries(values[0], values[1], values[2], values[3]);
+			}
+
+			for (size_t i = 0; i < 4; ++i)
+				counts[i] += chunk_counts[i];
+		});
+
+		info.draw_cnt[color] = counts[static_cast<size_t>(WDL_Entry::DRAW)];
+		info.lose_cnt[color] = counts[static_cast<size_t>(WDL_Entry::LOSE)];
+		info.win_cnt[color] = counts[static_cast<size_t>(WDL_Entry::WIN)];
+		info.illegal_cnt[color] = counts[static_cast<size_t>(WDL_Entry::ILLEGAL)];
+
+		src[color] = Const_Span(entries, src_files[color].size());
+	}
+
+	replace_if_verified(path, new_path, [&]() {
+		save_evtb_table(thread_pool, ps, src, info, generation_stats_of(summary), { { new_path, summary.table_colors } }, EGTB_Magic::WDL_MAGIC, settings);
+
+		WDL_File_For_Probe new_file;
+		load_evtb_table(out_param(new_file), ps, new_path, new_tmp, EGTB_Magic::WDL_MAGIC);
+
+		verify_same_entries(thread_pool, old_file, new_file, summary.table_colors, num_positions,
+			[](const WDL_File_For_Probe& file, Color color, Board_Index pos) {
+				return file.read(color, pos);
+			}
+		);
+	});
+}
+
+static void recompress_egtb_file(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const Piece_Config& ps,
+	const std::filesystem::path& path,
+	const EGTB_Paths& paths,
+	EGTB_Magic magic,
+	EGTB_Save_Settings settings
+)
+{
+	const EGTB_File_Summary summary = read_table_file_summary(path, ps, magic);
+	const size_t num_positions = Piece_Config_For_Gen(ps).num_positions();
+	const std::filesystem::path new_path = path.string() + RECOMPRESS_EXT;
+
+	// The decoded tables have no illegal entries left to fill.
+	settings.fill_illegal = false;
+
+	Temporary_File_Tracker tmp_files;
+	std::filesystem::path old_tmp[COLOR_NB], src_tmp[COLOR_NB], new_tmp[COLOR_NB], wdl_tmp[COLOR_NB];
+	make_tmp_paths(old_tmp, tmp_files, paths, ps, "recompress_old_", false);
+	make_tmp_paths(src_tmp, tmp_files, paths, ps, "recompress_src_", false);
+	make_tmp_paths(new_tmp, tmp_files, paths, ps, "recompress_new_", false);
+	make_tmp_paths(wdl_tmp, tmp_files, paths, ps, "recompress_wdl_", true);
+
+	// Only needed for tables stored without their draws, before or after.
+	std::filesystem::path wdl_path;
+	(void)paths.find_wdl_file(ps, &wdl_path);
+
+	DTM_File_For_Probe old_file;
+	load_egtb_table(out_param(old_file), ps, path, old_tmp, magic, wdl_path, wdl_tmp);
+
+	auto read_raw = [](const DTM_File_For_Probe& file, Color color, Board_Index pos) {
+		const DTM_Final_Entry entry = file.read(color, pos);
+		uint16_t value;
+		std::memcpy(&value, &entry, sizeof(uint16_t));
+		return value;
+	};
+
+	// Only whether a table has anything but draws matters to save_egtb_table.
+	Memory_Mapped_File src_files[COLOR_NB];
+	Const_Span<uint8_t> src[COLOR_NB];
+	EGTB_Info info;
+	for (const Color color : summary.table_colors)
+	{
+		if (!src_files[color].create(src_tmp[color], DTM_File_For_Probe::uncompressed_file_size(num_positions)))
+			throw std::runtime_error("Could not create temporary file " + src_tmp[color].string());
+
+		uint16_t* entries = reinterpret_cast<uint16_t*>(src_files[color].data());
+		std::atomic<uint64_t> num_draws(0);
+		for_each_chunk(thread_pool, num_positions, [&](size_t begin, size_t end) {
+			uint64_t chunk_draws = 0;
+			for (size_t pos = begin; pos < end; ++pos)
+			{
+				entries[pos] = read_raw(old_file, color, static_cast<Board_Index>(pos));
+				chunk_draws += entries[pos] == 0;
+			}
+			num_draws += chunk_draws;
+		});
+
+		info.draw_cnt[color] = num_draws;
+		info.win_cnt[color] = num_positions - num_draws;
+
+		src[color] = src_files[color].data_span();
+	}
+
+	EGTB_Bits decisive_bits[COLOR_NB];
+	if (settings.omit_draws)
+	{
+		if (wdl_path.empty())
+			throw std::runtime_error("Saving without draws needs the WDL file of " + ps.name());
+
+		WDL_File_For_Probe wdl;
+		load_evtb_table(out_param(wdl), ps, wdl_path, wdl_tmp, EGTB_Magic::WDL_MAGIC);
+
+		for (const Color color : summary.table_colors)
+		{
+			decisive_bits[color] = EGTB_Bits(num_positions);
+			for_each_chunk(thread_pool, num_positions, [&](size_t begin, size_t end) {
+				for (size_t pos = begin; pos < end; ++pos)
+				{
+					const WDL_Entry value = wdl.read(color, static_cast<Board_Index>(pos));
+					if (value == WDL_Entry::WIN || value == WDL_Entry::LOSE)
+						decisive_bits[color].set_bit(static_cast<Board_Index>(pos));
+				}
+			});
+		}
+	}
+
+	replace_if_verified(path, new_path, [&]() {
+		// The .info file is kept, the statistics of the value map are not needed to load.
+		(void)save_egtb_table(
+			thread_pool,
+			ps,
+			src,
+			info,
+			generation_stats_of(summary),
+			summary.is_big_order,
+			{ { new_path, summary.table_colors } },
+			magic,
+			settings,
+			settings.omit_draws ? decisive_bits : nullptr
+		);
+
+		DTM_File_For_Probe new_file;
+		load_egtb_table(out_param(new_file), ps, new_path, new_tmp, magic, wdl_path, wdl_tmp);
+
+		verify_same_entries(thread_pool, old_file, new_file, summary.table_colors, num_positions, read_raw);
+	});
+}
+
+size_t recompress_table_files(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const std::vector<std::filesystem::path>& dirs,
+	const EGTB_Paths& egtb_files,
+	const EGTB_Recompress_Settings& settings
+)
+{
+	EGTB_Paths paths = egtb_files;
+	std::vector<std::filesystem::path> files;
+	for (const auto& dir : dirs)
+	{
+		paths.add_wdl_path(dir);
+		for (const auto& entry : std::filesystem::directory_iterator(dir))
+		{
+			const std::string ext = entry.path().extension().string();
+			if (entry.is_regular_file() && (ext == EGTB_Paths::WDL_EXT || ext == EGTB_Paths::DTC_EXT || ext == EGTB_Paths::DTM_EXT))
+				files.emplace_back(entry.path());
+		}
+	}
+
+	// WDL files first, they may be needed by the others. The contents don't change.
+	std::sort(files.begin(), files.end(), [](const std::filesystem::path& lhs, const std::filesystem::path& rhs) {
+		const bool lhs_wdl = lhs.extension() == EGTB_Paths::WDL_EXT;
+		const bool rhs_wdl = rhs.extension() == EGTB_Paths::WDL_EXT;
+		if (lhs_wdl != rhs_wdl)
+			return lhs_wdl;
+		return lhs < rhs;
+	});
+
+	size_t num_failed = 0;
+	for (const auto& path : files)
+	{
+		try
+		{
+			const Piece_Config ps(path.stem().string());
+			const std::string ext = path.extension().string();
+			const size_t old_size = std::filesystem::file_size(path);
+
+			if (ext == EGTB_Paths::WDL_EXT)
+				recompress_wdl_file(thread_pool, ps, path, paths, settings.wdl);
+			else if (ext == EGTB_Paths::DTC_EXT)
+				recompress_egtb_file(thread_pool, ps, path, paths, EGTB_Magic::DTC_MAGIC, settings.dtc);
+			else
+				recompress_egtb_file(thread_pool, ps, path, paths, EGTB_Magic::DTM_MAGIC, settings.dtm);
+
+			printf("Recompressed %s: %zu -> %zu bytes\n", path.string().c_str(), old_size, static_cast<size_t>(std::filesystem::file_size(path)));
+		}
+		catch (const std::exception& e)
+		{
+			fprintf(stderr, "Could not recompress %s: %s\n", path.string().c_str(), e.what());
+			num_failed += 1;
+		}
+	}
+
+	return num_failed;
+}
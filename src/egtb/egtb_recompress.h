@@ -0,0 +1,33 @@
+#pragma once
+
+#include "egtb.h"
+#include "egtb_compress.h"
+
+#include "util/defines.h"
+#include "util/param.h"
+#include "util/thread_pool.h"
+
+#include <filesystem>
+#include <vector>
+
+// The settings recompress_table_files saves the tables with.
+struct EGTB_Recompress_Settings
+{
+	WDL_Save_Settings wdl;
+	EGTB_Save_Settings dtc;
+	EGTB_Save_Settings dtm;
+};
+
+// Decodes each WDL, DTC and DTM file in the directories and saves it again with
+// the given settings, to switch codecs or block sizes without regenerating.
+// The new file is loaded again and compared with the old one entry by entry,
+// and only then renamed over it. Files that fail are reported and left unchanged.
+// The WDL files of DTC and DTM tables stored with or without their draws are looked
+// up in the directories and in egtb_files. The decoded tables go to its tmp directory.
+// Returns the number of files that failed.
+NODISCARD size_t recompress_table_files(
+	In_Out_Param<Thread_Pool> thread_pool,
+	const std::vector<std::filesystem::path>& dirs,
+	const EGTB_Paths& egtb_files,
+	const EGTB_Recompress_Settings& settings
+);
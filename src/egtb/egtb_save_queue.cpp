@@ -0,0 +1,106 @@
+#include "egtb_save_queue.h"
+
+#include <cstdio>
+#include <stdexcept>
+
+EGTB_Save_Queue::EGTB_Save_Queue(size_t num_threads, size_t memory_budget) :
+	m_thread_pool(num_threads),
+	m_memory_budget(memory_budget),
+	m_pending_memory(0),
+	m_num_enqueued(0),
+	m_num_finished(0),
+	m_quit(false),
+	m_thread([this]() { thread_entry(); })
+{
+}
+
+EGTB_Save_Queue::~EGTB_Save_Queue()
+{
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_quit = true;
+		m_changed.notify_all();
+	}
+
+	m_thread.join();
+}
+
+EGTB_Save_Queue::Ticket EGTB_Save_Queue::enqueue(std::string name, size_t memory, Save_Function save)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	rethrow_error_if_any();
+
+	m_pending.push_back(Pending_Save{ std::move(name), memory, std::move(save) });
+	m_pending_memory += memory;
+	m_changed.notify_all();
+
+	return m_num_enqueued++;
+}
+
+void EGTB_Save_Queue::wait(Ticket ticket)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changed.wait(lock, [&]() { return m_num_finished > ticket; });
+	rethrow_error_if_any();
+}
+
+void EGTB_Save_Queue::wait_for_memory(size_t memory)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changed.wait(lock, [&]() { 
+		return m_pending_memory == 0 || m_pending_memory + memory <= m_memory_budget; 
+	});
+	rethrow_error_if_any();
+}
+
+void EGTB_Save_Queue::wait_all()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_changed.wait(lock, [&]() { return m_num_finished == m_num_enqueued; });
+	rethrow_error_if_any();
+}
+
+void EGTB_Save_Queue::thread_entry()
+{
+	for (;;)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait(lock, [&]() { return m_quit || !m_pending.empty(); });
+		if (m_pending.empty())
+			return;
+
+		// Stays in the queue until finished, so that its memory is accounted for.
+		const Pending_Save& save = m_pending.front();
+		lock.unlock();
+
+		std::exception_ptr error;
+		try
+		{
+			save.save(inout_param(m_thread_pool));
+		}
+		catch (std::runtime_error& e)
+		{
+			printf("Error during saving of %s: %s\n", save.name.c_str(), e.what());
+			error = std::current_exception();
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+
+		lock.lock();
+		m_pending_memory -= save.memory;
+		m_pending.pop_front();
+		m_num_finished += 1;
+		if (error != nullptr && m_error == nullptr)
+			m_error = error;
+		m_changed.notify_all();
+	}
+}
+
+void EGTB_Save_Queue::rethrow_error_if_any()
+{
+	if (m_error != nullptr)
+		std::rethrow_exception(m_error);
+}
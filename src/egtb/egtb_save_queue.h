@@ -0,0 +1,74 @@
+#pragma once
+
+#include "util/defines.h"
+#include "util/param.h"
+#include "util/thread_pool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Runs the compression and writing of finished tables on a separate, smaller
+// thread pool, so that the generation of the next tables doesn't have to wait
+// for it. Saves run one at a time, in the order they were enqueued.
+// A save owns the tables it writes, so it holds their memory until it finishes.
+// The queue keeps track of that memory, the generation has to wait for it to be
+// freed when the next tables wouldn't fit into the budget otherwise.
+struct EGTB_Save_Queue
+{
+	using Save_Function = std::function<void(In_Out_Param<Thread_Pool>)>;
+	using Ticket = size_t;
+
+	EGTB_Save_Queue(size_t num_threads, size_t memory_budget);
+
+	EGTB_Save_Queue(const EGTB_Save_Queue&) = delete;
+	EGTB_Save_Queue& operator=(const EGTB_Save_Queue&) = delete;
+
+	// Waits for all pending saves. Errors are not reported, use wait_all() for that.
+	~EGTB_Save_Queue();
+
+	// The memory is the amount held by the save until it finishes.
+	NODISCARD Ticket enqueue(std::string name, size_t memory, Save_Function save);
+
+	// Waits until the save with the given ticket, and all enqueued before it, are finished.
+	// Rethrows the first error of any save.
+	void wait(Ticket ticket);
+
+	// Waits until the memory held by pending saves leaves room for the given amount.
+	// Returns immediately when nothing is pending, a single generation
+	// is never larger than the budget.
+	void wait_for_memory(size_t memory);
+
+	void wait_all();
+
+private:
+	struct Pending_Save
+	{
+		std::string name;
+		size_t memory;
+		Save_Function save;
+	};
+
+	Thread_Pool m_thread_pool;
+	size_t m_memory_budget;
+
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	std::deque<Pending_Save> m_pending;
+	size_t m_pending_memory;
+	Ticket m_num_enqueued;
+	Ticket m_num_finished;
+	std::exception_ptr m_error;
+	bool m_quit;
+
+	// Must be initialized last.
+	std::thread m_thread;
+
+	void thread_entry();
+
+	void rethrow_error_if_any();
+};
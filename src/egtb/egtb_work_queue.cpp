@@ -0,0 +1,94 @@
+#include "egtb_work_queue.h"
+
+#include "system/system.h"
+
+#include "util/filesystem.h"
+
+#if defined(OS_WINDOWS)
+
+#include <Windows.h>
+
+#elif defined(OS_LINUX)
+
+#include <unistd.h>
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+
+// Identifies the owner of a lock, for the operator dealing with stale locks.
+NODISCARD static std::string make_worker_id()
+{
+	char host[256] = {};
+
+#if defined(OS_WINDOWS)
+
+	DWORD size = sizeof(host);
+	GetComputerNameA(host, &size);
+	const unsigned long pid = GetCurrentProcessId();
+
+#elif defined(OS_LINUX)
+
+	gethostname(host, sizeof(host) - 1);
+	const unsigned long pid = getpid();
+
+#endif
+
+	return std::string(host) + " " + std::to_string(pid) + " " + std::to_string(std::time(nullptr)) + "\n";
+}
+
+EGTB_Work_Queue::EGTB_Work_Queue(std::filesystem::path dir) :
+	m_dir(std::move(dir)),
+	m_worker_id(make_worker_id())
+{
+	std::filesystem::create_directories(m_dir);
+}
+
+bool EGTB_Work_Queue::try_claim(const Piece_Config& ps) const
+{
+	return try_create_file_exclusive(lock_path(ps), Const_Span(m_worker_id.data(), m_worker_id.size()));
+}
+
+bool EGTB_Work_Queue::is_done(const Piece_Config& ps) const
+{
+	return std::filesystem::exists(done_path(ps));
+}
+
+void EGTB_Work_Queue::mark_done(const Piece_Config& ps) const
+{
+	const std::filesystem::path path = done_path(ps);
+	const std::filesystem::path partial_path = std::filesystem::path(path).concat(".part");
+
+	{
+		std::ofstream fp(partial_path, std::ios_base::binary);
+		fp << m_worker_id;
+		if (!fp)
+			throw std::runtime_error("Cannot write done marker " + partial_path.string());
+	}
+
+	std::filesystem::rename(partial_path, path);
+
+	release(ps);
+}
+
+void EGTB_Work_Queue::release(const Piece_Config& ps) const
+{
+	std::error_code ec;
+	std::filesystem::remove(lock_path(ps), ec);
+}
+
+std::filesystem::path EGTB_Work_Queue::lock_path(const Piece_Config& ps) const
+{
+	return path_join(m_dir, ps.name() + LOCK_EXT);
+}
+
+std::filesystem::path EGTB_Work_Queue::done_path(const Piece_Config& ps) const
+{
+	return path_join(m_dir, ps.name() + DONE_EXT);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "chess/piece_config.h"
+
+#include "util/defines.h"
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+// Coordinates multiple generator processes, possibly on different machines,
+// through a directory on a shared filesystem. There is no coordinator process.
+// A worker claims a piece configuration by exclusively creating "<name>.lock",
+// and after all tables of it are saved publishes "<name>.done".
+// The done marker is created before the lock is removed, so a configuration
+// that can be claimed and isn't done was never finished.
+// Locks of crashed workers are not broken automatically, they have to be
+// removed by hand (generation resumes from a checkpoint, if there is one).
+struct EGTB_Work_Queue
+{
+	static inline const std::string LOCK_EXT = ".lock";
+	static inline const std::string DONE_EXT = ".done";
+
+	static constexpr std::chrono::seconds DEFAULT_POLL_INTERVAL = std::chrono::seconds(10);
+
+	explicit EGTB_Work_Queue(std::filesystem::path dir);
+
+	NODISCARD const std::filesystem::path& dir() const
+	{
+		return m_dir;
+	}
+
+	// Returns true if this worker now owns the configuration.
+	NODISCARD bool try_claim(const Piece_Config& ps) const;
+
+	NODISCARD bool is_done(const Piece_Config& ps) const;
+
+	// Publishes the done marker and releases the claim.
+	void mark_done(const Piece_Config& ps) const;
+
+	// Releases the claim without marking as done, for example after a failure.
+	void release(const Piece_Config& ps) const;
+
+	// The done marker, removing it by hand lets the configuration be claimed again.
+	NODISCARD std::filesystem::path done_path(const Piece_Config& ps) const;
+
+private:
+	std::filesystem::path m_dir;
+	std::string m_worker_id;
+
+	NODISCARD std::filesystem::path lock_path(const Piece_Config& ps) const;
+};
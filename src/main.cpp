@@ -9,6 +9,11 @@
 
 #include "egtb/egtb_gen_wdl_dtc.h"
 #include "egtb/egtb_gen_dtm.h"
+#include "egtb/egtb_work_queue.h"
+#include "egtb/egtb_save_queue.h"
+#include "egtb/egtb_compress.h"
+#include "egtb/egtb_recompress.h"
+#include "egtb/egtb_pack.h"
 
 #include <vector>
 #include <string>
@@ -24,6 +29,11 @@
 #include <chrono>
 #include <algorithm>
 #include <numeric>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
 
 using namespace std::string_view_literals;
 
@@ -48,6 +58,46 @@ struct Program_Options
 	size_t max_pieces = 20;
 	size_t memory_size = GiB;
 
+	// How many independent piece configurations may be generated at the same time.
+	// Threads and memory are split between them.
+	size_t max_concurrent_configs = 1;
+
+	// How many threads compress and write finished tables while the next ones
+	// are generated. Zero saves them before continuing. Only used when
+	// configurations are generated one at a time.
+	size_t background_save_threads = 0;
+
+	// Directory shared by cooperating workers. Empty for a standalone run.
+	std::filesystem::path work_queue_path;
+	std::chrono::seconds work_queue_poll_interval = EGTB_Work_Queue::DEFAULT_POLL_INTERVAL;
+
+	// FREE_PIECE_RELATIVE has fewer positions, but takes more time to generate
+	// and compresses worse, so it's only worth it if memory is the limit.
+	Board_Index_Layout board_index_layout = Board_Index_Layout::CARTESIAN;
+	// BY_MOBILITY makes the lookups of the generators more local. The tables
+	// are different, all sub tables must have been generated with the same order.
+	Board_Index_Group_Order board_index_group_order = Board_Index_Group_Order::BY_CLASS;
+
+	// RC2 makes WDL files smaller at the cost of slower loading.
+	WDL_Save_Settings wdl_settings;
+
+	// LZ4 saves and loads much faster than LZMA, the files are larger.
+	// SEPARATE_RULE_BITS makes DTM files with rule bits smaller.
+	// map_values stores the entries as ranks of their values by frequency, when
+	// a table has few distinct values. The .info files then get the sampled gain.
+	// fill_illegal lets each block store its illegal entries either as draws or as
+	// the values around them, whichever compresses better. Reported per table.
+	// omit_draws saves the tables without the positions that are draws in the WDL
+	// tables, the WDL file is then needed to load them. Needs the WDL tables saved.
+	EGTB_Save_Settings dtc_settings;
+	EGTB_Save_Settings dtm_settings;
+
+	// How often the generation state is dumped to tmpdir. Zero disables checkpoints.
+	std::chrono::seconds checkpoint_interval = std::chrono::seconds(0);
+
+	// Keeps the constructed piece groups in tmpdir, so that later runs of the same build load them.
+	bool cache_piece_groups = false;
+
 	bool generate_run_list = true;
 	bool generate_tablebases = true;
 
@@ -149,9 +199,28 @@ private:
 };
 
 void gen_tablebases(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options);
+void gen_tablebases_concurrently(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options);
+void gen_tablebases_distributed(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options);
+// Saves of finished tables running in the background of the generation.
+struct Background_Saves
+{
+	Background_Saves(size_t num_threads, size_t memory_budget) :
+		queue(num_threads, memory_budget)
+	{
+	}
+
+	EGTB_Save_Queue queue;
+
+	// DTM generation reads the DTM tables of sub configurations,
+	// so it has to wait for the ones being saved.
+	std::optional<EGTB_Save_Queue::Ticket> last_dtm_save;
+};
+
+void gen_tablebase(const Gen_List_Entry& entry, const Program_Options& options, In_Out_Param<Thread_Pool> thread_pool, Background_Saves* background_saves = nullptr);
 
 using PieceFilterFunc = std::function<bool(Const_Span<size_t>)>;
-NODISCARD std::vector<Gen_List_Candidate> gen_man_piece_sets(size_t max_man_cnt, PieceFilterFunc filter = nullptr);
+NODISCARD Unique_Piece_Configs gen_man_piece_configs(size_t max_man_cnt, PieceFilterFunc filter = nullptr);
+NODISCARD std::vector<Gen_List_Candidate> gen_man_piece_sets(size_t max_man_cnt, size_t num_threads, PieceFilterFunc filter = nullptr);
 
 NODISCARD std::vector<Gen_List_Entry> make_gen_list(const Unique_Piece_Configs& piece_sets, const Program_Options& options);
 
@@ -176,22 +245,220 @@ int main(int argc, char* argv[])
 	const std::vector<std::string> args(argv + 1, argv + argc);
 	const Program_Options options(ADDITIONAL_OPTIONS_FILE_PATH);
 
+	Piece_Config_For_Gen::set_preferred_board_index_layout(options.board_index_layout);
+	Piece_Config_For_Gen::set_board_index_group_order(options.board_index_group_order);
+
+	if (options.cache_piece_groups)
+		set_piece_group_cache_dir(options.egtb_files.piece_group_cache_path());
+
 	if (args.size() >= 1 && args[0] == "compute_egtb_gen_info")
 	{
 		std::cout << "Gathering all piece configurations...\n";
-		const auto& list = gen_man_piece_sets(MAX_MAN);
+		const auto& list = gen_man_piece_sets(MAX_MAN, options.num_threads);
 		std::cout << "Gathered total of " << list.size() << " piece configurations. Saving info...\n";
 		save_gen_info(list, options.egtb_full_gen_info_file_path);
 		std::cout << "Info saved to " << options.egtb_full_gen_info_file_path << '\n';
 		return 0;
 	}
 
+	if (args.size() >= 1 && args[0] == "prebuild_piece_groups")
+	{
+		if (!options.cache_piece_groups)
+		{
+			std::cerr << "Piece groups are only kept with CachePieceGroups = 1\n";
+			return 1;
+		}
+
+		const auto start_time = std::chrono::steady_clock::now();
+		Thread_Pool thread_pool(options.num_threads);
+		prebuild_piece_groups(inout_param(thread_pool), gen_man_piece_configs(options.max_pieces, pieces_filter));
+		std::cout << "Piece groups cached in " << options.egtb_files.piece_group_cache_path().string()
+			<< " in " << format_elapsed_time(start_time, std::chrono::steady_clock::now()) << '\n';
+		return 0;
+	}
+
+	if (args.size() >= 1 && (args[0] == "benchmark_wdl_codecs" || args[0] == "benchmark_wdl_dicts"))
+	{
+		Thread_Pool thread_pool(options.num_threads);
+		for (size_t i = 1; i < args.size(); ++i)
+		{
+			const Piece_Config ps(args[i]);
+
+			std::filesystem::path path;
+			if (!options.egtb_files.find_wdl_file(ps, &path))
+			{
+				std::cerr << "Could not find a WDL file for " << ps.name() << '\n';
+				return 1;
+			}
+
+			if (args[0] == "benchmark_wdl_codecs")
+				benchmark_wdl_codecs(inout_param(thread_pool), ps, path);
+			else
+				benchmark_wdl_dicts(inout_param(thread_pool), ps, path);
+		}
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "benchmark_group_orders")
+	{
+		if (args.size() < 2)
+		{
+			std::cerr << "Usage: benchmark_group_orders <piece config>...\n";
+			return 1;
+		}
+
+		constexpr size_t NUM_SAMPLE_POSITIONS = 1 << 24;
+
+		Thread_Pool thread_pool(options.num_threads);
+		for (size_t i = 1; i < args.size(); ++i)
+			benchmark_board_index_group_orders(inout_param(thread_pool), Piece_Config(args[i]), NUM_SAMPLE_POSITIONS);
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "benchmark_quiet_index_updates")
+	{
+		if (args.size() < 2)
+		{
+			std::cerr << "Usage: benchmark_quiet_index_updates <piece config>...\n";
+			return 1;
+		}
+
+		constexpr size_t NUM_SAMPLE_POSITIONS = 1 << 20;
+		constexpr size_t NUM_PASSES = 16;
+
+		for (size_t i = 1; i < args.size(); ++i)
+			benchmark_quiet_index_updates(Piece_Config(args[i]), NUM_SAMPLE_POSITIONS, NUM_PASSES);
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "benchmark_egtb_codecs")
+	{
+		options.egtb_files.init_directories();
+
+		Thread_Pool thread_pool(options.num_threads);
+		for (size_t i = 1; i < args.size(); ++i)
+		{
+			const Piece_Config ps(args[i]);
+
+			Temporary_File_Tracker tmp_files;
+			const std::filesystem::path tmp[COLOR_NB] = {
+				tmp_files.track_path(options.egtb_files.dtm_tmp_path(ps, WHITE)),
+				tmp_files.track_path(options.egtb_files.dtm_tmp_path(ps, BLACK))
+			};
+
+			// Only needed for tables stored without their draws.
+			std::filesystem::path wdl_path;
+			(void)options.egtb_files.find_wdl_file(ps, &wdl_path);
+			const std::filesystem::path wdl_tmp[COLOR_NB] = {
+				options.egtb_files.wdl_tmp_path(ps, WHITE),
+				options.egtb_files.wdl_tmp_path(ps, BLACK)
+			};
+
+			bool found_any = false;
+			std::filesystem::path path;
+			if (options.egtb_files.find_dtc_file(ps, &path))
+			{
+				found_any = true;
+				benchmark_egtb_codecs(inout_param(thread_pool), ps, path, EGTB_Magic::DTC_MAGIC, tmp, wdl_path, wdl_tmp);
+			}
+			if (options.egtb_files.find_dtm_file(ps, &path))
+			{
+				found_any = true;
+				benchmark_egtb_codecs(inout_param(thread_pool), ps, path, EGTB_Magic::DTM_MAGIC, tmp, wdl_path, wdl_tmp);
+			}
+
+			if (!found_any)
+			{
+				std::cerr << "Could not find a DTC or DTM file for " << ps.name() << '\n';
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "recompress")
+	{
+		if (args.size() < 2)
+		{
+			std::cerr << "Usage: recompress <directory>...\n";
+			return 1;
+		}
+
+		options.egtb_files.init_directories();
+
+		EGTB_Recompress_Settings settings;
+		settings.wdl = options.wdl_settings;
+		settings.dtc = options.dtc_settings;
+		settings.dtm = options.dtm_settings;
+
+		Thread_Pool thread_pool(options.num_threads);
+		const std::vector<std::filesystem::path> dirs(args.begin() + 1, args.end());
+		const size_t num_failed = recompress_table_files(inout_param(thread_pool), dirs, options.egtb_files, settings);
+		if (num_failed != 0)
+		{
+			std::cerr << num_failed << " files could not be recompressed\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "pack")
+	{
+		if (args.size() < 3)
+		{
+			std::cerr << "Usage: pack <pack file> <directory>...\n";
+			return 1;
+		}
+
+		const std::vector<std::filesystem::path> dirs(args.begin() + 2, args.end());
+		const size_t num_tables = pack_table_files(args[1], dirs);
+		std::cout << "Packed " << num_tables << " tables into " << args[1] << '\n';
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "unpack")
+	{
+		if (args.size() != 3)
+		{
+			std::cerr << "Usage: unpack <pack file> <directory>\n";
+			return 1;
+		}
+
+		const size_t num_tables = unpack_table_files(args[1], args[2]);
+		std::cout << "Unpacked " << num_tables << " tables into " << args[2] << '\n';
+		return 0;
+	}
+
+	if (args.size() >= 1 && args[0] == "dump_header")
+	{
+		if (args.size() < 2)
+		{
+			std::cerr << "Usage: dump_header <table file>...\n";
+			return 1;
+		}
+
+		int result = 0;
+		for (size_t i = 1; i < args.size(); ++i)
+		{
+			try
+			{
+				print_table_file_header(args[i]);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << e.what() << '\n';
+				result = 1;
+			}
+		}
+		return result;
+	}
+
 	options.egtb_files.init_directories();
 
 	if (options.generate_run_list)
 	{
 		std::cout << "Gathering configurations with <=" << options.max_pieces << " pieces...\n";
-		const auto& list = gen_man_piece_sets(options.max_pieces, pieces_filter);
+		const auto& list = gen_man_piece_sets(options.max_pieces, options.num_threads, pieces_filter);
 		std::cout << "Gathered total of " << list.size() << " candidate piece configurations. Saving...\n";
 		save_gen_info(list, options.egtb_gen_info_file_path);
 		std::cout << "Info saved to " << options.egtb_gen_info_file_path << '\n';
@@ -234,12 +501,114 @@ int main(int argc, char* argv[])
 	}
 }
 
+void gen_tablebase(const Gen_List_Entry& entry, const Program_Options& options, In_Out_Param<Thread_Pool> thread_pool, Background_Saves* background_saves)
+{
+	// Computed once when both generators need them.
+	std::shared_ptr<const EGTB_Legal_Positions> legal_positions;
+
+	if (entry.generate_wdl || entry.generate_dtc)
+	{
+		try
+		{
+			if (background_saves != nullptr)
+				background_saves->queue.wait_for_memory(entry.required_memory());
+
+			const auto start_time = std::chrono::steady_clock::now();
+			if (entry.generate_dtm)
+				legal_positions = std::make_shared<const EGTB_Legal_Positions>(thread_pool, Piece_Config_For_Gen(entry.piece_set));
+
+			auto input = std::make_shared<DTC_Generator>(entry.piece_set, entry.generate_wdl, entry.generate_dtc, options.egtb_files, options.checkpoint_interval, options.wdl_settings, options.dtc_settings, legal_positions);
+			input->gen(thread_pool);
+
+			if (background_saves == nullptr)
+				input->save_dtc(thread_pool);
+			else
+			{
+				(void)background_saves->queue.enqueue(
+					entry.piece_set.name() + " DTC",
+					input->memory_held_for_saving(),
+					[input](In_Out_Param<Thread_Pool> save_thread_pool) { input->save_dtc(save_thread_pool); }
+				);
+			}
+
+			const auto end_time = std::chrono::steady_clock::now();
+			printf("%s WDL/DTC generation took %s\n", entry.piece_set.name().c_str(), format_elapsed_time(start_time, end_time).c_str());
+		}
+		catch (std::runtime_error& e)
+		{
+			std::cout << "Error during generation of " << entry.piece_set.name() << " WDL/DTC TB: " << e.what() << '\n';
+			throw;
+		}
+	}
+
+	if (entry.generate_dtm)
+	{
+		try
+		{
+			if (background_saves != nullptr)
+			{
+				if (background_saves->last_dtm_save.has_value())
+					background_saves->queue.wait(*background_saves->last_dtm_save);
+				background_saves->queue.wait_for_memory(entry.required_memory());
+			}
+
+			const auto start_time = std::chrono::steady_clock::now();
+			auto input = std::make_shared<DTM_Generator>(entry.piece_set, options.save_rule_bits, options.egtb_files, options.checkpoint_interval, options.dtm_settings, std::move(legal_positions));
+			input->gen(thread_pool);
+
+			if (background_saves == nullptr)
+				input->save_dtm(thread_pool);
+			else
+			{
+				background_saves->last_dtm_save = background_saves->queue.enqueue(
+					entry.piece_set.name() + " DTM",
+					input->memory_held_for_saving(),
+					[input](In_Out_Param<Thread_Pool> save_thread_pool) { input->save_dtm(save_thread_pool); }
+				);
+			}
+
+			const auto end_time = std::chrono::steady_clock::now();
+			printf("%s DTM generation took %s\n", entry.piece_set.name().c_str(), format_elapsed_time(start_time, end_time).c_str());
+		}
+		catch (std::runtime_error& e)
+		{
+			std::cout << "Error during generation of " << entry.piece_set.name() << " DTM TB: " << e.what() << '\n';
+			throw;
+		}
+	}
+}
+
 void gen_tablebases(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options)
 {
+	// The other modes run several generations on their own pools, the saves
+	// would not get a bounded share of the threads.
+	const bool is_concurrent = options.max_concurrent_configs > 1 && options.num_threads > 1;
+	if (options.background_save_threads > 0 && (!options.work_queue_path.empty() || is_concurrent))
+		printf("WARNING: BackgroundSaveThreads is ignored with WorkQueueDir or MaxConcurrentConfigs, tables are saved after their generation.\n");
+
+	if (!options.work_queue_path.empty())
+	{
+		gen_tablebases_distributed(gen_list, options);
+		return;
+	}
+
+	if (is_concurrent)
+	{
+		gen_tablebases_concurrently(gen_list, options);
+		return;
+	}
+
 	auto start_time = std::chrono::steady_clock::now();
 
 	Thread_Pool thread_pool(options.num_threads);
 
+	std::optional<Background_Saves> background_saves;
+	if (options.background_save_threads > 0)
+	{
+		const size_t memory_budget = (options.memory_size * MiB) * 4 / 5;
+		background_saves.emplace(options.background_save_threads, memory_budget);
+	}
+
 	size_t current_processed = 0;
 	for (const auto& entry : gen_list)
 	{
@@ -247,45 +616,304 @@ void gen_tablebases(const std::vector<Gen_List_Entry>& gen_list, const Program_O
 		std::cout << "Processing piece configuration " << current_processed << " out of " << gen_list.size() << ": " << entry.piece_set.name() << "\n";
 		std::cout << "=====================\n";
 
-		if (entry.generate_wdl || entry.generate_dtc)
+		gen_tablebase(entry, options, inout_param(thread_pool), background_saves.has_value() ? &*background_saves : nullptr);
+
+		printf("=====================\n");
+	}
+
+	if (background_saves.has_value())
+		background_saves->queue.wait_all();
+
+	auto end_time = std::chrono::steady_clock::now();
+	printf("Generating tablebases finished in %s\n", format_elapsed_time(start_time, end_time).c_str());
+}
+
+// For each entry, the indices of the entries it needs the tables of (by captures).
+NODISCARD std::vector<std::vector<size_t>> gen_list_dependencies(const std::vector<Gen_List_Entry>& gen_list)
+{
+	std::map<Material_Key, size_t> entry_by_material;
+	for (size_t i = 0; i < gen_list.size(); ++i)
+		entry_by_material.try_emplace(gen_list[i].piece_set.base_material_key(), i);
+
+	std::vector<std::vector<size_t>> dependencies(gen_list.size());
+	for (size_t i = 0; i < gen_list.size(); ++i)
+	{
+		for (const auto& [cap, sub_ps] : gen_list[i].piece_set.sub_configs_by_capture())
 		{
-			try
+			const auto it = entry_by_material.find(sub_ps.base_material_key());
+			if (it != entry_by_material.end())
+				dependencies[i].emplace_back(it->second);
+		}
+	}
+
+	return dependencies;
+}
+
+// The kinds of tables that the entry was supposed to generate, but are not saved
+// or are corrupted, like "WDL DTM". Empty if all are intact. On a shared filesystem
+// the files may become visible before their contents do.
+NODISCARD std::string missing_gen_list_entry_tables(const Gen_List_Entry& entry, const EGTB_Paths& egtb_files)
+{
+	// They were saved by another worker, so the directory index doesn't know them yet.
+	egtb_files.refresh_tb_files(entry.piece_set);
+
+	std::string missing;
+	std::filesystem::path path;
+
+	auto add_missing = [&](const char* kind) {
+		if (!missing.empty())
+			missing += ' ';
+		missing += kind;
+	};
+
+	if (entry.generate_wdl && !(egtb_files.find_wdl_file(entry.piece_set, &path) && is_egtb_file_intact(path)))
+		add_missing("WDL");
+
+	if (entry.generate_dtc && !(egtb_files.find_dtc_file(entry.piece_set, &path) && is_egtb_file_intact(path)))
+		add_missing("DTC");
+
+	if (entry.generate_dtm && !(egtb_files.find_dtm_file(entry.piece_set, &path) && is_egtb_file_intact(path)))
+		add_missing("DTM");
+
+	return missing;
+}
+
+// Runs multiple entries of the gen list at once.
+// An entry can start when all entries it depends on (by captures) are finished
+// and there are enough free threads and memory for it. Small configurations
+// get a few threads each, large ones get up to all of them.
+// Entries are started in list order, a ready entry that doesn't fit blocks the
+// following ones, so large configurations are not starved by small ones.
+void gen_tablebases_concurrently(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options)
+{
+	// Roughly the amount of positions for which a single thread is enough
+	// to not make the generation dominated by synchronization overhead.
+	constexpr size_t POSITIONS_PER_THREAD = 16 * 1024 * 1024;
+
+	enum struct Job_State
+	{
+		WAITING, RUNNING, DONE
+	};
+
+	auto start_time = std::chrono::steady_clock::now();
+
+	const size_t num_jobs = gen_list.size();
+	const auto dependencies = gen_list_dependencies(gen_list);
+
+	// Entries of the gen list have all generation infos, make_gen_list leaves out
+	// configurations without them, and all of them have the same number of positions.
+	auto threads_for_job = [&](size_t i) {
+		const auto& entry = gen_list[i];
+		ASSERT(entry.wdl_info.has_value());
+		return std::clamp<size_t>(ceil_div(entry.wdl_info->num_positions, POSITIONS_PER_THREAD), 1, options.num_threads);
+	};
+
+	const size_t memory_budget = (options.memory_size * MiB) * 4 / 5;
+
+	std::mutex mutex;
+	std::condition_variable job_finished;
+	std::vector<Job_State> states(num_jobs, Job_State::WAITING);
+	std::vector<std::thread> workers;
+	std::exception_ptr error;
+	size_t free_threads = options.num_threads;
+	size_t free_memory = memory_budget;
+	size_t num_running = 0;
+	size_t num_done = 0;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (num_done < num_jobs)
+	{
+		if (error != nullptr && num_running == 0)
+			break;
+
+		for (size_t i = 0; i < num_jobs && error == nullptr && num_running < options.max_concurrent_configs; ++i)
+		{
+			if (states[i] != Job_State::WAITING)
+				continue;
+
+			const bool is_ready = std::all_of(
+				dependencies[i].begin(), 
+				dependencies[i].end(), 
+				[&](size_t j) { return states[j] == Job_State::DONE; }
+			);
+			if (!is_ready)
+				continue;
+
+			const size_t num_threads = threads_for_job(i);
+			// A job that is alone must always be able to run, the memory estimate
+			// for it has already been checked when making the gen list.
+			// It still takes all the memory it can, so that no other job starts next to it.
+			const size_t required_memory = gen_list[i].required_memory();
+			if (num_threads > free_threads || (num_running != 0 && required_memory > free_memory))
+				break;
+
+			const size_t memory = std::min(required_memory, free_memory);
+
+			states[i] = Job_State::RUNNING;
+			free_threads -= num_threads;
+			free_memory -= memory;
+			num_running += 1;
+
+			printf("Starting %s (%zu out of %zu) on %zu threads\n", 
+				gen_list[i].piece_set.name().c_str(), i + 1, num_jobs, num_threads);
+
+			workers.emplace_back([&, i, num_threads, memory]() {
+				std::exception_ptr job_error;
+				try
+				{
+					// Sub tables are decompressed to tmp files named after them,
+					// so they must not collide with ones loaded by the other jobs.
+					Program_Options job_options = options;
+					job_options.egtb_files.set_tmp_file_prefix(gen_list[i].piece_set.name() + "_");
+
+					Thread_Pool thread_pool(num_threads);
+					gen_tablebase(gen_list[i], job_options, inout_param(thread_pool));
+				}
+				catch (...)
+				{
+					job_error = std::current_exception();
+				}
+
+				std::unique_lock<std::mutex> lock(mutex);
+				states[i] = Job_State::DONE;
+				free_threads += num_threads;
+				free_memory += memory;
+				num_running -= 1;
+				num_done += 1;
+				if (job_error != nullptr && error == nullptr)
+					error = job_error;
+				job_finished.notify_one();
+			});
+		}
+
+		if (num_done < num_jobs)
+			job_finished.wait(lock);
+	}
+	lock.unlock();
+
+	for (auto& worker : workers)
+		worker.join();
+
+	if (error != nullptr)
+		std::rethrow_exception(error);
+
+	auto end_time = std::chrono::steady_clock::now();
+	printf("Generating tablebases finished in %s\n", format_elapsed_time(start_time, end_time).c_str());
+}
+
+// Generates the gen list cooperatively with other processes that use the same
+// work queue directory, typically on other machines sharing the filesystem.
+// Entries are claimed in list order once the tables they depend on are done
+// and pass the checksum check. When nothing can be claimed the worker polls
+// until the other workers finish.
+void gen_tablebases_distributed(const std::vector<Gen_List_Entry>& gen_list, const Program_Options& options)
+{
+	auto start_time = std::chrono::steady_clock::now();
+
+	const EGTB_Work_Queue queue(options.work_queue_path);
+	const auto dependencies = gen_list_dependencies(gen_list);
+
+	Thread_Pool thread_pool(options.num_threads);
+
+	// Tables of entries marked as done by other workers are checked again for this long
+	// before giving up, as they may not be visible here yet.
+	const auto max_missing_tables_time = options.work_queue_poll_interval * 10;
+
+	std::vector<bool> is_finished(gen_list.size(), false);
+	std::vector<std::optional<std::chrono::steady_clock::time_point>> missing_tables_since(gen_list.size());
+	size_t num_finished = 0;
+	size_t num_generated = 0;
+
+	while (num_finished < gen_list.size())
+	{
+		bool any_progress = false;
+
+		for (size_t i = 0; i < gen_list.size(); ++i)
+		{
+			if (is_finished[i])
+				continue;
+
+			const auto& entry = gen_list[i];
+
+			if (queue.is_done(entry.piece_set))
 			{
-				const auto start_time = std::chrono::steady_clock::now();
-				DTC_Generator input(entry.piece_set, entry.generate_wdl, entry.generate_dtc, options.egtb_files);
-				input.gen(inout_param(thread_pool));
-				const auto end_time = std::chrono::steady_clock::now();
-				printf("WDL/DTC generation took %s\n", format_elapsed_time(start_time, end_time).c_str());
+				const std::string missing = missing_gen_list_entry_tables(entry, options.egtb_files);
+				if (missing.empty())
+				{
+					is_finished[i] = true;
+					num_finished += 1;
+					any_progress = true;
+				}
+				else if (!missing_tables_since[i].has_value())
+				{
+					printf("%s is marked as done, but its %s tables are missing or damaged, waiting for them\n", entry.piece_set.name().c_str(), missing.c_str());
+					missing_tables_since[i] = std::chrono::steady_clock::now();
+				}
+				else if (std::chrono::steady_clock::now() - *missing_tables_since[i] >= max_missing_tables_time)
+				{
+					// Nobody else claims an entry that is marked as done, so waiting longer won't help.
+					throw std::runtime_error(
+						entry.piece_set.name() + " is marked as done, but its " + missing + " tables are missing or damaged. "
+						"Remove " + queue.done_path(entry.piece_set).string() + " to generate it again."
+					);
+				}
+				continue;
 			}
-			catch (std::runtime_error& e)
+
+			const bool is_ready = std::all_of(
+				dependencies[i].begin(),
+				dependencies[i].end(),
+				[&](size_t j) { return is_finished[j]; }
+			);
+			if (!is_ready || !queue.try_claim(entry.piece_set))
+				continue;
+
+			// Someone could have finished it between the checks.
+			if (queue.is_done(entry.piece_set))
 			{
-				std::cout << "Error during generation of " << entry.piece_set.name() << " WDL/DTC TB: " << e.what() << '\n';
-				throw;
+				queue.release(entry.piece_set);
+				continue;
 			}
-		}
 
-		if (entry.generate_dtm)
-		{
+			std::cout << "Processing piece configuration " << i + 1 << " out of " << gen_list.size() << ": " << entry.piece_set.name() << "\n";
+			std::cout << "=====================\n";
+
 			try
 			{
-				const auto start_time = std::chrono::steady_clock::now();
-				DTM_Generator input(entry.piece_set, options.save_rule_bits, options.egtb_files);
-				input.gen(inout_param(thread_pool));
-				const auto end_time = std::chrono::steady_clock::now();
-				printf("DTM generation took %s\n", format_elapsed_time(start_time, end_time).c_str());
+				// Workers may share the tmp directory as well.
+				Program_Options job_options = options;
+				job_options.egtb_files.set_tmp_file_prefix(entry.piece_set.name() + "_");
+
+				gen_tablebase(entry, job_options, inout_param(thread_pool));
 			}
-			catch (std::runtime_error& e)
+			catch (...)
 			{
-				std::cout << "Error during generation of " << entry.piece_set.name() << " DTM TB: " << e.what() << '\n';
+				queue.release(entry.piece_set);
 				throw;
 			}
+
+			queue.mark_done(entry.piece_set);
+
+			printf("=====================\n");
+
+			is_finished[i] = true;
+			num_finished += 1;
+			num_generated += 1;
+			any_progress = true;
+
+			// Restart from the beginning, earlier entries may have become ready.
+			break;
 		}
 
-		printf("=====================\n");
+		if (!any_progress && num_finished < gen_list.size())
+		{
+			printf("Waiting for %zu piece configurations being generated by other workers\n", gen_list.size() - num_finished);
+			std::this_thread::sleep_for(options.work_queue_poll_interval);
+		}
 	}
 
 	auto end_time = std::chrono::steady_clock::now();
-	printf("Generating tablebases finished in %s\n", format_elapsed_time(start_time, end_time).c_str());
+	printf("Generated %zu out of %zu piece configurations in %s\n", num_generated, gen_list.size(), format_elapsed_time(start_time, end_time).c_str());
 }
 
 NODISCARD Unique_Piece_Configs read_gen_list(std::filesystem::path path)
@@ -316,6 +944,11 @@ NODISCARD std::vector<Gen_List_Entry> make_gen_list(const Unique_Piece_Configs&
 	for (const Piece_Config& ps : piece_sets)
 		ps.add_closure_in_dependency_order_to(closured_piece_sets, true);
 
+	{
+		Thread_Pool thread_pool(options.num_threads);
+		prebuild_piece_groups(inout_param(thread_pool), closured_piece_sets);
+	}
+
 	const size_t safe_amount_of_memory_bytes = (options.memory_size * MiB) * 4 / 5;
 
 	std::vector<Gen_List_Entry> gen_list;
@@ -348,6 +981,7 @@ NODISCARD std::vector<Gen_List_Entry> make_gen_list(const Unique_Piece_Configs&
 }
 
 NODISCARD bool parse_line(const std::string& line, std::string& name, std::string& value);
+NODISCARD EGTB_Codec parse_egtb_codec(const std::string& value);
 
 Program_Options::Program_Options(const std::filesystem::path& path)
 {
@@ -412,6 +1046,124 @@ Program_Options::Program_Options(const std::filesystem::path& path)
 			{
 				max_pieces = atoi(value.c_str());
 			}
+			else if (name == "MaxConcurrentConfigs"sv)
+			{
+				max_concurrent_configs = atoi(value.c_str());
+			}
+			else if (name == "BackgroundSaveThreads"sv)
+			{
+				background_save_threads = atoi(value.c_str());
+			}
+			else if (name == "WorkQueueDir"sv)
+			{
+				work_queue_path = value;
+			}
+			else if (name == "WorkQueuePollInterval"sv)
+			{
+				work_queue_poll_interval = std::chrono::seconds(std::max(atoi(value.c_str()), 1));
+			}
+			else if (name == "CheckpointInterval"sv)
+			{
+				checkpoint_interval = std::chrono::seconds(atoi(value.c_str()));
+			}
+			else if (name == "CachePieceGroups"sv)
+			{
+				cache_piece_groups = atoi(value.c_str());
+			}
+			else if (name == "BoardIndexLayout"sv)
+			{
+				board_index_layout = 
+					atoi(value.c_str()) != 0 
+					? Board_Index_Layout::FREE_PIECE_RELATIVE 
+					: Board_Index_Layout::CARTESIAN;
+			}
+			else if (name == "BoardIndexGroupOrder"sv)
+			{
+				board_index_group_order =
+					atoi(value.c_str()) != 0
+					? Board_Index_Group_Order::BY_MOBILITY
+					: Board_Index_Group_Order::BY_CLASS;
+			}
+			else if (name == "CompressionPreset"sv)
+			{
+				// Only overrides the codecs and levels set before it.
+				if (value == "draft")
+				{
+					wdl_settings.use_draft_preset();
+					dtc_settings.use_draft_preset();
+					dtm_settings.use_draft_preset();
+				}
+			}
+			else if (name == "WDLCodec"sv)
+			{
+				wdl_settings.codec = 
+					atoi(value.c_str()) != 0 
+					? WDL_Codec::RC2 
+					: WDL_Codec::LZ4;
+			}
+			else if (name == "WDLLevel"sv)
+			{
+				wdl_settings.level = atoi(value.c_str());
+			}
+			else if (name == "WDLBlockSize"sv)
+			{
+				wdl_settings.block_size = atoi(value.c_str());
+			}
+			else if (name == "WDLDictSampleBlocks"sv)
+			{
+				wdl_settings.dict_sample_blocks = atoi(value.c_str());
+			}
+			else if (name == "WDLDictSampleStride"sv)
+			{
+				wdl_settings.dict_sample_stride = atoi(value.c_str());
+			}
+			else if (name == "DTCCodec"sv)
+			{
+				dtc_settings.codec = parse_egtb_codec(value);
+			}
+			else if (name == "DTCLevel"sv)
+			{
+				dtc_settings.level = atoi(value.c_str());
+			}
+			else if (name == "DTCBlockSize"sv)
+			{
+				dtc_settings.block_size = atoi(value.c_str());
+			}
+			else if (name == "DTMCodec"sv)
+			{
+				dtm_settings.codec = parse_egtb_codec(value);
+			}
+			else if (name == "DTMLevel"sv)
+			{
+				dtm_settings.level = atoi(value.c_str());
+			}
+			else if (name == "DTMBlockSize"sv)
+			{
+				dtm_settings.block_size = atoi(value.c_str());
+			}
+			else if (name == "MapValues"sv)
+			{
+				dtc_settings.map_values = dtm_settings.map_values = atoi(value.c_str());
+			}
+			else if (name == "FillIllegal"sv)
+			{
+				dtc_settings.fill_illegal = dtm_settings.fill_illegal = atoi(value.c_str());
+			}
+			else if (name == "OmitDraws"sv)
+			{
+				dtc_settings.omit_draws = dtm_settings.omit_draws = atoi(value.c_str());
+			}
+			else if (name == "SaveTimes"sv)
+			{
+				wdl_settings.save_times = dtc_settings.save_times = dtm_settings.save_times = atoi(value.c_str());
+			}
+			else if (name == "DTMSeparateRuleBits"sv)
+			{
+				dtm_settings.layout = 
+					atoi(value.c_str()) != 0 
+					? EGTB_Block_Layout::SEPARATE_RULE_BITS 
+					: EGTB_Block_Layout::INTERLEAVED;
+			}
 		}
 	}
 }
@@ -471,7 +1223,7 @@ NODISCARD std::array<std::pair<size_t, size_t>, PIECE_NB> supported_piece_count_
 	return piece_count_ranges;
 }
 
-NODISCARD std::vector<Gen_List_Candidate> gen_man_piece_sets(size_t max_man_cnt, PieceFilterFunc filter)
+NODISCARD Unique_Piece_Configs gen_man_piece_configs(size_t max_man_cnt, PieceFilterFunc filter)
 {
 	const auto piece_count_ranges = supported_piece_count_ranges();
 
@@ -494,6 +1246,19 @@ NODISCARD std::vector<Gen_List_Candidate> gen_man_piece_sets(size_t max_man_cnt,
 		piece_sets.add_unique(Piece_Config(Const_Span(pieces)));
 	}
 
+	return piece_sets;
+}
+
+NODISCARD std::vector<Gen_List_Candidate> gen_man_piece_sets(size_t max_man_cnt, size_t num_threads, PieceFilterFunc filter)
+{
+	const Unique_Piece_Configs piece_sets = gen_man_piece_configs(max_man_cnt, filter);
+
+	// The candidates need all piece groups, make them all at once first.
+	{
+		Thread_Pool thread_pool(num_threads);
+		prebuild_piece_groups(inout_param(thread_pool), piece_sets);
+	}
+
 	std::vector<Gen_List_Candidate> res(piece_sets.begin(), piece_sets.end());
 	std::sort(res.begin(), res.end());
 	return res;
@@ -525,10 +1290,26 @@ bool parse_line(const std::string& line, std::string& name, std::string& value)
 	return !name.empty() && !value.empty();
 }
 
+// 0 for LZMA, 1 for LZ4, 2 for zstd. Other values select LZMA.
+EGTB_Codec parse_egtb_codec(const std::string& value)
+{
+	switch (atoi(value.c_str()))
+	{
+	case 1:
+		return EGTB_Codec::LZ4;
+
+	case 2:
+		return EGTB_Codec::ZSTD;
+
+	default:
+		return EGTB_Codec::LZMA;
+	}
+}
+
 void save_gen_info(const std::vector<Gen_List_Candidate>& infos, std::filesystem::path path)
 {
 	std::ofstream out_file(path);
-	out_file << "Piece configuration;Num positions;WDL uncompressed size;DTC uncompressed size;DTM uncompressed size;WDL generation memory;DTC generation memory;DTM generation memory;WDL sub EGTB size;DTC sub EGTB size;DTM sub EGTB size\n";
+	out_file << "Piece configuration;Num positions;Relative layout reduction;WDL uncompressed size;DTC uncompressed size;DTM uncompressed size;WDL generation memory;DTC generation memory;DTM generation memory;WDL sub EGTB size;DTC sub EGTB size;DTM sub EGTB size\n";
 	for (size_t i = 0; i < infos.size(); ++i)
 	{
 		const auto& entry = infos[i];
@@ -536,7 +1317,7 @@ void save_gen_info(const std::vector<Gen_List_Candidate>& infos, std::filesystem
 		if (entry.is_too_large())
 		{
 			std::snprintf(buf, sizeof(buf),
-				"%-32s;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE\n",
+				"%-32s;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE;TOO LARGE\n",
 				entry.piece_set.name().c_str()
 			);
 		}
@@ -546,9 +1327,13 @@ void save_gen_info(const std::vector<Gen_List_Candidate>& infos, std::filesystem
 			ASSERT(entry.dtc_info.has_value());
 			ASSERT(entry.dtm_info.has_value());
 
+			// Positions not indexed by the FREE_PIECE_RELATIVE layout.
+			const double reduction = 
+				1.0 - static_cast<double>(entry.wdl_info->num_relative_positions) / entry.wdl_info->num_cartesian_positions;
+
 			std::snprintf(buf, sizeof(buf),
-				"%-32s;%016zu;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB\n",
-				entry.piece_set.name().c_str(), entry.wdl_info->num_positions,
+				"%-32s;%016zu;%6.2f%%;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB;%010zuMiB\n",
+				entry.piece_set.name().c_str(), entry.wdl_info->num_positions, reduction * 100.0,
 				entry.wdl_info->uncompressed_size / MiB, entry.dtc_info->uncompressed_size / MiB, entry.dtm_info->uncompressed_size / MiB,
 				entry.wdl_info->memory_required_for_generation / MiB, entry.dtc_info->memory_required_for_generation / MiB, entry.dtm_info->memory_required_for_generation / MiB,
 				entry.wdl_info->uncompressed_sub_tb_size / MiB, entry.dtc_info->uncompressed_sub_tb_size / MiB, entry.dtm_info->uncompressed_sub_tb_size / MiB
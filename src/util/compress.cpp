@@ -5,46 +5,198 @@
 #include "util/allocation.h"
 #include "util/progress_bar.h"
 
+#include "zstd/common/xxhash.h"
+#include "zstd/zstd.h"
+
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <memory>
 #include <cstring>
 #include <filesystem>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+// The k parameters ZDICT_trainFromBuffer tries, with d = 8.
+static constexpr unsigned DICT_CANDIDATE_K[] = { 50, 537, 1024, 1511, 1998 };
+static constexpr unsigned DICT_CANDIDATE_D = 8;
+
+// Trains fastCover dictionaries of at most dict_size bytes on the first
+// train_count samples, one candidate per k on the threads of the pool.
+// make_cost_function is called once on each thread and returns a function that
+// gives the cost of a candidate. The last candidate is no dictionary at all.
+// Returns the first candidate of the lowest cost, so that the result
+// doesn't depend on the number of threads.
+template <typename MakeCostFunctionT>
+NODISCARD static std::vector<uint8_t> select_fast_cover_dict(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> data,
+	const std::vector<size_t>& sample_sizes,
+	size_t train_count,
+	size_t dict_size,
+	MakeCostFunctionT&& make_cost_function
+)
+{
+	constexpr size_t NUM_CANDIDATES = std::size(DICT_CANDIDATE_K) + 1;
+
+	std::vector<uint8_t> candidates[NUM_CANDIDATES];
+	double costs[NUM_CANDIDATES];
+
+	std::atomic<size_t> next_candidate(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t) {
+		auto cost_of = make_cost_function();
+
+		for (;;)
+		{
+			const size_t idx = next_candidate.fetch_add(1);
+			if (idx >= NUM_CANDIDATES)
+				break;
+
+			std::vector<uint8_t>& dict = candidates[idx];
+			if (idx < std::size(DICT_CANDIDATE_K))
+			{
+				ZDICT_fastCover_params_t params;
+				std::memset(&params, 0, sizeof(params));
+				params.k = DICT_CANDIDATE_K[idx];
+				params.d = DICT_CANDIDATE_D;
+				params.zParams.compressionLevel = ZSTD_CLEVEL_DEFAULT;
+
+				dict.resize(dict_size);
+				const size_t new_size = ZDICT_trainFromBuffer_fastCover(
+					dict.data(),
+					dict.size(),
+					data.data(),
+					sample_sizes.data(),
+					narrowing_static_cast<unsigned int>(train_count),
+					params
+				);
+
+				if (ZDICT_isError(new_size))
+				{
+					dict.clear();
+					costs[idx] = std::numeric_limits<double>::infinity();
+					continue;
+				}
+
+				ASSUME(new_size <= dict.size());
+				dict.resize(new_size);
+			}
+
+			costs[idx] = cost_of(Const_Span(dict.data(), dict.size()));
+		}
+	});
+
+	const size_t best = std::min_element(costs, costs + NUM_CANDIDATES) - costs;
+	return std::move(candidates[best]);
+}
 
 LZ4_Dict::LZ4_Dict(
+	In_Out_Param<Thread_Pool> thread_pool,
 	Const_Span<uint8_t> data,
 	size_t dict_size,
-	size_t sample_size
-) :
-	m_dict(dict_size)
+	size_t sample_size,
+	size_t block_size
+)
 {
-	if (data.size() % sample_size != 0)
-		throw std::runtime_error("LZ4 dict sample size must divide the data size.");
+	if (data.size() % block_size != 0 || block_size % sample_size != 0)
+		throw std::runtime_error("LZ4 dict sample size must divide the block size, which must divide the data size.");
 
-	const size_t sample_count = data.size() / sample_size;
+	const size_t block_count = data.size() / block_size;
 
-	if (sample_count == 0)
+	if (block_count == 0)
 		throw std::runtime_error("LZ4 dict no samples.");
 
-	const std::vector<size_t> sample_sizes(sample_count, sample_size);
+	// Like in ZDICT_optimizeTrainFromBuffer_fastCover, the candidates are trained on
+	// the first 3/4 of the samples and judged by how well they compress the rest.
+	// Here with LZ4, in whole blocks, and with the size of the dictionary added
+	// to the size of all samples compressed with it.
+	const size_t train_blocks = std::max<size_t>(block_count * 3 / 4, 1);
+	const size_t test_offset = train_blocks < block_count ? train_blocks * block_size : 0;
+	const Const_Span<uint8_t> test_data(data.data() + test_offset, data.size() - test_offset);
+	const size_t train_count = train_blocks * (block_size / sample_size);
+	const std::vector<size_t> sample_sizes(train_count, sample_size);
 
-	const size_t new_size = ZDICT_trainFromBuffer(
-		m_dict.data(),
-		m_dict.size(),
-		data.data(),
-		sample_sizes.data(),
-		narrowing_static_cast<unsigned int>(sample_count)
-	);
+	m_dict = select_fast_cover_dict(thread_pool, data, sample_sizes, train_count, dict_size, [&]() {
+		auto stream = std::shared_ptr<LZ4_stream_t>(LZ4_createStream(), LZ4_freeStream);
+		auto compressed = std::make_shared<std::vector<char>>(LZ4_compressBound(narrowing_static_cast<int>(block_size)));
 
-	if (ZDICT_isError(new_size))
-		m_dict.clear();
-	else
-	{
-		ASSUME(new_size <= m_dict.size());
-		m_dict.resize(new_size);
-	}
+		return [&, stream, compressed](Const_Span<uint8_t> dict) {
+			size_t test_size = 0;
+			for (size_t offset = 0; offset < test_data.size(); offset += block_size)
+			{
+				LZ4_resetStream_fast(stream.get());
+				LZ4_loadDict(stream.get(), reinterpret_cast<const char*>(dict.data()), narrowing_static_cast<int>(dict.size()));
+				test_size += LZ4_compress_fast_continue(
+					stream.get(),
+					reinterpret_cast<const char*>(test_data.data() + offset),
+					compressed->data(),
+					narrowing_static_cast<int>(block_size),
+					narrowing_static_cast<int>(compressed->size()),
+					1
+				);
+			}
+			return dict.size() + static_cast<double>(test_size) * data.size() / test_data.size();
+		};
+	});
+}
+
+ZSTD_Dict::ZSTD_Dict(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> data,
+	const std::vector<size_t>& sample_sizes,
+	size_t dict_size,
+	int level
+)
+{
+	if (sample_sizes.empty())
+		throw std::runtime_error("ZSTD dict no samples.");
+
+	// The same split as for LZ4 dictionaries, in samples.
+	const size_t train_count = std::max<size_t>(sample_sizes.size() * 3 / 4, 1);
+	const size_t test_begin = train_count < sample_sizes.size() ? train_count : 0;
+	size_t test_offset = 0;
+	for (size_t i = 0; i < test_begin; ++i)
+		test_offset += sample_sizes[i];
+
+	const size_t test_data_size = std::accumulate(sample_sizes.begin() + test_begin, sample_sizes.end(), size_t(0));
+	if (test_offset + test_data_size != data.size())
+		throw std::runtime_error("ZSTD dict sample sizes don't add up to the data size.");
+
+	m_dict = select_fast_cover_dict(thread_pool, data, sample_sizes, train_count, dict_size, [&]() {
+		auto cctx = std::shared_ptr<ZSTD_CCtx>(ZSTD_createCCtx(), ZSTD_freeCCtx);
+		auto compressed = std::make_shared<std::vector<uint8_t>>();
+
+		return [&, cctx, compressed](Const_Span<uint8_t> dict) {
+			size_t test_size = 0;
+			size_t offset = test_offset;
+			for (size_t i = test_begin; i < sample_sizes.size(); ++i)
+			{
+				compressed->resize(ZSTD_compressBound(sample_sizes[i]));
+				const size_t size = ZSTD_compress_usingDict(
+					cctx.get(),
+					compressed->data(),
+					compressed->size(),
+					data.data() + offset,
+					sample_sizes[i],
+					dict.data(),
+					dict.size(),
+					level
+				);
+				if (ZSTD_isError(size))
+					return std::numeric_limits<double>::infinity();
+
+				test_size += size;
+				offset += sample_sizes[i];
+			}
+			return dict.size() + static_cast<double>(test_size) * data.size() / test_data_size;
+		};
+	});
 }
 
 LZ4_Decompress_Helper::LZ4_Decompress_Helper(const LZ4_Dict& dict, size_t max_output_size) :
@@ -80,12 +232,423 @@ std::vector<uint8_t> LZMA_Compress_Helper::compress(Const_Span<uint8_t> src)
 	return std::vector(compressed_block_buffer.get(), compressed_block_buffer.get() + out_sz);
 }
 
+ZSTD_Compress_Helper::ZSTD_Compress_Helper(const ZSTD_Dict* dict, int level) :
+	m_cctx(ZSTD_createCCtx()),
+	m_cdict(nullptr),
+	m_dict(dict),
+	m_level(level)
+{
+	ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, level);
+	ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_contentSizeFlag, 0);
+	ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_checksumFlag, 0);
+	ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_dictIDFlag, 0);
+
+	if (dict != nullptr && !dict->empty())
+	{
+		m_cdict = ZSTD_createCDict(dict->data(), dict->size(), level);
+		if (m_cdict == nullptr)
+			throw std::runtime_error("ZSTD could not load the dictionary.");
+
+		ZSTD_CCtx_refCDict(m_cctx, m_cdict);
+	}
+}
+
+ZSTD_Compress_Helper::~ZSTD_Compress_Helper()
+{
+	ZSTD_freeCCtx(m_cctx);
+	ZSTD_freeCDict(m_cdict);
+}
+
+std::vector<uint8_t> ZSTD_Compress_Helper::compress(Const_Span<uint8_t> src)
+{
+	std::vector<uint8_t> compressed(compress_bound(src.size()));
+	compressed.resize(compress(Span(compressed.data(), compressed.size()), src));
+	return compressed;
+}
+
+size_t ZSTD_Compress_Helper::compress(Span<uint8_t> dest, Const_Span<uint8_t> src)
+{
+	const size_t ret = ZSTD_compress2(m_cctx, dest.data(), dest.size(), src.data(), src.size());
+	if (ZSTD_isError(ret))
+		throw std::runtime_error("ZSTD error when trying to compress a block.");
+
+	return ret;
+}
+
+ZSTD_Decompress_Helper::ZSTD_Decompress_Helper(const ZSTD_Dict& dict, size_t max_output_size) :
+	m_dctx(ZSTD_createDCtx()),
+	m_ddict(nullptr),
+	m_output_buffer(cpp20::make_unique_for_overwrite<uint8_t[]>(max_output_size)),
+	m_max_output_size(max_output_size)
+{
+	if (!dict.empty())
+	{
+		m_ddict = ZSTD_createDDict(dict.data(), dict.size());
+		if (m_ddict == nullptr)
+			throw std::runtime_error("ZSTD could not load the dictionary.");
+	}
+}
+
+ZSTD_Decompress_Helper::~ZSTD_Decompress_Helper()
+{
+	ZSTD_freeDCtx(m_dctx);
+	ZSTD_freeDDict(m_ddict);
+}
+
+Const_Span<uint8_t> ZSTD_Decompress_Helper::decompress(Const_Span<uint8_t> src, size_t expected_size) const
+{
+	if (expected_size > m_max_output_size)
+		throw std::runtime_error("ZSTD block larger than the output buffer.");
+
+	const size_t ret =
+		m_ddict != nullptr
+		? ZSTD_decompress_usingDDict(m_dctx, m_output_buffer.get(), expected_size, src.data(), src.size(), m_ddict)
+		: ZSTD_decompressDCtx(m_dctx, m_output_buffer.get(), expected_size, src.data(), src.size());
+
+	if (ZSTD_isError(ret) || ret != expected_size)
+		throw std::runtime_error("ZSTD error when trying to decompress a block.");
+
+	return Const_Span(m_output_buffer.get(), ret);
+}
+
 LZMA_Decompress_Helper::LZMA_Decompress_Helper(size_t max_output_size) :
 	m_output_buffer(cpp20::make_unique_for_overwrite<uint8_t[]>(max_output_size)),
 	m_max_output_size(max_output_size)
 {
 }
 
+// The RC2 block starts with one of these.
+enum struct RC2_Block_Mode : uint8_t
+{
+	RAW = 0,
+	CODED = 1
+};
+
+// Predicts the symbols of one block. Each symbol is coded as its high bit
+// followed by its low bit, the latter conditioned on the former.
+// The context is formed by the preceding symbol and a match model, which
+// finds the last occurrence of the preceding MIN_MATCH_LENGTH symbols and
+// predicts the symbol that followed it. WDL tables have a lot of such
+// repetitions, at distances depending on the piece configuration.
+// `data` are the packed symbols seen so far, written by the caller.
+struct RC2_Model
+{
+	static constexpr uint32_t PROB_BITS = 16;
+	static constexpr uint32_t ADAPT_SHIFT = 5;
+	static constexpr size_t MIN_MATCH_LENGTH = 16;
+	static constexpr size_t HASH_BITS = 16;
+	static constexpr size_t NUM_CONTEXTS = 64;
+
+	RC2_Model(const uint8_t* data) :
+		m_data(data),
+		m_pos(0),
+		m_history(0),
+		m_match_pos(0),
+		m_match_length(0),
+		m_match_table(size_t(1) << HASH_BITS, 0)
+	{
+		for (auto& probs : m_probs)
+			for (uint16_t& p : probs)
+				p = 1 << (PROB_BITS - 1);
+	}
+
+	// Probabilities of a zero bit, in 1/65536, for the next symbol.
+	NODISCARD uint16_t* probs()
+	{
+		uint32_t context = m_history & 3;
+		if (m_match_length > 0)
+		{
+			const uint32_t length_bucket = m_match_length < 16 ? 1 : m_match_length < 64 ? 2 : 3;
+			context |= (symbol_at(m_match_pos) << 2) | (length_bucket << 4);
+		}
+
+		return m_probs[context];
+	}
+
+	void update(uint32_t symbol)
+	{
+		if (m_match_length > 0 && symbol_at(m_match_pos) == symbol)
+		{
+			m_match_length += 1;
+			m_match_pos += 1;
+		}
+		else
+			m_match_length = 0;
+
+		m_history = (m_history << 2) | symbol;
+		m_pos += 1;
+
+		if (m_pos >= MIN_MATCH_LENGTH)
+		{
+			static_assert(MIN_MATCH_LENGTH * 2 == sizeof(m_history) * 8);
+
+			uint32_t& entry = m_match_table[(m_history * 2654435761u) >> (32 - HASH_BITS)];
+			if (m_match_length == 0 && entry != 0)
+			{
+				m_match_pos = entry;
+				m_match_length = 1;
+			}
+			entry = narrowing_static_cast<uint32_t>(m_pos);
+		}
+	}
+
+	INLINE static void adapt(uint16_t& prob, uint32_t bit)
+	{
+		if (bit)
+			prob -= prob >> ADAPT_SHIFT;
+		else
+			prob += ((1 << PROB_BITS) - prob) >> ADAPT_SHIFT;
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_pos;
+	uint32_t m_history;
+	size_t m_match_pos;
+	size_t m_match_length;
+
+	// Position following the last occurrence of a hash of MIN_MATCH_LENGTH symbols.
+	// Zero means none, as no position before MIN_MATCH_LENGTH is stored.
+	std::vector<uint32_t> m_match_table;
+
+	uint16_t m_probs[NUM_CONTEXTS][3];
+
+	NODISCARD uint32_t symbol_at(size_t pos) const
+	{
+		return (m_data[pos / 4] >> (pos % 4 * 2)) & 3;
+	}
+};
+
+// Binary range coder with carry propagation as in LZMA.
+struct RC2_Encoder
+{
+	RC2_Encoder(Span<uint8_t> dest) :
+		m_low(0),
+		m_range(0xFFFFFFFF),
+		m_cache(0),
+		m_cache_size(1),
+		m_out(dest.data()),
+		m_out_end(dest.data() + dest.size()),
+		m_overflow(false)
+	{
+	}
+
+	INLINE void encode_bit(uint16_t& prob, uint32_t bit)
+	{
+		const uint32_t bound = (m_range >> RC2_Model::PROB_BITS) * prob;
+		if (bit)
+		{
+			m_low += bound;
+			m_range -= bound;
+		}
+		else
+			m_range = bound;
+
+		RC2_Model::adapt(prob, bit);
+
+		while (m_range < (1u << 24))
+		{
+			m_range <<= 8;
+			shift_low();
+		}
+	}
+
+	void flush()
+	{
+		for (int i = 0; i < 5; ++i)
+			shift_low();
+	}
+
+	// Whether the output didn't fit in the destination.
+	NODISCARD bool overflow() const
+	{
+		return m_overflow;
+	}
+
+	NODISCARD uint8_t* end() const
+	{
+		return m_out;
+	}
+
+private:
+	uint64_t m_low;
+	uint32_t m_range;
+	uint8_t m_cache;
+	uint64_t m_cache_size;
+	uint8_t* m_out;
+	uint8_t* m_out_end;
+	bool m_overflow;
+
+	void put_byte(uint8_t byte)
+	{
+		if (m_out == m_out_end)
+			m_overflow = true;
+		else
+			*m_out++ = byte;
+	}
+
+	void shift_low()
+	{
+		if (static_cast<uint32_t>(m_low) < 0xFF000000u || (m_low >> 32) != 0)
+		{
+			const uint8_t carry = static_cast<uint8_t>(m_low >> 32);
+			uint8_t temp = m_cache;
+			do
+			{
+				put_byte(static_cast<uint8_t>(temp + carry));
+				temp = 0xFF;
+			} while (--m_cache_size != 0);
+			m_cache = static_cast<uint8_t>(m_low >> 24);
+		}
+		m_cache_size += 1;
+		m_low = (m_low & 0x00FFFFFF) << 8;
+	}
+};
+
+struct RC2_Decoder
+{
+	RC2_Decoder(Const_Span<uint8_t> src) :
+		m_range(0xFFFFFFFF),
+		m_code(0),
+		m_in(src.data()),
+		m_in_end(src.data() + src.size())
+	{
+		for (int i = 0; i < 5; ++i)
+			m_code = (m_code << 8) | next_byte();
+	}
+
+	INLINE uint32_t decode_bit(uint16_t& prob)
+	{
+		const uint32_t bound = (m_range >> RC2_Model::PROB_BITS) * prob;
+		uint32_t bit;
+		if (m_code < bound)
+		{
+			m_range = bound;
+			bit = 0;
+		}
+		else
+		{
+			m_code -= bound;
+			m_range -= bound;
+			bit = 1;
+		}
+
+		RC2_Model::adapt(prob, bit);
+
+		while (m_range < (1u << 24))
+		{
+			m_range <<= 8;
+			m_code = (m_code << 8) | next_byte();
+		}
+
+		return bit;
+	}
+
+private:
+	uint32_t m_range;
+	uint32_t m_code;
+	const uint8_t* m_in;
+	const uint8_t* m_in_end;
+
+	// Reading past the end can only happen for corrupted data, 
+	// which is then detected by the caller's checks.
+	INLINE uint8_t next_byte()
+	{
+		return m_in != m_in_end ? *m_in++ : 0;
+	}
+};
+
+std::vector<uint8_t> RC2_Compress_Helper::compress(Const_Span<uint8_t> src)
+{
+	std::vector<uint8_t> compressed(compress_bound(src.size()));
+	compressed.resize(compress(Span(compressed.data(), compressed.size()), src));
+	return compressed;
+}
+
+size_t RC2_Compress_Helper::compress(Span<uint8_t> dest, Const_Span<uint8_t> src)
+{
+	if (dest.size() < compress_bound(src.size()))
+		throw std::runtime_error("Destination buffer not sufficient for RC2 compression.");
+
+	// The coded data must be smaller than the raw block to be worth it.
+	RC2_Encoder encoder(Span(dest.data() + 1, src.size() - (src.size() > 0)));
+	RC2_Model model(src.data());
+
+	for (size_t i = 0; i < src.size() && !encoder.overflow(); ++i)
+	{
+		for (uint32_t shift = 0; shift < 8; shift += 2)
+		{
+			const uint32_t symbol = (src[i] >> shift) & 3;
+			uint16_t* probs = model.probs();
+			encoder.encode_bit(probs[0], symbol >> 1);
+			encoder.encode_bit(probs[1 + (symbol >> 1)], symbol & 1);
+			model.update(symbol);
+		}
+	}
+	encoder.flush();
+
+	if (encoder.overflow())
+	{
+		dest[0] = static_cast<uint8_t>(RC2_Block_Mode::RAW);
+		std::memcpy(dest.data() + 1, src.data(), src.size());
+		return src.size() + 1;
+	}
+
+	dest[0] = static_cast<uint8_t>(RC2_Block_Mode::CODED);
+	return static_cast<size_t>(encoder.end() - dest.data());
+}
+
+RC2_Decompress_Helper::RC2_Decompress_Helper(size_t max_output_size) :
+	m_output_buffer(cpp20::make_unique_for_overwrite<uint8_t[]>(max_output_size)),
+	m_max_output_size(max_output_size)
+{
+}
+
+Const_Span<uint8_t> RC2_Decompress_Helper::decompress(Const_Span<uint8_t> src, size_t expected_size) const
+{
+	if (src.empty() || expected_size > m_max_output_size)
+		throw std::runtime_error("RC2 error when trying to decompress a block.");
+
+	uint8_t* out = m_output_buffer.get();
+	const Const_Span<uint8_t> payload(src.data() + 1, src.size() - 1);
+
+	switch (static_cast<RC2_Block_Mode>(src[0]))
+	{
+	case RC2_Block_Mode::RAW:
+		if (payload.size() != expected_size)
+			throw std::runtime_error("RC2 error when trying to decompress a block.");
+		std::memcpy(out, payload.data(), expected_size);
+		break;
+
+	case RC2_Block_Mode::CODED:
+	{
+		RC2_Decoder decoder(payload);
+		RC2_Model model(out);
+
+		for (size_t i = 0; i < expected_size; ++i)
+		{
+			// The model may need the symbols decoded so far in this byte.
+			out[i] = 0;
+			for (uint32_t shift = 0; shift < 8; shift += 2)
+			{
+				uint16_t* probs = model.probs();
+				const uint32_t hi = decoder.decode_bit(probs[0]);
+				const uint32_t lo = decoder.decode_bit(probs[1 + hi]);
+				const uint32_t symbol = (hi << 1) | lo;
+				out[i] |= static_cast<uint8_t>(symbol << shift);
+				model.update(symbol);
+			}
+		}
+		break;
+	}
+
+	default:
+		throw std::runtime_error("Unknown RC2 block mode.");
+	}
+
+	return Const_Span(out, expected_size);
+}
+
 std::vector<std::vector<uint8_t>> compress_blocks(
 	In_Out_Param<Thread_Pool> thread_pool,
 	Const_Span<uint8_t> src,
@@ -131,3 +694,203 @@ std::vector<std::vector<uint8_t>> compress_blocks(
 
 	return compressed_blocks;
 }
+
+// For each block of src, the index of the first block with the same contents.
+NODISCARD static std::vector<size_t> find_first_equal_blocks(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> src,
+	size_t block_size
+)
+{
+	const size_t num_blocks = ceil_div(src.size(), block_size);
+
+	std::vector<uint64_t> hashes(num_blocks);
+	std::atomic<size_t> next_block_id(0);
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		for (;;)
+		{
+			const size_t block_id = next_block_id.fetch_add(1);
+			if (block_id >= num_blocks)
+				return;
+
+			const auto block = src.nth_chunk(block_id, block_size);
+			hashes[block_id] = XXH64(block.data(), block.size(), 0);
+		}
+	});
+
+	// Done in order of blocks, so that the result doesn't depend on the threads.
+	// Only the first block with a given hash is looked up, a block that collides
+	// with a different one is kept as it is.
+	std::vector<size_t> first_equal(num_blocks);
+	std::unordered_map<uint64_t, size_t> first_block_by_hash;
+	for (size_t block_id = 0; block_id < num_blocks; ++block_id)
+	{
+		first_equal[block_id] = block_id;
+
+		auto [it, inserted] = first_block_by_hash.try_emplace(hashes[block_id], block_id);
+		if (inserted)
+			continue;
+
+		const auto block = src.nth_chunk(block_id, block_size);
+		const auto other = src.nth_chunk(it->second, block_size);
+		if (block.size() == other.size() && std::memcmp(block.data(), other.data(), block.size()) == 0)
+			first_equal[block_id] = it->second;
+	}
+
+	return first_equal;
+}
+
+Compressed_Block_Layout compress_blocks_streaming(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> src,
+	size_t block_size,
+	std::unique_ptr<Compress_Helper> compressor_factory,
+	std::string task_name,
+	size_t max_blocks_in_flight,
+	bool deduplicate,
+	const Compressed_Block_Consumer& consumer
+)
+{
+	ASSERT(max_blocks_in_flight > 0);
+
+	struct Placed_Block
+	{
+		size_t block_id;
+		size_t offset;
+		std::vector<uint8_t> data;
+	};
+
+	const size_t num_blocks = ceil_div(src.size(), block_size);
+
+	std::vector<size_t> first_equal;
+	if (deduplicate)
+		first_equal = find_first_equal_blocks(thread_pool, src, block_size);
+
+	auto is_duplicate = [&](size_t block_id) {
+		return deduplicate && first_equal[block_id] != block_id;
+	};
+
+	Compressed_Block_Layout layout;
+	layout.sizes.resize(num_blocks);
+	layout.offsets.resize(num_blocks);
+	std::vector<size_t>& compressed_sizes = layout.sizes;
+	std::atomic<size_t> next_block_id(0);
+
+	// Blocks that finished before all preceding ones, indexed by block_id % max_blocks_in_flight.
+	std::vector<std::vector<uint8_t>> waiting_blocks(max_blocks_in_flight);
+	std::vector<bool> is_waiting(max_blocks_in_flight, false);
+	size_t next_block_to_place = 0;
+	size_t next_offset = 0;
+	std::mutex mutex;
+	std::condition_variable window_moved;
+
+	// Must be called with the mutex locked, in the order of blocks.
+	// Returns whether the block has to be passed to the consumer.
+	auto place_next_block = [&]() {
+		const size_t block_id = next_block_to_place++;
+		if (is_duplicate(block_id))
+		{
+			const size_t first = first_equal[block_id];
+			compressed_sizes[block_id] = compressed_sizes[first];
+			layout.offsets[block_id] = layout.offsets[first];
+			layout.num_deduplicated += 1;
+			layout.deduplicated_size += compressed_sizes[block_id];
+			return false;
+		}
+
+		layout.offsets[block_id] = next_offset;
+		next_offset += compressed_sizes[block_id];
+		return true;
+	};
+
+	constexpr size_t PRINT_PERIOD_BYTES = 1024 * 1024 * 8;
+	const size_t PRINT_PERIOD = ceil_div(PRINT_PERIOD_BYTES * thread_pool->num_workers(), block_size);
+	Concurrent_Progress_Bar progress_bar(compressed_sizes.size(), PRINT_PERIOD, task_name);
+
+	thread_pool->run_sync_task_on_all_threads([&](size_t thread_id) {
+		std::unique_ptr<Compress_Helper> c_helper = compressor_factory->clone();
+
+		const size_t bound_size = c_helper->compress_bound(block_size);
+
+		auto compressed_block_buffer = cpp20::make_unique_for_overwrite<uint8_t[]>(bound_size);
+
+		std::vector<Placed_Block> placed_blocks;
+
+		for (;;)
+		{
+			const size_t block_id = next_block_id.fetch_add(1);
+
+			const auto block = src.nth_chunk(block_id, block_size);
+			if (block.empty())
+				return;
+
+			{
+				std::unique_lock lock(mutex);
+				window_moved.wait(lock, [&]() { return block_id < next_block_to_place + max_blocks_in_flight; });
+			}
+
+			const bool is_compressed = !is_duplicate(block_id);
+			const size_t out_sz =
+				is_compressed
+				? c_helper->compress(Span(compressed_block_buffer.get(), bound_size), block)
+				: 0;
+
+			size_t offset = 0;
+			bool has_moved = false;
+			bool is_placed = false;
+			{
+				std::unique_lock lock(mutex);
+
+				if (is_compressed)
+					compressed_sizes[block_id] = out_sz;
+
+				if (block_id == next_block_to_place)
+				{
+					has_moved = true;
+					is_placed = place_next_block();
+					offset = layout.offsets[block_id];
+
+					// Blocks that were waiting only for this one can be placed now.
+					for (;;)
+					{
+						const size_t slot = next_block_to_place % max_blocks_in_flight;
+						if (!is_waiting[slot])
+							break;
+
+						is_waiting[slot] = false;
+						const size_t waiting_block_id = next_block_to_place;
+						if (place_next_block())
+							placed_blocks.push_back(Placed_Block{ waiting_block_id, layout.offsets[waiting_block_id], std::move(waiting_blocks[slot]) });
+					}
+				}
+				else
+				{
+					const size_t slot = block_id % max_blocks_in_flight;
+					if (is_compressed)
+						waiting_blocks[slot].assign(compressed_block_buffer.get(), compressed_block_buffer.get() + out_sz);
+					is_waiting[slot] = true;
+				}
+			}
+
+			if (has_moved)
+			{
+				window_moved.notify_all();
+
+				if (is_placed)
+					consumer(block_id, offset, Const_Span(compressed_block_buffer.get(), out_sz));
+
+				for (const Placed_Block& placed : placed_blocks)
+					consumer(placed.block_id, placed.offset, Const_Span(placed.data));
+				placed_blocks.clear();
+			}
+
+			progress_bar += 1;
+		}
+	});
+
+	progress_bar.set_finished();
+
+	layout.total_size = next_offset;
+
+	return layout;
+}
@@ -2,11 +2,13 @@
 
 #define LZ4_STATIC_LINKING_ONLY
 #define LZ4_HC_STATIC_LINKING_ONLY
+#define ZDICT_STATIC_LINKING_ONLY
 
 #include "lz4/lz4.h"
 #include "lz4/lz4hc.h"
 
 #include "zstd/zdict.h"
+#include "zstd/zstd.h"
 
 #include "LZMA/LzmaLib.h"
 
@@ -34,16 +36,22 @@ struct LZ4_Dict
 		return LZ4_Dict(data);
 	}
 
-	// Creates a dictionary for given data, divided into samples of sample_size.
-	// The sample size must divide the size of the data.
+	// Creates a dictionary for given data, divided into samples of sample_size,
+	// for blocks of block_size. The sample size must divide the block size,
+	// which must divide the size of the data.
 	// The dictionary will be of size <=dict_size bytes.
+	// Candidates are trained with fastCover on the threads of the pool, the one
+	// that compresses held out blocks best, counting its own size, is kept.
+	// That may be an empty one.
 	NODISCARD static LZ4_Dict make(
+		In_Out_Param<Thread_Pool> thread_pool,
 		Const_Span<uint8_t> data,
 		size_t dict_size,
-		size_t sample_size
+		size_t sample_size,
+		size_t block_size
 	)
 	{
-		return LZ4_Dict(data, dict_size, sample_size);
+		return LZ4_Dict(thread_pool, data, dict_size, sample_size, block_size);
 	}
 
 	NODISCARD bool empty() const
@@ -70,9 +78,70 @@ private:
 	}
 
 	LZ4_Dict(
+		In_Out_Param<Thread_Pool> thread_pool,
 		Const_Span<uint8_t> data,
 		size_t dict_size,
-		size_t sample_size
+		size_t sample_size,
+		size_t block_size
+	);
+};
+
+// Represents a zstd dictionary.
+struct ZSTD_Dict
+{
+	// Copies the raw dictionary data from given memory span.
+	NODISCARD static ZSTD_Dict load(Const_Span<uint8_t> data)
+	{
+		return ZSTD_Dict(data);
+	}
+
+	// Creates a dictionary for blocks like the samples, which are concatenated
+	// in data and have the sizes in sample_sizes.
+	// The dictionary will be of size <=dict_size bytes.
+	// Candidates are chosen like in LZ4_Dict::make, judged by compressing the held
+	// out samples with zstd at the given level. That may be an empty one.
+	// Low levels misjudge them, dictionaries that help at level 9
+	// and above can make level 3 worse.
+	NODISCARD static ZSTD_Dict make(
+		In_Out_Param<Thread_Pool> thread_pool,
+		Const_Span<uint8_t> data,
+		const std::vector<size_t>& sample_sizes,
+		size_t dict_size,
+		int level
+	)
+	{
+		return ZSTD_Dict(thread_pool, data, sample_sizes, dict_size, level);
+	}
+
+	NODISCARD bool empty() const
+	{
+		return m_dict.empty();
+	}
+
+	NODISCARD size_t size() const
+	{
+		return m_dict.size();
+	}
+
+	NODISCARD const uint8_t* data() const
+	{
+		return m_dict.data();
+	}
+
+private:
+	std::vector<uint8_t> m_dict;
+
+	ZSTD_Dict(Const_Span<uint8_t> data)
+	{
+		m_dict.assign(data.begin(), data.end());
+	}
+
+	ZSTD_Dict(
+		In_Out_Param<Thread_Pool> thread_pool,
+		Const_Span<uint8_t> data,
+		const std::vector<size_t>& sample_sizes,
+		size_t dict_size,
+		int level
 	);
 };
 
@@ -101,11 +170,14 @@ struct Compress_Helper
 // A compressor utilizing LZ4.
 // It is not thread safe. Use it as a factory and clone() when to be
 // used in a multithreaded context.
+// The level defaults to the strongest one, lower levels can be used
+// where speed matters more than size (for example for temporary files).
 struct LZ4_Compress_Helper : public Compress_Helper
 {
-	LZ4_Compress_Helper(const LZ4_Dict* dict) :
+	LZ4_Compress_Helper(const LZ4_Dict* dict, int level = LZ4HC_CLEVEL_MAX) :
 		m_lz4_stream(LZ4_createStreamHC()),
-		m_dict(dict)
+		m_dict(dict),
+		m_level(level)
 	{
 	}
 
@@ -131,13 +203,13 @@ struct LZ4_Compress_Helper : public Compress_Helper
 				reinterpret_cast<char*>(dst.data()),
 				narrowing_static_cast<int>(src.size()),
 				narrowing_static_cast<int>(dst.size()),
-				LZ4HC_CLEVEL_MAX
+				m_level
 			);
 		}
 		else
 		{
 			LZ4_loadDictHC(m_lz4_stream, reinterpret_cast<const char*>(m_dict->data()), narrowing_static_cast<int>(m_dict->size()));
-			LZ4_setCompressionLevel(m_lz4_stream, LZ4HC_CLEVEL_MAX);
+			LZ4_setCompressionLevel(m_lz4_stream, m_level);
 			ret = LZ4_compress_HC_continue(
 				m_lz4_stream,
 				reinterpret_cast<const char*>(src.data()),
@@ -155,25 +227,34 @@ struct LZ4_Compress_Helper : public Compress_Helper
 
 	NODISCARD virtual std::unique_ptr<Compress_Helper> clone() const override
 	{
-		return std::make_unique<LZ4_Compress_Helper>(m_dict);
+		return std::make_unique<LZ4_Compress_Helper>(m_dict, m_level);
 	}
 
 private:
 	LZ4_streamHC_t* m_lz4_stream;
 	const LZ4_Dict* m_dict;
+	int m_level;
 };
 
 // A compressor utilizing LZMA.
+// Levels below 5 use the fast match finder and are several times faster.
+// The dictionary doesn't have to be larger than the blocks.
 struct LZMA_Compress_Helper : public Compress_Helper
 {
-	static constexpr unsigned int DICT_SIZE = 1 << 20;
-	static constexpr int LEVEL = 9;
+	static constexpr unsigned int DEFAULT_DICT_SIZE = 1 << 20;
+	static constexpr int DEFAULT_LEVEL = 9;
 	static constexpr int LC = 3;
 	static constexpr int LP = 0;
 	static constexpr int PB = 2;
 	static constexpr int FB = 32;
 	static constexpr int NUM_THREADS = 1;
 
+	LZMA_Compress_Helper(int level = DEFAULT_LEVEL, unsigned int dict_size = DEFAULT_DICT_SIZE) :
+		m_level(level),
+		m_dict_size(dict_size)
+	{
+	}
+
 	NODISCARD size_t compress_bound(size_t size) const override
 	{
 		return size + size / 10 + 65536 + LZMA_PROPS_SIZE;
@@ -194,8 +275,8 @@ struct LZMA_Compress_Helper : public Compress_Helper
 			src.size(),
 			props,
 			&outPropsSize,
-			LEVEL,
-			DICT_SIZE,
+			m_level,
+			m_dict_size,
 			LC, LP,
 			PB, FB,
 			NUM_THREADS
@@ -217,7 +298,69 @@ struct LZMA_Compress_Helper : public Compress_Helper
 
 	NODISCARD virtual std::unique_ptr<Compress_Helper> clone() const override
 	{
-		return std::make_unique<LZMA_Compress_Helper>();
+		return std::make_unique<LZMA_Compress_Helper>(m_level, m_dict_size);
+	}
+
+private:
+	int m_level;
+	unsigned int m_dict_size;
+};
+
+// A compressor utilizing zstd, with a dictionary if one is given.
+// The frames have neither the content size, nor a checksum, nor the id of the
+// dictionary, the table headers already have what is needed to decode them.
+// Levels above 19 are the ones zstd calls ultra. They use more memory for
+// compression, decoding is about as fast.
+// It is not thread safe, clone() it for each thread.
+struct ZSTD_Compress_Helper : public Compress_Helper
+{
+	static constexpr int DEFAULT_LEVEL = 19;
+
+	ZSTD_Compress_Helper(const ZSTD_Dict* dict, int level = DEFAULT_LEVEL);
+
+	~ZSTD_Compress_Helper() override;
+
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return ZSTD_compressBound(size);
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override;
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override;
+
+	NODISCARD virtual std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<ZSTD_Compress_Helper>(m_dict, m_level);
+	}
+
+private:
+	ZSTD_CCtx* m_cctx;
+	ZSTD_CDict* m_cdict;
+	const ZSTD_Dict* m_dict;
+	int m_level;
+};
+
+// A compressor for data of 2-bit symbols, packed four per byte starting from
+// the lowest bits (like packed WDL entries). Each symbol is coded as two binary
+// decisions with an adaptive range coder, conditioned on the preceding symbols
+// in a way that captures both short and long repetitions.
+// Blocks are compressed independently.
+// Blocks that would not get smaller are stored raw.
+struct RC2_Compress_Helper : public Compress_Helper
+{
+	NODISCARD size_t compress_bound(size_t size) const override
+	{
+		return size + 1;
+	}
+
+	NODISCARD std::vector<uint8_t> compress(Const_Span<uint8_t> src) override;
+
+	NODISCARD size_t compress(Span<uint8_t> dest, Const_Span<uint8_t> src) override;
+
+	NODISCARD virtual std::unique_ptr<Compress_Helper> clone() const override
+	{
+		return std::make_unique<RC2_Compress_Helper>();
 	}
 };
 
@@ -315,6 +458,35 @@ private:
 	size_t m_max_output_size;
 };
 
+// A decompressor for blocks compressed with ZSTD_Compress_Helper.
+// The dictionary must be the one they were compressed with.
+struct ZSTD_Decompress_Helper : public Decompress_Helper
+{
+	ZSTD_Decompress_Helper(const ZSTD_Dict& dict, size_t max_output_size);
+
+	~ZSTD_Decompress_Helper() override;
+
+	NODISCARD Const_Span<uint8_t> decompress(Const_Span<uint8_t> src, size_t expected_size) const override;
+
+private:
+	ZSTD_DCtx* m_dctx;
+	ZSTD_DDict* m_ddict;
+	std::unique_ptr<uint8_t[]> m_output_buffer;
+	size_t m_max_output_size;
+};
+
+// A decompressor for blocks compressed with RC2_Compress_Helper.
+struct RC2_Decompress_Helper : public Decompress_Helper
+{
+	RC2_Decompress_Helper(size_t max_output_size);
+
+	NODISCARD Const_Span<uint8_t> decompress(Const_Span<uint8_t> src, size_t expected_size) const override;
+
+private:
+	std::unique_ptr<uint8_t[]> m_output_buffer;
+	size_t m_max_output_size;
+};
+
 // Compresses the src memory block, divided into blocks of size
 // block_size (last block may be smaller).
 // Returns a vector of compressed blocks.
@@ -329,3 +501,43 @@ NODISCARD std::vector<std::vector<uint8_t>> compress_blocks(
 	std::unique_ptr<Compress_Helper> compressor,
 	std::string task_name
 );
+
+// Receives a compressed block, its index, and its offset in the concatenation
+// of all compressed blocks.
+using Compressed_Block_Consumer = std::function<void(size_t block_id, size_t offset, Const_Span<uint8_t> block)>;
+
+// Where the compressed blocks are in the concatenation of all compressed blocks.
+// A deduplicated block has the size and the offset of the first block with
+// the same contents, and takes no space of its own.
+struct Compressed_Block_Layout
+{
+	std::vector<size_t> sizes;
+	std::vector<size_t> offsets;
+	size_t total_size = 0;
+
+	size_t num_deduplicated = 0;
+	size_t deduplicated_size = 0;
+};
+
+// Like compress_blocks, but instead of keeping all compressed blocks in memory
+// passes each one to the consumer as soon as its offset is known.
+// Offsets are assigned in the order of blocks, so without deduplication
+// the concatenation is the same as the one of the result of compress_blocks.
+// With deduplication a block equal to an earlier one is neither compressed
+// nor passed to the consumer, it uses the compressed data of the earlier one.
+// The compressor must then produce the same output for the same input.
+// The consumer is called from the worker threads, possibly concurrently,
+// and not necessarily in the order of blocks.
+// Compression doesn't get further ahead than max_blocks_in_flight blocks
+// from the first block without an offset, which bounds the memory used
+// for blocks that wait for their offset.
+NODISCARD Compressed_Block_Layout compress_blocks_streaming(
+	In_Out_Param<Thread_Pool> thread_pool,
+	Const_Span<uint8_t> src,
+	size_t block_size,
+	std::unique_ptr<Compress_Helper> compressor,
+	std::string task_name,
+	size_t max_blocks_in_flight,
+	bool deduplicate,
+	const Compressed_Block_Consumer& consumer
+);
@@ -4,6 +4,8 @@
 
 #include "util/utility.h"
 
+#include <algorithm>
+
 #if defined(OS_WINDOWS)
 
 #include <Windows.h>
@@ -23,6 +25,169 @@
 
 #endif
 
+bool try_create_file_exclusive(const std::filesystem::path& path, Const_Span<char> contents)
+{
+	const std::string str = path.string();
+
+#if defined(OS_WINDOWS)
+
+	const HANDLE handle = CreateFileA(
+		str.c_str(),
+		GENERIC_WRITE,
+		0,
+		NULL,
+		CREATE_NEW,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	if (handle == sys_common::INVALID_HANLE_VALUE)
+		return false;
+
+	DWORD written = 0;
+	WriteFile(handle, contents.data(), static_cast<DWORD>(contents.size()), &written, NULL);
+	CloseHandle(handle);
+
+	return true;
+
+#elif defined(OS_LINUX)
+
+	const int handle = ::open(str.c_str(), O_CREAT | O_EXCL | O_WRONLY, (mode_t)0644);
+	if (handle == sys_common::INVALID_HANLE_VALUE)
+		return false;
+
+	if (write(handle, contents.data(), contents.size()) == -1)
+		print_and_abort("Could not write() %s\n", str.c_str());
+	::close(handle);
+
+	return true;
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+}
+
+bool Positional_File::create(const std::filesystem::path& path)
+{
+	const std::string str = path.string();
+
+#if defined(OS_WINDOWS)
+
+	m_handle = CreateFileA(
+		str.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ,
+		NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+#elif defined(OS_LINUX)
+
+	m_handle = ::open(str.c_str(), O_CREAT | O_RDWR | O_TRUNC, (mode_t)0644);
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+
+	return m_handle != sys_common::INVALID_HANLE_VALUE;
+}
+
+void Positional_File::write(size_t offset, Const_Span<uint8_t> data) const
+{
+	ASSERT(m_handle != sys_common::INVALID_HANLE_VALUE);
+
+	while (!data.empty())
+	{
+#if defined(OS_WINDOWS)
+
+		OVERLAPPED overlapped{};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		const DWORD to_write = static_cast<DWORD>(std::min<size_t>(data.size(), 1u << 30));
+		DWORD written = 0;
+		if (!WriteFile(m_handle, data.data(), to_write, &written, &overlapped))
+			print_and_abort("Could not write() at offset %zu\n", offset);
+
+#elif defined(OS_LINUX)
+
+		const ssize_t written = ::pwrite(m_handle, data.data(), data.size(), offset);
+		if (written <= 0)
+			print_and_abort("Could not pwrite() at offset %zu\n", offset);
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+
+		data = Const_Span(data.data() + written, data.size() - written);
+		offset += written;
+	}
+}
+
+void Positional_File::read(size_t offset, Span<uint8_t> data) const
+{
+	ASSERT(m_handle != sys_common::INVALID_HANLE_VALUE);
+
+	while (!data.empty())
+	{
+#if defined(OS_WINDOWS)
+
+		OVERLAPPED overlapped{};
+		overlapped.Offset = static_cast<DWORD>(offset);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		const DWORD to_read = static_cast<DWORD>(std::min<size_t>(data.size(), 1u << 30));
+		DWORD num_read = 0;
+		if (!ReadFile(m_handle, data.data(), to_read, &num_read, &overlapped) || num_read == 0)
+			print_and_abort("Could not read() at offset %zu\n", offset);
+
+#elif defined(OS_LINUX)
+
+		const ssize_t num_read = ::pread(m_handle, data.data(), data.size(), offset);
+		if (num_read <= 0)
+			print_and_abort("Could not pread() at offset %zu\n", offset);
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+
+		data = Span(data.data() + num_read, data.size() - num_read);
+		offset += num_read;
+	}
+}
+
+void Positional_File::close()
+{
+	if (m_handle == sys_common::INVALID_HANLE_VALUE)
+		return;
+
+#if defined(OS_WINDOWS)
+
+	CloseHandle(m_handle);
+
+#elif defined(OS_LINUX)
+
+	::close(m_handle);
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+
+	m_handle = sys_common::INVALID_HANLE_VALUE;
+}
+
 bool Memory_Mapped_File::open_readonly(const char* file_name)
 {
 #if defined(OS_WINDOWS)
@@ -74,6 +239,71 @@ bool Memory_Mapped_File::open_readonly(const char* file_name)
 #endif
 }
 
+bool Memory_Mapped_File::open_readonly(const char* file_name, size_t offset, size_t size)
+{
+#if defined(OS_WINDOWS)
+
+	m_handle = CreateFileA(
+		file_name,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+
+	if (m_handle == sys_common::INVALID_HANLE_VALUE)
+		return false;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	m_view_offset = offset % info.dwAllocationGranularity;
+	const uint64_t view_start = offset - m_view_offset;
+
+	m_size = size;
+	const HANDLE fm = CreateFileMappingW(m_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	uint8_t* view = reinterpret_cast<uint8_t*>(MapViewOfFile(
+		fm,
+		FILE_MAP_READ,
+		static_cast<DWORD>(view_start >> 32),
+		static_cast<DWORD>(view_start),
+		m_view_offset + size
+	));
+
+	if (view == nullptr)
+		print_and_abort("Could not mmap() %s\n", file_name);
+
+	CloseHandle(fm);
+
+	m_data = view + m_view_offset;
+
+	return true;
+
+#elif defined(OS_LINUX)
+
+	m_handle = ::open(file_name, O_RDONLY);
+	if (m_handle == sys_common::INVALID_HANLE_VALUE)
+		return false;
+
+	m_view_offset = offset % static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	m_size = size;
+	void* view = mmap(NULL, m_view_offset + size, PROT_READ, MAP_PRIVATE, m_handle, offset - m_view_offset);
+
+	if (view == MAP_FAILED)
+		print_and_abort("Could not mmap() %s\n", file_name);
+
+	m_data = reinterpret_cast<uint8_t*>(view) + m_view_offset;
+
+	return true;
+
+#else
+
+#error "Unsupported OS"
+
+#endif
+}
+
 bool Memory_Mapped_File::create(const char* file_name, size_t size)
 {
 #if defined(OS_WINDOWS)
@@ -141,8 +371,9 @@ void Memory_Mapped_File::close()
 
 	if (m_data != nullptr)
 	{
-		UnmapViewOfFile(m_data);
+		UnmapViewOfFile(m_data - m_view_offset);
 		m_data = nullptr;
+		m_view_offset = 0;
 	}
 
 	if (m_handle != sys_common::INVALID_HANLE_VALUE)
@@ -158,8 +389,9 @@ void Memory_Mapped_File::close()
 
 	if (m_data != nullptr)
 	{
-		munmap(m_data, m_size);
+		munmap(m_data - m_view_offset, m_view_offset + m_size);
 		m_data = nullptr;
+		m_view_offset = 0;
 	}
 
 	if (m_handle != sys_common::INVALID_HANLE_VALUE)
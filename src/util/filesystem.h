@@ -53,6 +53,53 @@ private:
 	std::vector<std::filesystem::path> m_paths;
 };
 
+// Atomically creates a new file with the given contents.
+// Returns false if the file already exists or could not be created.
+// Exclusive creation is atomic also on network filesystems (NFSv3+, Lustre),
+// so it can be used for inter-process locking.
+NODISCARD bool try_create_file_exclusive(const std::filesystem::path& path, Const_Span<char> contents);
+
+// A file written at explicit offsets. Writes to disjoint ranges can be
+// issued from multiple threads at once. Unwritten gaps read as zeros.
+struct Positional_File
+{
+	Positional_File() :
+		m_handle(sys_common::INVALID_HANLE_VALUE)
+	{
+	}
+
+	Positional_File(const Positional_File&) = delete;
+	Positional_File(Positional_File&& other) noexcept :
+		m_handle(std::exchange(other.m_handle, sys_common::INVALID_HANLE_VALUE))
+	{
+	}
+
+	Positional_File& operator=(const Positional_File&) = delete;
+	Positional_File& operator=(Positional_File&& other) noexcept
+	{
+		close();
+		m_handle = std::exchange(other.m_handle, sys_common::INVALID_HANLE_VALUE);
+		return *this;
+	}
+
+	~Positional_File()
+	{
+		close();
+	}
+
+	// Creates the file, truncating it if it exists.
+	bool create(const std::filesystem::path& path);
+
+	void write(size_t offset, Const_Span<uint8_t> data) const;
+
+	void read(size_t offset, Span<uint8_t> data) const;
+
+	void close();
+
+private:
+	sys_common::Native_Handle m_handle;
+};
+
 struct Memory_Mapped_File
 {
 	enum struct Access_Advice
@@ -65,7 +112,8 @@ struct Memory_Mapped_File
 		m_data(nullptr),
 		m_size(0),
 		m_handle(sys_common::INVALID_HANLE_VALUE),
-		m_advise(Access_Advice::NORMAL)
+		m_advise(Access_Advice::NORMAL),
+		m_view_offset(0)
 	{
 	}
 
@@ -73,7 +121,8 @@ struct Memory_Mapped_File
 		m_data(nullptr),
 		m_size(0),
 		m_handle(sys_common::INVALID_HANLE_VALUE),
-		m_advise(access)
+		m_advise(access),
+		m_view_offset(0)
 	{
 	}
 
@@ -82,7 +131,8 @@ struct Memory_Mapped_File
 		m_data(std::exchange(other.m_data, nullptr)),
 		m_size(std::exchange(other.m_size, 0)),
 		m_handle(std::exchange(other.m_handle, sys_common::INVALID_HANLE_VALUE)),
-		m_advise(std::exchange(other.m_advise, Access_Advice::NORMAL))
+		m_advise(std::exchange(other.m_advise, Access_Advice::NORMAL)),
+		m_view_offset(std::exchange(other.m_view_offset, 0))
 	{
 	}
 
@@ -93,6 +143,7 @@ struct Memory_Mapped_File
 		m_size = std::exchange(other.m_size, 0);
 		m_handle = std::exchange(other.m_handle, sys_common::INVALID_HANLE_VALUE);
 		m_advise = std::exchange(other.m_advise, Access_Advice::NORMAL);
+		m_view_offset = std::exchange(other.m_view_offset, 0);
 		return *this;
 	}
 
@@ -109,6 +160,16 @@ struct Memory_Mapped_File
 
 	bool open_readonly(const char* file_name);
 
+	// Maps only size bytes starting at offset. The view starts at the nearest
+	// boundary the OS allows below offset, but data() points at offset.
+	bool open_readonly(const std::filesystem::path& path, size_t offset, size_t size)
+	{
+		const std::string str = path.string();
+		return open_readonly(str.c_str(), offset, size);
+	}
+
+	bool open_readonly(const char* file_name, size_t offset, size_t size);
+
 	bool create(const std::filesystem::path& path, size_t size)
 	{
 		const std::string str = path.string();
@@ -150,4 +211,5 @@ private:
 	size_t m_size;
 	sys_common::Native_Handle m_handle;
 	Access_Advice m_advise;
+	size_t m_view_offset; // Distance of m_data from the start of the mapped view.
 };